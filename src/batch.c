@@ -0,0 +1,116 @@
+#define _GNU_SOURCE // getline
+#include "batch.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int batch_add(batch_t *batch, const char *source, const char *destination) {
+    if (batch->count == batch->cap) {
+        size_t cap = batch->cap ? batch->cap * 2 : 64;
+        batch_op_t *grown = realloc(batch->ops, cap * sizeof(batch_op_t));
+        if (!grown) return -ENOMEM;
+        batch->ops = grown;
+        batch->cap = cap;
+    }
+    batch_op_t *op = &batch->ops[batch->count];
+    op->source = strdup(source);
+    op->destination = strdup(destination);
+    if (!op->source || !op->destination) {
+        free(op->source);
+        free(op->destination);
+        return -ENOMEM;
+    }
+    batch->count++;
+    return 0;
+}
+
+int batch_read_manifest(batch_t *batch, const char *path, const char *default_destination) {
+    int from_stdin = strcmp(path, BATCH_STDIN) == 0;
+    FILE *fp = from_stdin ? stdin : fopen(path, "r");
+    if (!fp) {
+        int err = errno;
+        fprintf(stderr, "Error: Cannot open %s: %s\n", path, strerror(err));
+        return -err;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    unsigned long lineno = 0;
+    int result = 0;
+    while (result == 0 && (len = getline(&line, &line_cap, fp)) != -1) {
+        lineno++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+
+        char *tab = strchr(line, '\t');
+        const char *destination = default_destination;
+        if (tab) {
+            *tab = '\0';
+            destination = tab + 1;
+        }
+        if (line[0] == '\0' || !destination || destination[0] == '\0') {
+            fprintf(stderr, "Error: %s:%lu: expected \"source<TAB>destination\"%s\n",
+                    from_stdin ? "stdin" : path, lineno,
+                    default_destination ? "" : " (no destination given on the command line)");
+            result = -EINVAL;
+            break;
+        }
+        result = batch_add(batch, line, destination);
+    }
+    if (result == 0 && ferror(fp)) {
+        fprintf(stderr, "Error: Cannot read %s\n", from_stdin ? "stdin" : path);
+        result = -EIO;
+    }
+
+    free(line);
+    if (!from_stdin) fclose(fp);
+    return result;
+}
+
+void batch_free(batch_t *batch) {
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->ops[i].source);
+        free(batch->ops[i].destination);
+    }
+    free(batch->ops);
+    batch->ops = NULL;
+    batch->count = batch->cap = 0;
+}
+
+int batch_run_local(const char *tool, const char *flag, const char *source, const char *destination) {
+    char *argv[6];
+    int argc = 0;
+    argv[argc++] = (char *)tool;
+    if (flag) argv[argc++] = (char *)flag;
+    argv[argc++] = "--";    // Names starting with '-' are not options
+    argv[argc++] = (char *)source;
+    argv[argc++] = (char *)destination;
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        execv(tool, argv);
+        perror(tool);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return -1;
+        }
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return -1;
+}
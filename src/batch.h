@@ -0,0 +1,42 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+// Operations of one remote-cp/remote-mv run. Several sources on the command
+// line ("a b c dir/") or a manifest read with --from-file become a list of
+// source/destination pairs that the tool runs over a single SSH connection
+// (and a single set of -j sessions), so the handshake is paid once per run
+// instead of once per file.
+//
+// Manifest format, one operation per line:
+//   source<TAB>destination
+//   source                  (copied into the destination given on the command line)
+// Blank lines and lines starting with '#' are skipped, a trailing '\r' is
+// dropped and names are taken as they are (spaces included).
+
+#define BATCH_STDIN         "-"     // --from-file - reads the manifest from stdin
+
+typedef struct {
+    char *source;
+    char *destination;
+} batch_op_t;
+
+typedef struct {
+    batch_op_t *ops;
+    size_t count;
+    size_t cap;
+} batch_t;
+
+int batch_add(batch_t *batch, const char *source, const char *destination);
+// default_destination may be NULL, then every line needs its own destination.
+// Returns 0 or a negative errno (the offending line has been reported).
+int batch_read_manifest(batch_t *batch, const char *path, const char *default_destination);
+void batch_free(batch_t *batch);
+
+// Run a local tool (/bin/cp, /bin/mv) on source and destination without a
+// shell, so names from a manifest are never interpreted. flag may be NULL.
+// Returns the tool's exit status, or -1 if it could not be run.
+int batch_run_local(const char *tool, const char *flag, const char *source, const char *destination);
+
+#endif // BATCH_H
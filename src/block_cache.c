@@ -0,0 +1,296 @@
+#include "block_cache.h"
+#include "common.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct bc_file bc_file_t;
+
+typedef struct bc_block {
+    bc_file_t *file;
+    libssh2_uint64_t index;
+    char *data;
+    size_t len;
+    struct bc_block *hnext;                     // Block hash chain
+    struct bc_block *lru_prev, *lru_next;       // Global LRU list, head = most recent
+    struct bc_block *fprev, *fnext;             // Blocks of the same file
+} bc_block_t;
+
+struct bc_file {
+    char *path;
+    libssh2_uint64_t size;                      // Attributes the blocks were cached under
+    unsigned long mtime;
+    bc_block_t *blocks;
+    bc_file_t *hnext;                           // File hash chain
+};
+
+static struct {
+    int enabled;
+    size_t budget;
+    size_t used;
+    bc_block_t **blocks;
+    size_t nblocks;
+    bc_file_t **files;
+    size_t nfiles;
+    bc_block_t *lru_head;
+    bc_block_t *lru_tail;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    pthread_mutex_t lock;
+} bc = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static size_t hash_path(const char *path) {
+    size_t h = 1469598103934665603ULL; // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static size_t hash_block(const bc_file_t *file, libssh2_uint64_t index) {
+    size_t h = (size_t)(uintptr_t)file ^ (size_t)(index * 0x9E3779B97F4A7C15ULL);
+    return (h ^ (h >> 29)) & (bc.nblocks - 1);
+}
+
+int block_cache_init(size_t budget_bytes) {
+    if (budget_bytes < BLOCK_CACHE_BLOCK_SIZE) {
+        bc.enabled = 0;
+        return 0;
+    }
+
+    // Power-of-two tables sized for roughly two entries per slot at full budget
+    size_t max_blocks = budget_bytes / BLOCK_CACHE_BLOCK_SIZE;
+    size_t n = 64;
+    while (n < max_blocks * 2) n <<= 1;
+
+    bc.blocks = calloc(n, sizeof(bc_block_t *));
+    bc.files = calloc(n, sizeof(bc_file_t *));
+    if (!bc.blocks || !bc.files) {
+        LOG_ERR("Failed to allocate block cache tables");
+        free(bc.blocks);
+        free(bc.files);
+        bc.blocks = NULL;
+        bc.files = NULL;
+        return -1;
+    }
+    bc.nblocks = n;
+    bc.nfiles = n;
+    bc.budget = budget_bytes;
+    bc.used = 0;
+    bc.enabled = 1;
+    LOG_INFO("Block cache enabled: %zu MiB budget, %d KiB blocks",
+             budget_bytes / (1024 * 1024), BLOCK_CACHE_BLOCK_SIZE / 1024);
+    return 0;
+}
+
+int block_cache_enabled(void) {
+    return bc.enabled;
+}
+
+static bc_file_t *find_file(const char *path, int create) {
+    size_t slot = hash_path(path) & (bc.nfiles - 1);
+    for (bc_file_t *f = bc.files[slot]; f; f = f->hnext) {
+        if (strcmp(f->path, path) == 0) return f;
+    }
+    if (!create) return NULL;
+
+    bc_file_t *f = calloc(1, sizeof(bc_file_t));
+    if (!f) return NULL;
+    f->path = strdup(path);
+    if (!f->path) {
+        free(f);
+        return NULL;
+    }
+    f->hnext = bc.files[slot];
+    bc.files[slot] = f;
+    return f;
+}
+
+static void free_file(bc_file_t *file) {
+    size_t slot = hash_path(file->path) & (bc.nfiles - 1);
+    bc_file_t **pp = &bc.files[slot];
+    while (*pp && *pp != file) pp = &(*pp)->hnext;
+    if (*pp) *pp = file->hnext;
+    free(file->path);
+    free(file);
+}
+
+static void lru_unlink(bc_block_t *b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next; else bc.lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev; else bc.lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_front(bc_block_t *b) {
+    b->lru_prev = NULL;
+    b->lru_next = bc.lru_head;
+    if (bc.lru_head) bc.lru_head->lru_prev = b;
+    bc.lru_head = b;
+    if (!bc.lru_tail) bc.lru_tail = b;
+}
+
+// Unlink a block from every list and free it. Frees the file when it was its last block.
+static void drop_block(bc_block_t *b) {
+    bc_file_t *file = b->file;
+
+    bc_block_t **pp = &bc.blocks[hash_block(file, b->index)];
+    while (*pp && *pp != b) pp = &(*pp)->hnext;
+    if (*pp) *pp = b->hnext;
+
+    lru_unlink(b);
+
+    if (b->fprev) b->fprev->fnext = b->fnext; else file->blocks = b->fnext;
+    if (b->fnext) b->fnext->fprev = b->fprev;
+
+    bc.used -= b->len;
+    free(b->data);
+    free(b);
+
+    if (!file->blocks) free_file(file);
+}
+
+static void drop_file_blocks(bc_file_t *file) {
+    while (file->blocks && file->blocks->fnext) drop_block(file->blocks);
+    if (file->blocks) drop_block(file->blocks); // Frees the file as well
+}
+
+static bc_block_t *find_block(bc_file_t *file, libssh2_uint64_t index) {
+    for (bc_block_t *b = bc.blocks[hash_block(file, index)]; b; b = b->hnext) {
+        if (b->file == file && b->index == index) return b;
+    }
+    return NULL;
+}
+
+ssize_t block_cache_get(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                        libssh2_uint64_t index, size_t offset, char *out, size_t len) {
+    if (!bc.enabled) return -1;
+
+    pthread_mutex_lock(&bc.lock);
+    bc_file_t *file = find_file(path, 0);
+    if (file && (file->size != file_size || file->mtime != mtime)) {
+        LOG_DEBUG("block cache: %s changed remotely, dropping cached blocks", path);
+        drop_file_blocks(file);
+        file = NULL;
+    }
+    bc_block_t *b = file ? find_block(file, index) : NULL;
+    if (!b) {
+        bc.misses++;
+        pthread_mutex_unlock(&bc.lock);
+        return -1;
+    }
+
+    size_t n = 0;
+    if (offset < b->len) {
+        n = b->len - offset;
+        if (n > len) n = len;
+        memcpy(out, b->data + offset, n);
+    }
+    lru_unlink(b);
+    lru_push_front(b);
+    bc.hits++;
+    pthread_mutex_unlock(&bc.lock);
+    return (ssize_t)n;
+}
+
+void block_cache_put(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                     libssh2_uint64_t index, const char *data, size_t len) {
+    if (!bc.enabled || len > BLOCK_CACHE_BLOCK_SIZE) return;
+
+    char *copy = malloc(len ? len : 1);
+    if (!copy) return;
+    memcpy(copy, data, len);
+
+    pthread_mutex_lock(&bc.lock);
+    bc_file_t *file = find_file(path, 1);
+    if (!file) {
+        pthread_mutex_unlock(&bc.lock);
+        free(copy);
+        return;
+    }
+    if (file->blocks && (file->size != file_size || file->mtime != mtime)) {
+        drop_file_blocks(file);
+        file = find_file(path, 1);
+        if (!file) {
+            pthread_mutex_unlock(&bc.lock);
+            free(copy);
+            return;
+        }
+    }
+    file->size = file_size;
+    file->mtime = mtime;
+
+    bc_block_t *b = find_block(file, index);
+    if (b) {
+        // Another thread fetched the same block concurrently; keep the newer copy
+        bc.used -= b->len;
+        free(b->data);
+        b->data = copy;
+        b->len = len;
+        bc.used += len;
+        lru_unlink(b);
+        lru_push_front(b);
+    } else {
+        b = calloc(1, sizeof(bc_block_t));
+        if (!b) {
+            if (!file->blocks) free_file(file);
+            pthread_mutex_unlock(&bc.lock);
+            free(copy);
+            return;
+        }
+        b->file = file;
+        b->index = index;
+        b->data = copy;
+        b->len = len;
+
+        size_t slot = hash_block(file, index);
+        b->hnext = bc.blocks[slot];
+        bc.blocks[slot] = b;
+
+        b->fnext = file->blocks;
+        if (file->blocks) file->blocks->fprev = b;
+        file->blocks = b;
+
+        lru_push_front(b);
+        bc.used += len;
+    }
+
+    while (bc.used > bc.budget && bc.lru_tail && bc.lru_tail != b) {
+        drop_block(bc.lru_tail);
+        bc.evictions++;
+    }
+    pthread_mutex_unlock(&bc.lock);
+}
+
+void block_cache_invalidate(const char *path) {
+    if (!bc.enabled || !path) return;
+
+    pthread_mutex_lock(&bc.lock);
+    bc_file_t *file = find_file(path, 0);
+    if (file) drop_file_blocks(file);
+    pthread_mutex_unlock(&bc.lock);
+}
+
+void block_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions, size_t *used) {
+    pthread_mutex_lock(&bc.lock);
+    if (hits) *hits = bc.hits;
+    if (misses) *misses = bc.misses;
+    if (evictions) *evictions = bc.evictions;
+    if (used) *used = bc.used;
+    pthread_mutex_unlock(&bc.lock);
+}
+
+void block_cache_destroy(void) {
+    pthread_mutex_lock(&bc.lock);
+    while (bc.lru_head) drop_block(bc.lru_head);
+    free(bc.blocks);
+    free(bc.files);
+    bc.blocks = NULL;
+    bc.files = NULL;
+    bc.nblocks = bc.nfiles = 0;
+    bc.enabled = 0;
+    pthread_mutex_unlock(&bc.lock);
+}
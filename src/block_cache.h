@@ -0,0 +1,34 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <libssh2.h>
+
+// Process-wide cache of remote file contents in fixed-size blocks, keyed by
+// (remote path, block index). Every file carries the size/mtime it was cached
+// under; a lookup with different attributes drops the file's blocks first.
+// Memory use is bounded by a byte budget with least-recently-used eviction.
+
+#define BLOCK_CACHE_BLOCK_SIZE   (128 * 1024)
+#define BLOCK_CACHE_DEFAULT_MB   64
+#define BLOCK_CACHE_MAX_MB       65536
+
+int block_cache_init(size_t budget_bytes);
+void block_cache_destroy(void);
+int block_cache_enabled(void);
+
+// Copy up to len bytes starting at byte `offset` inside block `index`.
+// Returns bytes copied (0 when the cached block ends before offset),
+// or -1 on a miss.
+ssize_t block_cache_get(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                        libssh2_uint64_t index, size_t offset, char *out, size_t len);
+// Store a block. len < BLOCK_CACHE_BLOCK_SIZE marks the last block of the file.
+void block_cache_put(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                     libssh2_uint64_t index, const char *data, size_t len);
+// Drop every cached block of a file (after local writes, truncate, unlink, rename).
+void block_cache_invalidate(const char *path);
+
+void block_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions, size_t *used);
+
+#endif // BLOCK_CACHE_H
@@ -7,6 +7,9 @@
 #include <libssh2.h>
 #include <libssh2_sftp.h>
 
+struct sftp_pool;
+struct sftp_loop;
+
 typedef struct {
     char *remote_host;
     char *remote_user;
@@ -19,14 +22,41 @@ typedef struct {
     LIBSSH2_SESSION *ssh_session;
     LIBSSH2_SFTP *sftp_session;
 
+    int pool_size;              // Number of SFTP sessions to open (-o connections=N)
+    struct sftp_pool *pool;     // Session pool owned by the mount (NULL for helper utilities)
+    int read_window_kb;         // Max KiB of SFTP READ requests in flight per handle (-o read_window=)
+    int readahead_kb;           // Max adaptive read-ahead per open file, 0 disables (-o readahead=)
+    int cache_size_mb;          // Shared block cache budget in MiB, 0 disables (-o cache_size=)
+    char *disk_cache_dir;       // Persistent block cache directory, NULL disables (-o disk_cache=)
+    int disk_cache_mb;          // Size cap of the disk cache in MiB (-o disk_cache_size=)
+    int attr_cache_ttl;         // Seconds attributes stay in the userspace cache, 0 disables (-o attr_cache_ttl=)
+    int negative_cache_ttl;     // Seconds missing paths stay cached, 0 disables (-o negative_cache_ttl=)
+    int dir_cache_ttl;          // Seconds directory listings stay cached, 0 disables (-o dir_cache_ttl=)
+    int write_buffer_kb;        // Per-handle write-back buffer in KiB, 0 writes through (-o write_buffer=)
+    int direct_io;              // Whole-file downloads of large files bypass the page cache (remote-cp --direct)
+    char *control_path;         // Control socket served to remote-cp/remote-mv, NULL disables (see control.h)
+    int event_loop;             // Run metadata requests on a multiplexing session (-o event_loop)
+    struct sftp_loop *loop;     // That session's event loop, NULL when off or unavailable (see sftp_loop.h)
+    int low_level;              // Serve the mount through the inode-based low-level API (-o lowlevel)
+
 } remote_conn_info_t;
 
 extern remote_conn_info_t *ssh_cli_conn;
+// Mount served through the low-level API (rp_lowlevel.c), which has no
+// fuse_get_context() to carry the connection
+extern remote_conn_info_t *fuse_ll_conn;
+// Session currently checked out of the pool by this thread (see sftp_pool.c)
+extern __thread remote_conn_info_t *sftp_tls_conn;
 
 static inline remote_conn_info_t* get_conn_info() {
+    // A session checked out of the pool by this thread takes precedence
+    if (sftp_tls_conn)
+        return sftp_tls_conn;
     // If running as a helper utility, use the global connection if set
     if (ssh_cli_conn) 
         return ssh_cli_conn;
+    if (fuse_ll_conn)
+        return fuse_ll_conn;
     struct fuse_context *fc = fuse_get_context();
     if (fc && fc->private_data)
         return (remote_conn_info_t*)fc->private_data;
@@ -0,0 +1,638 @@
+#define _GNU_SOURCE // SO_PEERCRED, accept4
+#include "control.h"
+#include "ssh_sftp_client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CONTROL_CLIENTS_MAX     64
+#define CONTROL_FDS_MAX         8       // Descriptors accepted with one frame (the extra ones are closed)
+
+typedef struct {
+    char data[CONTROL_FRAME_MAX];
+    uint32_t len;
+} control_msg_t;
+
+typedef struct {
+    const char *p;
+    const char *end;
+} control_reader_t;
+
+// --- Framing ---
+
+static int control_msg_put(control_msg_t *msg, const void *data, size_t len) {
+    if (len > sizeof(msg->data) - msg->len) return -ENAMETOOLONG;
+    memcpy(msg->data + msg->len, data, len);
+    msg->len += (uint32_t)len;
+    return 0;
+}
+
+static int control_msg_put_u32(control_msg_t *msg, uint32_t value) {
+    uint32_t be = htonl(value);
+    return control_msg_put(msg, &be, sizeof(be));
+}
+
+static int control_msg_field(control_msg_t *msg, const void *data, size_t len) {
+    int rc = control_msg_put_u32(msg, (uint32_t)len);
+    return rc ? rc : control_msg_put(msg, data, len);
+}
+
+// Strings travel with their NUL so the reader can use them in place
+static int control_msg_string(control_msg_t *msg, const char *s) {
+    return control_msg_field(msg, s, strlen(s) + 1);
+}
+
+static int control_read_u32(control_reader_t *r, uint32_t *value) {
+    if (r->end - r->p < 4) return -EPROTO;
+    uint32_t be;
+    memcpy(&be, r->p, sizeof(be));
+    r->p += 4;
+    *value = ntohl(be);
+    return 0;
+}
+
+static const char *control_read_field(control_reader_t *r, uint32_t *len) {
+    if (control_read_u32(r, len) != 0 || (size_t)(r->end - r->p) < *len) return NULL;
+    const char *field = r->p;
+    r->p += *len;
+    return field;
+}
+
+static const char *control_read_string(control_reader_t *r) {
+    uint32_t len;
+    const char *s = control_read_field(r, &len);
+    return (s && len > 0 && s[len - 1] == '\0') ? s : NULL;
+}
+
+static int control_write_all(int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int control_read_all(int sock, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(sock, buf, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (n == 0) return -ECONNRESET;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Send one frame, with pass_fd (if >= 0) attached to its first byte
+static int control_send_frame(int sock, const control_msg_t *msg, int pass_fd) {
+    uint32_t hdr = htonl(msg->len);
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void *)msg->data, .iov_len = msg->len }
+    };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } cbuf;
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+    if (pass_fd >= 0) {
+        memset(&cbuf, 0, sizeof(cbuf));
+        mh.msg_control = cbuf.buf;
+        mh.msg_controllen = sizeof(cbuf.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) return -errno;
+
+    // The descriptor went with the first byte, the rest is plain data
+    size_t total = sizeof(hdr) + msg->len;
+    if ((size_t)sent < sizeof(hdr)) {
+        int rc = control_write_all(sock, (const char *)&hdr + sent, sizeof(hdr) - (size_t)sent);
+        if (rc != 0) return rc;
+        sent = sizeof(hdr);
+    }
+    return control_write_all(sock, msg->data + ((size_t)sent - sizeof(hdr)), total - (size_t)sent);
+}
+
+// Receive one frame into msg; *passed_fd gets a descriptor sent with it, or -1
+static int control_recv_frame(int sock, control_msg_t *msg, int *passed_fd) {
+    uint32_t hdr;
+    struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(CONTROL_FDS_MAX * sizeof(int))];
+    } cbuf;
+    struct msghdr mh = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = cbuf.buf, .msg_controllen = sizeof(cbuf.buf)
+    };
+
+    *passed_fd = -1;
+    ssize_t got;
+    do {
+        got = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) return -errno;
+    if (got == 0) return -ECONNRESET;
+
+    // Keep the first descriptor; any other one a client sent is closed
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < nfds; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*passed_fd < 0) *passed_fd = fd;
+            else close(fd);
+        }
+    }
+
+    int rc = 0;
+    if ((size_t)got < sizeof(hdr)) {
+        rc = control_read_all(sock, (char *)&hdr + got, sizeof(hdr) - (size_t)got);
+    }
+    if (rc == 0) {
+        msg->len = ntohl(hdr);
+        rc = msg->len > sizeof(msg->data) ? -EPROTO : control_read_all(sock, msg->data, msg->len);
+    }
+    if (rc != 0 && *passed_fd >= 0) {
+        close(*passed_fd);
+        *passed_fd = -1;
+    }
+    return rc;
+}
+
+// --- Server (remotefs) ---
+
+static struct {
+    int listen_fd;
+    char *path;
+    sftp_pool_t *pool;
+    control_invalidate_t invalidate;
+    pthread_t accept_thread;
+    int clients[CONTROL_CLIENTS_MAX];   // Open client sockets, -1 when free
+    int nclients;
+    int copies;                         // PUT/GET requests running
+    int copies_max;                     // Keeps sessions of the pool free for FUSE
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;                // Signalled when the last client thread exits
+} control_server = {
+    .listen_fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER
+};
+
+static void control_invalidate(const char *remote_path) {
+    if (control_server.invalidate) control_server.invalidate(remote_path);
+}
+
+static int control_copy_begin(void) {
+    pthread_mutex_lock(&control_server.lock);
+    int ok = control_server.copies < control_server.copies_max;
+    if (ok) control_server.copies++;
+    pthread_mutex_unlock(&control_server.lock);
+    return ok;
+}
+
+static void control_copy_end(void) {
+    pthread_mutex_lock(&control_server.lock);
+    control_server.copies--;
+    pthread_mutex_unlock(&control_server.lock);
+}
+
+// Run one request on a session of the pool. Returns the reply status.
+static int control_serve(int op, control_reader_t *req, int passed_fd, control_msg_t *reply) {
+    if (op == CONTROL_HELLO) {
+        uint32_t version, attrs_size;
+        if (control_read_u32(req, &version) != 0 || control_read_u32(req, &attrs_size) != 0) return -EPROTO;
+        return (version == CONTROL_VERSION && attrs_size == sizeof(LIBSSH2_SFTP_ATTRIBUTES)) ? 0 : -EPROTONOSUPPORT;
+    }
+
+    const char *path = control_read_string(req);
+    if (!path) return -EPROTO;
+
+    // Arguments are checked before a session is taken from the mount
+    const char *new_path = NULL;
+    uint32_t mode = 0;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    switch (op) {
+        case CONTROL_SETSTAT: {
+            uint32_t len;
+            const char *field = control_read_field(req, &len);
+            if (!field || len != sizeof(attrs)) return -EPROTO;
+            memcpy(&attrs, field, sizeof(attrs));
+            break;
+        }
+        case CONTROL_MKDIR:
+            if (control_read_u32(req, &mode) != 0) return -EPROTO;
+            break;
+        case CONTROL_RENAME:
+            new_path = control_read_string(req);
+            if (!new_path) return -EPROTO;
+            break;
+        case CONTROL_PUT:
+        case CONTROL_GET:
+            if (passed_fd < 0) return -EBADF;
+            break;
+        case CONTROL_STAT:
+        case CONTROL_UNLINK:
+        case CONTROL_RMDIR:
+            break;
+        default:
+            return -EOPNOTSUPP;
+    }
+
+    // A copy keeps its session for the whole file, so only so many run at
+    // once; the tool copies the others over a session of its own
+    int copy = op == CONTROL_PUT || op == CONTROL_GET;
+    if (copy && !control_copy_begin()) return -EBUSY;
+
+    remote_conn_info_t *conn = sftp_pool_checkout(control_server.pool);
+    if (!conn) {
+        if (copy) control_copy_end();
+        return -ENOTCONN;
+    }
+
+    int result;
+    switch (op) {
+        case CONTROL_STAT:
+            result = sftp_stat_remote(path, &attrs) == 0 ? 0 : sftp_last_errno();
+            if (result == 0) result = control_msg_field(reply, &attrs, sizeof(attrs));
+            break;
+        case CONTROL_SETSTAT:
+            result = sftp_setstat_remote(path, &attrs);
+            break;
+        case CONTROL_UNLINK:
+            result = sftp_unlink_remote(path) == 0 ? 0 : sftp_last_errno();
+            break;
+        case CONTROL_MKDIR:
+            result = sftp_mkdir_remote(path, (long)mode) == 0 ? 0 : sftp_last_errno();
+            break;
+        case CONTROL_RMDIR:
+            result = sftp_rmdir_remote(path) == 0 ? 0 : sftp_last_errno();
+            break;
+        case CONTROL_RENAME:
+            result = sftp_rename_remote(path, new_path);
+            break;
+        case CONTROL_PUT:
+            result = sftp_copy_fd_to_remote(passed_fd, path);
+            break;
+        default: // CONTROL_GET
+            result = sftp_copy_remote_to_fd(path, passed_fd);
+            break;
+    }
+    sftp_pool_checkin(control_server.pool, conn);
+    if (copy) control_copy_end();
+
+    if (op != CONTROL_STAT && op != CONTROL_GET) {
+        control_invalidate(path);
+        if (new_path) control_invalidate(new_path);
+    }
+    return result;
+}
+
+static void control_client_remove(int sock) {
+    pthread_mutex_lock(&control_server.lock);
+    for (int i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+        if (control_server.clients[i] == sock) {
+            control_server.clients[i] = -1;
+            break;
+        }
+    }
+    if (--control_server.nclients == 0) pthread_cond_broadcast(&control_server.idle);
+    pthread_mutex_unlock(&control_server.lock);
+}
+
+static void *control_client_thread(void *arg) {
+    int sock = (int)(intptr_t)arg;
+    control_msg_t *req = malloc(sizeof(control_msg_t));
+    control_msg_t *reply = malloc(sizeof(control_msg_t));
+
+    while (req && reply) {
+        int passed_fd;
+        if (control_recv_frame(sock, req, &passed_fd) != 0) break;
+
+        control_reader_t r = { req->data, req->data + req->len };
+        int op = req->len > 0 ? (unsigned char)*r.p++ : 0;
+        reply->len = sizeof(uint32_t); // Status, filled in below
+        int status = control_serve(op, &r, passed_fd, reply);
+        if (passed_fd >= 0) close(passed_fd);
+        if (status != 0) reply->len = sizeof(uint32_t);
+
+        uint32_t be = htonl((uint32_t)status);
+        memcpy(reply->data, &be, sizeof(be));
+        if (control_send_frame(sock, reply, -1) != 0) break;
+    }
+
+    free(req);
+    free(reply);
+    control_client_remove(sock);
+    close(sock);
+    return NULL;
+}
+
+static void *control_accept_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        int sock = accept4(control_server.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            pthread_mutex_lock(&control_server.lock);
+            int stopping = control_server.stopping;
+            pthread_mutex_unlock(&control_server.lock);
+            if (!stopping) LOG_ERR("Control socket: accept failed: %s", strerror(errno));
+            break;
+        }
+
+        // Tools act on local files through the daemon, so only the mount's own user is served
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 || cred.uid != getuid()) {
+            LOG_WARN("Control socket: refusing a client of another user");
+            close(sock);
+            continue;
+        }
+
+        pthread_mutex_lock(&control_server.lock);
+        int slot = -1;
+        for (int i = 0; i < CONTROL_CLIENTS_MAX && !control_server.stopping; i++) {
+            if (control_server.clients[i] < 0) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot >= 0) {
+            control_server.clients[slot] = sock;
+            control_server.nclients++;
+        }
+        pthread_mutex_unlock(&control_server.lock);
+        if (slot < 0) {
+            LOG_WARN("Control socket: too many clients, refusing one");
+            close(sock);
+            continue;
+        }
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, control_client_thread, (void *)(intptr_t)sock) != 0) {
+            LOG_WARN("Control socket: failed to start a client thread");
+            control_client_remove(sock);
+            close(sock);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return NULL;
+}
+
+int control_server_start(const char *socket_path, sftp_pool_t *pool, control_invalidate_t invalidate) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (!socket_path || !pool) return -EINVAL;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        LOG_WARN("Control socket path too long: %s", socket_path);
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -errno;
+
+    // A socket left behind by a mount that did not exit cleanly
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        chmod(socket_path, 0600) != 0 ||
+        listen(fd, CONTROL_BACKLOG) != 0) {
+        int err = errno;
+        LOG_WARN("Control socket %s: %s", socket_path, strerror(err));
+        close(fd);
+        unlink(socket_path);
+        return -err;
+    }
+
+    control_server.path = strdup(socket_path);
+    control_server.pool = pool;
+    control_server.invalidate = invalidate;
+    control_server.nclients = 0;
+    control_server.copies = 0;
+    control_server.copies_max = pool->size - 1;   // None with a single session
+    control_server.stopping = 0;
+    for (int i = 0; i < CONTROL_CLIENTS_MAX; i++) control_server.clients[i] = -1;
+    control_server.listen_fd = fd;
+    if (!control_server.path ||
+        pthread_create(&control_server.accept_thread, NULL, control_accept_thread, NULL) != 0) {
+        LOG_WARN("Failed to start the control socket thread");
+        control_server.listen_fd = -1;
+        close(fd);
+        unlink(socket_path);
+        free(control_server.path);
+        control_server.path = NULL;
+        return -ENOMEM;
+    }
+    LOG_INFO("Control socket for remote-cp/remote-mv: %s", socket_path);
+    return 0;
+}
+
+void control_server_stop(void) {
+    if (control_server.listen_fd < 0) return;
+
+    // Wake the accept thread and every idle client thread
+    pthread_mutex_lock(&control_server.lock);
+    control_server.stopping = 1;
+    for (int i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+        if (control_server.clients[i] >= 0) shutdown(control_server.clients[i], SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&control_server.lock);
+    shutdown(control_server.listen_fd, SHUT_RDWR);
+    pthread_join(control_server.accept_thread, NULL);
+    close(control_server.listen_fd);
+    control_server.listen_fd = -1;
+    unlink(control_server.path);
+    free(control_server.path);
+    control_server.path = NULL;
+
+    // A request in progress finishes before the pool goes away
+    pthread_mutex_lock(&control_server.lock);
+    while (control_server.nclients > 0) {
+        pthread_cond_wait(&control_server.idle, &control_server.lock);
+    }
+    pthread_mutex_unlock(&control_server.lock);
+}
+
+// --- Client (remote-cp, remote-mv) ---
+
+static int control_fd = -1;
+static int control_was_served = 0;  // A mount answered, even if it went away since
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static control_msg_t control_buf;   // Request and reply, guarded by control_lock
+
+// Send the request in control_buf and read the reply into it, leaving the
+// reader positioned after the status. Called with control_lock held.
+static int control_call(int pass_fd, control_reader_t *r) {
+    if (control_fd < 0) return -ENOTCONN;
+
+    int rc = control_send_frame(control_fd, &control_buf, pass_fd);
+    int passed_fd = -1;
+    if (rc == 0) rc = control_recv_frame(control_fd, &control_buf, &passed_fd);
+    if (passed_fd >= 0) close(passed_fd);
+    uint32_t status = 0;
+    if (rc == 0) {
+        r->p = control_buf.data;
+        r->end = control_buf.data + control_buf.len;
+        rc = control_read_u32(r, &status);
+    }
+    if (rc != 0) {
+        // The mount went away: the caller retries on the tool's own session,
+        // later calls go there directly
+        LOG_WARN("Lost the control connection to the mount: %s", strerror(-rc));
+        close(control_fd);
+        control_fd = -1;
+        return -ENOTCONN;
+    }
+    return (int)status;
+}
+
+static void control_begin(int op) {
+    pthread_mutex_lock(&control_lock);
+    control_buf.len = 0;
+    unsigned char byte = (unsigned char)op;
+    control_msg_put(&control_buf, &byte, 1);
+}
+
+// Send a request made of path arguments (and an optional fd), no results
+static int control_simple(int op, const char *path, const char *path2, int pass_fd) {
+    control_begin(op);
+    int rc = control_msg_string(&control_buf, path);
+    if (rc == 0 && path2) rc = control_msg_string(&control_buf, path2);
+    control_reader_t r;
+    if (rc == 0) rc = control_call(pass_fd, &r);
+    pthread_mutex_unlock(&control_lock);
+    return rc;
+}
+
+int control_connect(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) return -ENAMETOOLONG;
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -errno;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        return -err; // ENOENT: not mounted, ECONNREFUSED: stale socket
+    }
+    control_fd = fd;
+
+    control_begin(CONTROL_HELLO);
+    control_msg_put_u32(&control_buf, CONTROL_VERSION);
+    control_msg_put_u32(&control_buf, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+    control_reader_t r;
+    int rc = control_call(-1, &r);
+    pthread_mutex_unlock(&control_lock);
+    if (rc != 0) {
+        LOG_DEBUG("Control socket %s not usable: %s", socket_path, strerror(-rc));
+        control_disconnect();
+    } else {
+        control_was_served = 1;
+    }
+    return rc;
+}
+
+int control_active(void) {
+    return control_fd >= 0;
+}
+
+int control_served(void) {
+    return control_was_served;
+}
+
+void control_disconnect(void) {
+    if (control_fd >= 0) {
+        close(control_fd);
+        control_fd = -1;
+    }
+}
+
+int control_stat(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    control_begin(CONTROL_STAT);
+    int rc = control_msg_string(&control_buf, remote_path);
+    control_reader_t r;
+    if (rc == 0) rc = control_call(-1, &r);
+    if (rc == 0) {
+        uint32_t len;
+        const char *field = control_read_field(&r, &len);
+        if (field && len == sizeof(*attrs)) {
+            memcpy(attrs, field, sizeof(*attrs));
+        } else {
+            rc = -EPROTO;
+        }
+    }
+    pthread_mutex_unlock(&control_lock);
+    return rc;
+}
+
+int control_setstat(const char *remote_path, const LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    control_begin(CONTROL_SETSTAT);
+    int rc = control_msg_string(&control_buf, remote_path);
+    if (rc == 0) rc = control_msg_field(&control_buf, attrs, sizeof(*attrs));
+    control_reader_t r;
+    if (rc == 0) rc = control_call(-1, &r);
+    pthread_mutex_unlock(&control_lock);
+    return rc;
+}
+
+int control_unlink(const char *remote_path) {
+    return control_simple(CONTROL_UNLINK, remote_path, NULL, -1);
+}
+
+int control_mkdir(const char *remote_path, long mode) {
+    control_begin(CONTROL_MKDIR);
+    int rc = control_msg_string(&control_buf, remote_path);
+    if (rc == 0) rc = control_msg_put_u32(&control_buf, (uint32_t)mode);
+    control_reader_t r;
+    if (rc == 0) rc = control_call(-1, &r);
+    pthread_mutex_unlock(&control_lock);
+    return rc;
+}
+
+int control_rmdir(const char *remote_path) {
+    return control_simple(CONTROL_RMDIR, remote_path, NULL, -1);
+}
+
+int control_rename(const char *old_path, const char *new_path) {
+    return control_simple(CONTROL_RENAME, old_path, new_path, -1);
+}
+
+int control_put(int fd, const char *remote_path) {
+    return control_simple(CONTROL_PUT, remote_path, NULL, fd);
+}
+
+int control_get(const char *remote_path, int fd) {
+    return control_simple(CONTROL_GET, remote_path, NULL, fd);
+}
@@ -0,0 +1,78 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "common.h"
+#include "sftp_pool.h"
+
+// Control socket of a live mount. remotefs listens on a UNIX-domain socket
+// next to its saved configuration (get_control_socket_path()) and runs the
+// requests of remote-cp/remote-mv on its own, already authenticated SFTP
+// sessions, so a tool run does not pay a TCP connect, key exchange and login
+// of its own. Only processes of the same user are served (SO_PEERCRED), and
+// the socket file is created mode 0600.
+//
+// Frames are a 4-byte length (network order) followed by the payload. A
+// request payload is the opcode byte and its arguments; a reply payload is a
+// 4-byte status (0 or negative errno, network order) and its results. Both
+// carry fields as a 4-byte length and the bytes. Local files never travel by
+// name: the tool opens them and passes the descriptor with the request
+// (SCM_RIGHTS), so the daemon reads and writes with the tool's permissions.
+// Attributes are sent as the raw LIBSSH2_SFTP_ATTRIBUTES, which is why the
+// HELLO exchange checks the protocol version and the structure size.
+//
+// A PUT or GET holds a session of the mount for the whole file, so at most
+// pool size - 1 of them run at once (none on a single-session mount), leaving
+// a session for FUSE requests; the others are answered -EBUSY and the tool
+// copies that file over its own SSH session.
+//
+// The tools use it through ssh_sftp_client.c: while a control connection is
+// open, stat/setstat/unlink/mkdir/rmdir/rename and whole-file copies on the
+// tool's main thread are forwarded, and any other call (directory listings,
+// exec channels, -j sessions) connects the tool's own SSH session on first use.
+
+#define CONTROL_VERSION         1
+#define CONTROL_FRAME_MAX       (64 * 1024)   // Paths and attributes only, data goes through fds
+#define CONTROL_BACKLOG         16
+
+typedef enum {
+    CONTROL_HELLO = 1,          // version, sizeof(LIBSSH2_SFTP_ATTRIBUTES)
+    CONTROL_STAT,               // path -> attributes
+    CONTROL_SETSTAT,            // path, attributes
+    CONTROL_UNLINK,             // path
+    CONTROL_MKDIR,              // path, mode
+    CONTROL_RMDIR,              // path
+    CONTROL_RENAME,             // old path, new path
+    CONTROL_PUT,                // remote path + fd of the local source (-EBUSY: copy it yourself)
+    CONTROL_GET                 // remote path + fd of the local destination (-EBUSY: same)
+} control_op_t;
+
+// Called by the server after a request changed a remote path, so the mount
+// can drop what it cached about it
+typedef void (*control_invalidate_t)(const char *remote_path);
+
+// Daemon side: listen on socket_path and serve requests on the pool's sessions
+int control_server_start(const char *socket_path, sftp_pool_t *pool, control_invalidate_t invalidate);
+void control_server_stop(void);
+
+// Tool side. control_connect() returns 0 when a live mount answered on
+// socket_path, a negative errno otherwise (the tool then connects itself).
+int control_connect(const char *socket_path);
+int control_active(void);
+// Non-zero once a mount served this tool, also after it went away (the tool
+// then has no session yet and connects one on first use)
+int control_served(void);
+void control_disconnect(void);
+
+// Forwarded operations, 0 or negative errno. -ENOTCONN: the mount went away
+// during the call, which did not reach it or may not have completed; nothing
+// is forwarded any more.
+int control_stat(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs);
+int control_setstat(const char *remote_path, const LIBSSH2_SFTP_ATTRIBUTES *attrs);
+int control_unlink(const char *remote_path);
+int control_mkdir(const char *remote_path, long mode);
+int control_rmdir(const char *remote_path);
+int control_rename(const char *old_path, const char *new_path);
+int control_put(int fd, const char *remote_path);
+int control_get(const char *remote_path, int fd);
+
+#endif // CONTROL_H
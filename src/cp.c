@@ -2,6 +2,10 @@
 #include "common.h"
 #include "ssh_sftp_client.h"
 #include "mount_config.h"
+#include "transfer.h"
+#include "tar_stream.h"
+#include "batch.h"
+#include "control.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,70 +21,71 @@
 // Biến toàn cục này nên được định nghĩa duy nhất trong ssh_sftp_client.c
 // extern remote_conn_info_t *ssh_cli_conn; // Khai báo extern nếu cần
 
+// Tùy chọn chỉ có dạng dài
+enum {
+    OPT_RESUME = 256,
+    OPT_DELTA,
+    OPT_CHECKSUM,
+    OPT_TAR,
+    OPT_DIRECT,
+    OPT_FROM_FILE
+};
+
 void show_usage(const char *progname) {
-    fprintf(stderr, "Usage: %s [options] <source> <destination>\n\n", progname);
-    fprintf(stderr, "Copy files between local filesystem and RemoteFS mounted directories.\n\n");
+    fprintf(stderr, "Usage: %s [options] <source>... <destination>\n", progname);
+    fprintf(stderr, "       %s [options] --from-file FILE [<destination>]\n\n", progname);
+    fprintf(stderr, "Copy files between local filesystem and RemoteFS mounted directories.\n");
+    fprintf(stderr, "With several sources the destination must be a directory. All operations of\n"
+                    "one run share a single SSH connection.\n\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -h, --help           Show this help message\n");
     fprintf(stderr, "  -v, --verbose        Enable verbose output\n");
     fprintf(stderr, "  -r, --recursive      Copy directories recursively\n");
+    fprintf(stderr, "  -j, --jobs N         Copy up to N files in parallel over N SFTP sessions (default: 1, max: %d).\n"
+                    "                       Files of %llu MiB or more are split into ranges copied in parallel.\n",
+            TRANSFER_JOBS_MAX, TRANSFER_STRIPE_MIN / (1024 * 1024));
+    fprintf(stderr, "      --resume         Record progress of files of %llu MiB or more and continue\n"
+                    "                       an interrupted copy of the same file instead of starting over.\n",
+            TRANSFER_RESUME_MIN / (1024 * 1024));
+    fprintf(stderr, "      --delta          Send only the blocks that differ from the existing destination file\n"
+                    "                       (needs shell access on the server, otherwise copies in full).\n");
+    fprintf(stderr, "  -u, --update, --sync Skip files whose destination has the same size and modification time,\n"
+                    "                       and give copied files the source modification time.\n");
+    fprintf(stderr, "      --checksum       With --update, compare content (MD5 on the server) when only the\n"
+                    "                       modification time differs.\n");
+    fprintf(stderr, "      --tar            With -r, send the whole tree as one tar stream over SSH (fast for\n"
+                    "                       many small files; needs tar on the server, otherwise file by file).\n");
+    fprintf(stderr, "      --direct         Write downloaded files of %llu MiB or more with O_DIRECT, bypassing\n"
+                    "                       the page cache (files not split into ranges by -j).\n",
+            SFTP_DIRECT_IO_MIN / (1024 * 1024));
+    fprintf(stderr, "      --from-file FILE Read operations from FILE (- for stdin), one per line:\n"
+                    "                       \"source<TAB>destination\", or just \"source\" to copy into\n"
+                    "                       <destination>. Blank lines and lines starting with # are skipped.\n");
     fprintf(stderr, "\nExamples:\n");
     fprintf(stderr, "  %s localfile.txt /path/to/mounted/remotefs/      # Copy local file to remote\n", progname);
     fprintf(stderr, "  %s /path/to/mounted/remotefs/file.txt ./         # Copy remote file to local\n", progname);
     fprintf(stderr, "  %s -r local_dir/ /path/to/mounted/remotefs/      # Copy directory recursively\n", progname);
+    fprintf(stderr, "  %s -r -j 8 local_dir/ /path/to/mounted/remotefs/ # Same, 8 files at a time\n", progname);
+    fprintf(stderr, "  %s -r -u /path/to/mounted/remotefs/data ./mirror # Copy only what changed\n", progname);
     fprintf(stderr, "  %s file1.txt /path/to/mounted/remotefs/file2.txt # Copy and rename\n", progname);
+    fprintf(stderr, "  %s a.txt b.txt c.txt /path/to/mounted/remotefs/  # Copy several files at once\n", progname);
+    fprintf(stderr, "  find . -name '*.log' | %s -j 4 --from-file - /path/to/mounted/remotefs/logs/\n", progname);
+    fprintf(stderr, "  %s /path/to/mounted/remotefs/a.img /path/to/mounted/remotefs/b.img\n"
+                    "                                                   # Copy on the server (same mount)\n", progname);
 }
 
+// Đường dẫn có nằm trên một điểm mount remotefs không (tra trong chỉ mục
+// các mount đã lưu; registry được ánh xạ lại khi tiến trình khác ghi đè nó)
 const char* is_remote_path(const char *path, char *mount_point_buf, size_t buf_size) {
-    // Empty path check
-    if (!path || strlen(path) == 0) {
-        return NULL;
-    }
-
-    // Try to resolve the real absolute path
-    char abs_path[PATH_MAX];
-    if (realpath(path, abs_path) == NULL) {
-        // If realpath fails, just use the provided path directly
-        strncpy(abs_path, path, sizeof(abs_path) - 1);
-        abs_path[sizeof(abs_path) - 1] = '\0';
-    }
-
-    // Get all mount points
-    int count = 0;
-    char **mount_points = get_mount_points(&count);
-    if (!mount_points || count == 0) {
-        // No mount points found
+    mount_lookup_t lookup;
+    if (mount_lookup(path, &lookup) != 0) {
         return NULL;
     }
-
-    // Check if the path starts with any of our mount points
-    for (int i = 0; i < count; i++) {
-        size_t len = strlen(mount_points[i]);
-        if (strncmp(abs_path, mount_points[i], len) == 0 &&
-            (abs_path[len] == '/' || abs_path[len] == '\0')) {
-            // Match found - copy to output buffer if provided
-            if (mount_point_buf && buf_size > 0) {
-                strncpy(mount_point_buf, mount_points[i], buf_size - 1);
-                mount_point_buf[buf_size - 1] = '\0';
-            }
-
-            // Free all mount points
-            for (int j = 0; j < count; j++) {
-                free(mount_points[j]);
-            }
-            free(mount_points);
-
-            return mount_point_buf;
-        }
-    }
-
-    // No match found - free all mount points
-    for (int i = 0; i < count; i++) {
-        free(mount_points[i]);
+    if (mount_point_buf && buf_size > 0) {
+        strncpy(mount_point_buf, lookup.mount_point, buf_size - 1);
+        mount_point_buf[buf_size - 1] = '\0';
     }
-    free(mount_points);
-
-    return NULL;
+    return mount_point_buf;
 }
 
 int get_remote_path(const char *path, char *remote_path, size_t size, int verbose) {
@@ -88,61 +93,25 @@ int get_remote_path(const char *path, char *remote_path, size_t size, int verbos
         return -1;
     }
 
-    char mount_point[PATH_MAX];
-
-    // Determine if the path is on a remote filesystem
-    if (!is_remote_path(path, mount_point, sizeof(mount_point))) {
+    mount_lookup_t lookup;
+    if (mount_lookup(path, &lookup) != 0) {
         if (verbose) {
             fprintf(stderr, "Path is not on a remote filesystem: %s\n", path);
         }
         return -1;
     }
-
-    // Get the remote base path for this mount point
-    char *base_remote_path = get_remote_path_for_mount(mount_point);
-    if (!base_remote_path) {
-        fprintf(stderr, "Error: Cannot determine remote path for mount point: %s\n", mount_point);
+    if ((size_t)snprintf(remote_path, size, "%s", lookup.remote_path) >= size) {
+        fprintf(stderr, "Error: Remote path too long for %s\n", path);
         return -1;
     }
 
-    // Get the absolute path of the local path
-    char abs_path[PATH_MAX];
-    if (realpath(path, abs_path) == NULL) {
-        // If realpath fails, use the provided path
-        strncpy(abs_path, path, sizeof(abs_path) - 1);
-        abs_path[sizeof(abs_path) - 1] = '\0';
-    }
-
-    // Calculate the relative part (path within the mount)
-    const char *rel_path = abs_path + strlen(mount_point);
-
-    // Construct the full remote path
-    if (rel_path[0] != '/' && strlen(rel_path) > 0) {
-        // Add slash if needed
-        snprintf(remote_path, size, "%s/%s", base_remote_path, rel_path);
-    } else {
-        // Already has a slash or is empty
-        snprintf(remote_path, size, "%s%s", base_remote_path, rel_path);
-    }
-
-    // Cleanup any double slashes that might occur
-    if (strlen(base_remote_path) > 0 && base_remote_path[strlen(base_remote_path) - 1] == '/' &&
-        rel_path[0] == '/') {
-        char *double_slash = strstr(remote_path, "//");
-        if (double_slash) {
-            memmove(double_slash, double_slash + 1, strlen(double_slash));
-        }
-    }
-
     if (verbose) {
         printf("Local path: %s\n", path);
-        printf("Mount point: %s\n", mount_point);
-        printf("Remote base path: %s\n", base_remote_path);
-        printf("Relative path: %s\n", rel_path);
+        printf("Mount point: %s\n", lookup.mount_point);
+        printf("Remote base path: %s\n", lookup.remote_base);
+        printf("Relative path: %s\n", lookup.rel_path);
         printf("Full remote path: %s\n", remote_path);
     }
-
-    free(base_remote_path);
     return 0;
 }
 
@@ -153,25 +122,23 @@ typedef struct {
     const char* dest_base;        // Base destination path
     int source_is_remote;
     int dest_is_remote;
+    transfer_engine_t *engine;    // Hàng đợi copy file (chạy song song khi -j > 1)
 } copy_context_t;
 
 // Global pointer for copy context
 static copy_context_t *g_copy_ctx = NULL;
 
-// Copy a single file from local to remote
-int copy_local_to_remote_file(const char* local_path, const char* remote_path, int verbose) {
-    if (verbose) {
-        printf("Copying local file %s to remote %s\n", local_path, remote_path);
-    }
-    return sftp_copy_local_to_remote(local_path, remote_path);
+// Khi chạy nhiều thao tác (nhiều nguồn hoặc --from-file), mọi file của cả lô
+// đi qua một transfer engine chung, nên các phiên SFTP của -j chỉ mở một lần;
+// engine này chỉ được đợi ở cuối main. NULL khi chỉ có một cặp nguồn/đích.
+static transfer_engine_t *g_batch_engine = NULL;
+
+static transfer_engine_t *engine_begin(int jobs, int flags, int verbose) {
+    return g_batch_engine ? g_batch_engine : transfer_engine_create(ssh_cli_conn, jobs, flags, verbose);
 }
 
-// Copy a single file from remote to local
-int copy_remote_to_local_file(const char* remote_path, const char* local_path, int verbose) {
-    if (verbose) {
-        printf("Copying remote file %s to local %s\n", remote_path, local_path);
-    }
-    return sftp_copy_remote_to_local(remote_path, local_path);
+static int engine_end(transfer_engine_t *engine) {
+    return engine == g_batch_engine ? 0 : transfer_engine_finish(engine);
 }
 
 // Function to create remote directory
@@ -195,6 +162,21 @@ int create_remote_dir(const char* remote_path, mode_t mode, int verbose) {
     return sftp_mkdir_remote(remote_path, mode);
 }
 
+// --tar: chỉ dùng luồng tar khi server có tar và không cần xử lý từng file
+// (--update, --delta, --resume); ngược lại quay về copy từng file
+static int use_tar_stream(int flags, int verbose) {
+    if (!(flags & TRANSFER_TAR)) return 0;
+    if (flags & (TRANSFER_UPDATE | TRANSFER_DELTA | TRANSFER_RESUME)) {
+        fprintf(stderr, "Warning: --tar is ignored with --update, --delta or --resume\n");
+        return 0;
+    }
+    if (tar_stream_available() != 0) {
+        if (verbose) printf("Remote has no tar (or no shell access), copying file by file\n");
+        return 0;
+    }
+    return 1;
+}
+
 // Callback function for ftw() in local to remote recursive copy
 int copy_local_to_remote_callback(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
     // Use global context instead of ftwbuf->extra
@@ -228,11 +210,9 @@ int copy_local_to_remote_callback(const char *path, const struct stat *sb, int t
             return -1;
         }
     } else if (typeflag == FTW_F) {
-        // Regular file
-        int result = copy_local_to_remote_file(path, dest_path, ctx->verbose);
-        if (result != 0) {
-            fprintf(stderr, "Error copying %s to %s: %s\n",
-                    path, dest_path, strerror(-result)); // sftp_* trả về -errno
+        // Regular file: đưa vào hàng đợi, lỗi đã được in bởi transfer engine
+        if (transfer_engine_submit(ctx->engine, TRANSFER_UPLOAD, path, dest_path,
+                                   (libssh2_uint64_t)sb->st_size, (unsigned long)sb->st_mtime) != 0) {
             return -1;
         }
     }
@@ -241,7 +221,7 @@ int copy_local_to_remote_callback(const char *path, const struct stat *sb, int t
 }
 
 // Copy a directory recursively from local to remote
-int copy_local_to_remote_recursive(const char* local_dir, const char* remote_path, int verbose) {
+int copy_local_to_remote_recursive(const char* local_dir, const char* remote_path, int jobs, int flags, int verbose) {
     struct stat st;
     if (stat(local_dir, &st) != 0) {
         fprintf(stderr, "Error: Cannot stat local directory: %s (%s)\n", local_dir, strerror(errno));
@@ -261,6 +241,10 @@ int copy_local_to_remote_recursive(const char* local_dir, const char* remote_pat
         return result; // Trả về mã lỗi từ create_remote_dir
     }
 
+    if (use_tar_stream(flags, verbose)) {
+        return tar_upload_tree(local_dir, remote_path, verbose);
+    }
+
     // Setup context for nftw
     copy_context_t ctx = {
         .verbose = verbose,
@@ -288,11 +272,21 @@ int copy_local_to_remote_recursive(const char* local_dir, const char* remote_pat
 
     ctx.source_base = normalized_source;
 
-    // Walk through the directory tree and copy files using global context
+    ctx.engine = engine_begin(jobs, flags, verbose);
+    if (!ctx.engine) return -ENOMEM;
+
+    // Walk through the directory tree and copy files using global context.
+    // Duyệt theo thứ tự trước (không dùng FTW_DEPTH) để thư mục được tạo trước các file bên trong
     g_copy_ctx = &ctx;
-    result = nftw(local_dir, copy_local_to_remote_callback, 20, FTW_PHYS | FTW_DEPTH);
+    result = nftw(local_dir, copy_local_to_remote_callback, 20, FTW_PHYS);
     g_copy_ctx = NULL;
 
+    // Chờ các file còn trong hàng đợi
+    int copy_result = engine_end(ctx.engine);
+    if (result == 0 && copy_result != 0) {
+         return copy_result;
+    }
+
     if (result != 0) {
          fprintf(stderr, "Error during recursive copy from %s\n", local_dir);
          // nftw trả về -1 khi callback trả về giá trị khác 0
@@ -303,20 +297,17 @@ int copy_local_to_remote_recursive(const char* local_dir, const char* remote_pat
     return 0; // Thành công
 }
 
-// Copy a directory recursively from remote to local
-int copy_remote_to_local_recursive(const char* remote_dir, const char* local_path, int verbose) {
+// Copy a directory recursively from remote to local.
+// Thư mục được tạo ngay khi duyệt, còn các file được đưa vào hàng đợi của engine
+static int copy_remote_to_local_tree(const char* remote_dir, const char* local_path,
+                                     transfer_engine_t *engine, int verbose) {
     LIBSSH2_SFTP_ATTRIBUTES attrs;
 
     // Check if remote path exists and is a directory
     if (sftp_stat_remote(remote_dir, &attrs) != 0) {
         fprintf(stderr, "Error: Cannot stat remote directory: %s\n", remote_dir);
         // Lấy lỗi cụ thể nếu có
-        remote_conn_info_t *conn = get_conn_info();
-        if (conn && conn->sftp_session) {
-             unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-             return -sftp_error_to_errno(sftp_err);
-        }
-        return -ENOENT;
+        return sftp_last_errno();
     }
 
     if (!LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
@@ -386,16 +377,15 @@ int copy_remote_to_local_recursive(const char* remote_dir, const char* local_pat
 
         if (file_attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS && LIBSSH2_SFTP_S_ISDIR(file_attrs.permissions)) {
             // Recursively copy subdirectory
-            result = copy_remote_to_local_recursive(remote_file_path, local_file_path, verbose);
+            result = copy_remote_to_local_tree(remote_file_path, local_file_path, engine, verbose);
             // Nếu có lỗi trong đệ quy, dừng lại
         } else if (file_attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS && LIBSSH2_SFTP_S_ISREG(file_attrs.permissions)) {
-            // Copy regular file
-            result = copy_remote_to_local_file(remote_file_path, local_file_path, verbose);
-            if (result != 0) {
-                fprintf(stderr, "Error copying %s to %s: %s\n",
-                        remote_file_path, local_file_path, strerror(-result));
-                // Dừng lại nếu có lỗi copy file
-            }
+            // Copy regular file (lỗi đã được in bởi transfer engine, dừng lại nếu có lỗi)
+            libssh2_uint64_t size = (file_attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ? file_attrs.filesize
+                                                                              : TRANSFER_SIZE_UNKNOWN;
+            result = transfer_engine_submit(engine, TRANSFER_DOWNLOAD, remote_file_path, local_file_path,
+                                            size, (file_attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+                                                  ? file_attrs.mtime : TRANSFER_MTIME_UNKNOWN);
         } else {
              // Bỏ qua các loại file khác (symlink, etc.) hoặc xử lý nếu cần
              if (verbose) {
@@ -408,142 +398,139 @@ int copy_remote_to_local_recursive(const char* remote_dir, const char* local_pat
     return result; // Trả về 0 nếu thành công, hoặc mã lỗi âm nếu thất bại
 }
 
-int setup_connection(const char *mount_point, int verbose) {
-    if (verbose) {
-        printf("Setting up connection for mount point: %s\n", mount_point);
-    }
-
-    // Allocate connection info structure
-    ssh_cli_conn = calloc(1, sizeof(remote_conn_info_t));
-    if (!ssh_cli_conn) {
-        perror("Failed to allocate memory for connection info");
-        return -1;
+int copy_remote_to_local_recursive(const char* remote_dir, const char* local_path, int jobs, int flags, int verbose) {
+    if (use_tar_stream(flags, verbose)) {
+        return tar_download_tree(remote_dir, local_path, verbose);
     }
 
-    // Initialize to default values
-    ssh_cli_conn->sock = -1;
-    ssh_cli_conn->remote_port = 22;
+    transfer_engine_t *engine = engine_begin(jobs, flags, verbose);
+    if (!engine) return -ENOMEM;
 
-    // Try to load full connection information
-    int load_result = load_connection_info_for_mount(mount_point, ssh_cli_conn);
+    int result = copy_remote_to_local_tree(remote_dir, local_path, engine, verbose);
+    int copy_result = engine_end(engine);
+    return result != 0 ? result : copy_result;
+}
 
-    if (load_result != 0) {
-        fprintf(stderr, "Error: Cannot load connection configuration for mount point: %s\n", mount_point);
-        fprintf(stderr, "Ensure the filesystem was mounted with host, user, key/pass options.\n");
-        if (ssh_cli_conn->remote_proc_path) free(ssh_cli_conn->remote_proc_path);
-        free(ssh_cli_conn);
-        ssh_cli_conn = NULL;
-        return -1;
+// Copy một file đơn. Với -j > 1 và file lớn, file được chia thành nhiều đoạn
+// và truyền song song qua nhiều phiên SFTP; với --resume, file lớn được ghi
+// nhật ký để lần chạy sau tiếp tục từ chỗ bị ngắt; với --delta chỉ gửi các
+// khối khác với file đích đã có; với --update bỏ qua file đích đã giống nguồn.
+// Các tùy chọn này do transfer engine xử lý (chạy ngay trên kết nối hiện tại).
+// Trong một lô, file được đưa vào engine chung để chạy song song với các file khác.
+static int copy_single_file(transfer_direction_t direction, const char *src, const char *dst,
+                            libssh2_uint64_t size, unsigned long mtime, int jobs, int flags, int verbose) {
+    if (g_batch_engine) {
+        return transfer_engine_submit(g_batch_engine, direction, src, dst, size, mtime);
     }
 
-    // Validate the loaded connection information
-    if (!ssh_cli_conn->remote_host || !ssh_cli_conn->remote_user) {
-        fprintf(stderr, "Error: Missing required connection information (host or user).\n");
-        // Giải phóng bộ nhớ đã cấp phát trước đó nếu có
-        free(ssh_cli_conn->remote_host); // An toàn khi gọi free(NULL)
-        free(ssh_cli_conn->remote_user);
-        free(ssh_cli_conn->remote_pass);
-        free(ssh_cli_conn->ssh_key_path);
-        free(ssh_cli_conn->remote_proc_path);
-        free(ssh_cli_conn);
-        ssh_cli_conn = NULL;
-        return -1;
+    int stripe = jobs > 1 && size != TRANSFER_SIZE_UNKNOWN && size >= TRANSFER_STRIPE_MIN &&
+                 !(flags & TRANSFER_DELTA);
+    if (!stripe && flags == 0) {
+        return direction == TRANSFER_UPLOAD ? sftp_copy_local_to_remote(src, dst)
+                                            : sftp_copy_remote_to_local(src, dst);
     }
 
-    if (!ssh_cli_conn->remote_pass && !ssh_cli_conn->ssh_key_path) {
-        fprintf(stderr, "Error: No authentication method available (password or key).\n");
-        free(ssh_cli_conn->remote_host);
-        free(ssh_cli_conn->remote_user);
-        free(ssh_cli_conn->remote_pass);
-        free(ssh_cli_conn->ssh_key_path);
-        free(ssh_cli_conn->remote_proc_path);
-        free(ssh_cli_conn);
-        ssh_cli_conn = NULL;
-        return -1;
+    transfer_engine_t *engine = transfer_engine_create(ssh_cli_conn, stripe ? jobs : 1, flags, verbose);
+    if (!engine) return -ENOMEM;
+    int result = transfer_engine_submit(engine, direction, src, dst, size, mtime);
+    int copy_result = transfer_engine_finish(engine);
+    return result != 0 ? result : copy_result;
+}
+
+// Copy giữa hai đường dẫn trên cùng mount point bằng cp chạy trên server
+// (--reflink=auto). Đích là thư mục đã có thì copy vào bên trong, như cp.
+static int copy_remote_to_remote(const char *source, const char *destination,
+                                 int recursive, int flags, int verbose) {
+    char remote_source[PATH_MAX];
+    char remote_dest[PATH_MAX];
+    if (get_remote_path(source, remote_source, sizeof(remote_source), verbose) != 0 ||
+        get_remote_path(destination, remote_dest, sizeof(remote_dest), verbose) != 0) {
+        fprintf(stderr, "Error: Cannot determine remote paths for copy operation.\n");
+        return -EINVAL;
     }
 
-    if (verbose) {
-        printf("Connecting to %s@%s:%d\n",
-               ssh_cli_conn->remote_user,
-               ssh_cli_conn->remote_host,
-               ssh_cli_conn->remote_port);
-        printf("Authentication method: %s\n",
-               ssh_cli_conn->ssh_key_path ? "SSH key" : "Password");
-        printf("Remote path: %s\n",
-               ssh_cli_conn->remote_proc_path ? ssh_cli_conn->remote_proc_path : "/");
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (sftp_stat_remote(remote_source, &attrs) != 0) {
+        fprintf(stderr, "Error: Cannot stat remote source %s\n", remote_source);
+        return -ENOENT;
+    }
+    int is_dir = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
+    if (is_dir && !recursive) {
+        fprintf(stderr, "Error: Source '%s' is a directory. Use -r option for recursive copy.\n", source);
+        return -EISDIR;
+    }
+    if (flags & (TRANSFER_DELTA | TRANSFER_RESUME | TRANSFER_TAR)) {
+        fprintf(stderr, "Warning: --delta, --resume and --tar do not apply to a copy on the server\n");
     }
 
-    // Attempt to connect and authenticate
-    if (sftp_connect_and_auth(ssh_cli_conn) != 0) {
-        fprintf(stderr, "Error: Failed to connect and authenticate SFTP session\n");
-        // Giải phóng bộ nhớ đã cấp phát
-        free(ssh_cli_conn->remote_host);
-        free(ssh_cli_conn->remote_user);
-        free(ssh_cli_conn->remote_pass);
-        free(ssh_cli_conn->ssh_key_path);
-        free(ssh_cli_conn->remote_proc_path);
-        free(ssh_cli_conn);
-        ssh_cli_conn = NULL;
-        return -1;
+    if (sftp_stat_remote(remote_dest, &attrs) == 0 &&
+        (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
+        char *source_dup = strdup(remote_source);
+        if (!source_dup) return -ENOMEM;
+        size_t len = strlen(remote_dest);
+        int ret = snprintf(remote_dest + len, sizeof(remote_dest) - len, "/%s", basename(source_dup));
+        free(source_dup);
+        if (ret < 0 || (size_t)ret >= sizeof(remote_dest) - len) {
+            fprintf(stderr, "Error: Destination path string too long.\n");
+            return -ENAMETOOLONG;
+        }
     }
 
     if (verbose) {
-        printf("SFTP connection established successfully\n");
+        printf("Copying on the server from %s to %s\n", remote_source, remote_dest);
     }
-
-    return 0;
-}
-
-int main(int argc, char *argv[]) {
-    // ---> KHỞI TẠO LIBSSH2 <---
-    if (libssh2_init(0) != 0) {
-        fprintf(stderr, "Error initializing libssh2\n");
-        return 1;
+    int opts = (is_dir ? SSH_COPY_RECURSIVE : 0) | ((flags & TRANSFER_UPDATE) ? SSH_COPY_UPDATE : 0);
+    int result = ssh_copy_remote(remote_source, remote_dest, opts);
+    if (result == -ENOSYS) {
+        fprintf(stderr, "Error: The server does not allow running cp over SSH; "
+                        "copy through a local directory instead\n");
+    } else if (result != 0) {
+        fprintf(stderr, "Error during remote copy: %s\n", strerror(-result));
     }
+    return result;
+}
 
-    int verbose = 0;
-    int recursive = 0;
-    int result = 1; // Mặc định là lỗi
-
-    static struct option long_options[] = {
-        {"help",     no_argument, 0, 'h'},
-        {"verbose",  no_argument, 0, 'v'},
-        {"recursive", no_argument, 0, 'r'},
-        {0, 0, 0, 0}
-    };
-
-    int opt;
-    int option_index = 0;
-
-    while ((opt = getopt_long(argc, argv, "hvr", long_options, &option_index)) != -1) {
-        switch (opt) {
-            case 'h':
-                show_usage(argv[0]);
-                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-                return 0;
-            case 'v':
-                verbose = 1;
-                break;
-            case 'r':
-                recursive = 1;
-                break;
-            default:
-                show_usage(argv[0]);
-                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-                return 1;
+// Mount point chung của mọi đường dẫn remote trong lô (chuỗi rỗng nếu tất cả
+// đều local). Cả lô dùng một kết nối, nên các mount point khác nhau bị từ chối
+static int batch_mount_point(const batch_t *batch, char *mount_point, size_t size) {
+    mount_point[0] = '\0';
+    for (size_t i = 0; i < batch->count; i++) {
+        const char *paths[2] = { batch->ops[i].source, batch->ops[i].destination };
+        for (int p = 0; p < 2; p++) {
+            char path_mount[PATH_MAX];
+            if (!is_remote_path(paths[p], path_mount, sizeof(path_mount))) continue;
+            if (mount_point[0] == '\0') {
+                strncpy(mount_point, path_mount, size - 1);
+                mount_point[size - 1] = '\0';
+            } else if (strcmp(mount_point, path_mount) != 0) {
+                fprintf(stderr, "Error: All remote paths must be on one mount point (%s and %s)\n",
+                        mount_point, path_mount);
+                return -EINVAL;
+            }
         }
     }
+    return 0;
+}
 
-    if (argc - optind != 2) {
-        fprintf(stderr, "Error: Source and destination arguments are required.\n");
-        show_usage(argv[0]);
-        libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-        return 1;
+// Với nhiều nguồn, đích chung phải là thư mục có sẵn (như cp)
+static int target_is_directory(const char *path, int verbose) {
+    char mount_point[PATH_MAX];
+    if (is_remote_path(path, mount_point, sizeof(mount_point))) {
+        char remote_path[PATH_MAX];
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+        return get_remote_path(path, remote_path, sizeof(remote_path), verbose) == 0 &&
+               sftp_stat_remote(remote_path, &attrs) == 0 &&
+               (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
     }
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
 
-    const char *source = argv[optind];
-    const char *destination = argv[optind + 1];
-
+// Copy một cặp nguồn/đích (một đối số nguồn của lệnh hoặc một dòng của
+// --from-file) trên kết nối đã thiết lập. Trả về 0 nếu thành công, 1 nếu lỗi
+static int copy_one(const char *source, const char *destination,
+                    int recursive, int jobs, int flags, int verbose) {
+    int result = 1;
     char source_mount_point[PATH_MAX] = {0};
     char dest_mount_point[PATH_MAX] = {0};
     int source_is_remote = (is_remote_path(source, source_mount_point, sizeof(source_mount_point)) != NULL);
@@ -556,51 +543,24 @@ int main(int argc, char *argv[]) {
         if (dest_is_remote) printf("Destination mount point: %s\n", dest_mount_point);
     }
 
-    const char *relevant_mount_point = NULL;
-    if (source_is_remote) {
-        relevant_mount_point = source_mount_point;
-    } else if (dest_is_remote) {
-        relevant_mount_point = dest_mount_point;
-    }
-
-    // Chỉ thiết lập kết nối nếu cần (một trong hai là remote)
-    if (relevant_mount_point) {
-        if (setup_connection(relevant_mount_point, verbose) != 0) {
-            libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-            return 1;
-        }
-    } else if (!source_is_remote && !dest_is_remote) {
-        // Trường hợp cả hai đều local, không cần kết nối SSH
-    } else {
-        // Trường hợp không xác định được mount point liên quan (lỗi logic?)
-        fprintf(stderr, "Error: Could not determine relevant mount point for operation.\n");
-        libssh2_exit();
-        return 1;
-    }
-
-
     if (source_is_remote && dest_is_remote) {
-        fprintf(stderr, "Error: Cannot copy directly between two remote locations\n");
-        result = 1; // Đã đặt mặc định
+        // Cùng mount point: copy ngay trên server, dữ liệu không đi qua client
+        if (strcmp(source_mount_point, dest_mount_point) == 0) {
+            result = copy_remote_to_remote(source, destination, recursive, flags, verbose) == 0 ? 0 : 1;
+        } else {
+            fprintf(stderr, "Error: Cannot copy directly between two different remote locations/mount points\n");
+            result = 1;
+        }
     } else if (!source_is_remote && !dest_is_remote) {
         fprintf(stderr, "Note: Both paths are local, using system cp\n");
 
-        char cmd[PATH_MAX * 2 + 20]; // Tăng kích thước buffer
-        // Đảm bảo source và destination được bao trong dấu nháy kép để xử lý tên có khoảng trắng
-        int ret = snprintf(cmd, sizeof(cmd), "/bin/cp %s \"%s\" \"%s\"",
-                 recursive ? "-r" : "", source, destination);
-        if (ret < 0 || (size_t)ret >= sizeof(cmd)) {
-             fprintf(stderr, "Error: Command string too long.\n");
-             result = 1;
+        // Chạy /bin/cp trực tiếp (không qua shell): tên file từ manifest không bị shell diễn giải
+        int status = batch_run_local("/bin/cp", recursive ? "-r" : NULL, source, destination);
+        if (status != 0) {
+            fprintf(stderr, "System cp command failed with exit code %d\n", status);
+            result = 1;
         } else {
-             result = system(cmd);
-             if (result != 0) {
-                  fprintf(stderr, "System cp command failed with exit code %d\n", result);
-                  // Chuyển đổi mã lỗi system thành giá trị khác 0 đơn giản
-                  result = 1;
-             } else {
-                  result = 0; // Thành công
-             }
+            result = 0; // Thành công
         }
     } else if (source_is_remote && !dest_is_remote) {
         // --- Copy từ Remote về Local ---
@@ -617,10 +577,10 @@ int main(int argc, char *argv[]) {
             if (stat(destination, &dest_st) == 0 && S_ISDIR(dest_st.st_mode)) {
                 // Nếu là thư mục, tạo đường dẫn đích cuối cùng bên trong thư mục đó
                 char *source_basename_dup = strdup(source); // Cần basename của source remote
-                if (!source_basename_dup) { perror("strdup"); result = 1; goto cleanup; }
+                if (!source_basename_dup) { perror("strdup"); return 1; }
                 // Lấy basename từ remote_path thay vì source local
                 char *remote_path_dup = strdup(remote_path);
-                if (!remote_path_dup) { perror("strdup"); free(source_basename_dup); result = 1; goto cleanup; }
+                if (!remote_path_dup) { perror("strdup"); free(source_basename_dup); return 1; }
                 char *source_basename = basename(remote_path_dup);
 
                 int ret = snprintf(new_dest_buf, sizeof(new_dest_buf), "%s/%s", destination, source_basename);
@@ -628,8 +588,7 @@ int main(int argc, char *argv[]) {
                      fprintf(stderr, "Error: Destination path string too long.\n");
                      free(source_basename_dup);
                      free(remote_path_dup);
-                     result = 1;
-                     goto cleanup;
+                     return 1;
                  }
                 free(source_basename_dup); // Không cần nữa
                 free(remote_path_dup);
@@ -643,8 +602,7 @@ int main(int argc, char *argv[]) {
             } else {
                  // Lỗi khác khi stat đích
                  perror("Error stating destination path");
-                 result = 1;
-                 goto cleanup;
+                 return 1;
             }
 
 
@@ -656,8 +614,7 @@ int main(int argc, char *argv[]) {
                 is_remote_dir = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
             } else {
                  fprintf(stderr, "Error: Cannot stat remote source %s\n", remote_path);
-                 result = -stat_rc; // Trả về mã lỗi từ sftp_stat_remote
-                 goto cleanup;
+                 return 1;
             }
 
             if (is_remote_dir) {
@@ -670,7 +627,7 @@ int main(int argc, char *argv[]) {
                         printf("Copying recursively from remote directory %s to local %s\n",
                                remote_path, actual_destination);
                     }
-                    result = copy_remote_to_local_recursive(remote_path, actual_destination, verbose);
+                    result = copy_remote_to_local_recursive(remote_path, actual_destination, jobs, flags, verbose);
                 }
             } else {
                 // Nguồn là file remote
@@ -680,7 +637,12 @@ int main(int argc, char *argv[]) {
                 if (verbose) {
                     printf("Copying from remote file %s to local %s\n", remote_path, actual_destination);
                 }
-                result = sftp_copy_remote_to_local(remote_path, actual_destination);
+                libssh2_uint64_t size = (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ? attrs.filesize
+                                                                               : TRANSFER_SIZE_UNKNOWN;
+                result = copy_single_file(TRANSFER_DOWNLOAD, remote_path, actual_destination,
+                                          size, (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+                                                ? attrs.mtime : TRANSFER_MTIME_UNKNOWN,
+                                          jobs, flags, verbose);
             }
              // Chuyển đổi mã lỗi âm thành 1 nếu có lỗi, 0 nếu thành công
              if (result != 0) {
@@ -702,8 +664,7 @@ int main(int argc, char *argv[]) {
             // Kiểm tra nguồn local
             if (stat(source, &source_st) != 0) {
                 fprintf(stderr, "Error: Cannot stat local source %s: %s\n", source, strerror(errno));
-                result = 1;
-                goto cleanup; // Đi đến cleanup để đóng kết nối nếu có
+                return 1; // Đi đến cleanup để đóng kết nối nếu có
             }
 
             // Kiểm tra xem đích remote có phải là thư mục không
@@ -714,13 +675,11 @@ int main(int argc, char *argv[]) {
                 is_remote_dir = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
             } else {
                 // Nếu đích remote không tồn tại (ENOENT), thì coi như copy vào file mới
-                remote_conn_info_t *conn = get_conn_info();
-                unsigned long sftp_err = (conn && conn->sftp_session) ? libssh2_sftp_last_error(conn->sftp_session) : 0;
-                if (sftp_error_to_errno(sftp_err) != ENOENT) {
+                int stat_err = sftp_last_errno();
+                if (stat_err != -ENOENT) {
                     // Lỗi khác không phải không tồn tại
-                    fprintf(stderr, "Error: Cannot stat remote destination %s (sftp_err: %lu)\n", remote_path, sftp_err);
-                    result = 1;
-                    goto cleanup;
+                    fprintf(stderr, "Error: Cannot stat remote destination %s: %s\n", remote_path, strerror(-stat_err));
+                    return 1;
                 }
                 // Nếu không tồn tại, is_remote_dir = 0
             }
@@ -729,7 +688,7 @@ int main(int argc, char *argv[]) {
             if (is_remote_dir) {
                  // Đích là thư mục remote, tạo đường dẫn cuối cùng bên trong nó
                 char *source_basename_dup = strdup(source);
-                if (!source_basename_dup) { perror("strdup"); result = 1; goto cleanup; }
+                if (!source_basename_dup) { perror("strdup"); return 1; }
                 char *source_basename = basename(source_basename_dup);
                 int remote_len = strlen(remote_path);
 
@@ -739,16 +698,14 @@ int main(int argc, char *argv[]) {
                      if (ret < 0 || (size_t)ret >= sizeof(final_remote_path_buf)) {
                          fprintf(stderr, "Error: Final remote path string too long.\n");
                          free(source_basename_dup);
-                         result = 1;
-                         goto cleanup;
+                         return 1;
                      }
                 } else {
                     int ret = snprintf(final_remote_path_buf, sizeof(final_remote_path_buf), "%s/%s", remote_path, source_basename);
                      if (ret < 0 || (size_t)ret >= sizeof(final_remote_path_buf)) {
                          fprintf(stderr, "Error: Final remote path string too long.\n");
                          free(source_basename_dup);
-                         result = 1;
-                         goto cleanup;
+                         return 1;
                      }
                 }
                 free(source_basename_dup);
@@ -773,7 +730,7 @@ int main(int argc, char *argv[]) {
                          result = 1;
                     } else {
                          // Nếu đích remote không tồn tại, hàm copy_local_to_remote_recursive sẽ tạo nó
-                         result = copy_local_to_remote_recursive(source, final_remote_path, verbose);
+                         result = copy_local_to_remote_recursive(source, final_remote_path, jobs, flags, verbose);
                     }
                 }
             } else {
@@ -785,7 +742,9 @@ int main(int argc, char *argv[]) {
                     printf("Copying from local file %s to remote %s\n", source, final_remote_path);
                 }
                 // Copy local file to computed remote path
-                result = sftp_copy_local_to_remote(source, final_remote_path);
+                result = copy_single_file(TRANSFER_UPLOAD, source, final_remote_path,
+                                          (libssh2_uint64_t)source_st.st_size, (unsigned long)source_st.st_mtime,
+                                          jobs, flags, verbose);
             }
              // Chuyển đổi mã lỗi âm thành 1 nếu có lỗi, 0 nếu thành công
              if (result != 0) {
@@ -798,8 +757,291 @@ int main(int argc, char *argv[]) {
          result = 1;
     }
 
+    return result;
+}
+
+int setup_connection(const char *mount_point, int verbose) {
+    if (verbose) {
+        printf("Setting up connection for mount point: %s\n", mount_point);
+    }
+
+    // Allocate connection info structure
+    ssh_cli_conn = calloc(1, sizeof(remote_conn_info_t));
+    if (!ssh_cli_conn) {
+        perror("Failed to allocate memory for connection info");
+        return -1;
+    }
+
+    // Initialize to default values
+    ssh_cli_conn->sock = -1;
+    ssh_cli_conn->remote_port = 22;
+
+    // Try to load full connection information
+    int load_result = load_connection_info_for_mount(mount_point, ssh_cli_conn);
+
+    if (load_result != 0) {
+        fprintf(stderr, "Error: Cannot load connection configuration for mount point: %s\n", mount_point);
+        fprintf(stderr, "Ensure the filesystem was mounted with host, user, key/pass options.\n");
+        if (ssh_cli_conn->remote_proc_path) free(ssh_cli_conn->remote_proc_path);
+        free(ssh_cli_conn);
+        ssh_cli_conn = NULL;
+        return -1;
+    }
+
+    // Validate the loaded connection information
+    if (!ssh_cli_conn->remote_host || !ssh_cli_conn->remote_user) {
+        fprintf(stderr, "Error: Missing required connection information (host or user).\n");
+        // Giải phóng bộ nhớ đã cấp phát trước đó nếu có
+        free(ssh_cli_conn->remote_host); // An toàn khi gọi free(NULL)
+        free(ssh_cli_conn->remote_user);
+        free(ssh_cli_conn->remote_pass);
+        free(ssh_cli_conn->ssh_key_path);
+        free(ssh_cli_conn->remote_proc_path);
+        free(ssh_cli_conn);
+        ssh_cli_conn = NULL;
+        return -1;
+    }
+
+    if (!ssh_cli_conn->remote_pass && !ssh_cli_conn->ssh_key_path) {
+        fprintf(stderr, "Error: No authentication method available (password or key).\n");
+        free(ssh_cli_conn->remote_host);
+        free(ssh_cli_conn->remote_user);
+        free(ssh_cli_conn->remote_pass);
+        free(ssh_cli_conn->ssh_key_path);
+        free(ssh_cli_conn->remote_proc_path);
+        free(ssh_cli_conn);
+        ssh_cli_conn = NULL;
+        return -1;
+    }
+
+    if (verbose) {
+        printf("Connecting to %s@%s:%d\n",
+               ssh_cli_conn->remote_user,
+               ssh_cli_conn->remote_host,
+               ssh_cli_conn->remote_port);
+        printf("Authentication method: %s\n",
+               ssh_cli_conn->ssh_key_path ? "SSH key" : "Password");
+        printf("Remote path: %s\n",
+               ssh_cli_conn->remote_proc_path ? ssh_cli_conn->remote_proc_path : "/");
+    }
+
+    // Nếu mount đang chạy, dùng lại các phiên SFTP của nó qua control socket;
+    // phiên SSH riêng chỉ được mở khi cần (liệt kê thư mục, kênh exec, -j)
+    char *control_path = get_control_socket_path(mount_point);
+    int served = control_path && control_connect(control_path) == 0;
+    free(control_path);
+    if (served) {
+        if (verbose) {
+            printf("Using the SFTP sessions of the live mount\n");
+        }
+        return 0;
+    }
+
+    // Attempt to connect and authenticate
+    if (sftp_connect_and_auth(ssh_cli_conn) != 0) {
+        fprintf(stderr, "Error: Failed to connect and authenticate SFTP session\n");
+        // Giải phóng bộ nhớ đã cấp phát
+        free(ssh_cli_conn->remote_host);
+        free(ssh_cli_conn->remote_user);
+        free(ssh_cli_conn->remote_pass);
+        free(ssh_cli_conn->ssh_key_path);
+        free(ssh_cli_conn->remote_proc_path);
+        free(ssh_cli_conn);
+        ssh_cli_conn = NULL;
+        return -1;
+    }
+
+    if (verbose) {
+        printf("SFTP connection established successfully\n");
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // ---> KHỞI TẠO LIBSSH2 <---
+    if (libssh2_init(0) != 0) {
+        fprintf(stderr, "Error initializing libssh2\n");
+        return 1;
+    }
+
+    int verbose = 0;
+    int recursive = 0;
+    int jobs = 1;
+    int flags = 0;
+    int direct_io = 0;
+    const char *from_file = NULL;
+    int result = 1; // Mặc định là lỗi
+
+    static struct option long_options[] = {
+        {"help",     no_argument, 0, 'h'},
+        {"verbose",  no_argument, 0, 'v'},
+        {"recursive", no_argument, 0, 'r'},
+        {"jobs",     required_argument, 0, 'j'},
+        {"resume",   no_argument, 0, OPT_RESUME},
+        {"delta",    no_argument, 0, OPT_DELTA},
+        {"update",   no_argument, 0, 'u'},
+        {"sync",     no_argument, 0, 'u'},
+        {"checksum", no_argument, 0, OPT_CHECKSUM},
+        {"tar",      no_argument, 0, OPT_TAR},
+        {"direct",   no_argument, 0, OPT_DIRECT},
+        {"from-file", required_argument, 0, OPT_FROM_FILE},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    int option_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "hvruj:", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'h':
+                show_usage(argv[0]);
+                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+                return 0;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'r':
+                recursive = 1;
+                break;
+            case 'j': {
+                char *end = NULL;
+                long n = strtol(optarg, &end, 10);
+                if (!end || *end != '\0' || n < 1 || n > TRANSFER_JOBS_MAX) {
+                    fprintf(stderr, "Error: -j expects a number between 1 and %d\n", TRANSFER_JOBS_MAX);
+                    libssh2_exit();
+                    return 1;
+                }
+                jobs = (int)n;
+                break;
+            }
+            case OPT_RESUME:
+                flags |= TRANSFER_RESUME;
+                break;
+            case OPT_DELTA:
+                flags |= TRANSFER_DELTA;
+                break;
+            case 'u':
+                flags |= TRANSFER_UPDATE;
+                break;
+            case OPT_CHECKSUM:
+                flags |= TRANSFER_UPDATE | TRANSFER_CHECKSUM;
+                break;
+            case OPT_TAR:
+                flags |= TRANSFER_TAR;
+                break;
+            case OPT_DIRECT:
+                direct_io = 1;
+                break;
+            case OPT_FROM_FILE:
+                from_file = optarg;
+                break;
+            default:
+                show_usage(argv[0]);
+                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+                return 1;
+        }
+    }
+
+    batch_t batch = {0};
+    const char *target_dir = NULL; // Đích chung của các nguồn, phải là thư mục
+    if (from_file) {
+        // --from-file: đối số còn lại (nếu có) là đích của các dòng chỉ ghi nguồn
+        if (argc - optind > 1) {
+            fprintf(stderr, "Error: --from-file takes at most one destination argument.\n");
+            show_usage(argv[0]);
+            libssh2_exit();
+            return 1;
+        }
+        if (argc - optind == 1) target_dir = argv[optind];
+        if (batch_read_manifest(&batch, from_file, target_dir) != 0) {
+            batch_free(&batch);
+            libssh2_exit();
+            return 1;
+        }
+        if (batch.count == 0) {
+            fprintf(stderr, "Error: %s lists no files to copy.\n", from_file);
+            batch_free(&batch);
+            libssh2_exit();
+            return 1;
+        }
+    } else {
+        if (argc - optind < 2) {
+            fprintf(stderr, "Error: Source and destination arguments are required.\n");
+            show_usage(argv[0]);
+            libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+            return 1;
+        }
+        const char *destination = argv[argc - 1];
+        if (argc - optind > 2) target_dir = destination;
+        for (int i = optind; i < argc - 1; i++) {
+            if (batch_add(&batch, argv[i], destination) != 0) {
+                perror("batch_add");
+                batch_free(&batch);
+                libssh2_exit();
+                return 1;
+            }
+        }
+    }
+
+    char mount_point[PATH_MAX];
+    if (batch_mount_point(&batch, mount_point, sizeof(mount_point)) != 0) {
+        batch_free(&batch);
+        libssh2_exit();
+        return 1;
+    }
+
+    // Chỉ thiết lập kết nối nếu cần (có đường dẫn remote), một lần cho cả lô
+    if (mount_point[0] != '\0') {
+        if (setup_connection(mount_point, verbose) != 0) {
+            batch_free(&batch);
+            libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+            return 1;
+        }
+        // Các phiên của -j sao chép cấu hình này, nên phải đặt trước khi copy
+        ssh_cli_conn->direct_io = direct_io;
+    }
+
+    if (target_dir && !target_is_directory(target_dir, verbose)) {
+        fprintf(stderr, "Error: Target '%s' is not a directory\n", target_dir);
+        result = 1;
+        goto cleanup;
+    }
+
+    if (batch.count > 1 && ssh_cli_conn) {
+        g_batch_engine = transfer_engine_create(ssh_cli_conn, jobs, flags, verbose);
+        if (!g_batch_engine) {
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+    result = 0;
+    for (size_t i = 0; i < batch.count; i++) {
+        // Như với -j, lỗi đầu tiên trong hàng đợi dừng các thao tác còn lại
+        if (g_batch_engine && transfer_engine_error(g_batch_engine) != 0) {
+            fprintf(stderr, "Error: Skipping the remaining %zu operation(s) after a failed copy\n",
+                    batch.count - i);
+            result = 1;
+            break;
+        }
+        if (copy_one(batch.ops[i].source, batch.ops[i].destination, recursive, jobs, flags, verbose) != 0) {
+            result = 1;
+        }
+    }
+    if (g_batch_engine) {
+        int copy_result = transfer_engine_finish(g_batch_engine);
+        g_batch_engine = NULL;
+        if (copy_result != 0) {
+            fprintf(stderr, "Error during copy: %s\n", strerror(-copy_result));
+            result = 1;
+        }
+    }
 cleanup:
+    batch_free(&batch);
+
     // Đóng kết nối SSH nếu đã mở
+    control_disconnect();
     if (ssh_cli_conn) {
         sftp_disconnect(ssh_cli_conn);
 
@@ -0,0 +1,454 @@
+#define _GNU_SOURCE // copy_file_range
+#include "delta.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+// Set once a server refused exec, so the remaining files skip the attempt
+static int delta_exec_unavailable = 0;
+
+// Smallest power-of-two block (>= DELTA_BLOCK_MIN) giving at most DELTA_MAX_BLOCKS blocks
+static size_t delta_block_size(libssh2_uint64_t size) {
+    size_t block = DELTA_BLOCK_MIN;
+    while ((size + block - 1) / block > DELTA_MAX_BLOCKS) block *= 2;
+    return block;
+}
+
+static void delta_digest(const char *data, size_t len, unsigned char *digest) {
+    unsigned int digest_len = DELTA_DIGEST_LEN;
+    EVP_Digest(data, len, digest, &digest_len, EVP_md5(), NULL);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Run a script under sh on the server, whatever the login shell of the
+// account is, with path as $1 (never part of the script text). Returns its
+// exit status with *output set (caller frees), or -ENOSYS once the server
+// refused exec.
+static int delta_exec_sh(const char *script, const char *path, char **output) {
+    if (__atomic_load_n(&delta_exec_unavailable, __ATOMIC_RELAXED)) return -ENOSYS;
+
+    char *quoted_script = ssh_shell_quote(script);
+    char *quoted_path = ssh_shell_quote(path);
+    char *command = NULL;
+    if (quoted_script && quoted_path) {
+        command = malloc(strlen(quoted_script) + strlen(quoted_path) + 12);
+        if (command) sprintf(command, "sh -c %s sh %s", quoted_script, quoted_path);
+    }
+    free(quoted_script);
+    free(quoted_path);
+    if (!command) return -ENOMEM;
+
+    size_t output_len;
+    int status = ssh_exec_remote(command, output, &output_len);
+    free(command);
+    if (status == -ENOSYS) __atomic_store_n(&delta_exec_unavailable, 1, __ATOMIC_RELAXED);
+    return status;
+}
+
+static int parse_digest(const char *hex, unsigned char *digest) {
+    for (int i = 0; i < DELTA_DIGEST_LEN; i++) {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hi < 0 ? -1 : hex_value(hex[2 * i + 1]);
+        if (lo < 0) return -1;
+        digest[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return 0;
+}
+
+// Checksum the first nblocks blocks of a remote file on the server. GNU split
+// hashes every block in one pass; elsewhere a dd loop does the same. Fills
+// *digests (nblocks * DELTA_DIGEST_LEN bytes, caller frees).
+static int delta_remote_digests(const char *remote_path, size_t block, size_t nblocks,
+                                unsigned char **digests) {
+    char script[512];
+    int n = snprintf(script, sizeof(script),
+        "f=$1; b=%zu; n=%zu; "
+        "if split --help 2>/dev/null | grep -q -- --filter; then "
+        "split -a 6 -b \"$b\" --filter=md5sum -- \"$f\"; "
+        "else i=0; while [ \"$i\" -lt \"$n\" ]; do "
+        "dd if=\"$f\" bs=\"$b\" skip=\"$i\" count=1 2>/dev/null | md5sum || exit 1; i=$((i+1)); "
+        "done; fi",
+        block, nblocks);
+    if (n < 0 || (size_t)n >= sizeof(script)) return -EINVAL;
+
+    char *output;
+    int status = delta_exec_sh(script, remote_path, &output);
+    if (status != 0) {
+        LOG_DEBUG("Remote checksum of '%s' failed (status %d)", remote_path, status);
+        if (status > 0) free(output);
+        return status == -ENOSYS ? -ENOSYS : -EIO;
+    }
+
+    // One "<32 hex digits>  -" line per block
+    unsigned char *result = malloc(nblocks * DELTA_DIGEST_LEN + 1);
+    size_t count = 0;
+    char *line = output;
+    while (result && *line) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0'; else next = line + strlen(line);
+        if (count == nblocks) { count++; break; }
+        if (parse_digest(line, result + count * DELTA_DIGEST_LEN) != 0) break;
+        count++;
+        line = next;
+    }
+    free(output);
+
+    if (!result) return -ENOMEM;
+    if (count != nblocks) {
+        LOG_DEBUG("Remote checksum of '%s' gave %zu blocks, expected %zu", remote_path, count, nblocks);
+        free(result);
+        return -EIO;
+    }
+    *digests = result;
+    return 0;
+}
+
+// Name of the patched copy of path (caller frees)
+static char *delta_temp_path(const char *path) {
+    char *tmp = malloc(strlen(path) + sizeof(DELTA_TEMP_SUFFIX));
+    if (tmp) sprintf(tmp, "%s%s", path, DELTA_TEMP_SUFFIX);
+    return tmp;
+}
+
+// Copy the local file path to tmp (mode as given) and return tmp opened for
+// reading and writing, or a negative errno
+static int delta_local_clone(const char *path, const char *tmp, mode_t mode) {
+    int in = open(path, O_RDONLY);
+    if (in < 0) return -errno;
+    int out = open(tmp, O_RDWR | O_CREAT | O_TRUNC, mode);
+    if (out < 0) {
+        int err = -errno;
+        close(in);
+        return err;
+    }
+
+    int result = 0;
+    ssize_t n;
+    while ((n = copy_file_range(in, NULL, out, NULL, SFTP_COPY_BUFFER_SIZE, 0)) > 0) {}
+    if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+        // No in-kernel copy here: plain read/write from where it stopped
+        char *buffer = malloc(SFTP_COPY_BUFFER_SIZE);
+        n = buffer ? 0 : -1;
+        errno = ENOMEM;
+        while (buffer && (n = read(in, buffer, SFTP_COPY_BUFFER_SIZE)) > 0) {
+            for (ssize_t done = 0; done < n; ) {
+                ssize_t w = write(out, buffer + done, (size_t)(n - done));
+                if (w < 0 && errno != EINTR) {
+                    n = -1;
+                    break;
+                }
+                if (w > 0) done += w;
+            }
+            if (n < 0) break;
+        }
+        free(buffer);
+    }
+    if (n < 0) result = -errno;
+    close(in);
+    if (result != 0) {
+        close(out);
+        unlink(tmp);
+        return result;
+    }
+    return out;
+}
+
+static void delta_report(const char *src, size_t changed, size_t nblocks,
+                         libssh2_uint64_t transferred, libssh2_uint64_t size) {
+    printf("Delta %s: %zu of %zu block(s) changed, transferred %llu of %llu bytes\n", src, changed, nblocks,
+           (unsigned long long)transferred, (unsigned long long)size);
+}
+
+int delta_copy_local_to_remote(const char *local_path, const char *remote_path, int verbose) {
+    struct stat st;
+    if (stat(local_path, &st) != 0) {
+        LOG_ERR("Failed to stat local file '%s': %s", local_path, strerror(errno));
+        return -errno;
+    }
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (sftp_stat_remote(remote_path, &attrs) != 0 || !(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ||
+        !(attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) || !LIBSSH2_SFTP_S_ISREG(attrs.permissions) ||
+        attrs.filesize == 0 || st.st_size == 0) {
+        if (verbose) printf("Copying %s in full (nothing to diff against)\n", local_path);
+        return sftp_copy_local_to_remote(local_path, remote_path);
+    }
+
+    libssh2_uint64_t size = (libssh2_uint64_t)st.st_size;
+    size_t block = delta_block_size(size > attrs.filesize ? size : attrs.filesize);
+    size_t remote_blocks = (size_t)((attrs.filesize + block - 1) / block);
+    unsigned char *digests = NULL;
+    int result = delta_remote_digests(remote_path, block, remote_blocks, &digests);
+    if (result != 0) {
+        if (verbose) {
+            printf("Copying %s in full (%s)\n", local_path,
+                   result == -ENOSYS ? "server does not allow remote commands" : "remote checksums unavailable");
+        }
+        return sftp_copy_local_to_remote(local_path, remote_path);
+    }
+
+    // Patch a copy made on the server, so an interrupted run never leaves the
+    // destination half old and half new
+    char *temp_path = delta_temp_path(remote_path);
+    result = temp_path ? ssh_copy_remote(remote_path, temp_path, 0) : -ENOMEM;
+    if (result != 0) {
+        if (verbose) printf("Copying %s in full (cannot copy the destination on the server)\n", local_path);
+        if (temp_path) sftp_unlink_remote(temp_path);
+        free(temp_path);
+        free(digests);
+        return sftp_copy_local_to_remote(local_path, remote_path);
+    }
+
+    int fd = open(local_path, O_RDONLY);
+    if (fd < 0) {
+        result = -errno;
+        LOG_ERR("Failed to open local file '%s': %s", local_path, strerror(errno));
+        sftp_unlink_remote(temp_path);
+        free(temp_path);
+        free(digests);
+        return result;
+    }
+    LIBSSH2_SFTP_HANDLE *handle = sftp_open_remote(temp_path, LIBSSH2_FXF_WRITE, 0);
+    if (!handle) {
+        LOG_ERR("Failed to open remote file '%s' for writing", temp_path);
+        result = sftp_last_errno();
+        sftp_unlink_remote(temp_path);
+        free(temp_path);
+        close(fd);
+        free(digests);
+        return result;
+    }
+
+    // Changed blocks next to each other go out as one pipelined write
+    size_t cap = block > SFTP_COPY_BUFFER_SIZE ? block : SFTP_COPY_BUFFER_SIZE;
+    char *buffer = malloc(cap);
+    size_t nblocks = (size_t)((size + block - 1) / block);
+    size_t changed = 0;
+    libssh2_uint64_t run_offset = 0, sent = 0;
+    size_t run_len = 0;
+    unsigned char digest[DELTA_DIGEST_LEN];
+    if (!buffer) result = -ENOMEM;
+
+    for (size_t i = 0; result == 0 && i <= nblocks; i++) {
+        libssh2_uint64_t offset = (libssh2_uint64_t)i * block;
+        size_t len = 0;
+        int differs = 0;
+        if (i < nblocks) {
+            len = size - offset < block ? (size_t)(size - offset) : block;
+            ssize_t got = pread(fd, buffer + run_len, len, (off_t)offset);
+            if (got != (ssize_t)len) {
+                result = got < 0 ? -errno : -EIO;
+                LOG_ERR("Error reading local file '%s' at offset %llu", local_path, (unsigned long long)offset);
+                break;
+            }
+            if (i < remote_blocks) delta_digest(buffer + run_len, len, digest);
+            differs = i >= remote_blocks || memcmp(digest, digests + i * DELTA_DIGEST_LEN, DELTA_DIGEST_LEN) != 0;
+        }
+
+        if (differs) {
+            if (run_len == 0) run_offset = offset;
+            run_len += len;
+            changed++;
+            if (run_len + block <= cap) continue;
+        }
+        if (run_len > 0) {
+            ssize_t written = sftp_pwrite_remote(handle, buffer, run_len, run_offset);
+            if (written < 0) {
+                LOG_ERR("Failed to write to remote file '%s'", temp_path);
+                result = (int)written;
+                break;
+            }
+            sent += run_len;
+            run_len = 0;
+        }
+    }
+
+    free(buffer);
+    free(digests);
+    close(fd);
+    if (sftp_close_remote(handle) != 0 && result == 0) result = -EIO;
+
+    if (result == 0) {
+        // New size and the destination's permissions, then swap it in
+        LIBSSH2_SFTP_ATTRIBUTES final_attrs = {
+            .flags = LIBSSH2_SFTP_ATTR_SIZE | LIBSSH2_SFTP_ATTR_PERMISSIONS,
+            .filesize = size,
+            .permissions = attrs.permissions & 07777
+        };
+        result = sftp_setstat_remote(temp_path, &final_attrs);
+    }
+    if (result == 0) result = sftp_rename_remote(temp_path, remote_path);
+    if (result != 0) sftp_unlink_remote(temp_path);
+    free(temp_path);
+    if (result == 0 && verbose) delta_report(local_path, changed, nblocks, sent, size);
+    return result;
+}
+
+int delta_copy_remote_to_local(const char *remote_path, const char *local_path, int verbose) {
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (sftp_stat_remote(remote_path, &attrs) != 0 || !(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE)) {
+        return sftp_copy_remote_to_local(remote_path, local_path);
+    }
+    struct stat st;
+    if (stat(local_path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || attrs.filesize == 0) {
+        if (verbose) printf("Copying %s in full (nothing to diff against)\n", remote_path);
+        return sftp_copy_remote_to_local(remote_path, local_path);
+    }
+
+    libssh2_uint64_t size = attrs.filesize;
+    libssh2_uint64_t local_size = (libssh2_uint64_t)st.st_size;
+    size_t block = delta_block_size(size > local_size ? size : local_size);
+    size_t nblocks = (size_t)((size + block - 1) / block);
+    unsigned char *digests = NULL;
+    int result = delta_remote_digests(remote_path, block, nblocks, &digests);
+    if (result != 0) {
+        if (verbose) {
+            printf("Copying %s in full (%s)\n", remote_path,
+                   result == -ENOSYS ? "server does not allow remote commands" : "remote checksums unavailable");
+        }
+        return sftp_copy_remote_to_local(remote_path, local_path);
+    }
+
+    // Patch a copy, so an interrupted run never leaves the destination half
+    // old and half new
+    char *temp_path = delta_temp_path(local_path);
+    int fd = temp_path ? delta_local_clone(local_path, temp_path, st.st_mode & 07777) : -ENOMEM;
+    if (fd < 0) {
+        result = fd;
+        LOG_ERR("Failed to copy local file '%s': %s", local_path, strerror(-result));
+        free(temp_path);
+        free(digests);
+        return result;
+    }
+    LIBSSH2_SFTP_HANDLE *handle = sftp_open_remote(remote_path, LIBSSH2_FXF_READ, 0);
+    if (!handle) {
+        LOG_ERR("Failed to open remote file '%s' for reading", remote_path);
+        result = sftp_last_errno();
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        free(digests);
+        return result;
+    }
+
+    // Find runs of changed blocks, then fetch each run with one pipelined read
+    size_t cap = block > SFTP_COPY_BUFFER_SIZE ? block : SFTP_COPY_BUFFER_SIZE;
+    char *buffer = malloc(cap);
+    size_t changed = 0;
+    libssh2_uint64_t run_offset = 0, received = 0;
+    libssh2_uint64_t pos = SFTP_POS_UNKNOWN;
+    size_t window = (size_t)SFTP_READ_WINDOW_DEFAULT_KB * 1024;
+    size_t run_len = 0;
+    unsigned char digest[DELTA_DIGEST_LEN];
+    if (!buffer) result = -ENOMEM;
+
+    for (size_t i = 0; result == 0 && i <= nblocks; i++) {
+        libssh2_uint64_t offset = (libssh2_uint64_t)i * block;
+        size_t len = 0;
+        int differs = 0;
+        if (i < nblocks) {
+            len = size - offset < block ? (size_t)(size - offset) : block;
+            // Checked in the free tail of the buffer so a pending run stays intact
+            char *scratch = run_len + block <= cap ? buffer + run_len : NULL;
+            ssize_t got = scratch ? pread(fd, scratch, len, (off_t)offset) : -1;
+            if (scratch && got == (ssize_t)len) {
+                delta_digest(scratch, len, digest);
+                differs = memcmp(digest, digests + i * DELTA_DIGEST_LEN, DELTA_DIGEST_LEN) != 0;
+            } else {
+                differs = scratch != NULL; // Local file shorter: fetch it
+            }
+            if (!scratch) i--; // Buffer full: flush the run, then look at this block again
+        }
+
+        if (differs) {
+            if (run_len == 0) run_offset = offset;
+            run_len += len;
+            changed++;
+            continue;
+        }
+        if (run_len > 0) {
+            for (size_t done = 0; done < run_len && result == 0; ) {
+                ssize_t got = sftp_pread_remote(handle, &pos, buffer + done, run_len - done,
+                                                run_offset + done, window);
+                if (got <= 0) {
+                    LOG_ERR("Error reading from remote file '%s'", remote_path);
+                    result = got < 0 ? (int)got : -EIO;
+                    break;
+                }
+                done += (size_t)got;
+            }
+            for (size_t done = 0; result == 0 && done < run_len; ) {
+                ssize_t n = pwrite(fd, buffer + done, run_len - done, (off_t)(run_offset + done));
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    result = -errno;
+                    LOG_ERR("Error writing local file '%s': %s", temp_path, strerror(errno));
+                    break;
+                }
+                done += (size_t)n;
+            }
+            received += run_len;
+            run_len = 0;
+        }
+    }
+
+    free(buffer);
+    free(digests);
+    sftp_close_remote(handle);
+    if (result == 0 && local_size != size && ftruncate(fd, (off_t)size) != 0) {
+        result = -errno;
+        LOG_ERR("Failed to resize local file '%s': %s", temp_path, strerror(errno));
+    }
+    if (close(fd) != 0 && result == 0) result = -errno;
+    if (result == 0 && rename(temp_path, local_path) != 0) {
+        result = -errno;
+        LOG_ERR("Failed to replace local file '%s': %s", local_path, strerror(errno));
+    }
+    if (result != 0) unlink(temp_path);
+    free(temp_path);
+    if (result == 0 && verbose) delta_report(remote_path, changed, nblocks, received, size);
+    return result;
+}
+
+int delta_same_content(const char *local_path, const char *remote_path) {
+    // Hashing stdin keeps the output "<hash>  -": md5sum escapes a file name
+    // holding a backslash or newline and marks the line with a leading '\'
+    char *output;
+    int status = delta_exec_sh("exec md5sum < \"$1\"", remote_path, &output);
+    if (status < 0) return status;
+    unsigned char remote_digest[DELTA_DIGEST_LEN];
+    int parsed = status == 0 ? parse_digest(output, remote_digest) : -1;
+    free(output);
+    if (parsed != 0) return -EIO;
+
+    int fd = open(local_path, O_RDONLY);
+    if (fd < 0) return -errno;
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    char *buffer = malloc(SFTP_COPY_BUFFER_SIZE);
+    int result = ctx && buffer && EVP_DigestInit_ex(ctx, EVP_md5(), NULL) ? 0 : -ENOMEM;
+    ssize_t got;
+    while (result == 0 && (got = read(fd, buffer, SFTP_COPY_BUFFER_SIZE)) != 0) {
+        if (got < 0) {
+            if (errno != EINTR) result = -errno;
+            continue;
+        }
+        EVP_DigestUpdate(ctx, buffer, (size_t)got);
+    }
+    unsigned char local_digest[DELTA_DIGEST_LEN];
+    unsigned int digest_len = DELTA_DIGEST_LEN;
+    if (result == 0) EVP_DigestFinal_ex(ctx, local_digest, &digest_len);
+    EVP_MD_CTX_free(ctx);
+    free(buffer);
+    close(fd);
+    if (result != 0) return result;
+    return memcmp(local_digest, remote_digest, DELTA_DIGEST_LEN) == 0;
+}
@@ -0,0 +1,31 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "common.h"
+#include "ssh_sftp_client.h"
+
+// Delta copy for remote-cp --delta: when the destination already holds an
+// older version of the file, both sides are cut into fixed blocks, the server
+// checksums its copy (md5sum run over an exec channel on the same SSH
+// session) and only blocks whose checksum differs are sent, with positioned
+// writes into a copy of the existing file (made on the server with cp, or
+// locally), which is cut to the new size and renamed over the destination.
+// An interrupted run leaves the destination as it was, plus a stale copy
+// named <destination>DELTA_TEMP_SUFFIX.
+//
+// Offsets are kept as they are, which suits files updated in place (disk
+// images, databases, logs). Without exec access on the server, or without an
+// existing destination, the file is copied in full.
+
+#define DELTA_BLOCK_MIN     (64 * 1024)
+#define DELTA_MAX_BLOCKS    65536       // Larger files use larger blocks
+#define DELTA_DIGEST_LEN    16          // MD5
+#define DELTA_TEMP_SUFFIX   ".remote-cp-delta"
+
+int delta_copy_local_to_remote(const char *local_path, const char *remote_path, int verbose);
+int delta_copy_remote_to_local(const char *remote_path, const char *local_path, int verbose);
+// Whole-file MD5 comparison (remote-cp --update --checksum): 1 when equal,
+// 0 when not, negative errno when the server cannot checksum the file
+int delta_same_content(const char *local_path, const char *remote_path);
+
+#endif // DELTA_H
@@ -0,0 +1,597 @@
+#include "disk_cache.h"
+#include "block_cache.h"
+#include "common.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DC_MAGIC       "remotefs-disk-cache 1"
+#define DC_BUCKETS     1024
+#define DC_SAVE_EVERY  64       // Persist an entry's index after this many new blocks
+#define DC_LOCK_FILE   "lock"   // flock()ed by the mount that owns the directory
+
+typedef struct dc_entry {
+    uint64_t key;               // Hash of host, port and remote path; names the files
+    char *host;
+    int port;
+    char *path;
+    libssh2_uint64_t size;      // Remote attributes the blocks belong to
+    unsigned long mtime;
+    time_t atime;               // Last use, for eviction across mounts
+    size_t nblocks;
+    unsigned char *bitmap;      // One bit per block present in the data file
+    size_t bytes;               // Bytes of blocks present
+    unsigned long epoch;        // Bumped whenever the contents are reset
+    int refs;                   // Readers currently reading the data file
+    int dirty;                  // Blocks added since the index was last written
+    int saving;                 // An index write is running outside the lock
+    struct dc_entry *next;
+} dc_entry_t;
+
+static struct {
+    int enabled;
+    char *dir;
+    char *host;
+    int port;
+    int lock_fd;                // Holds the directory's flock while enabled
+    unsigned long tmp_seq;      // Makes index temp file names unique
+    size_t cap;
+    size_t used;
+    dc_entry_t *buckets[DC_BUCKETS];
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    pthread_mutex_t lock;
+} dc = { .lock_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t make_key(const char *host, int port, const char *path) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "\n%d\n", port);
+    const char *parts[3] = { host, port_str, path };
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (int i = 0; i < 3; i++) {
+        for (const unsigned char *p = (const unsigned char *)parts[i]; *p; p++) {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+static void entry_file(const dc_entry_t *e, const char *ext, char *buf, size_t len) {
+    snprintf(buf, len, "%s/%016llx.%s", dc.dir, (unsigned long long)e->key, ext);
+}
+
+static size_t nblocks_for(libssh2_uint64_t size) {
+    return (size_t)((size + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE);
+}
+
+static size_t block_len(libssh2_uint64_t size, libssh2_uint64_t index) {
+    libssh2_uint64_t rest = size - index * BLOCK_CACHE_BLOCK_SIZE;
+    return rest < BLOCK_CACHE_BLOCK_SIZE ? (size_t)rest : BLOCK_CACHE_BLOCK_SIZE;
+}
+
+static int has_block(const dc_entry_t *e, libssh2_uint64_t index) {
+    return index < e->nblocks && (e->bitmap[index / 8] & (1u << (index % 8)));
+}
+
+// Index text of an entry (caller holds dc.lock)
+static char *format_meta(const dc_entry_t *e) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&text, &len);
+    if (!fp) return NULL;
+    fprintf(fp, "%s\nhost %s\nport %d\nsize %llu\nmtime %lu\natime %lld\npath %s\nbitmap ",
+            DC_MAGIC, e->host, e->port, (unsigned long long)e->size, e->mtime,
+            (long long)e->atime, e->path);
+    for (size_t i = 0; i < (e->nblocks + 7) / 8; i++) {
+        fprintf(fp, "%02x", e->bitmap[i]);
+    }
+    fprintf(fp, "\n");
+    if (fclose(fp) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+// Flush the blocks written so far to disk, so the index never claims blocks
+// a crash could still lose
+static void sync_data(const char *data) {
+    int fd = open(data, O_WRONLY);
+    if (fd < 0) return;
+    if (fdatasync(fd) != 0) {
+        LOG_WARN("disk cache: fdatasync %s: %s", data, strerror(errno));
+    }
+    close(fd);
+}
+
+// Write an index to a new temp file (named into tmp, PATH_MAX + 32 bytes)
+static int write_meta_tmp(const dc_entry_t *e, const char *text, char *tmp) {
+    char file[PATH_MAX];
+    entry_file(e, "meta", file, sizeof(file));
+    snprintf(tmp, PATH_MAX + 32, "%s.%lu.tmp", file, __atomic_add_fetch(&dc.tmp_seq, 1, __ATOMIC_RELAXED));
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        LOG_WARN("disk cache: cannot write %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+    fchmod(fileno(fp), 0600); // Same protection as the cached data
+    fputs(text, fp);
+    if (fclose(fp) != 0) {
+        LOG_WARN("disk cache: failed to write %s", tmp);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static int publish_meta(const dc_entry_t *e, const char *tmp) {
+    char file[PATH_MAX];
+    entry_file(e, "meta", file, sizeof(file));
+    if (rename(tmp, file) != 0) {
+        LOG_WARN("disk cache: failed to save index %s", file);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Write the index atomically (tmp file + rename), after the data it describes
+// is on disk. Runs entirely under dc.lock: used when the bitmap is empty
+// (reset) or at shutdown.
+static int save_meta(dc_entry_t *e) {
+    char tmp[PATH_MAX + 32];
+    char *text = format_meta(e);
+    if (!text) return -1;
+    if (e->bytes > 0) {
+        char data[PATH_MAX];
+        entry_file(e, "data", data, sizeof(data));
+        sync_data(data);
+    }
+    int rc = write_meta_tmp(e, text, tmp);
+    free(text);
+    if (rc == 0) rc = publish_meta(e, tmp);
+    if (rc == 0) e->dirty = 0;
+    return rc;
+}
+
+// Same as save_meta() for the periodic saves of disk_cache_put(): the sync and
+// the write run with dc.lock released, only the rename is done under it, and
+// only if the entry was not reset meanwhile (its index is then newer).
+// Called and returns with dc.lock held.
+static void save_meta_unlocked(dc_entry_t *e) {
+    if (e->saving) return;  // dirty stays set, a later put saves again
+    char *text = format_meta(e);
+    if (!text) return;
+    unsigned long epoch = e->epoch;
+    int dirty = e->dirty;
+    char data[PATH_MAX], tmp[PATH_MAX + 32];
+    entry_file(e, "data", data, sizeof(data));
+    e->saving = 1;
+    e->refs++;
+    pthread_mutex_unlock(&dc.lock);
+
+    sync_data(data);
+    int rc = write_meta_tmp(e, text, tmp);
+    free(text);
+
+    pthread_mutex_lock(&dc.lock);
+    e->refs--;
+    e->saving = 0;
+    if (rc == 0) {
+        if (e->epoch != epoch) {
+            unlink(tmp);
+        } else if (publish_meta(e, tmp) == 0) {
+            e->dirty -= dirty;
+        }
+    }
+}
+
+static void free_entry(dc_entry_t *e) {
+    free(e->host);
+    free(e->path);
+    free(e->bitmap);
+    free(e);
+}
+
+static void link_entry(dc_entry_t *e) {
+    size_t slot = e->key % DC_BUCKETS;
+    e->next = dc.buckets[slot];
+    dc.buckets[slot] = e;
+    dc.used += e->bytes;
+}
+
+// Unlink an entry from the index, delete its files and free it
+static void remove_entry(dc_entry_t *e) {
+    dc_entry_t **pp = &dc.buckets[e->key % DC_BUCKETS];
+    while (*pp && *pp != e) pp = &(*pp)->next;
+    if (*pp) *pp = e->next;
+
+    char file[PATH_MAX];
+    entry_file(e, "data", file, sizeof(file));
+    unlink(file);
+    entry_file(e, "meta", file, sizeof(file));
+    unlink(file);
+
+    dc.used -= e->bytes;
+    free_entry(e);
+}
+
+// Drop all blocks and adopt new remote attributes. The index is rewritten
+// before the data file is truncated so stale blocks are never marked present.
+static int reset_entry(dc_entry_t *e, libssh2_uint64_t size, unsigned long mtime) {
+    size_t nblocks = nblocks_for(size);
+    unsigned char *bitmap = calloc((nblocks + 7) / 8 + 1, 1);
+    if (!bitmap) return -1;
+
+    free(e->bitmap);
+    e->bitmap = bitmap;
+    e->nblocks = nblocks;
+    e->size = size;
+    e->mtime = mtime;
+    dc.used -= e->bytes;
+    e->bytes = 0;
+    e->epoch++;
+    save_meta(e);
+
+    char file[PATH_MAX];
+    entry_file(e, "data", file, sizeof(file));
+    if (truncate(file, 0) != 0 && errno != ENOENT) {
+        LOG_WARN("disk cache: cannot truncate %s: %s", file, strerror(errno));
+    }
+    return 0;
+}
+
+static dc_entry_t *find_entry(const char *path) {
+    uint64_t key = make_key(dc.host, dc.port, path);
+    for (dc_entry_t *e = dc.buckets[key % DC_BUCKETS]; e; e = e->next) {
+        if (e->key == key && e->port == dc.port &&
+            strcmp(e->host, dc.host) == 0 && strcmp(e->path, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static dc_entry_t *create_entry(const char *path, libssh2_uint64_t size, unsigned long mtime) {
+    dc_entry_t *e = calloc(1, sizeof(dc_entry_t));
+    if (!e) return NULL;
+    e->key = make_key(dc.host, dc.port, path);
+    e->host = strdup(dc.host);
+    e->path = strdup(path);
+    e->port = dc.port;
+    e->atime = time(NULL);
+    if (!e->host || !e->path || reset_entry(e, size, mtime) != 0) {
+        free_entry(e);
+        return NULL;
+    }
+    link_entry(e);
+    return e;
+}
+
+// Evict least recently used files until the cache fits in cap bytes
+static void evict(size_t cap, const dc_entry_t *keep) {
+    while (dc.used > cap) {
+        dc_entry_t *victim = NULL;
+        for (size_t i = 0; i < DC_BUCKETS; i++) {
+            for (dc_entry_t *e = dc.buckets[i]; e; e = e->next) {
+                if (e == keep || e->refs > 0) continue;
+                if (!victim || e->atime < victim->atime) victim = e;
+            }
+        }
+        if (!victim) break;
+        LOG_DEBUG("disk cache: evicting %s:%s (%zu KiB)", victim->host, victim->path, victim->bytes / 1024);
+        remove_entry(victim);
+        dc.evictions++;
+    }
+}
+
+static dc_entry_t *load_meta(const char *file) {
+    FILE *fp = fopen(file, "r");
+    if (!fp) return NULL;
+
+    dc_entry_t *e = calloc(1, sizeof(dc_entry_t));
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int ok = e && (n = getline(&line, &cap, fp)) > 0 && strncmp(line, DC_MAGIC, strlen(DC_MAGIC)) == 0;
+    char *bitmap_hex = NULL;
+
+    while (ok && (n = getline(&line, &cap, fp)) > 0) {
+        if (line[n - 1] == '\n') line[--n] = '\0';
+        char *value = strchr(line, ' ');
+        if (!value) continue;
+        *value++ = '\0';
+        if (strcmp(line, "host") == 0) e->host = strdup(value);
+        else if (strcmp(line, "port") == 0) e->port = atoi(value);
+        else if (strcmp(line, "size") == 0) e->size = strtoull(value, NULL, 10);
+        else if (strcmp(line, "mtime") == 0) e->mtime = strtoul(value, NULL, 10);
+        else if (strcmp(line, "atime") == 0) e->atime = (time_t)strtoll(value, NULL, 10);
+        else if (strcmp(line, "path") == 0) e->path = strdup(value);
+        else if (strcmp(line, "bitmap") == 0) bitmap_hex = strdup(value);
+    }
+    fclose(fp);
+    free(line);
+
+    if (ok && e->host && e->path && bitmap_hex) {
+        e->nblocks = nblocks_for(e->size);
+        size_t nbytes = (e->nblocks + 7) / 8;
+        e->bitmap = calloc(nbytes + 1, 1);
+        ok = e->bitmap && strlen(bitmap_hex) == nbytes * 2;
+        for (size_t i = 0; ok && i < nbytes; i++) {
+            unsigned int byte;
+            ok = sscanf(bitmap_hex + i * 2, "%2x", &byte) == 1;
+            e->bitmap[i] = (unsigned char)byte;
+        }
+        for (size_t i = 0; ok && i < e->nblocks; i++) {
+            if (has_block(e, i)) e->bytes += block_len(e->size, i);
+        }
+        e->key = make_key(e->host, e->port, e->path);
+    } else {
+        ok = 0;
+    }
+    free(bitmap_hex);
+
+    if (!ok) {
+        if (e) free_entry(e);
+        return NULL;
+    }
+    return e;
+}
+
+int disk_cache_init(const char *dir, size_t cap_bytes, const char *host, int port) {
+    if (!dir || !*dir || !host || cap_bytes < BLOCK_CACHE_BLOCK_SIZE) {
+        dc.enabled = 0;
+        return 0;
+    }
+
+    struct stat st;
+    if (stat(dir, &st) == -1) {
+        if (mkdir(dir, 0700) == -1) {
+            LOG_ERR("disk cache: cannot create %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    } else if (!S_ISDIR(st.st_mode)) {
+        LOG_ERR("disk cache: %s is not a directory", dir);
+        return -1;
+    }
+
+    // The in-memory index is only right while no other mount changes the
+    // files, so the directory belongs to one mount at a time
+    char lock_file[PATH_MAX];
+    snprintf(lock_file, sizeof(lock_file), "%s/%s", dir, DC_LOCK_FILE);
+    int lock_fd = open(lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0) {
+        LOG_ERR("disk cache: cannot open %s: %s", lock_file, strerror(errno));
+        return -1;
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        LOG_WARN("disk cache: %s is in use by another mount, continuing without it", dir);
+        close(lock_fd);
+        dc.enabled = 0;
+        return 0;
+    }
+
+    dc.dir = strdup(dir);
+    dc.host = strdup(host);
+    if (!dc.dir || !dc.host) {
+        free(dc.dir);
+        free(dc.host);
+        dc.dir = dc.host = NULL;
+        close(lock_fd);
+        return -1;
+    }
+    dc.lock_fd = lock_fd;
+    dc.port = port;
+    dc.cap = cap_bytes;
+    dc.used = 0;
+    dc.hits = dc.misses = dc.evictions = 0;
+
+    // Load the index left by earlier mounts (of any host sharing this directory)
+    DIR *d = opendir(dir);
+    int loaded = 0;
+    if (d) {
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            size_t len = strlen(de->d_name);
+            char file[PATH_MAX];
+            snprintf(file, sizeof(file), "%s/%s", dir, de->d_name);
+            if (len > 4 && strcmp(de->d_name + len - 4, ".tmp") == 0) {
+                unlink(file);   // Index write interrupted by a crash
+                continue;
+            }
+            if (len < 6 || strcmp(de->d_name + len - 5, ".meta") != 0) continue;
+
+            dc_entry_t *e = load_meta(file);
+            if (!e) {
+                LOG_WARN("disk cache: ignoring unreadable index %s", file);
+                continue;
+            }
+            char data[PATH_MAX];
+            entry_file(e, "data", data, sizeof(data));
+            if (access(data, R_OK) != 0 && e->bytes > 0) {
+                free_entry(e);
+                unlink(file);
+                continue;
+            }
+            link_entry(e);
+            loaded++;
+        }
+        closedir(d);
+    }
+
+    pthread_mutex_lock(&dc.lock);
+    evict(dc.cap, NULL);
+    dc.enabled = 1;
+    pthread_mutex_unlock(&dc.lock);
+
+    LOG_INFO("Disk cache enabled in %s: %zu MiB cap, %d file(s) / %zu MiB reused",
+             dir, cap_bytes / (1024 * 1024), loaded, dc.used / (1024 * 1024));
+    return 0;
+}
+
+int disk_cache_enabled(void) {
+    return dc.enabled;
+}
+
+ssize_t disk_cache_get(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                       libssh2_uint64_t index, char *out) {
+    if (!dc.enabled) return -1;
+
+    pthread_mutex_lock(&dc.lock);
+    dc_entry_t *e = find_entry(path);
+    if (e && (e->size != file_size || e->mtime != mtime) && e->refs == 0) {
+        LOG_DEBUG("disk cache: %s changed remotely, dropping cached blocks", path);
+        reset_entry(e, file_size, mtime);
+    }
+    if (!e || e->size != file_size || e->mtime != mtime || !has_block(e, index)) {
+        dc.misses++;
+        pthread_mutex_unlock(&dc.lock);
+        return -1;
+    }
+    size_t len = block_len(file_size, index);
+    unsigned long epoch = e->epoch;
+    char file[PATH_MAX];
+    entry_file(e, "data", file, sizeof(file));
+    e->refs++;
+    e->atime = time(NULL);
+    pthread_mutex_unlock(&dc.lock);
+
+    ssize_t n = -1;
+    int fd = open(file, O_RDONLY);
+    if (fd >= 0) {
+        n = pread(fd, out, len, (off_t)(index * BLOCK_CACHE_BLOCK_SIZE));
+        close(fd);
+    }
+
+    pthread_mutex_lock(&dc.lock);
+    e->refs--;
+    int valid = n == (ssize_t)len && e->epoch == epoch;
+    if (valid) {
+        dc.hits++;
+    } else {
+        dc.misses++;
+        if (e->epoch == epoch && has_block(e, index)) {
+            // The data file lost the block (removed or truncated behind our back)
+            LOG_WARN("disk cache: block %llu of %s unreadable, dropping it", (unsigned long long)index, path);
+            e->bitmap[index / 8] &= (unsigned char)~(1u << (index % 8));
+            e->bytes -= len;
+            dc.used -= len;
+            e->dirty++;
+        }
+    }
+    pthread_mutex_unlock(&dc.lock);
+    return valid ? (ssize_t)len : -1;
+}
+
+void disk_cache_put(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                    libssh2_uint64_t index, const char *data, size_t len) {
+    if (!dc.enabled || strchr(path, '\n')) return;
+    if (index >= nblocks_for(file_size) || len != block_len(file_size, index)) return;
+
+    pthread_mutex_lock(&dc.lock);
+    dc_entry_t *e = find_entry(path);
+    if (e && (e->size != file_size || e->mtime != mtime)) {
+        if (e->refs > 0 || reset_entry(e, file_size, mtime) != 0) {
+            pthread_mutex_unlock(&dc.lock);
+            return;
+        }
+    }
+    if (!e) e = create_entry(path, file_size, mtime);
+    if (!e || has_block(e, index)) {
+        pthread_mutex_unlock(&dc.lock);
+        return;
+    }
+
+    // Make room first so the cap holds even while the block is written. The
+    // reference keeps the entry from being evicted or removed meanwhile.
+    dc.used += len;
+    e->bytes += len;
+    evict(dc.cap, e);
+    unsigned long epoch = e->epoch;
+    char file[PATH_MAX];
+    entry_file(e, "data", file, sizeof(file));
+    e->refs++;
+    pthread_mutex_unlock(&dc.lock);
+
+    int fd = open(file, O_WRONLY | O_CREAT, 0600);
+    ssize_t n = -1;
+    if (fd >= 0) {
+        n = pwrite(fd, data, len, (off_t)(index * BLOCK_CACHE_BLOCK_SIZE));
+        close(fd);
+    }
+    int err = errno;
+
+    pthread_mutex_lock(&dc.lock);
+    e->refs--;
+    if (e->epoch != epoch) {
+        // Reset while writing: the reservation went with the old contents
+    } else if (n == (ssize_t)len && !has_block(e, index)) {
+        e->bitmap[index / 8] |= (unsigned char)(1u << (index % 8));
+        e->atime = time(NULL);
+        if (++e->dirty >= DC_SAVE_EVERY || e->bytes == e->size) save_meta_unlocked(e);
+    } else {
+        if (n != (ssize_t)len) {
+            LOG_WARN("disk cache: failed to write block %llu of %s: %s",
+                     (unsigned long long)index, path, strerror(err));
+        }
+        dc.used -= len;
+        e->bytes -= len;
+    }
+    pthread_mutex_unlock(&dc.lock);
+}
+
+void disk_cache_invalidate(const char *path) {
+    if (!dc.enabled || !path) return;
+
+    pthread_mutex_lock(&dc.lock);
+    dc_entry_t *e = find_entry(path);
+    if (e) {
+        if (e->refs > 0) reset_entry(e, 0, 0);
+        else remove_entry(e);
+    }
+    pthread_mutex_unlock(&dc.lock);
+}
+
+void disk_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions, size_t *used) {
+    pthread_mutex_lock(&dc.lock);
+    if (hits) *hits = dc.hits;
+    if (misses) *misses = dc.misses;
+    if (evictions) *evictions = dc.evictions;
+    if (used) *used = dc.used;
+    pthread_mutex_unlock(&dc.lock);
+}
+
+void disk_cache_destroy(void) {
+    pthread_mutex_lock(&dc.lock);
+    for (size_t i = 0; i < DC_BUCKETS; i++) {
+        dc_entry_t *e = dc.buckets[i];
+        while (e) {
+            dc_entry_t *next = e->next;
+            if (dc.enabled && e->dirty) save_meta(e);
+            free_entry(e);
+            e = next;
+        }
+        dc.buckets[i] = NULL;
+    }
+    free(dc.dir);
+    free(dc.host);
+    dc.dir = dc.host = NULL;
+    if (dc.lock_fd >= 0) close(dc.lock_fd);
+    dc.lock_fd = -1;
+    dc.used = 0;
+    dc.enabled = 0;
+    pthread_mutex_unlock(&dc.lock);
+}
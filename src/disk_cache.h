@@ -0,0 +1,36 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <libssh2.h>
+
+// Optional on-disk cache of remote file contents that survives remounts
+// (-o disk_cache=DIR). Each remote file is stored as a sparse data file plus
+// a small text index (<hash>.meta) recording host, port, remote path, size,
+// mtime and which blocks are present. Entries are reused by later mounts as
+// long as the remote size and mtime still match. Blocks have the same size as
+// the in-memory block cache; total size is capped with least-recently-used
+// eviction of whole files. The directory is locked (flock) by the mount using
+// it; another mount finding it locked runs without a disk cache.
+
+#define DISK_CACHE_DEFAULT_MB   10240
+#define DISK_CACHE_MAX_MB       (16 * 1024 * 1024)
+
+int disk_cache_init(const char *dir, size_t cap_bytes, const char *host, int port);
+void disk_cache_destroy(void);
+int disk_cache_enabled(void);
+
+// Read block `index` of a file into out (BLOCK_CACHE_BLOCK_SIZE bytes).
+// Returns the block length, or -1 when the block is not cached.
+ssize_t disk_cache_get(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                       libssh2_uint64_t index, char *out);
+// Store a block. Only complete blocks (or the exact tail of the file) are kept.
+void disk_cache_put(const char *path, libssh2_uint64_t file_size, unsigned long mtime,
+                    libssh2_uint64_t index, const char *data, size_t len);
+// Forget a file (after local writes, truncate, unlink, rename).
+void disk_cache_invalidate(const char *path);
+
+void disk_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions, size_t *used);
+
+#endif // DISK_CACHE_H
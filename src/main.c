@@ -4,6 +4,10 @@
 #include "remote_proc_fuse.h"
 #include "ssh_sftp_client.h"
 #include "mount_config.h"
+#include "sftp_pool.h"
+#include "block_cache.h"
+#include "disk_cache.h"
+#include "rp_lowlevel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,7 +26,21 @@ remote_conn_info_t connection_info = {
     .remote_proc_path = NULL,
     .sock = -1,
     .ssh_session = NULL,
-    .sftp_session = NULL
+    .sftp_session = NULL,
+    .pool_size = 1,
+    .pool = NULL,
+    .read_window_kb = SFTP_READ_WINDOW_DEFAULT_KB,
+    .readahead_kb = RP_READAHEAD_DEFAULT_KB,
+    .cache_size_mb = BLOCK_CACHE_DEFAULT_MB,
+    .disk_cache_dir = NULL,
+    .disk_cache_mb = DISK_CACHE_DEFAULT_MB,
+    .attr_cache_ttl = RP_ATTR_CACHE_TTL_DEFAULT,
+    .negative_cache_ttl = RP_NEG_CACHE_TTL_DEFAULT,
+    .dir_cache_ttl = RP_DIR_CACHE_TTL_DEFAULT,
+    .write_buffer_kb = RP_WRITE_BUFFER_DEFAULT_KB,
+    .event_loop = 0,
+    .loop = NULL,
+    .low_level = 0
 };
 
 static void show_usage(const char *progname) {
@@ -36,6 +54,25 @@ static void show_usage(const char *progname) {
     fprintf(stderr, "  pass=password     Password for SSH login (INSECURE!).\n");
     fprintf(stderr, "  key=keyfile       Path to the private SSH key file for authentication.\n");
     fprintf(stderr, "  remotepath=path   Path to mount on the remote system (default: /).\n");
+    fprintf(stderr, "  connections=N     Number of parallel SFTP sessions (default: 1, max: %d).\n", SFTP_POOL_MAX_SIZE);
+    fprintf(stderr, "  read_window=KiB   SFTP READ data kept in flight per open file (default: %d, max: %d).\n",
+            SFTP_READ_WINDOW_DEFAULT_KB, SFTP_READ_WINDOW_MAX_KB);
+    fprintf(stderr, "  readahead=KiB     Max adaptive read-ahead per open file, 0 disables (default: %d).\n",
+            RP_READAHEAD_DEFAULT_KB);
+    fprintf(stderr, "  cache_size=MiB    Memory for the shared file block cache, 0 disables (default: %d).\n",
+            BLOCK_CACHE_DEFAULT_MB);
+    fprintf(stderr, "  disk_cache=dir    Keep file blocks on disk in dir and reuse them across mounts.\n");
+    fprintf(stderr, "  disk_cache_size=MiB Size cap of the disk cache (default: %d).\n", DISK_CACHE_DEFAULT_MB);
+    fprintf(stderr, "  attr_cache_ttl=S  Seconds to keep file attributes in the userspace cache, 0 disables (default: %d).\n",
+            RP_ATTR_CACHE_TTL_DEFAULT);
+    fprintf(stderr, "  negative_cache_ttl=S Seconds to remember paths that do not exist, 0 disables (default: %d).\n",
+            RP_NEG_CACHE_TTL_DEFAULT);
+    fprintf(stderr, "  dir_cache_ttl=S   Seconds to keep directory listings cached, 0 disables (default: %d).\n",
+            RP_DIR_CACHE_TTL_DEFAULT);
+    fprintf(stderr, "  write_buffer=KiB  Write-back buffer per open file, 0 writes through (default: %d, max: %d).\n",
+            RP_WRITE_BUFFER_DEFAULT_KB, RP_WRITE_BUFFER_MAX_KB);
+    fprintf(stderr, "  event_loop        Run stat requests on one extra session that keeps many in flight at once.\n");
+    fprintf(stderr, "  lowlevel          Serve through the inode-based low-level FUSE API (async lookups with event_loop).\n");
     fprintf(stderr, "  readonly          Mount filesystem as read-only.\n");
     fprintf(stderr, "  allow_other       Allow other users to access the filesystem.\n");
     fprintf(stderr, "\nExample:\n");
@@ -53,6 +90,16 @@ enum {
      KEY_OPT_PORT,
      KEY_OPT_KEY,
      KEY_OPT_REMOTEPATH,
+     KEY_OPT_CONNECTIONS,
+     KEY_OPT_READ_WINDOW,
+     KEY_OPT_READAHEAD,
+     KEY_OPT_CACHE_SIZE,
+     KEY_OPT_DISK_CACHE,
+     KEY_OPT_DISK_CACHE_SIZE,
+     KEY_OPT_ATTR_CACHE_TTL,
+     KEY_OPT_NEG_CACHE_TTL,
+     KEY_OPT_DIR_CACHE_TTL,
+     KEY_OPT_WRITE_BUFFER,
 };
 
 #define RP_OPT(t, p, v) { t, offsetof(remote_conn_info_t, p), v }
@@ -64,6 +111,19 @@ static struct fuse_opt rp_opts[] = {
      { "port=%d",    offsetof(remote_conn_info_t, remote_port), KEY_OPT_PORT },
      { "key=%s",     offsetof(remote_conn_info_t, ssh_key_path), KEY_OPT_KEY },
      { "remotepath=%s", offsetof(remote_conn_info_t, remote_proc_path), KEY_OPT_REMOTEPATH },
+     { "connections=%d", offsetof(remote_conn_info_t, pool_size), KEY_OPT_CONNECTIONS },
+     { "read_window=%d", offsetof(remote_conn_info_t, read_window_kb), KEY_OPT_READ_WINDOW },
+     { "readahead=%d", offsetof(remote_conn_info_t, readahead_kb), KEY_OPT_READAHEAD },
+     { "cache_size=%d", offsetof(remote_conn_info_t, cache_size_mb), KEY_OPT_CACHE_SIZE },
+     { "disk_cache=%s", offsetof(remote_conn_info_t, disk_cache_dir), KEY_OPT_DISK_CACHE },
+     { "disk_cache_size=%d", offsetof(remote_conn_info_t, disk_cache_mb), KEY_OPT_DISK_CACHE_SIZE },
+     { "attr_cache_ttl=%d", offsetof(remote_conn_info_t, attr_cache_ttl), KEY_OPT_ATTR_CACHE_TTL },
+     { "negative_cache_ttl=%d", offsetof(remote_conn_info_t, negative_cache_ttl), KEY_OPT_NEG_CACHE_TTL },
+     { "dir_cache_ttl=%d", offsetof(remote_conn_info_t, dir_cache_ttl), KEY_OPT_DIR_CACHE_TTL },
+     { "write_buffer=%d", offsetof(remote_conn_info_t, write_buffer_kb), KEY_OPT_WRITE_BUFFER },
+     // Cờ không có giá trị: fuse_opt_parse ghi 1 vào trường, không gọi rp_opt_proc
+     RP_OPT("event_loop", event_loop, 1),
+     RP_OPT("lowlevel", low_level, 1),
 
      FUSE_OPT_KEY("-h",          KEY_HELP),
      FUSE_OPT_KEY("--help",      KEY_HELP),
@@ -95,6 +155,7 @@ static int rp_opt_proc(void *data, const char *arg, int key, struct fuse_args *o
         case KEY_OPT_PASS:
         case KEY_OPT_KEY:
         case KEY_OPT_REMOTEPATH:
+        case KEY_OPT_DISK_CACHE:
              {
                  size_t offset = 0;
                  // Tìm offset của trường tương ứng trong cấu trúc rp_opts
@@ -137,6 +198,42 @@ static int rp_opt_proc(void *data, const char *arg, int key, struct fuse_args *o
             // Trả về 0 để báo rằng tùy chọn đã được xử lý
             return 0;
 
+        case KEY_OPT_CONNECTIONS:
+            LOG_DEBUG("Parsed option: connections = %d", conn->pool_size);
+            return 0;
+
+        case KEY_OPT_READ_WINDOW:
+            LOG_DEBUG("Parsed option: read_window = %d KiB", conn->read_window_kb);
+            return 0;
+
+        case KEY_OPT_READAHEAD:
+            LOG_DEBUG("Parsed option: readahead = %d KiB", conn->readahead_kb);
+            return 0;
+
+        case KEY_OPT_CACHE_SIZE:
+            LOG_DEBUG("Parsed option: cache_size = %d MiB", conn->cache_size_mb);
+            return 0;
+
+        case KEY_OPT_DISK_CACHE_SIZE:
+            LOG_DEBUG("Parsed option: disk_cache_size = %d MiB", conn->disk_cache_mb);
+            return 0;
+
+        case KEY_OPT_ATTR_CACHE_TTL:
+            LOG_DEBUG("Parsed option: attr_cache_ttl = %d s", conn->attr_cache_ttl);
+            return 0;
+
+        case KEY_OPT_NEG_CACHE_TTL:
+            LOG_DEBUG("Parsed option: negative_cache_ttl = %d s", conn->negative_cache_ttl);
+            return 0;
+
+        case KEY_OPT_DIR_CACHE_TTL:
+            LOG_DEBUG("Parsed option: dir_cache_ttl = %d s", conn->dir_cache_ttl);
+            return 0;
+
+        case KEY_OPT_WRITE_BUFFER:
+            LOG_DEBUG("Parsed option: write_buffer = %d KiB", conn->write_buffer_kb);
+            return 0;
+
         // Các tùy chọn khác không được xử lý bởi hàm này sẽ được chuyển cho FUSE
         default:
             // Trả về 1 để FUSE xử lý các tùy chọn chuẩn của nó (ví dụ: -f, -d)
@@ -158,6 +255,8 @@ int main(int argc, char *argv[]) {
         .destroy    = rp_destroy,
         .getattr    = rp_getattr,
         .readdir    = rp_readdir,
+        .opendir    = rp_opendir,
+        .releasedir = rp_releasedir,
         .open       = rp_open,
         .read       = rp_read,
         .release    = rp_release,
@@ -171,6 +270,8 @@ int main(int argc, char *argv[]) {
         .truncate   = rp_truncate,
         .rename     = rp_rename,
         .fsync      = rp_fsync,
+        .flush      = rp_flush,
+        .copy_file_range = rp_copy_file_range,
     };
 
     // Khởi tạo FUSE args
@@ -207,6 +308,7 @@ int main(int argc, char *argv[]) {
         free(connection_info.remote_pass);
         free(connection_info.ssh_key_path);
         free(connection_info.remote_proc_path);
+        free(connection_info.disk_cache_dir);
         fuse_opt_free_args(&args);
         libssh2_exit(); // <-- Dọn dẹp trước khi thoát
         return 1;
@@ -221,11 +323,65 @@ int main(int argc, char *argv[]) {
         free(connection_info.remote_pass);
         free(connection_info.ssh_key_path);
         free(connection_info.remote_proc_path);
+        free(connection_info.disk_cache_dir);
         fuse_opt_free_args(&args);
         libssh2_exit(); // <-- Dọn dẹp trước khi thoát
         return 1;
     }
 
+    // Giới hạn số kết nối SFTP song song trong khoảng hợp lệ
+    if (connection_info.pool_size < 1 || connection_info.pool_size > SFTP_POOL_MAX_SIZE) {
+        LOG_WARN("connections=%d out of range, clamping to [1, %d]", connection_info.pool_size, SFTP_POOL_MAX_SIZE);
+        connection_info.pool_size = connection_info.pool_size < 1 ? 1 : SFTP_POOL_MAX_SIZE;
+    }
+    if (connection_info.read_window_kb < SFTP_READ_SLICE_MIN / 1024 ||
+        connection_info.read_window_kb > SFTP_READ_WINDOW_MAX_KB) {
+        LOG_WARN("read_window=%d out of range, clamping to [%d, %d] KiB",
+                 connection_info.read_window_kb, SFTP_READ_SLICE_MIN / 1024, SFTP_READ_WINDOW_MAX_KB);
+        connection_info.read_window_kb = connection_info.read_window_kb < SFTP_READ_SLICE_MIN / 1024
+                                         ? SFTP_READ_SLICE_MIN / 1024 : SFTP_READ_WINDOW_MAX_KB;
+    }
+    if (connection_info.readahead_kb < 0 || connection_info.readahead_kb > RP_READAHEAD_MAX_KB) {
+        LOG_WARN("readahead=%d out of range, clamping to [0, %d] KiB", connection_info.readahead_kb, RP_READAHEAD_MAX_KB);
+        connection_info.readahead_kb = connection_info.readahead_kb < 0 ? 0 : RP_READAHEAD_MAX_KB;
+    }
+    if (connection_info.cache_size_mb < 0 || connection_info.cache_size_mb > BLOCK_CACHE_MAX_MB) {
+        LOG_WARN("cache_size=%d out of range, clamping to [0, %d] MiB", connection_info.cache_size_mb, BLOCK_CACHE_MAX_MB);
+        connection_info.cache_size_mb = connection_info.cache_size_mb < 0 ? 0 : BLOCK_CACHE_MAX_MB;
+    }
+    if (connection_info.disk_cache_mb < 1 || connection_info.disk_cache_mb > DISK_CACHE_MAX_MB) {
+        LOG_WARN("disk_cache_size=%d out of range, clamping to [1, %d] MiB", connection_info.disk_cache_mb, DISK_CACHE_MAX_MB);
+        connection_info.disk_cache_mb = connection_info.disk_cache_mb < 1 ? 1 : DISK_CACHE_MAX_MB;
+    }
+    if (connection_info.attr_cache_ttl < 0 || connection_info.attr_cache_ttl > RP_ATTR_CACHE_TTL_MAX) {
+        LOG_WARN("attr_cache_ttl=%d out of range, clamping to [0, %d] s", connection_info.attr_cache_ttl, RP_ATTR_CACHE_TTL_MAX);
+        connection_info.attr_cache_ttl = connection_info.attr_cache_ttl < 0 ? 0 : RP_ATTR_CACHE_TTL_MAX;
+    }
+    if (connection_info.negative_cache_ttl < 0 || connection_info.negative_cache_ttl > RP_NEG_CACHE_TTL_MAX) {
+        LOG_WARN("negative_cache_ttl=%d out of range, clamping to [0, %d] s", connection_info.negative_cache_ttl, RP_NEG_CACHE_TTL_MAX);
+        connection_info.negative_cache_ttl = connection_info.negative_cache_ttl < 0 ? 0 : RP_NEG_CACHE_TTL_MAX;
+    }
+    if (connection_info.dir_cache_ttl < 0 || connection_info.dir_cache_ttl > RP_DIR_CACHE_TTL_MAX) {
+        LOG_WARN("dir_cache_ttl=%d out of range, clamping to [0, %d] s", connection_info.dir_cache_ttl, RP_DIR_CACHE_TTL_MAX);
+        connection_info.dir_cache_ttl = connection_info.dir_cache_ttl < 0 ? 0 : RP_DIR_CACHE_TTL_MAX;
+    }
+    if (connection_info.write_buffer_kb < 0 || connection_info.write_buffer_kb > RP_WRITE_BUFFER_MAX_KB) {
+        LOG_WARN("write_buffer=%d out of range, clamping to [0, %d] KiB", connection_info.write_buffer_kb, RP_WRITE_BUFFER_MAX_KB);
+        connection_info.write_buffer_kb = connection_info.write_buffer_kb < 0 ? 0 : RP_WRITE_BUFFER_MAX_KB;
+    }
+    // FUSE chuyển thư mục làm việc về "/" khi chạy nền, nên cần đường dẫn tuyệt đối cho disk cache
+    if (connection_info.disk_cache_dir && connection_info.disk_cache_dir[0] != '/') {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) != NULL) {
+            char *abs_dir = malloc(strlen(cwd) + strlen(connection_info.disk_cache_dir) + 2);
+            if (abs_dir) {
+                sprintf(abs_dir, "%s/%s", cwd, connection_info.disk_cache_dir);
+                free(connection_info.disk_cache_dir);
+                connection_info.disk_cache_dir = abs_dir;
+            }
+        }
+    }
+
     // --- Lưu thông tin mount point và kết nối ---
     // Tìm đối số không phải là tùy chọn (được cho là mount point)
     // Lưu ý: Đoạn mã này giả định mount point là đối số *đầu tiên* không phải tùy chọn.
@@ -256,17 +412,20 @@ int main(int argc, char *argv[]) {
 
             // Lưu đường dẫn remote tương ứng với mount point này
             if (save_mount_point(real_path, connection_info.remote_proc_path) != 0) {
-                LOG_WARN("Failed to save mount point information to mounts.conf");
+                LOG_WARN("Failed to save mount point information to the registry");
             } else {
-                LOG_INFO("Saved mount point info for tools (mounts.conf)");
+                LOG_INFO("Saved mount point info for tools (registry.bin)");
             }
 
             // Lưu toàn bộ thông tin kết nối
             if (save_connection_info(real_path, &connection_info) != 0) {
-                LOG_WARN("Failed to save full connection information to connections.conf");
+                LOG_WARN("Failed to save full connection information to the registry");
             } else {
-                LOG_INFO("Saved full connection info for tools (connections.conf)");
+                LOG_INFO("Saved full connection info for tools (registry.bin)");
             }
+
+            // remote-cp/remote-mv dùng lại các phiên SFTP của mount qua socket này
+            connection_info.control_path = get_control_socket_path(real_path);
         } else {
             LOG_WARN("Could not resolve real path for mount point: %s (%s)", mount_point, strerror(errno));
             // Có thể tiếp tục mount, nhưng các công cụ cp/mv có thể không hoạt động đúng
@@ -280,7 +439,12 @@ int main(int argc, char *argv[]) {
 
     // Bắt đầu vòng lặp chính của FUSE
     // connection_info được truyền làm private_data, có thể truy cập qua fuse_get_context()
-    ret = fuse_main(args.argc, args.argv, &rp_oper, &connection_info);
+    // (với -o lowlevel thì qua fuse_ll_conn, xem rp_lowlevel.c)
+    if (connection_info.low_level) {
+        ret = rp_ll_main(&args, &connection_info);
+    } else {
+        ret = fuse_main(args.argc, args.argv, &rp_oper, &connection_info);
+    }
 
     // Giải phóng bộ nhớ cho các đối số FUSE (không phải connection_info)
     fuse_opt_free_args(&args);
@@ -294,6 +458,8 @@ int main(int argc, char *argv[]) {
     free(connection_info.remote_pass);
     free(connection_info.ssh_key_path);
     free(connection_info.remote_proc_path);
+    free(connection_info.disk_cache_dir);
+    free(connection_info.control_path);
     // Không cần gọi sftp_disconnect ở đây vì rp_destroy sẽ làm điều đó
 
     if (ret != 0) {
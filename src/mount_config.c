@@ -1,5 +1,6 @@
 #include "common.h"
 #include "mount_config.h"
+#include "registry.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,552 +43,360 @@ char *get_config_dir() {
     return config_dir;
 }
 
-int save_mount_point(const char *mount_point, const char *remote_path) {
+// Mounts and their connection settings are kept in the binary registry
+// (registry.h). The text files of older versions, mounts.conf
+// ("mount_point:remote_path") and connections.conf
+// ("mount_point:host:user:port:remote_path:key_path|password"), are imported
+// when there is no registry yet and left untouched afterwards.
+#define MOUNT_REGISTRY_FILE     "registry.bin"
+
+static char *config_file_path(const char *name) {
     char *config_dir = get_config_dir();
     if (!config_dir) {
-        return -1;
+        return NULL;
     }
-    
-    char *config_file = malloc(strlen(config_dir) + 20);
-    if (!config_file) {
-        free(config_dir);
-        return -1;
+    char *path = malloc(strlen(config_dir) + strlen(name) + 2);
+    if (path) {
+        sprintf(path, "%s/%s", config_dir, name);
     }
-    sprintf(config_file, "%s/mounts.conf", config_dir);
-    
-    FILE *fp;
+    free(config_dir);
+    return path;
+}
+
+static FILE *open_legacy_file(const char *name) {
+    char *path = config_file_path(name);
+    if (!path) {
+        return NULL;
+    }
+    FILE *fp = fopen(path, "r");
+    free(path);
+    return fp;
+}
+
+// mounts.conf; the first line of a mount point wins, as it did when parsed
+static int import_mounts_conf(registry_list_t *list) {
+    FILE *fp = open_legacy_file("mounts.conf");
+    if (!fp) {
+        return 0;
+    }
+
     char line[PATH_MAX * 2];
-    int found = 0;
-    
-    fp = fopen(config_file, "r");
-    FILE *temp_fp = NULL;
-    char *temp_file = NULL;
-    
-    if (fp) {
-        temp_file = malloc(strlen(config_file) + 10);
-        if (!temp_file) {
-            free(config_dir);
-            free(config_file);
-            fclose(fp);
-            return -1;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), fp)) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+
+        char *sep = strchr(line, ':');
+        if (!sep || sep == line) continue;
+        *sep = '\0';
+
+        if (registry_list_find(list, line)) continue;
+        registry_entry_t entry = { .mount_point = line, .remote_path = sep + 1 };
+        result = registry_list_set(list, &entry);
+    }
+    fclose(fp);
+    return result;
+}
+
+// connections.conf, merged into the entries of mounts.conf
+static int import_connections_conf(registry_list_t *list) {
+    FILE *fp = open_legacy_file("connections.conf");
+    if (!fp) {
+        return 0;
+    }
+
+    char line[PATH_MAX * 4];  // Larger buffer for connection details
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), fp)) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+
+        // mount_point, host, user, port, remote path, then key_path|password
+        char *fields[5];
+        char *current_pos = line;
+        int n = 0;
+        for (; n < 5; n++) {
+            char *next_colon = strchr(current_pos, ':');
+            if (!next_colon) break;
+            *next_colon = '\0';
+            fields[n] = current_pos;
+            current_pos = next_colon + 1;
         }
-        sprintf(temp_file, "%s.tmp", config_file);
-        
-        temp_fp = fopen(temp_file, "w");
-        if (!temp_fp) {
-            free(config_dir);
-            free(config_file);
-            free(temp_file);
-            fclose(fp);
-            return -1;
+        if (n < 5 || fields[0][0] == '\0') continue;
+
+        char *key_path = current_pos;
+        char *password = NULL;
+        char *pipe_char = strchr(current_pos, '|');
+        if (pipe_char) {
+            *pipe_char = '\0';
+            password = pipe_char + 1;
         }
-        
-        while (fgets(line, sizeof(line), fp)) {
-            char *sep = strchr(line, ':');
-            if (sep) {
-                *sep = '\0';
-                if (strcmp(line, mount_point) == 0) {
-                    fprintf(temp_fp, "%s:%s\n", mount_point, remote_path);
-                    found = 1;
-                } else {
-                    *sep = ':';
-                    fputs(line, temp_fp);
-                }
-            } else {
-                fputs(line, temp_fp);
-            }
+
+        registry_entry_t *existing = registry_list_find(list, fields[0]);
+        if (existing && (existing->flags & REGISTRY_CONNECTION)) continue;
+        registry_entry_t entry = {
+            .mount_point = fields[0],
+            .remote_path = fields[4][0] ? fields[4] : "/",
+            .host = fields[1][0] ? fields[1] : NULL,
+            .user = fields[2][0] ? fields[2] : NULL,
+            .port = fields[3][0] ? atoi(fields[3]) : 22,
+            .key_path = key_path[0] ? key_path : NULL,
+            .password = password && password[0] ? password : NULL,
+            .flags = REGISTRY_CONNECTION,
+        };
+        result = registry_list_set(list, &entry);
+    }
+    fclose(fp);
+    return result;
+}
+
+// One change to the registry; mount_point NULL only imports the text files
+typedef struct {
+    const char *mount_point;
+    const char *remote_path;
+    const remote_conn_info_t *conn_info;
+    int remove;
+} mount_edit_t;
+
+static int mount_registry_edit(registry_list_t *list, void *arg) {
+    const mount_edit_t *edit = arg;
+    if (list->created) {
+        int result = import_mounts_conf(list);
+        if (result == 0) result = import_connections_conf(list);
+        if (result != 0) return result;
+        if (list->count > 0) {
+            LOG_INFO("Imported %zu mount point(s) from mounts.conf/connections.conf", list->count);
         }
-        
-        fclose(fp);
+    }
+    if (!edit->mount_point) {
+        return list->created ? 0 : 1;
+    }
+    if (edit->remove) {
+        return registry_list_remove(list, edit->mount_point) == 0 ? 0 : 1;
+    }
+
+    // Copied, registry_list_set() may move the entries
+    registry_entry_t entry = { .mount_point = edit->mount_point };
+    registry_entry_t *existing = registry_list_find(list, edit->mount_point);
+    if (existing) {
+        entry = *existing;
+    }
+    const remote_conn_info_t *conn_info = edit->conn_info;
+    if (conn_info) {
+        entry.remote_path = conn_info->remote_proc_path;
+        entry.host = conn_info->remote_host;
+        entry.user = conn_info->remote_user;
+        entry.port = conn_info->remote_port;
+        entry.key_path = conn_info->ssh_key_path;
+        entry.password = conn_info->remote_pass;
+        entry.flags |= REGISTRY_CONNECTION;
     } else {
-        temp_fp = fopen(config_file, "w");
-        if (!temp_fp) {
-            free(config_dir);
-            free(config_file);
-            return -1;
-        }
+        entry.remote_path = edit->remote_path;
     }
-    
-    if (!found) {
-        fprintf(temp_fp, "%s:%s\n", mount_point, remote_path);
+    return registry_list_set(list, &entry);
+}
+
+// Registry as mapped by this process, opened on first use. Strings taken
+// from it stay valid until the mapping is replaced (a stale registry found by
+// mount_lookup, or a change made by this process).
+static registry_t *mount_registry;
+
+static registry_t *mount_registry_open(void) {
+    if (mount_registry) {
+        return mount_registry;
     }
-    
-    fclose(temp_fp);
-    
-    if (temp_file) {
-        if (rename(temp_file, config_file) == -1) {
-            unlink(temp_file);
-            free(temp_file);
-            free(config_dir);
-            free(config_file);
-            return -1;
+    char *path = config_file_path(MOUNT_REGISTRY_FILE);
+    if (!path) {
+        return NULL;
+    }
+    mount_registry = registry_open(path);
+    if (!mount_registry && errno == ENOENT) {
+        // First run after an upgrade: build the registry from the text files
+        FILE *fp = open_legacy_file("mounts.conf");
+        if (!fp) fp = open_legacy_file("connections.conf");
+        if (fp) {
+            fclose(fp);
+            mount_edit_t edit = { 0 };
+            if (registry_update(path, mount_registry_edit, &edit) == 0) {
+                mount_registry = registry_open(path);
+            }
         }
-        free(temp_file);
     }
-    
-    free(config_dir);
-    free(config_file);
-    return 0;
+    free(path);
+    return mount_registry;
+}
+
+// The mapping, replaced first when another process rewrote the registry since
+// it was mapped, so a long run (--from-file) sees mounts added or removed meanwhile
+static registry_t *mount_registry_current(void) {
+    if (mount_registry) {
+        char *path = config_file_path(MOUNT_REGISTRY_FILE);
+        if (path && registry_stale(mount_registry, path)) {
+            registry_close(mount_registry);
+            mount_registry = NULL;
+        }
+        free(path);
+    }
+    return mount_registry_open();
+}
+
+static int mount_registry_update(const mount_edit_t *edit) {
+    char *path = config_file_path(MOUNT_REGISTRY_FILE);
+    if (!path) {
+        return -1;
+    }
+    int result = registry_update(path, mount_registry_edit, (void *)edit);
+    free(path);
+
+    // Map the new file on the next lookup
+    registry_close(mount_registry);
+    mount_registry = NULL;
+    return result == 0 ? 0 : -1;
+}
+
+int save_mount_point(const char *mount_point, const char *remote_path) {
+    mount_edit_t edit = { .mount_point = mount_point, .remote_path = remote_path };
+    return mount_registry_update(&edit);
 }
 
-// New function to save full connection info for a mount point
 int save_connection_info(const char *mount_point, const remote_conn_info_t *conn_info) {
-    char *config_dir = get_config_dir();
-    if (!config_dir) {
+    mount_edit_t edit = { .mount_point = mount_point, .conn_info = conn_info };
+    return mount_registry_update(&edit);
+}
+
+int remove_mount_point(const char *mount_point) {
+    mount_edit_t edit = { .mount_point = mount_point, .remove = 1 };
+    return mount_registry_update(&edit);
+}
+
+int mount_lookup(const char *path, mount_lookup_t *result) {
+    if (!path || path[0] == '\0') {
         return -1;
     }
-    
-    char *config_file = malloc(strlen(config_dir) + 30);
-    if (!config_file) {
-        free(config_dir);
+
+    // Try to resolve the real absolute path, as main.c saved the mount point
+    if (realpath(path, result->abs_path) == NULL) {
+        strncpy(result->abs_path, path, sizeof(result->abs_path) - 1);
+        result->abs_path[sizeof(result->abs_path) - 1] = '\0';
+    }
+
+    registry_t *reg = mount_registry_current();
+    if (!reg || registry_count(reg) == 0) {
         return -1;
     }
-    sprintf(config_file, "%s/connections.conf", config_dir);
-    
-    FILE *fp;
-    char line[PATH_MAX * 4];  // Larger buffer for connection details
+
+    // The path itself, then each parent directory, longest first, so the
+    // deepest mount containing the path wins
+    const char *abs_path = result->abs_path;
+    registry_entry_t entry;
+    size_t len = strlen(abs_path);
     int found = 0;
-    
-    fp = fopen(config_file, "r");
-    FILE *temp_fp = NULL;
-    char *temp_file = NULL;
-    
-    if (fp) {
-        temp_file = malloc(strlen(config_file) + 10);
-        if (!temp_file) {
-            free(config_dir);
-            free(config_file);
-            fclose(fp);
-            return -1;
-        }
-        sprintf(temp_file, "%s.tmp", config_file);
-        
-        temp_fp = fopen(temp_file, "w");
-        if (!temp_fp) {
-            free(config_dir);
-            free(config_file);
-            free(temp_file);
-            fclose(fp);
-            return -1;
-        }
-        
-        while (fgets(line, sizeof(line), fp)) {
-            char *sep = strchr(line, ':');
-            if (sep) {
-                *sep = '\0';
-                if (strcmp(line, mount_point) == 0) {
-                    // Format: mount_point:host:user:port:remotepath:key_path|password
-                    // Using pipe (|) separator between key_path and password to avoid colon parsing issues
-                    fprintf(temp_fp, "%s:%s:%s:%d:%s:%s|%s\n", 
-                            mount_point,
-                            conn_info->remote_host ? conn_info->remote_host : "",
-                            conn_info->remote_user ? conn_info->remote_user : "",
-                            conn_info->remote_port,
-                            conn_info->remote_proc_path ? conn_info->remote_proc_path : "",
-                            conn_info->ssh_key_path ? conn_info->ssh_key_path : "",
-                            conn_info->remote_pass ? conn_info->remote_pass : "");
-                    found = 1;
-                } else {
-                    *sep = ':';
-                    fputs(line, temp_fp);
-                }
-            } else {
-                fputs(line, temp_fp);
-            }
-        }
-        
-        fclose(fp);
-    } else {
-        temp_fp = fopen(config_file, "w");
-        if (!temp_fp) {
-            free(config_dir);
-            free(config_file);
-            return -1;
-        }
+    while (len > 0 && !(found = registry_find(reg, abs_path, len, &entry) == 0)) {
+        while (len > 0 && abs_path[len - 1] != '/') len--;
+        if (len > 0) len--; // Drop the slash itself
     }
-    
-    if (!found) {
-        // Format: mount_point:host:user:port:remotepath:key_path|password
-        fprintf(temp_fp, "%s:%s:%s:%d:%s:%s|%s\n",
-                mount_point,
-                conn_info->remote_host ? conn_info->remote_host : "",
-                conn_info->remote_user ? conn_info->remote_user : "",
-                conn_info->remote_port,
-                conn_info->remote_proc_path ? conn_info->remote_proc_path : "",
-                conn_info->ssh_key_path ? conn_info->ssh_key_path : "",
-                conn_info->remote_pass ? conn_info->remote_pass : "");
+    if (!found || !entry.remote_path) {
+        return -1;
     }
-    
-    fclose(temp_fp);
-    
-    if (temp_file) {
-        if (rename(temp_file, config_file) == -1) {
-            unlink(temp_file);
-            free(temp_file);
-            free(config_dir);
-            free(config_file);
-            return -1;
-        }
-        free(temp_file);
+
+    result->mount_point = entry.mount_point;
+    result->remote_base = entry.remote_path;
+    result->rel_path = abs_path + len;
+
+    // base + rel, without a double slash when the base ends with one
+    size_t base_len = strlen(entry.remote_path);
+    const char *rel = result->rel_path;
+    if (base_len > 0 && entry.remote_path[base_len - 1] == '/' && rel[0] == '/') rel++;
+    if ((size_t)snprintf(result->remote_path, sizeof(result->remote_path), "%s%s",
+                         entry.remote_path, rel) >= sizeof(result->remote_path)) {
+        return -1;
     }
-    
-    free(config_dir);
-    free(config_file);
     return 0;
 }
 
 char **get_mount_points(int *count) {
     *count = 0;
-    
-    char *config_dir = get_config_dir();
-    if (!config_dir) {
-        return NULL;
-    }
-    
-    char *config_file = malloc(strlen(config_dir) + 20);
-    if (!config_file) {
-        free(config_dir);
-        return NULL;
-    }
-    sprintf(config_file, "%s/mounts.conf", config_dir);
-    
-    FILE *fp = fopen(config_file, "r");
-    if (!fp) {
-        free(config_dir);
-        free(config_file);
-        return NULL;
-    }
-    
-    char line[PATH_MAX * 2];
-    int num_lines = 0;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        char *sep = strchr(line, ':');
-        if (sep) num_lines++;
-    }
-    
-    if (num_lines == 0) {
-        fclose(fp);
-        free(config_dir);
-        free(config_file);
+    registry_t *reg = mount_registry_open();
+    if (!reg || registry_count(reg) == 0) {
         return NULL;
     }
-    
-    char **mount_points = malloc(sizeof(char*) * (num_lines + 1));
+
+    size_t n = registry_count(reg);
+    char **mount_points = malloc(sizeof(char*) * (n + 1));
     if (!mount_points) {
-        fclose(fp);
-        free(config_dir);
-        free(config_file);
         return NULL;
     }
-    
-    rewind(fp);
-    
-    int idx = 0;
-    
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        char *nl = strchr(line, '\n');
-        if (nl) *nl = '\0';
-        
-        if (strlen(line) == 0) continue;
-        
-        char *sep = strchr(line, ':');
-        if (!sep) continue;
-        
-        *sep = '\0';
-        
-        mount_points[idx] = strdup(line);
-        if (!mount_points[idx]) {
-            for (int i = 0; i < idx; i++) {
-                free(mount_points[i]);
+    for (size_t i = 0; i < n; i++) {
+        registry_entry_t entry;
+        registry_get(reg, i, &entry);
+        mount_points[i] = strdup(entry.mount_point);
+        if (!mount_points[i]) {
+            for (size_t j = 0; j < i; j++) {
+                free(mount_points[j]);
             }
             free(mount_points);
-            fclose(fp);
-            free(config_dir);
-            free(config_file);
-            *count = 0;
             return NULL;
         }
-        
-        idx++;
     }
-    
-    mount_points[idx] = NULL;
-    *count = idx;
-    
-    fclose(fp);
-    free(config_dir);
-    free(config_file);
-    
+    mount_points[n] = NULL;
+    *count = (int)n;
     return mount_points;
 }
 
 char *get_remote_path_for_mount(const char *mount_point) {
-    char *config_dir = get_config_dir();
-    if (!config_dir) {
-        return NULL;
-    }
-    
-    char *config_file = malloc(strlen(config_dir) + 20);
-    if (!config_file) {
-        free(config_dir);
+    registry_t *reg = mount_registry_open();
+    registry_entry_t entry;
+    if (!reg || registry_find(reg, mount_point, strlen(mount_point), &entry) != 0 || !entry.remote_path) {
         return NULL;
     }
-    sprintf(config_file, "%s/mounts.conf", config_dir);
-    
-    if (access(config_file, F_OK) == -1) {
-        free(config_dir);
-        free(config_file);
-        return NULL;
-    }
-    
-    FILE *fp = fopen(config_file, "r");
-    if (!fp) {
-        free(config_dir);
-        free(config_file);
-        return NULL;
-    }
-    
-    char line[PATH_MAX * 2];
-    char *remote_path = NULL;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        char *nl = strchr(line, '\n');
-        if (nl) *nl = '\0';
-        
-        char *sep = strchr(line, ':');
-        if (!sep) continue;
-        
-        *sep = '\0';
-        sep++;
-        
-        if (strcmp(line, mount_point) == 0) {
-            remote_path = strdup(sep);
-            break;
-        }
-    }
-    
-    fclose(fp);
-    free(config_dir);
-    free(config_file);
-    
-    return remote_path;
+    return strdup(entry.remote_path);
 }
 
 int load_connection_info_for_mount(const char *mount_point, remote_conn_info_t *conn_info) {
-    char *config_dir = get_config_dir();
-    if (!config_dir) {
-        return -1;
-    }
-    
-    char *config_file = malloc(strlen(config_dir) + 30);
-    if (!config_file) {
-        free(config_dir);
-        return -1;
-    }
-    sprintf(config_file, "%s/connections.conf", config_dir);
-    
-    if (access(config_file, F_OK) == -1) {
-        // Fall back to getting just the remote path from mounts.conf
-        free(config_file);
-        
-        char *remote_path = get_remote_path_for_mount(mount_point);
-        if (remote_path) {
-            conn_info->remote_proc_path = remote_path;
-            free(config_dir);
-            return 1; // Partial success - only remote_proc_path is available
-        }
-        
-        free(config_dir);
-        return -1;
-    }
-    
-    FILE *fp = fopen(config_file, "r");
-    if (!fp) {
-        free(config_dir);
-        free(config_file);
+    registry_t *reg = mount_registry_open();
+    registry_entry_t entry;
+    if (!reg || registry_find(reg, mount_point, strlen(mount_point), &entry) != 0) {
         return -1;
     }
-    
-    char line[PATH_MAX * 4];  // Larger buffer for connection details
-    int found = 0;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        char *nl = strchr(line, '\n');
-        if (nl) *nl = '\0';
-        
-        // Find mount point at start of line
-        char *mount_start = line;
-        char *first_colon = strchr(mount_start, ':');
-        if (!first_colon) continue;
-        
-        *first_colon = '\0';
-        if (strcmp(mount_start, mount_point) != 0) {
-            *first_colon = ':'; // Restore to avoid modifying the line for next iterations
-            continue;
-        }
-        
-        // We found our mount point, now parse each field
-        char *current_pos = first_colon + 1;
-        
-        // 1. Host
-        char *next_colon = strchr(current_pos, ':');
-        if (!next_colon) break;
-        *next_colon = '\0';
-        if (strlen(current_pos) > 0) {
-            conn_info->remote_host = strdup(current_pos);
-        }
-        current_pos = next_colon + 1;
-        
-        // 2. User
-        next_colon = strchr(current_pos, ':');
-        if (!next_colon) break;
-        *next_colon = '\0';
-        if (strlen(current_pos) > 0) {
-            conn_info->remote_user = strdup(current_pos);
-        }
-        current_pos = next_colon + 1;
-        
-        // 3. Port
-        next_colon = strchr(current_pos, ':');
-        if (!next_colon) break;
-        *next_colon = '\0';
-        if (strlen(current_pos) > 0) {
-            conn_info->remote_port = atoi(current_pos);
-        } else {
-            conn_info->remote_port = 22; // Default SSH port
-        }
-        current_pos = next_colon + 1;
-        
-        // 4. Remote path
-        next_colon = strchr(current_pos, ':');
-        if (!next_colon) break;
-        *next_colon = '\0';
-        if (strlen(current_pos) > 0) {
-            conn_info->remote_proc_path = strdup(current_pos);
-        } else {
-            conn_info->remote_proc_path = strdup("/");
-        }
-        current_pos = next_colon + 1;
-        
-        // 5. SSH key path and password (divided by pipe)
-        char *pipe_char = strchr(current_pos, '|');
-        if (pipe_char) {
-            *pipe_char = '\0';
-            if (strlen(current_pos) > 0) {
-                conn_info->ssh_key_path = strdup(current_pos);
-            }
-            
-            // Get password after the pipe
-            char *password = pipe_char + 1;
-            if (strlen(password) > 0) {
-                conn_info->remote_pass = strdup(password);
-            }
-        } else {
-            // Old format or no password case
-            if (strlen(current_pos) > 0) {
-                conn_info->ssh_key_path = strdup(current_pos);
-            }
-        }
-        
-        found = 1;
-        break;
-    }
-    
-    fclose(fp);
-    free(config_dir);
-    free(config_file);
-    
-    if (!found) {
-        // Fall back to getting just the remote path from mounts.conf
-        char *remote_path = get_remote_path_for_mount(mount_point);
-        if (remote_path) {
-            conn_info->remote_proc_path = remote_path;
-            return 1; // Partial success - only remote_proc_path is available
+
+    if (!(entry.flags & REGISTRY_CONNECTION)) {
+        // Only the remote path is known for this mount point
+        if (!entry.remote_path) {
+            return -1;
         }
-        return -1;
+        conn_info->remote_proc_path = strdup(entry.remote_path);
+        return 1; // Partial success - only remote_proc_path is available
     }
-    
+
+    if (entry.host && entry.host[0]) conn_info->remote_host = strdup(entry.host);
+    if (entry.user && entry.user[0]) conn_info->remote_user = strdup(entry.user);
+    if (entry.key_path && entry.key_path[0]) conn_info->ssh_key_path = strdup(entry.key_path);
+    if (entry.password && entry.password[0]) conn_info->remote_pass = strdup(entry.password);
+    conn_info->remote_port = entry.port > 0 ? entry.port : 22; // Default SSH port
+    conn_info->remote_proc_path = strdup(entry.remote_path && entry.remote_path[0] ? entry.remote_path : "/");
     return 0;
 }
 
-int remove_mount_point(const char *mount_point) {
+// Control socket of the live mount at mount_point (see control.h). Named
+// after a hash of the mount point so the path stays short enough for
+// sun_path whatever the mount point is. Caller frees.
+char *get_control_socket_path(const char *mount_point) {
     char *config_dir = get_config_dir();
     if (!config_dir) {
-        return -1;
-    }
-    
-    char *config_file = malloc(strlen(config_dir) + 20);
-    if (!config_file) {
-        free(config_dir);
-        return -1;
-    }
-    sprintf(config_file, "%s/mounts.conf", config_dir);
-    
-    if (access(config_file, F_OK) == -1) {
-        free(config_dir);
-        free(config_file);
-        return 0;
-    }
-    
-    FILE *fp = fopen(config_file, "r");
-    if (!fp) {
-        free(config_dir);
-        free(config_file);
-        return -1;
-    }
-    
-    char *temp_file = malloc(strlen(config_file) + 5);
-    if (!temp_file) {
-        fclose(fp);
-        free(config_dir);
-        free(config_file);
-        return -1;
-    }
-    sprintf(temp_file, "%s.tmp", config_file);
-    
-    FILE *fp_tmp = fopen(temp_file, "w");
-    if (!fp_tmp) {
-        fclose(fp);
-        free(config_dir);
-        free(config_file);
-        free(temp_file);
-        return -1;
+        return NULL;
     }
-    
-    char line[1024];
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        char line_copy[1024];
-        strcpy(line_copy, line);
-        
-        char *nl = strchr(line_copy, '\n');
-        if (nl) *nl = '\0';
-        
-        char *sep = strchr(line_copy, ':');
-        if (!sep) {
-            fputs(line, fp_tmp);
-            continue;
-        }
-        
-        *sep = '\0';
-        
-        if (strcmp(line_copy, mount_point) != 0) {
-            fputs(line, fp_tmp);
-        }
+
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)mount_point; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
     }
-    
-    fclose(fp);
-    fclose(fp_tmp);
-    
-    if (rename(temp_file, config_file) != 0) {
-        free(config_dir);
-        free(config_file);
-        free(temp_file);
-        return -1;
+
+    char *socket_path = malloc(strlen(config_dir) + 40);
+    if (socket_path) {
+        sprintf(socket_path, "%s/control-%016llx.sock", config_dir, hash);
     }
-    
     free(config_dir);
-    free(config_file);
-    free(temp_file);
-    return 0;
-}
\ No newline at end of file
+    return socket_path;
+}
@@ -1,12 +1,31 @@
 #ifndef MOUNT_CONFIG_H
 #define MOUNT_CONFIG_H
 
+#include <limits.h>
+
 char *get_config_dir();
 int save_mount_point(const char *mount_point, const char *remote_path);
 char **get_mount_points(int *count);
 char *get_remote_path_for_mount(const char *mount_point);
+
+// Mount containing a local path, answered from the mapped registry
+// (O(depth * log mounts)), which is mapped again once another process has
+// replaced it. mount_point and remote_base point into the mapping and stay
+// valid until the next lookup or until this process saves or removes a mount point.
+typedef struct {
+    const char *mount_point;
+    const char *remote_base;    // remote_proc_path of the mount
+    const char *rel_path;       // Rest of abs_path below the mount point ("" or "/...")
+    char abs_path[PATH_MAX];    // realpath() of the path, or the path as given
+    char remote_path[PATH_MAX]; // remote_base + rel_path
+} mount_lookup_t;
+
+// 0 when path lies on a mount (the deepest one if mounts are nested), -1 otherwise
+int mount_lookup(const char *path, mount_lookup_t *result);
 int load_connection_info_for_mount(const char *mount_point, remote_conn_info_t *conn_info);
 int remove_mount_point(const char *mount_point);
+// UNIX socket on which the mount at mount_point serves remote-cp/remote-mv
+char *get_control_socket_path(const char *mount_point);
 
 // Declaration for saving full connection info
 int save_connection_info(const char *mount_point, const remote_conn_info_t *conn_info);
@@ -1,6 +1,10 @@
+#define _XOPEN_SOURCE 500 // Required for nftw
 #include "common.h"
 #include "ssh_sftp_client.h"
 #include "mount_config.h"
+#include "transfer.h"
+#include "batch.h"
+#include "control.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,73 +14,55 @@
 #include <limits.h>
 #include <errno.h>
 #include <unistd.h> // Thêm include cho unlink
+#include <ftw.h>
 #include <libssh2.h> // <-- Thêm include cho libssh2_init/exit
 
 // Biến toàn cục này nên được định nghĩa duy nhất trong ssh_sftp_client.c
 // extern remote_conn_info_t *ssh_cli_conn; // Khai báo extern nếu cần
 
+// Tùy chọn chỉ có dạng dài
+enum {
+    OPT_FROM_FILE = 256
+};
+
 void show_usage(const char *progname) {
-    fprintf(stderr, "Usage: %s [options] <source> <destination>\n\n", progname);
-    fprintf(stderr, "Move files between local filesystem and RemoteFS mounted directories.\n\n");
+    fprintf(stderr, "Usage: %s [options] <source>... <destination>\n", progname);
+    fprintf(stderr, "       %s [options] --from-file FILE [<destination>]\n\n", progname);
+    fprintf(stderr, "Move files between local filesystem and RemoteFS mounted directories.\n");
+    fprintf(stderr, "With several sources the destination must be a directory. All operations of\n"
+                    "one run share a single SSH connection.\n\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -h, --help           Show this help message\n");
     fprintf(stderr, "  -v, --verbose        Enable verbose output\n");
+    fprintf(stderr, "  -j, --jobs N         Move up to N files in parallel over N SFTP sessions (default: 1, max: %d).\n"
+                    "                       Each file is deleted once its copy matches the source (size, and\n"
+                    "                       MD5 when the server can run md5sum).\n",
+            TRANSFER_JOBS_MAX);
+    fprintf(stderr, "      --from-file FILE Read operations from FILE (- for stdin), one per line:\n"
+                    "                       \"source<TAB>destination\", or just \"source\" to move into\n"
+                    "                       <destination>. Blank lines and lines starting with # are skipped.\n");
+    fprintf(stderr, "\nDirectories are moved with their contents. Within one mount, a move is a rename\n"
+                    "on the server and no data is copied.\n");
     fprintf(stderr, "\nExamples:\n");
     fprintf(stderr, "  %s localfile.txt /path/to/mounted/remotefs/      # Move local file to remote\n", progname);
     fprintf(stderr, "  %s /path/to/mounted/remotefs/file.txt ./         # Move remote file to local\n", progname);
     fprintf(stderr, "  %s file1.txt /path/to/mounted/remotefs/file2.txt # Move and rename\n", progname);
+    fprintf(stderr, "  %s -j 8 logs/2024-05 /path/to/mounted/remotefs/archive/ # Move a directory\n", progname);
+    fprintf(stderr, "  %s -j 4 --from-file moves.tsv                    # Many moves, one connection\n", progname);
 }
 
+// Đường dẫn có nằm trên một điểm mount remotefs không (tra trong chỉ mục
+// các mount đã lưu; registry được ánh xạ lại khi tiến trình khác ghi đè nó)
 const char* is_remote_path(const char *path, char *mount_point_buf, size_t buf_size) {
-    // Empty path check
-    if (!path || strlen(path) == 0) {
+    mount_lookup_t lookup;
+    if (mount_lookup(path, &lookup) != 0) {
         return NULL;
     }
-
-    // Try to resolve the real absolute path
-    char abs_path[PATH_MAX];
-    if (realpath(path, abs_path) == NULL) {
-        // If realpath fails, just use the provided path directly
-        strncpy(abs_path, path, sizeof(abs_path) - 1);
-        abs_path[sizeof(abs_path) - 1] = '\0';
-    }
-
-    // Get all mount points
-    int count = 0;
-    char **mount_points = get_mount_points(&count);
-    if (!mount_points || count == 0) {
-        // No mount points found
-        return NULL;
-    }
-
-    // Check if the path starts with any of our mount points
-    for (int i = 0; i < count; i++) {
-        size_t len = strlen(mount_points[i]);
-        if (strncmp(abs_path, mount_points[i], len) == 0 &&
-            (abs_path[len] == '/' || abs_path[len] == '\0')) {
-            // Match found - copy to output buffer if provided
-            if (mount_point_buf && buf_size > 0) {
-                strncpy(mount_point_buf, mount_points[i], buf_size - 1);
-                mount_point_buf[buf_size - 1] = '\0';
-            }
-
-            // Free all mount points
-            for (int j = 0; j < count; j++) {
-                free(mount_points[j]);
-            }
-            free(mount_points);
-
-            return mount_point_buf;
-        }
-    }
-
-    // No match found - free all mount points
-    for (int i = 0; i < count; i++) {
-        free(mount_points[i]);
+    if (mount_point_buf && buf_size > 0) {
+        strncpy(mount_point_buf, lookup.mount_point, buf_size - 1);
+        mount_point_buf[buf_size - 1] = '\0';
     }
-    free(mount_points);
-
-    return NULL;
+    return mount_point_buf;
 }
 
 int get_remote_path(const char *path, char *remote_path, size_t size, int verbose) {
@@ -84,61 +70,25 @@ int get_remote_path(const char *path, char *remote_path, size_t size, int verbos
         return -1;
     }
 
-    char mount_point[PATH_MAX];
-
-    // Determine if the path is on a remote filesystem
-    if (!is_remote_path(path, mount_point, sizeof(mount_point))) {
+    mount_lookup_t lookup;
+    if (mount_lookup(path, &lookup) != 0) {
         if (verbose) {
             fprintf(stderr, "Path is not on a remote filesystem: %s\n", path);
         }
         return -1;
     }
-
-    // Get the remote base path for this mount point
-    char *base_remote_path = get_remote_path_for_mount(mount_point);
-    if (!base_remote_path) {
-        fprintf(stderr, "Error: Cannot determine remote path for mount point: %s\n", mount_point);
+    if ((size_t)snprintf(remote_path, size, "%s", lookup.remote_path) >= size) {
+        fprintf(stderr, "Error: Remote path too long for %s\n", path);
         return -1;
     }
 
-    // Get the absolute path of the local path
-    char abs_path[PATH_MAX];
-    if (realpath(path, abs_path) == NULL) {
-        // If realpath fails, use the provided path
-        strncpy(abs_path, path, sizeof(abs_path) - 1);
-        abs_path[sizeof(abs_path) - 1] = '\0';
-    }
-
-    // Calculate the relative part (path within the mount)
-    const char *rel_path = abs_path + strlen(mount_point);
-
-    // Construct the full remote path
-    if (rel_path[0] != '/' && strlen(rel_path) > 0) {
-        // Add slash if needed
-        snprintf(remote_path, size, "%s/%s", base_remote_path, rel_path);
-    } else {
-        // Already has a slash or is empty
-        snprintf(remote_path, size, "%s%s", base_remote_path, rel_path);
-    }
-
-    // Cleanup any double slashes that might occur
-    if (strlen(base_remote_path) > 0 && base_remote_path[strlen(base_remote_path) - 1] == '/' &&
-        rel_path[0] == '/') {
-        char *double_slash = strstr(remote_path, "//");
-        if (double_slash) {
-            memmove(double_slash, double_slash + 1, strlen(double_slash));
-        }
-    }
-
     if (verbose) {
         printf("Local path: %s\n", path);
-        printf("Mount point: %s\n", mount_point);
-        printf("Remote base path: %s\n", base_remote_path);
-        printf("Relative path: %s\n", rel_path);
+        printf("Mount point: %s\n", lookup.mount_point);
+        printf("Remote base path: %s\n", lookup.remote_base);
+        printf("Relative path: %s\n", lookup.rel_path);
         printf("Full remote path: %s\n", remote_path);
     }
-
-    free(base_remote_path);
     return 0;
 }
 
@@ -206,6 +156,18 @@ int setup_connection(const char *mount_point, int verbose) {
                ssh_cli_conn->remote_proc_path ? ssh_cli_conn->remote_proc_path : "/");
     }
 
+    // Nếu mount đang chạy, dùng lại các phiên SFTP của nó qua control socket;
+    // phiên SSH riêng chỉ được mở khi cần (liệt kê thư mục, kênh exec, -j)
+    char *control_path = get_control_socket_path(mount_point);
+    int served = control_path && control_connect(control_path) == 0;
+    free(control_path);
+    if (served) {
+        if (verbose) {
+            printf("Using the SFTP sessions of the live mount\n");
+        }
+        return 0;
+    }
+
     // Attempt to connect and authenticate
     if (sftp_connect_and_auth(ssh_cli_conn) != 0) {
         fprintf(stderr, "Error: Failed to connect and authenticate SFTP session\n");
@@ -226,51 +188,271 @@ int setup_connection(const char *mount_point, int verbose) {
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    // ---> KHỞI TẠO LIBSSH2 <---
-    if (libssh2_init(0) != 0) {
-        fprintf(stderr, "Error initializing libssh2\n");
-        return 1;
+// Thư mục nguồn theo thứ tự duyệt (cha trước con); sau khi mọi file đã được
+// chuyển, chúng được xóa theo thứ tự ngược lại (con trước cha)
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t cap;
+} dir_list_t;
+
+static int dir_list_add(dir_list_t *list, const char *path) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        char **grown = realloc(list->paths, cap * sizeof(char *));
+        if (!grown) return -ENOMEM;
+        list->paths = grown;
+        list->cap = cap;
     }
+    list->paths[list->count] = strdup(path);
+    if (!list->paths[list->count]) return -ENOMEM;
+    list->count++;
+    return 0;
+}
 
-    int verbose = 0;
-    int result = 1; // Mặc định là lỗi
+static void dir_list_free(dir_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) free(list->paths[i]);
+    free(list->paths);
+}
 
-    static struct option long_options[] = {
-        {"help",     no_argument, 0, 'h'},
-        {"verbose",  no_argument, 0, 'v'},
-        {0, 0, 0, 0}
-    };
+// Xóa các thư mục nguồn đã rỗng. Thư mục còn chứa mục không chuyển được
+// (symlink, file đặc biệt) được giữ lại và báo lỗi.
+static int remove_source_dirs(const dir_list_t *dirs, int remote, int verbose) {
+    int result = 0;
+    for (size_t i = dirs->count; i-- > 0; ) {
+        int rc = remote ? (sftp_rmdir_remote(dirs->paths[i]) == 0 ? 0 : -EIO)
+                        : (rmdir(dirs->paths[i]) == 0 ? 0 : -errno);
+        if (rc != 0) {
+            // Thường là do còn mục không chuyển được bên trong
+            fprintf(stderr, "Error: Cannot remove source directory %s: %s\n", dirs->paths[i],
+                    remote ? "not empty or not permitted" : strerror(-rc));
+            if (result == 0) result = rc;
+        } else if (verbose) {
+            printf("Removed source directory %s\n", dirs->paths[i]);
+        }
+    }
+    return result;
+}
 
-    int opt;
-    int option_index = 0;
+// Khi chạy nhiều thao tác (nhiều nguồn hoặc --from-file), mọi file của cả lô
+// đi qua một transfer engine chung, nên các phiên SFTP của -j chỉ mở một lần.
+// Engine này chỉ được đợi ở cuối main, và các thư mục nguồn của lô cũng chỉ
+// được xóa khi đó. NULL khi chỉ có một cặp nguồn/đích.
+static transfer_engine_t *g_batch_engine = NULL;
+static dir_list_t g_batch_local_dirs;   // Thư mục nguồn của các lần tải lên
+static dir_list_t g_batch_remote_dirs;  // Thư mục nguồn của các lần tải về
+
+// Chuyển một file qua transfer engine: copy, so kích thước và MD5 ở đích rồi
+// mới xóa nguồn (TRANSFER_MOVE); file lớn được chia đoạn khi -j > 1
+static int move_single_file(transfer_direction_t direction, const char *src, const char *dst,
+                            libssh2_uint64_t size, unsigned long mtime, int jobs, int verbose) {
+    if (g_batch_engine) {
+        return transfer_engine_submit(g_batch_engine, direction, src, dst, size, mtime);
+    }
 
-    while ((opt = getopt_long(argc, argv, "hv", long_options, &option_index)) != -1) {
-        switch (opt) {
-            case 'h':
-                show_usage(argv[0]);
-                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-                return 0;
-            case 'v':
-                verbose = 1;
-                break;
-            default:
-                show_usage(argv[0]);
-                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-                return 1;
+    int stripe = jobs > 1 && size != TRANSFER_SIZE_UNKNOWN && size >= TRANSFER_STRIPE_MIN;
+    transfer_engine_t *engine = transfer_engine_create(ssh_cli_conn, stripe ? jobs : 1, TRANSFER_MOVE, verbose);
+    if (!engine) return -ENOMEM;
+    int result = transfer_engine_submit(engine, direction, src, dst, size, mtime);
+    int move_result = transfer_engine_finish(engine);
+    return result != 0 ? result : move_result;
+}
+
+// Ngữ cảnh cho nftw khi chuyển thư mục local lên remote
+static struct {
+    transfer_engine_t *engine;
+    const char *source_base;
+    const char *dest_base;
+    dir_list_t *dirs;
+    int verbose;
+} g_move_ctx;
+
+static int move_local_to_remote_callback(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)ftwbuf;
+    char remote_path[PATH_MAX];
+    const char *rel = path + strlen(g_move_ctx.source_base);
+    int n = snprintf(remote_path, sizeof(remote_path), "%s%s", g_move_ctx.dest_base, rel);
+    if (n < 0 || (size_t)n >= sizeof(remote_path)) {
+        fprintf(stderr, "Error: Remote path too long for %s\n", path);
+        return -ENAMETOOLONG;
+    }
+
+    if (typeflag == FTW_D) {
+        if (sftp_mkdir_remote(remote_path, sb->st_mode & 0777) != 0) {
+            fprintf(stderr, "Error creating remote directory %s\n", remote_path);
+            return -EIO;
         }
+        if (g_move_ctx.verbose) printf("Created remote directory: %s\n", remote_path);
+        return dir_list_add(g_move_ctx.dirs, path);
     }
+    if (typeflag == FTW_F && S_ISREG(sb->st_mode)) {
+        return transfer_engine_submit(g_move_ctx.engine, TRANSFER_UPLOAD, path, remote_path,
+                                      (libssh2_uint64_t)sb->st_size, (unsigned long)sb->st_mtime);
+    }
+    fprintf(stderr, "Warning: %s is not a regular file or directory, leaving it in place\n", path);
+    return 0;
+}
 
-    if (argc - optind != 2) {
-        fprintf(stderr, "Error: Source and destination arguments are required.\n");
-        show_usage(argv[0]);
-        libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-        return 1;
+// Chuyển cả thư mục local lên remote: tạo cây thư mục ở đích, các file đi qua
+// transfer engine (song song với -j), mỗi file bị xóa ngay khi bản copy đã
+// được kiểm tra; cuối cùng xóa các thư mục nguồn đã rỗng
+static int move_local_dir_to_remote(const char *local_dir, const char *remote_dir, int jobs, int verbose) {
+    char source_base[PATH_MAX];
+    size_t len = strlen(local_dir);
+    while (len > 1 && local_dir[len - 1] == '/') len--;
+    if (len >= sizeof(source_base)) return -ENAMETOOLONG;
+    memcpy(source_base, local_dir, len);
+    source_base[len] = '\0';
+
+    dir_list_t dirs = {0};
+    g_move_ctx.engine = g_batch_engine ? g_batch_engine
+                                       : transfer_engine_create(ssh_cli_conn, jobs, TRANSFER_MOVE, verbose);
+    if (!g_move_ctx.engine) return -ENOMEM;
+    g_move_ctx.source_base = source_base;
+    g_move_ctx.dest_base = remote_dir;
+    g_move_ctx.dirs = g_batch_engine ? &g_batch_local_dirs : &dirs;
+    g_move_ctx.verbose = verbose;
+
+    // Thứ tự trước (không dùng FTW_DEPTH) để thư mục được tạo trước các file bên trong
+    int walk_result = nftw(source_base, move_local_to_remote_callback, 20, FTW_PHYS);
+    if (walk_result != 0) walk_result = walk_result < 0 && walk_result != -1 ? walk_result : -EIO;
+    if (g_batch_engine) {
+        g_move_ctx.engine = NULL;
+        return walk_result;
+    }
+    int result = transfer_engine_finish(g_move_ctx.engine);
+    g_move_ctx.engine = NULL;
+    if (walk_result != 0 && result == 0) result = walk_result;
+
+    // Chỉ xóa thư mục nguồn khi mọi file đã được chuyển
+    if (result == 0) result = remove_source_dirs(&dirs, 0, verbose);
+    dir_list_free(&dirs);
+    return result;
+}
+
+static int move_remote_tree_to_local(const char *remote_dir, const char *local_dir, mode_t mode,
+                                     transfer_engine_t *engine, dir_list_t *dirs, int verbose) {
+    if (mkdir(local_dir, mode) != 0) {
+        fprintf(stderr, "Error creating local directory %s: %s\n", local_dir, strerror(errno));
+        return -errno;
+    }
+    if (verbose) printf("Created local directory: %s\n", local_dir);
+    int result = dir_list_add(dirs, remote_dir);
+    if (result != 0) return result;
+
+    LIBSSH2_SFTP_HANDLE *dir_handle = sftp_opendir_remote(remote_dir);
+    if (!dir_handle) {
+        fprintf(stderr, "Error opening remote directory: %s\n", remote_dir);
+        return -EIO;
     }
 
-    const char *source = argv[optind];
-    const char *destination = argv[optind + 1];
+    char filename[512];
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    while (result == 0) {
+        int rc = sftp_readdir_remote(dir_handle, filename, sizeof(filename), &attrs);
+        if (rc == 0) break;
+        if (rc < 0) {
+            fprintf(stderr, "Error reading remote directory %s\n", remote_dir);
+            result = -EIO;
+            break;
+        }
+        if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) continue;
 
+        char remote_path[PATH_MAX];
+        char local_path[PATH_MAX];
+        if (snprintf(remote_path, sizeof(remote_path), "%s/%s", remote_dir, filename) >= (int)sizeof(remote_path) ||
+            snprintf(local_path, sizeof(local_path), "%s/%s", local_dir, filename) >= (int)sizeof(local_path)) {
+            fprintf(stderr, "Error: Path too long for %s/%s\n", remote_dir, filename);
+            result = -ENAMETOOLONG;
+            break;
+        }
+
+        int has_mode = attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS;
+        if (has_mode && LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
+            result = move_remote_tree_to_local(remote_path, local_path, attrs.permissions & 0777,
+                                               engine, dirs, verbose);
+        } else if (has_mode && LIBSSH2_SFTP_S_ISREG(attrs.permissions)) {
+            result = transfer_engine_submit(engine, TRANSFER_DOWNLOAD, remote_path, local_path,
+                                            (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ? attrs.filesize
+                                                                                   : TRANSFER_SIZE_UNKNOWN,
+                                            (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) ? attrs.mtime
+                                                                                        : TRANSFER_MTIME_UNKNOWN);
+        } else {
+            fprintf(stderr, "Warning: %s is not a regular file or directory, leaving it in place\n", remote_path);
+        }
+    }
+
+    sftp_closedir_remote(dir_handle);
+    return result;
+}
+
+// Chuyển cả thư mục remote về local, cùng cách làm như chiều tải lên
+static int move_remote_dir_to_local(const char *remote_dir, const char *local_dir, mode_t mode,
+                                    int jobs, int verbose) {
+    if (g_batch_engine) {
+        return move_remote_tree_to_local(remote_dir, local_dir, mode, g_batch_engine,
+                                         &g_batch_remote_dirs, verbose);
+    }
+
+    dir_list_t dirs = {0};
+    transfer_engine_t *engine = transfer_engine_create(ssh_cli_conn, jobs, TRANSFER_MOVE, verbose);
+    if (!engine) return -ENOMEM;
+
+    int result = move_remote_tree_to_local(remote_dir, local_dir, mode, engine, &dirs, verbose);
+    int move_result = transfer_engine_finish(engine);
+    if (result == 0) result = move_result;
+
+    if (result == 0) result = remove_source_dirs(&dirs, 1, verbose);
+    dir_list_free(&dirs);
+    return result;
+}
+
+// Đích của một thư mục phải chưa tồn tại (không gộp vào thư mục có sẵn)
+static int remote_path_exists(const char *remote_path) {
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    return sftp_stat_remote(remote_path, &attrs) == 0;
+}
+
+// Mount point chung của mọi đường dẫn remote trong lô (chuỗi rỗng nếu tất cả
+// đều local). Cả lô dùng một kết nối, nên các mount point khác nhau bị từ chối
+static int batch_mount_point(const batch_t *batch, char *mount_point, size_t size) {
+    mount_point[0] = '\0';
+    for (size_t i = 0; i < batch->count; i++) {
+        const char *paths[2] = { batch->ops[i].source, batch->ops[i].destination };
+        for (int p = 0; p < 2; p++) {
+            char path_mount[PATH_MAX];
+            if (!is_remote_path(paths[p], path_mount, sizeof(path_mount))) continue;
+            if (mount_point[0] == '\0') {
+                strncpy(mount_point, path_mount, size - 1);
+                mount_point[size - 1] = '\0';
+            } else if (strcmp(mount_point, path_mount) != 0) {
+                fprintf(stderr, "Error: All remote paths must be on one mount point (%s and %s)\n",
+                        mount_point, path_mount);
+                return -EINVAL;
+            }
+        }
+    }
+    return 0;
+}
+
+// Với nhiều nguồn, đích chung phải là thư mục có sẵn (như mv)
+static int target_is_directory(const char *path, int verbose) {
+    char mount_point[PATH_MAX];
+    if (is_remote_path(path, mount_point, sizeof(mount_point))) {
+        char remote_path[PATH_MAX];
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+        return get_remote_path(path, remote_path, sizeof(remote_path), verbose) == 0 &&
+               sftp_stat_remote(remote_path, &attrs) == 0 &&
+               (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
+    }
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Chuyển một cặp nguồn/đích (một đối số nguồn của lệnh hoặc một dòng của
+// --from-file) trên kết nối đã thiết lập. Trả về 0 nếu thành công, 1 nếu lỗi
+static int move_one(const char *source, const char *destination, int jobs, int verbose) {
+    int result = 1;
     char source_mount_point[PATH_MAX] = {0};
     char dest_mount_point[PATH_MAX] = {0};
     int source_is_remote = (is_remote_path(source, source_mount_point, sizeof(source_mount_point)) != NULL);
@@ -283,29 +465,6 @@ int main(int argc, char *argv[]) {
         if (dest_is_remote) printf("Destination mount point: %s\n", dest_mount_point);
     }
 
-    const char *relevant_mount_point = NULL;
-    if (source_is_remote) {
-        relevant_mount_point = source_mount_point;
-    } else if (dest_is_remote) {
-        relevant_mount_point = dest_mount_point;
-    }
-
-    // Chỉ thiết lập kết nối nếu cần (một trong hai là remote)
-    if (relevant_mount_point) {
-        if (setup_connection(relevant_mount_point, verbose) != 0) {
-            libssh2_exit(); // <-- Dọn dẹp trước khi thoát
-            return 1;
-        }
-    } else if (!source_is_remote && !dest_is_remote) {
-        // Trường hợp cả hai đều local, không cần kết nối SSH
-    } else {
-        // Trường hợp không xác định được mount point liên quan (lỗi logic?)
-        fprintf(stderr, "Error: Could not determine relevant mount point for operation.\n");
-        libssh2_exit();
-        return 1;
-    }
-
-
     if (source_is_remote && dest_is_remote) {
         // Thử thực hiện rename trên remote nếu cả hai cùng mount point
         if (strcmp(source_mount_point, dest_mount_point) == 0) {
@@ -317,6 +476,22 @@ int main(int argc, char *argv[]) {
                  fprintf(stderr, "Error: Cannot determine remote paths for rename operation.\n");
                  result = 1;
              } else {
+                 // Đích là thư mục có sẵn: chuyển vào bên trong, như mv
+                 LIBSSH2_SFTP_ATTRIBUTES dest_attrs;
+                 size_t dest_len = strlen(remote_dest_path);
+                 if (sftp_stat_remote(remote_dest_path, &dest_attrs) == 0 &&
+                     (dest_attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) &&
+                     LIBSSH2_SFTP_S_ISDIR(dest_attrs.permissions)) {
+                     char *source_dup = strdup(remote_source_path);
+                     if (!source_dup) { perror("strdup"); return 1; }
+                     int ret = snprintf(remote_dest_path + dest_len, sizeof(remote_dest_path) - dest_len,
+                                        "/%s", basename(source_dup));
+                     free(source_dup);
+                     if (ret < 0 || (size_t)ret >= sizeof(remote_dest_path) - dest_len) {
+                         fprintf(stderr, "Error: Destination path string too long.\n");
+                         return 1;
+                     }
+                 }
                  if (verbose) {
                      printf("Attempting remote rename from %s to %s\n", remote_source_path, remote_dest_path);
                  }
@@ -336,21 +511,14 @@ int main(int argc, char *argv[]) {
     } else if (!source_is_remote && !dest_is_remote) {
         fprintf(stderr, "Note: Both paths are local, using system mv\n");
 
-        char cmd[PATH_MAX * 2 + 20]; // Tăng kích thước buffer
-        // Đảm bảo source và destination được bao trong dấu nháy kép
-        int ret = snprintf(cmd, sizeof(cmd), "/bin/mv \"%s\" \"%s\"", source, destination);
-         if (ret < 0 || (size_t)ret >= sizeof(cmd)) {
-             fprintf(stderr, "Error: Command string too long.\n");
-             result = 1;
-         } else {
-             result = system(cmd);
-             if (result != 0) {
-                  fprintf(stderr, "System mv command failed with exit code %d\n", result);
-                  result = 1;
-             } else {
-                  result = 0; // Thành công
-             }
-         }
+        // Chạy /bin/mv trực tiếp (không qua shell): tên file từ manifest không bị shell diễn giải
+        int status = batch_run_local("/bin/mv", NULL, source, destination);
+        if (status != 0) {
+            fprintf(stderr, "System mv command failed with exit code %d\n", status);
+            result = 1;
+        } else {
+            result = 0; // Thành công
+        }
     } else if (source_is_remote && !dest_is_remote) {
         // --- Move từ Remote về Local ---
         char remote_path[PATH_MAX];
@@ -366,10 +534,10 @@ int main(int argc, char *argv[]) {
             if (stat(destination, &dest_st) == 0 && S_ISDIR(dest_st.st_mode)) {
                 // Nếu là thư mục, tạo đường dẫn đích cuối cùng bên trong nó
                 char *source_basename_dup = strdup(source); // Cần basename của source remote
-                if (!source_basename_dup) { perror("strdup"); result = 1; goto cleanup; }
+                if (!source_basename_dup) { perror("strdup"); return 1; }
                  // Lấy basename từ remote_path thay vì source local
                  char *remote_path_dup = strdup(remote_path);
-                 if (!remote_path_dup) { perror("strdup"); free(source_basename_dup); result = 1; goto cleanup; }
+                 if (!remote_path_dup) { perror("strdup"); free(source_basename_dup); return 1; }
                  char *source_basename = basename(remote_path_dup);
 
                 int ret = snprintf(new_dest_buf, sizeof(new_dest_buf), "%s/%s",
@@ -378,8 +546,7 @@ int main(int argc, char *argv[]) {
                      fprintf(stderr, "Error: Destination path string too long.\n");
                      free(source_basename_dup);
                      free(remote_path_dup);
-                     result = 1;
-                     goto cleanup;
+                     return 1;
                  }
                 free(source_basename_dup);
                 free(remote_path_dup);
@@ -387,13 +554,34 @@ int main(int argc, char *argv[]) {
             }
             // Logic kiểm tra file đích khác tương tự cp.c
 
+            LIBSSH2_SFTP_ATTRIBUTES attrs;
+            if (sftp_stat_remote(remote_path, &attrs) != 0) {
+                fprintf(stderr, "Error: Cannot stat remote source %s\n", remote_path);
+                return 1;
+            }
+            int is_remote_dir = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
+
             if (verbose) {
                 printf("Moving from remote %s to local %s\n", remote_path, actual_destination);
             }
 
-            result = sftp_move_remote_to_local(remote_path, actual_destination);
+            if (is_remote_dir) {
+                if (access(actual_destination, F_OK) == 0) {
+                    fprintf(stderr, "Error: Destination %s already exists\n", actual_destination);
+                    return 1;
+                }
+                result = move_remote_dir_to_local(remote_path, actual_destination, attrs.permissions & 0777,
+                                                  jobs, verbose);
+            } else {
+                result = move_single_file(TRANSFER_DOWNLOAD, remote_path, actual_destination,
+                                          (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ? attrs.filesize
+                                                                                 : TRANSFER_SIZE_UNKNOWN,
+                                          (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) ? attrs.mtime
+                                                                                      : TRANSFER_MTIME_UNKNOWN,
+                                          jobs, verbose);
+            }
             if (result != 0) {
-                fprintf(stderr, "Error moving file: %s\n", strerror(-result));
+                fprintf(stderr, "Error moving %s: %s\n", source, strerror(-result));
                 result = 1; // Đánh dấu lỗi
             } else {
                  result = 0; // Thành công
@@ -410,15 +598,7 @@ int main(int argc, char *argv[]) {
              struct stat source_st;
              if (stat(source, &source_st) != 0) {
                  fprintf(stderr, "Error: Cannot stat local source %s: %s\n", source, strerror(errno));
-                 result = 1;
-                 goto cleanup;
-             }
-             // Không cho phép di chuyển thư mục (chưa hỗ trợ)
-             if (S_ISDIR(source_st.st_mode)) {
-                 fprintf(stderr, "Error: Moving directories from local to remote is not currently supported by remote-mv.\n");
-                 fprintf(stderr, "Use 'remote-cp -r' instead.\n");
-                 result = 1;
-                 goto cleanup;
+                 return 1;
              }
 
 
@@ -428,12 +608,10 @@ int main(int argc, char *argv[]) {
              if (stat_rc == 0) {
                  is_remote_dir = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions);
              } else {
-                 remote_conn_info_t *conn = get_conn_info();
-                 unsigned long sftp_err = (conn && conn->sftp_session) ? libssh2_sftp_last_error(conn->sftp_session) : 0;
-                 if (sftp_error_to_errno(sftp_err) != ENOENT) {
-                     fprintf(stderr, "Error: Cannot stat remote destination %s (sftp_err: %lu)\n", remote_path, sftp_err);
-                     result = 1;
-                     goto cleanup;
+                 int stat_err = sftp_last_errno();
+                 if (stat_err != -ENOENT) {
+                     fprintf(stderr, "Error: Cannot stat remote destination %s: %s\n", remote_path, strerror(-stat_err));
+                     return 1;
                  }
                  // Nếu không tồn tại, is_remote_dir = 0
              }
@@ -445,7 +623,7 @@ int main(int argc, char *argv[]) {
             if (is_remote_dir) {
                 // Đích là thư mục remote, tạo đường dẫn cuối cùng bên trong nó
                 char *source_basename_dup = strdup(source);
-                if (!source_basename_dup) { perror("strdup"); result = 1; goto cleanup; }
+                if (!source_basename_dup) { perror("strdup"); return 1; }
                 char *source_basename = basename(source_basename_dup);
                 int remote_len = strlen(remote_path);
 
@@ -454,16 +632,14 @@ int main(int argc, char *argv[]) {
                       if (ret < 0 || (size_t)ret >= sizeof(final_remote_path_buf)) {
                           fprintf(stderr, "Error: Final remote path string too long.\n");
                           free(source_basename_dup);
-                          result = 1;
-                          goto cleanup;
+                          return 1;
                       }
                 } else {
                      int ret = snprintf(final_remote_path_buf, sizeof(final_remote_path_buf), "%s/%s", remote_path, source_basename);
                       if (ret < 0 || (size_t)ret >= sizeof(final_remote_path_buf)) {
                           fprintf(stderr, "Error: Final remote path string too long.\n");
                           free(source_basename_dup);
-                          result = 1;
-                          goto cleanup;
+                          return 1;
                       }
                 }
                 free(source_basename_dup);
@@ -475,21 +651,21 @@ int main(int argc, char *argv[]) {
                 printf("Moving from local %s to remote %s\n", source, final_remote_path);
             }
 
-            // Đảm bảo đích remote không phải là thư mục nếu nguồn là file
-            if (is_remote_dir && !S_ISDIR(source_st.st_mode)) {
-                 // Trường hợp này đã được xử lý bằng cách tạo final_remote_path bên trong thư mục
-            } else if (is_remote_dir && S_ISDIR(source_st.st_mode)) {
-                 // Đã chặn ở trên
-            } else if (!is_remote_dir && S_ISDIR(source_st.st_mode)) {
-                 // Đã chặn ở trên
-            } else if (!is_remote_dir && !S_ISDIR(source_st.st_mode) && stat_rc == 0) {
-                 // Cả hai đều là file, ghi đè
+            if (S_ISDIR(source_st.st_mode)) {
+                // Thư mục: đích cuối cùng phải chưa tồn tại
+                if (remote_path_exists(final_remote_path)) {
+                    fprintf(stderr, "Error: Destination %s already exists\n", final_remote_path);
+                    return 1;
+                }
+                result = move_local_dir_to_remote(source, final_remote_path, jobs, verbose);
+            } else {
+                // File: ghi đè file đích nếu đã có
+                result = move_single_file(TRANSFER_UPLOAD, source, final_remote_path,
+                                          (libssh2_uint64_t)source_st.st_size,
+                                          (unsigned long)source_st.st_mtime, jobs, verbose);
             }
-
-
-            result = sftp_move_local_to_remote(source, final_remote_path);
             if (result != 0) {
-                fprintf(stderr, "Error moving file: %s\n", strerror(-result));
+                fprintf(stderr, "Error moving %s: %s\n", source, strerror(-result));
                 result = 1; // Đánh dấu lỗi
             } else {
                  result = 0; // Thành công
@@ -500,8 +676,165 @@ int main(int argc, char *argv[]) {
          result = 1;
     }
 
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    // ---> KHỞI TẠO LIBSSH2 <---
+    if (libssh2_init(0) != 0) {
+        fprintf(stderr, "Error initializing libssh2\n");
+        return 1;
+    }
+
+    int verbose = 0;
+    int jobs = 1;
+    const char *from_file = NULL;
+    int result = 1; // Mặc định là lỗi
+
+    static struct option long_options[] = {
+        {"help",     no_argument, 0, 'h'},
+        {"verbose",  no_argument, 0, 'v'},
+        {"jobs",     required_argument, 0, 'j'},
+        {"from-file", required_argument, 0, OPT_FROM_FILE},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    int option_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "hvj:", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'h':
+                show_usage(argv[0]);
+                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+                return 0;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'j': {
+                char *end = NULL;
+                long n = strtol(optarg, &end, 10);
+                if (!end || *end != '\0' || n < 1 || n > TRANSFER_JOBS_MAX) {
+                    fprintf(stderr, "Error: -j expects a number between 1 and %d\n", TRANSFER_JOBS_MAX);
+                    libssh2_exit();
+                    return 1;
+                }
+                jobs = (int)n;
+                break;
+            }
+            case OPT_FROM_FILE:
+                from_file = optarg;
+                break;
+            default:
+                show_usage(argv[0]);
+                libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+                return 1;
+        }
+    }
+
+    batch_t batch = {0};
+    const char *target_dir = NULL; // Đích chung của các nguồn, phải là thư mục
+    if (from_file) {
+        // --from-file: đối số còn lại (nếu có) là đích của các dòng chỉ ghi nguồn
+        if (argc - optind > 1) {
+            fprintf(stderr, "Error: --from-file takes at most one destination argument.\n");
+            show_usage(argv[0]);
+            libssh2_exit();
+            return 1;
+        }
+        if (argc - optind == 1) target_dir = argv[optind];
+        if (batch_read_manifest(&batch, from_file, target_dir) != 0) {
+            batch_free(&batch);
+            libssh2_exit();
+            return 1;
+        }
+        if (batch.count == 0) {
+            fprintf(stderr, "Error: %s lists no files to move.\n", from_file);
+            batch_free(&batch);
+            libssh2_exit();
+            return 1;
+        }
+    } else {
+        if (argc - optind < 2) {
+            fprintf(stderr, "Error: Source and destination arguments are required.\n");
+            show_usage(argv[0]);
+            libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+            return 1;
+        }
+        const char *destination = argv[argc - 1];
+        if (argc - optind > 2) target_dir = destination;
+        for (int i = optind; i < argc - 1; i++) {
+            if (batch_add(&batch, argv[i], destination) != 0) {
+                perror("batch_add");
+                batch_free(&batch);
+                libssh2_exit();
+                return 1;
+            }
+        }
+    }
+
+    char mount_point[PATH_MAX];
+    if (batch_mount_point(&batch, mount_point, sizeof(mount_point)) != 0) {
+        batch_free(&batch);
+        libssh2_exit();
+        return 1;
+    }
+
+    // Chỉ thiết lập kết nối nếu cần (có đường dẫn remote), một lần cho cả lô
+    if (mount_point[0] != '\0') {
+        if (setup_connection(mount_point, verbose) != 0) {
+            batch_free(&batch);
+            libssh2_exit(); // <-- Dọn dẹp trước khi thoát
+            return 1;
+        }
+    }
+
+    if (target_dir && !target_is_directory(target_dir, verbose)) {
+        fprintf(stderr, "Error: Target '%s' is not a directory\n", target_dir);
+        result = 1;
+        goto cleanup;
+    }
+
+    if (batch.count > 1 && ssh_cli_conn) {
+        g_batch_engine = transfer_engine_create(ssh_cli_conn, jobs, TRANSFER_MOVE, verbose);
+        if (!g_batch_engine) {
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+    result = 0;
+    for (size_t i = 0; i < batch.count; i++) {
+        // Như với -j, lỗi đầu tiên trong hàng đợi dừng các thao tác còn lại
+        if (g_batch_engine && transfer_engine_error(g_batch_engine) != 0) {
+            fprintf(stderr, "Error: Skipping the remaining %zu operation(s) after a failed move\n",
+                    batch.count - i);
+            result = 1;
+            break;
+        }
+        if (move_one(batch.ops[i].source, batch.ops[i].destination, jobs, verbose) != 0) {
+            result = 1;
+        }
+    }
+    if (g_batch_engine) {
+        int move_result = transfer_engine_finish(g_batch_engine);
+        g_batch_engine = NULL;
+        if (move_result != 0) {
+            fprintf(stderr, "Error during move: %s\n", strerror(-move_result));
+            result = 1;
+        } else {
+            // Mọi file đã được chuyển: xóa các thư mục nguồn đã rỗng
+            if (remove_source_dirs(&g_batch_local_dirs, 0, verbose) != 0) result = 1;
+            if (remove_source_dirs(&g_batch_remote_dirs, 1, verbose) != 0) result = 1;
+        }
+    }
 cleanup:
+    batch_free(&batch);
+    dir_list_free(&g_batch_local_dirs);
+    dir_list_free(&g_batch_remote_dirs);
+
     // Đóng kết nối SSH nếu đã mở
+    control_disconnect();
     if (ssh_cli_conn) {
         sftp_disconnect(ssh_cli_conn);
 
@@ -0,0 +1,399 @@
+#include "registry.h"
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REGISTRY_FIELDS         6     // mount_point, remote_path, host, user, key_path, password
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    uint32_t count;
+    uint32_t entry_size;
+    uint32_t strings_off;
+    uint32_t strings_len;
+} registry_header_t;
+
+typedef struct {
+    uint32_t str[REGISTRY_FIELDS];
+    int32_t port;
+    uint32_t flags;
+} registry_record_t;
+
+struct registry {
+    const char *map;
+    size_t size;
+    const registry_header_t *header;
+    const registry_record_t *records;
+    const char *strings;
+};
+
+// --- Reading ---
+
+static int registry_validate(const registry_t *reg) {
+    const registry_header_t *h = reg->header;
+    if (reg->size < sizeof(*h) || h->magic != REGISTRY_MAGIC || h->version != REGISTRY_VERSION ||
+        h->entry_size != sizeof(registry_record_t)) {
+        return -1;
+    }
+    uint64_t records_end = sizeof(*h) + (uint64_t)h->count * sizeof(registry_record_t);
+    if (h->strings_off != records_end || (uint64_t)h->strings_off + h->strings_len != reg->size) {
+        return -1;
+    }
+    // Every string ends inside the table once its last byte is a NUL
+    if (h->strings_len > 0 && reg->strings[h->strings_len - 1] != '\0') {
+        return -1;
+    }
+    for (uint32_t i = 0; i < h->count; i++) {
+        const registry_record_t *r = &reg->records[i];
+        if (r->str[0] == REGISTRY_NONE) return -1;
+        for (int f = 0; f < REGISTRY_FIELDS; f++) {
+            if (r->str[f] != REGISTRY_NONE && r->str[f] >= h->strings_len) return -1;
+        }
+    }
+    return 0;
+}
+
+registry_t *registry_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if ((uintmax_t)st.st_size < sizeof(registry_header_t) || (uintmax_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    registry_t *reg = calloc(1, sizeof(registry_t));
+    if (!reg) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    reg->size = (size_t)st.st_size;
+    void *map = mmap(NULL, reg->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        free(reg);
+        errno = err;
+        return NULL;
+    }
+
+    reg->map = map;
+    reg->header = map;
+    reg->records = (const registry_record_t *)(reg->map + sizeof(registry_header_t));
+    reg->strings = reg->map + reg->header->strings_off;
+    if (registry_validate(reg) != 0) {
+        LOG_WARN("Ignoring damaged registry %s", path);
+        registry_close(reg);
+        errno = EINVAL;
+        return NULL;
+    }
+    return reg;
+}
+
+void registry_close(registry_t *reg) {
+    if (!reg) return;
+    munmap((void *)reg->map, reg->size);
+    free(reg);
+}
+
+uint64_t registry_generation(const registry_t *reg) {
+    return reg->header->generation;
+}
+
+int registry_stale(const registry_t *reg, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+    registry_header_t h;
+    ssize_t n = pread(fd, &h, sizeof(h), 0);
+    close(fd);
+    return n != (ssize_t)sizeof(h) || h.generation != reg->header->generation;
+}
+
+size_t registry_count(const registry_t *reg) {
+    return reg->header->count;
+}
+
+static const char *registry_string(const registry_t *reg, uint32_t off) {
+    return off == REGISTRY_NONE ? NULL : reg->strings + off;
+}
+
+void registry_get(const registry_t *reg, size_t index, registry_entry_t *entry) {
+    const registry_record_t *r = &reg->records[index];
+    entry->mount_point = registry_string(reg, r->str[0]);
+    entry->remote_path = registry_string(reg, r->str[1]);
+    entry->host = registry_string(reg, r->str[2]);
+    entry->user = registry_string(reg, r->str[3]);
+    entry->key_path = registry_string(reg, r->str[4]);
+    entry->password = registry_string(reg, r->str[5]);
+    entry->port = r->port;
+    entry->flags = r->flags;
+}
+
+int registry_find(const registry_t *reg, const char *mount_point, size_t len, registry_entry_t *entry) {
+    size_t lo = 0, hi = reg->header->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *mp = reg->strings + reg->records[mid].str[0];
+        int c = strncmp(mount_point, mp, len);
+        if (c == 0) c = mp[len] == '\0' ? 0 : -1;
+        if (c == 0) {
+            if (entry) registry_get(reg, mid, entry);
+            return 0;
+        }
+        if (c < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+// --- Writing ---
+
+static void registry_entry_free(registry_entry_t *e) {
+    free((char *)e->mount_point);
+    free((char *)e->remote_path);
+    free((char *)e->host);
+    free((char *)e->user);
+    free((char *)e->key_path);
+    free((char *)e->password);
+}
+
+static int registry_strdup(const char **dst, const char *src) {
+    *dst = NULL;
+    if (!src) return 0;
+    *dst = strdup(src);
+    return *dst ? 0 : -ENOMEM;
+}
+
+registry_entry_t *registry_list_find(registry_list_t *list, const char *mount_point) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (strcmp(list->entries[i].mount_point, mount_point) == 0) return &list->entries[i];
+    }
+    return NULL;
+}
+
+// Copy entry to the end of the list, without looking for its mount point
+static int registry_list_append(registry_list_t *list, const registry_entry_t *entry) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 16;
+        registry_entry_t *grown = realloc(list->entries, cap * sizeof(registry_entry_t));
+        if (!grown) return -ENOMEM;
+        list->entries = grown;
+        list->cap = cap;
+    }
+
+    registry_entry_t *copy = &list->entries[list->count];
+    *copy = (registry_entry_t){ .port = entry->port, .flags = entry->flags };
+    if (!entry->mount_point) return -EINVAL;
+    if (registry_strdup(&copy->mount_point, entry->mount_point) != 0 ||
+        registry_strdup(&copy->remote_path, entry->remote_path) != 0 ||
+        registry_strdup(&copy->host, entry->host) != 0 ||
+        registry_strdup(&copy->user, entry->user) != 0 ||
+        registry_strdup(&copy->key_path, entry->key_path) != 0 ||
+        registry_strdup(&copy->password, entry->password) != 0) {
+        registry_entry_free(copy);
+        return -ENOMEM;
+    }
+    list->count++;
+    return 0;
+}
+
+int registry_list_set(registry_list_t *list, const registry_entry_t *entry) {
+    int rc = registry_list_append(list, entry);
+    if (rc != 0) return rc;
+
+    // Replace an existing entry with the copy just made
+    registry_entry_t *existing = registry_list_find(list, entry->mount_point);
+    if (existing != &list->entries[list->count - 1]) {
+        registry_entry_free(existing);
+        *existing = list->entries[--list->count];
+    }
+    return 0;
+}
+
+int registry_list_remove(registry_list_t *list, const char *mount_point) {
+    registry_entry_t *e = registry_list_find(list, mount_point);
+    if (!e) return -ENOENT;
+    registry_entry_free(e);
+    *e = list->entries[--list->count];
+    return 0;
+}
+
+void registry_list_free(registry_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        registry_entry_free(&list->entries[i]);
+    }
+    free(list->entries);
+    list->entries = NULL;
+    list->count = list->cap = 0;
+}
+
+static int registry_entry_cmp(const void *a, const void *b) {
+    return strcmp(((const registry_entry_t *)a)->mount_point, ((const registry_entry_t *)b)->mount_point);
+}
+
+static uint32_t registry_put_string(char *strings, uint32_t *len, const char *s) {
+    if (!s) return REGISTRY_NONE;
+    uint32_t off = *len;
+    size_t n = strlen(s) + 1;
+    memcpy(strings + off, s, n);
+    *len += (uint32_t)n;
+    return off;
+}
+
+static int registry_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Serialize the (sorted) list into a new file next to path and rename it over path
+static int registry_write(const char *path, const registry_list_t *list, uint64_t generation) {
+    uint64_t strings_size = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const registry_entry_t *e = &list->entries[i];
+        const char *fields[REGISTRY_FIELDS] = { e->mount_point, e->remote_path, e->host,
+                                                e->user, e->key_path, e->password };
+        for (int f = 0; f < REGISTRY_FIELDS; f++) {
+            if (fields[f]) strings_size += strlen(fields[f]) + 1;
+        }
+    }
+    uint64_t records_size = (uint64_t)list->count * sizeof(registry_record_t);
+    if (sizeof(registry_header_t) + records_size + strings_size > UINT32_MAX) {
+        return -EFBIG;
+    }
+
+    registry_header_t header = {
+        .magic = REGISTRY_MAGIC,
+        .version = REGISTRY_VERSION,
+        .generation = generation,
+        .count = (uint32_t)list->count,
+        .entry_size = sizeof(registry_record_t),
+        .strings_off = (uint32_t)(sizeof(registry_header_t) + records_size),
+    };
+    registry_record_t *records = calloc(list->count ? list->count : 1, sizeof(registry_record_t));
+    char *strings = malloc(strings_size ? strings_size : 1);
+    if (!records || !strings) {
+        free(records);
+        free(strings);
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        const registry_entry_t *e = &list->entries[i];
+        registry_record_t *r = &records[i];
+        r->str[0] = registry_put_string(strings, &header.strings_len, e->mount_point);
+        r->str[1] = registry_put_string(strings, &header.strings_len, e->remote_path);
+        r->str[2] = registry_put_string(strings, &header.strings_len, e->host);
+        r->str[3] = registry_put_string(strings, &header.strings_len, e->user);
+        r->str[4] = registry_put_string(strings, &header.strings_len, e->key_path);
+        r->str[5] = registry_put_string(strings, &header.strings_len, e->password);
+        r->port = e->port;
+        r->flags = e->flags;
+    }
+
+    char *temp_path = malloc(strlen(path) + 32);
+    if (!temp_path) {
+        free(records);
+        free(strings);
+        return -ENOMEM;
+    }
+    sprintf(temp_path, "%s.tmp.%ld", path, (long)getpid());
+
+    // 0600: the registry holds passwords
+    int result = 0;
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        result = -errno;
+    } else {
+        result = registry_write_all(fd, &header, sizeof(header));
+        if (result == 0) result = registry_write_all(fd, records, (size_t)records_size);
+        if (result == 0) result = registry_write_all(fd, strings, header.strings_len);
+        if (result == 0 && fsync(fd) != 0) result = -errno;
+        if (close(fd) != 0 && result == 0) result = -errno;
+        if (result == 0 && rename(temp_path, path) != 0) result = -errno;
+        if (result != 0) unlink(temp_path);
+    }
+
+    free(temp_path);
+    free(records);
+    free(strings);
+    return result;
+}
+
+int registry_update(const char *path, registry_edit_t edit, void *arg) {
+    char *lock_path = malloc(strlen(path) + 8);
+    if (!lock_path) return -ENOMEM;
+    sprintf(lock_path, "%s.lock", path);
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(lock_path);
+    if (lock_fd < 0) return -errno;
+    while (flock(lock_fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            int err = errno;
+            close(lock_fd);
+            return -err;
+        }
+    }
+
+    // Current contents, read under the lock so no concurrent update is lost
+    registry_list_t list = { 0 };
+    uint64_t generation = 0;
+    int result = 0;
+    registry_t *reg = registry_open(path);
+    if (reg) {
+        generation = registry_generation(reg);
+        for (size_t i = 0; i < registry_count(reg) && result == 0; i++) {
+            registry_entry_t e;
+            registry_get(reg, i, &e);
+            result = registry_list_append(&list, &e);
+        }
+        registry_close(reg);
+    } else {
+        if (errno != ENOENT) LOG_WARN("Rebuilding registry %s", path);
+        list.created = 1;
+    }
+
+    if (result == 0) result = edit(&list, arg);
+    if (result == 0) {
+        qsort(list.entries, list.count, sizeof(registry_entry_t), registry_entry_cmp);
+        result = registry_write(path, &list, generation + 1);
+        if (result != 0) LOG_ERR("Failed to write registry %s: %s", path, strerror(-result));
+    } else if (result > 0) {
+        result = 0;
+    }
+
+    registry_list_free(&list);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return result;
+}
@@ -0,0 +1,77 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary registry of mounts and their connection settings
+// (~/.config/remotefs/registry.bin, see mount_config.c). Readers map the file
+// read-only and binary-search its entries, which are sorted by mount point,
+// without parsing or locking anything. Writers take an flock on a side lock
+// file, build the new contents, write them to a temporary file and rename it
+// over the registry, so a reader sees either the old or the new file, never a
+// partial one. Each write bumps the generation stored in the header.
+//
+// Layout (host byte order, the file never leaves the machine):
+//   header   magic, version, generation, entry count/size, string table
+//   entries  count fixed-size records, strings given as table offsets
+//   strings  NUL-terminated strings
+
+#define REGISTRY_MAGIC          0x47455246u   // "FREG"
+#define REGISTRY_VERSION        1
+#define REGISTRY_NONE           UINT32_MAX    // Offset of a field that is not set
+
+// Entry flags
+#define REGISTRY_CONNECTION     0x1           // Connection settings saved, not just the remote path
+
+typedef struct {
+    const char *mount_point;
+    const char *remote_path;
+    const char *host;
+    const char *user;
+    const char *key_path;
+    const char *password;
+    int port;
+    uint32_t flags;
+} registry_entry_t;
+
+// --- Reading ---
+
+typedef struct registry registry_t;
+
+// Map the registry at path. NULL with errno set when there is none (ENOENT)
+// or it cannot be used (EINVAL for a damaged or foreign file).
+registry_t *registry_open(const char *path);
+void registry_close(registry_t *reg);
+uint64_t registry_generation(const registry_t *reg);
+// Non-zero when the file at path was replaced since reg was mapped
+int registry_stale(const registry_t *reg, const char *path);
+
+size_t registry_count(const registry_t *reg);
+// Strings of the returned entries point into the mapping (valid until registry_close)
+void registry_get(const registry_t *reg, size_t index, registry_entry_t *entry);
+// Entry whose mount point is the first len bytes of mount_point, in O(log n). 0 or -1.
+int registry_find(const registry_t *reg, const char *mount_point, size_t len, registry_entry_t *entry);
+
+// --- Writing ---
+
+// Editable copy of the entries; the list owns its strings
+typedef struct {
+    registry_entry_t *entries;
+    size_t count;
+    size_t cap;
+    int created;                // There was no usable registry before this update
+} registry_list_t;
+
+// Add entry or replace the one with the same mount point (strings are copied)
+int registry_list_set(registry_list_t *list, const registry_entry_t *entry);
+registry_entry_t *registry_list_find(registry_list_t *list, const char *mount_point);
+int registry_list_remove(registry_list_t *list, const char *mount_point);
+void registry_list_free(registry_list_t *list);
+
+// Called with the writer lock held on the current entries. Returns 0 to
+// write the list back, 1 to leave the registry untouched, or a negative errno.
+typedef int (*registry_edit_t)(registry_list_t *list, void *arg);
+int registry_update(const char *path, registry_edit_t edit, void *arg);
+
+#endif // REGISTRY_H
@@ -1,11 +1,279 @@
 #include "remote_proc_fuse.h"
 #include "ssh_sftp_client.h"
+#include "sftp_pool.h"
+#include "block_cache.h"
+#include "disk_cache.h"
+#include "control.h"
+#include "sftp_loop.h"
+#include "rp_lowlevel.h"
 #include <libssh2_sftp.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
 #include "common.h"
 
-static char* build_remote_path(const char *fuse_path) {
+// Adaptive read-ahead buffer. Sequential reads (offset == end of the previous
+// read) double the prefetch window on every refill; any random read collapses
+// it to zero so the next read goes straight to the caller's buffer.
+typedef struct {
+    char *data;
+    size_t cap;                 // Allocated size of data
+    libssh2_uint64_t start;     // File offset of data[0]
+    size_t len;                 // Valid bytes in data
+    int eof;                    // The last refill hit end of file
+    size_t window;              // Current prefetch size (0 = no prefetch)
+    libssh2_uint64_t last_end;  // offset + size of the previous kernel read
+    unsigned long hits;
+    unsigned long misses;
+} rp_readahead_t;
+
+#define RP_READAHEAD_MIN        (128 * 1024)
+
+// Write-back buffer: contiguous kernel writes are collected here and sent as
+// one large positioned write, which libssh2 turns into pipelined WRITEs.
+typedef struct {
+    char *data;
+    size_t cap;                 // Allocated size of data
+    libssh2_uint64_t start;     // File offset of data[0]
+    size_t len;                 // Bytes not yet sent
+    int error;                  // Failed flush not yet reported (negative errno)
+} rp_writeback_t;
+
+// Per-open-file state stored in fi->fh. SFTP handles belong to the session
+// that opened them, so every later operation on the file goes to that slot.
+typedef struct {
+    LIBSSH2_SFTP_HANDLE *handle;
+    int slot;
+    libssh2_uint64_t pos;       // Offset the handle's READ pipeline will deliver next
+    rp_readahead_t ra;
+    rp_writeback_t wb;
+    char *remote_path;
+    int cacheable;              // Reads may use the shared block cache (read-only, size/mtime known)
+    libssh2_uint64_t size;      // Attributes at open time, used to validate cached blocks
+    unsigned long mtime;
+} rp_file_t;
+
+// Mount-wide read-ahead counters, reported when the filesystem is unmounted
+static unsigned long rp_ra_hits = 0;
+static unsigned long rp_ra_misses = 0;
+
+static inline rp_file_t *rp_file(struct fuse_file_info *fi) {
+    return fi ? (rp_file_t *)(uintptr_t)fi->fh : NULL;
+}
+
+// The mount-wide connection info (holds the pool), regardless of any
+// session the current thread has checked out.
+static remote_conn_info_t *rp_mount_conn(void) {
+    if (fuse_ll_conn) return fuse_ll_conn;
+    struct fuse_context *fc = fuse_get_context();
+    if (fc && fc->private_data)
+        return (remote_conn_info_t*)fc->private_data;
+    return NULL;
+}
+
+// Check out the session for this request: the owning session for open files,
+// otherwise any free one. get_conn_info() returns it until rp_session_end().
+static remote_conn_info_t *rp_session_begin(struct fuse_file_info *fi) {
+    remote_conn_info_t *mount = rp_mount_conn();
+    if (!mount || !mount->pool) return NULL;
+
+    rp_file_t *file = rp_file(fi);
+    if (file) {
+        return sftp_pool_checkout_slot(mount->pool, file->slot);
+    }
+    return sftp_pool_checkout(mount->pool);
+}
+
+static void rp_session_end(remote_conn_info_t *conn) {
+    remote_conn_info_t *mount = rp_mount_conn();
+    if (conn && mount && mount->pool) {
+        sftp_pool_checkin(mount->pool, conn);
+    }
+}
+
+// Wrap a freshly opened handle, pinning it to the session checked out by this
+// thread. Takes ownership of remote_path.
+static rp_file_t *rp_file_new(LIBSSH2_SFTP_HANDLE *handle, char *remote_path) {
+    remote_conn_info_t *mount = rp_mount_conn();
+    rp_file_t *file = calloc(1, sizeof(rp_file_t));
+    if (!file) {
+        LOG_ERR("Failed to allocate file handle state");
+        free(remote_path);
+        return NULL;
+    }
+    file->handle = handle;
+    file->remote_path = remote_path;
+    file->slot = sftp_pool_slot_of(mount ? mount->pool : NULL, get_conn_info());
+    return file;
+}
+
+// Forget cached contents of a remote path after it was modified through the mount
+static void rp_cache_invalidate(const char *remote_path) {
+    block_cache_invalidate(remote_path);
+    disk_cache_invalidate(remote_path);
+}
+
+static void rp_file_free(rp_file_t *file) {
+    if (!file) return;
+    free(file->ra.data);
+    free(file->wb.data);
+    free(file->remote_path);
+    free(file);
+}
+
+// Read len bytes at offset, serving whole blocks from the shared block cache
+// or the persistent disk cache when possible and filling both with what has
+// to come from the server. Missing blocks are fetched as one aligned run
+// through the READ pipeline.
+static ssize_t rp_fetch(rp_file_t *file, char *buf, size_t len, libssh2_uint64_t offset, size_t window) {
+    if (!file->cacheable || (!block_cache_enabled() && !disk_cache_enabled())) {
+        return sftp_pread_remote(file->handle, &file->pos, buf, len, offset, window);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        libssh2_uint64_t cur = offset + done;
+        libssh2_uint64_t index = cur / BLOCK_CACHE_BLOCK_SIZE;
+        size_t boff = (size_t)(cur % BLOCK_CACHE_BLOCK_SIZE);
+
+        ssize_t n = block_cache_get(file->remote_path, file->size, file->mtime,
+                                    index, boff, buf + done, len - done);
+        if (n >= 0) {
+            // A cached block shorter than the block size is the end of the file
+            int at_eof = (size_t)n < len - done && boff + (size_t)n < BLOCK_CACHE_BLOCK_SIZE;
+            done += (size_t)n;
+            if (at_eof) break;
+            continue;
+        }
+
+        char *tmp = NULL;
+        size_t run = BLOCK_CACHE_BLOCK_SIZE;
+        ssize_t got = -1;
+        int from_disk = 0;
+
+        // Not in memory: a previous mount may have left the block on disk
+        if (disk_cache_enabled() && (tmp = malloc(run)) != NULL) {
+            got = disk_cache_get(file->remote_path, file->size, file->mtime, index, tmp);
+            from_disk = got >= 0;
+        }
+
+        if (!from_disk) {
+            libssh2_uint64_t last = (offset + len - 1) / BLOCK_CACHE_BLOCK_SIZE;
+            run = (size_t)(last - index + 1) * BLOCK_CACHE_BLOCK_SIZE;
+            free(tmp);
+            tmp = malloc(run);
+            if (!tmp) return done ? (ssize_t)done : -ENOMEM;
+
+            got = sftp_pread_remote(file->handle, &file->pos, tmp, run,
+                                    index * BLOCK_CACHE_BLOCK_SIZE, window);
+            if (got < 0) {
+                free(tmp);
+                return done ? (ssize_t)done : got;
+            }
+        }
+
+        // Cache every full block plus the short block that marks EOF
+        for (size_t o = 0; o <= (size_t)got && o < run; o += BLOCK_CACHE_BLOCK_SIZE) {
+            size_t blen = (size_t)got - o;
+            if (blen > BLOCK_CACHE_BLOCK_SIZE) blen = BLOCK_CACHE_BLOCK_SIZE;
+            libssh2_uint64_t bindex = index + o / BLOCK_CACHE_BLOCK_SIZE;
+            block_cache_put(file->remote_path, file->size, file->mtime, bindex, tmp + o, blen);
+            if (!from_disk) {
+                disk_cache_put(file->remote_path, file->size, file->mtime, bindex, tmp + o, blen);
+            }
+            if (blen < BLOCK_CACHE_BLOCK_SIZE) break;
+        }
+
+        size_t take = 0;
+        if ((size_t)got > boff) {
+            take = (size_t)got - boff;
+            if (take > len - done) take = len - done;
+            memcpy(buf + done, tmp + boff, take);
+        }
+        free(tmp);
+        done += take;
+        if ((size_t)got < run) break; // EOF
+    }
+    return (ssize_t)done;
+}
+
+static void rp_readahead_invalidate(rp_file_t *file) {
+    file->ra.len = 0;
+    file->ra.eof = 0;
+}
+
+// Serve a read from the read-ahead buffer, refilling it from the SFTP
+// pipeline on a miss. Returns bytes copied or a negative errno.
+static ssize_t rp_readahead_read(rp_file_t *file, char *buf, size_t size,
+                                 libssh2_uint64_t offset, const remote_conn_info_t *conn) {
+    rp_readahead_t *ra = &file->ra;
+    size_t window = (size_t)conn->read_window_kb * 1024;
+    size_t max = (size_t)conn->readahead_kb * 1024;
+    int sequential = (offset == ra->last_end);
+    ra->last_end = offset + size;
+
+    size_t done = 0;
+    if (ra->len > 0 && offset >= ra->start && offset < ra->start + ra->len) {
+        size_t avail = (size_t)(ra->start + ra->len - offset);
+        done = avail < size ? avail : size;
+        memcpy(buf, ra->data + (offset - ra->start), done);
+        if (done == size || ra->eof) {
+            ra->hits++;
+            __atomic_fetch_add(&rp_ra_hits, 1, __ATOMIC_RELAXED);
+            return (ssize_t)done;
+        }
+    }
+
+    ra->misses++;
+    __atomic_fetch_add(&rp_ra_misses, 1, __ATOMIC_RELAXED);
+
+    if (sequential) {
+        ra->window = ra->window ? ra->window * 2 : RP_READAHEAD_MIN;
+        if (ra->window > max) ra->window = max;
+    } else {
+        ra->window = 0;
+    }
+
+    size_t want = size - done;
+    libssh2_uint64_t at = offset + done;
+
+    if (ra->window <= want) {
+        ssize_t n = rp_fetch(file, buf + done, want, at, window);
+        if (n < 0) return done ? (ssize_t)done : n;
+        return (ssize_t)(done + n);
+    }
+
+    if (ra->cap < ra->window) {
+        char *grown = realloc(ra->data, ra->window);
+        if (!grown) {
+            LOG_WARN("read-ahead: cannot grow buffer to %zu bytes, reading directly", ra->window);
+            ra->window = 0;
+            ssize_t n = rp_fetch(file, buf + done, want, at, window);
+            if (n < 0) return done ? (ssize_t)done : n;
+            return (ssize_t)(done + n);
+        }
+        ra->data = grown;
+        ra->cap = ra->window;
+    }
+
+    ssize_t n = rp_fetch(file, ra->data, ra->window, at, window);
+    if (n < 0) {
+        rp_readahead_invalidate(file);
+        return done ? (ssize_t)done : n;
+    }
+    ra->start = at;
+    ra->len = (size_t)n;
+    ra->eof = ((size_t)n < ra->window);
+
+    size_t take = (size_t)n < want ? (size_t)n : want;
+    memcpy(buf + done, ra->data, take);
+    return (ssize_t)(done + take);
+}
+
+char* build_remote_path(const char *fuse_path) {
     remote_conn_info_t *conn = get_conn_info();
     if (!conn) return NULL;
 
@@ -19,6 +287,678 @@ static char* build_remote_path(const char *fuse_path) {
     return remote_path;
 }
 
+// Userspace attribute cache keyed by FUSE path. Holds the raw SFTP attributes
+// for -o attr_cache_ttl seconds, independently of the kernel attr_timeout, so
+// nested lookups (access, rename) and repeated stats skip the round trip.
+// Paths that returned ENOENT are kept as negative entries for
+// -o negative_cache_ttl seconds.
+typedef struct rp_attr_entry {
+    char *path;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int negative;               // Path known not to exist
+    long long expires_ms;
+    struct rp_attr_entry *next;
+} rp_attr_entry_t;
+
+#define RP_ATTR_BUCKETS    16384
+#define RP_ATTR_MAX        65536
+
+static struct {
+    rp_attr_entry_t *buckets[RP_ATTR_BUCKETS];
+    size_t count;
+    long long ttl_ms;
+    long long neg_ttl_ms;
+    unsigned long hits;
+    unsigned long neg_hits;
+    unsigned long misses;
+    pthread_mutex_t lock;
+} rp_attr_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static long long rp_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int rp_attr_enabled(void) {
+    return rp_attr_cache.ttl_ms > 0 || rp_attr_cache.neg_ttl_ms > 0;
+}
+
+static size_t rp_attr_slot(const char *path) {
+    size_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h % RP_ATTR_BUCKETS;
+}
+
+// Remove expired entries; called with the lock held when the table is full
+static void rp_attr_sweep(long long now) {
+    for (size_t i = 0; i < RP_ATTR_BUCKETS; i++) {
+        rp_attr_entry_t **pp = &rp_attr_cache.buckets[i];
+        while (*pp) {
+            rp_attr_entry_t *e = *pp;
+            if (e->expires_ms <= now) {
+                *pp = e->next;
+                free(e->path);
+                free(e);
+                rp_attr_cache.count--;
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+}
+
+// Returns 1 with attrs filled, -1 if the path is cached as missing, 0 on a miss
+static int rp_attr_get(const char *path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    if (!rp_attr_enabled()) return 0;
+
+    int found = 0;
+    long long now = rp_now_ms();
+    pthread_mutex_lock(&rp_attr_cache.lock);
+    for (rp_attr_entry_t *e = rp_attr_cache.buckets[rp_attr_slot(path)]; e; e = e->next) {
+        if (strcmp(e->path, path) == 0) {
+            if (e->expires_ms > now) {
+                if (e->negative) {
+                    found = -1;
+                } else {
+                    *attrs = e->attrs;
+                    found = 1;
+                }
+            }
+            break;
+        }
+    }
+    if (found > 0) rp_attr_cache.hits++;
+    else if (found < 0) rp_attr_cache.neg_hits++;
+    else rp_attr_cache.misses++;
+    pthread_mutex_unlock(&rp_attr_cache.lock);
+    return found;
+}
+
+// Store attributes, or a negative entry when attrs is NULL
+static void rp_attr_store(const char *path, const LIBSSH2_SFTP_ATTRIBUTES *attrs, long long ttl_ms) {
+    if (ttl_ms <= 0) return;
+
+    long long now = rp_now_ms();
+    size_t slot = rp_attr_slot(path);
+    pthread_mutex_lock(&rp_attr_cache.lock);
+    rp_attr_entry_t *e = rp_attr_cache.buckets[slot];
+    while (e && strcmp(e->path, path) != 0) e = e->next;
+
+    if (!e) {
+        if (rp_attr_cache.count >= RP_ATTR_MAX) rp_attr_sweep(now);
+        if (rp_attr_cache.count >= RP_ATTR_MAX ||
+            !(e = calloc(1, sizeof(rp_attr_entry_t))) || !(e->path = strdup(path))) {
+            free(e);
+            pthread_mutex_unlock(&rp_attr_cache.lock);
+            return;
+        }
+        e->next = rp_attr_cache.buckets[slot];
+        rp_attr_cache.buckets[slot] = e;
+        rp_attr_cache.count++;
+    }
+    if (attrs) e->attrs = *attrs;
+    e->negative = attrs == NULL;
+    e->expires_ms = now + ttl_ms;
+    pthread_mutex_unlock(&rp_attr_cache.lock);
+}
+
+static void rp_attr_put(const char *path, const LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    rp_attr_store(path, attrs, rp_attr_cache.ttl_ms);
+}
+
+static void rp_attr_put_negative(const char *path) {
+    rp_attr_store(path, NULL, rp_attr_cache.neg_ttl_ms);
+}
+
+static void rp_attr_invalidate(const char *path) {
+    if (!rp_attr_enabled()) return;
+
+    pthread_mutex_lock(&rp_attr_cache.lock);
+    rp_attr_entry_t **pp = &rp_attr_cache.buckets[rp_attr_slot(path)];
+    while (*pp && strcmp((*pp)->path, path) != 0) pp = &(*pp)->next;
+    if (*pp) {
+        rp_attr_entry_t *e = *pp;
+        *pp = e->next;
+        free(e->path);
+        free(e);
+        rp_attr_cache.count--;
+    }
+    pthread_mutex_unlock(&rp_attr_cache.lock);
+}
+
+// Drop a path, everything below it (renamed/removed directories) and its
+// parent, whose mtime and link count change with the entry.
+static void rp_attr_invalidate_tree(const char *path) {
+    if (!rp_attr_enabled()) return;
+
+    size_t len = strlen(path);
+    pthread_mutex_lock(&rp_attr_cache.lock);
+    for (size_t i = 0; i < RP_ATTR_BUCKETS; i++) {
+        rp_attr_entry_t **pp = &rp_attr_cache.buckets[i];
+        while (*pp) {
+            rp_attr_entry_t *e = *pp;
+            if (strncmp(e->path, path, len) == 0 && (e->path[len] == '\0' || e->path[len] == '/')) {
+                *pp = e->next;
+                free(e->path);
+                free(e);
+                rp_attr_cache.count--;
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&rp_attr_cache.lock);
+}
+
+static void rp_attr_invalidate_parent(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) return;
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    char *parent = strndup(path, len);
+    if (parent) {
+        rp_attr_invalidate(parent);
+        free(parent);
+    }
+}
+
+static void rp_attr_clear(void) {
+    pthread_mutex_lock(&rp_attr_cache.lock);
+    for (size_t i = 0; i < RP_ATTR_BUCKETS; i++) {
+        while (rp_attr_cache.buckets[i]) {
+            rp_attr_entry_t *e = rp_attr_cache.buckets[i];
+            rp_attr_cache.buckets[i] = e->next;
+            free(e->path);
+            free(e);
+        }
+    }
+    rp_attr_cache.count = 0;
+    pthread_mutex_unlock(&rp_attr_cache.lock);
+}
+
+// Directory listing cache. opendir takes a snapshot of the whole listing
+// (names sorted, plus the attributes READDIR returned) and keeps it in
+// fi->fh, so readdir can page through it with stable offsets without going
+// back to the server. Snapshots are shared through a small LRU list for
+// -o dir_cache_ttl seconds; after that, an unchanged directory mtime renews
+// them with a single STAT instead of a new listing.
+typedef struct {
+    char *name;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int has_attrs;              // attrs describe the entry itself (not a symlink)
+} rp_dirent_t;
+
+typedef struct rp_dir {
+    char *path;
+    rp_dirent_t *entries;       // Sorted by name
+    size_t count;
+    unsigned long mtime;        // Directory mtime when listed
+    int mtime_valid;            // mtime is old enough to reveal later changes
+    long long expires_ms;
+    int refs;                   // Cache reference plus open directory handles
+    struct rp_dir *prev, *next; // Cache list, most recently used first
+} rp_dir_t;
+
+#define RP_DIR_CACHE_MAX_DIRS     1024
+#define RP_DIR_CACHE_MAX_ENTRIES  (256 * 1024)
+
+static struct {
+    rp_dir_t *head;
+    rp_dir_t *tail;
+    size_t dirs;
+    size_t entries;
+    long long ttl_ms;
+    unsigned long gen;          // Bumped by every invalidation
+    unsigned long hits;
+    unsigned long renewed;
+    unsigned long misses;
+    pthread_mutex_t lock;
+} rp_dir_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void rp_dir_free(rp_dir_t *dir) {
+    for (size_t i = 0; i < dir->count; i++) free(dir->entries[i].name);
+    free(dir->entries);
+    free(dir->path);
+    free(dir);
+}
+
+// Drop one reference; called with the lock held
+static void rp_dir_unref_locked(rp_dir_t *dir) {
+    if (--dir->refs == 0) rp_dir_free(dir);
+}
+
+static void rp_dir_release(rp_dir_t *dir) {
+    if (!dir) return;
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    rp_dir_unref_locked(dir);
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+}
+
+static void rp_dir_unlink_locked(rp_dir_t *dir) {
+    if (dir->prev) dir->prev->next = dir->next; else rp_dir_cache.head = dir->next;
+    if (dir->next) dir->next->prev = dir->prev; else rp_dir_cache.tail = dir->prev;
+    dir->prev = dir->next = NULL;
+    rp_dir_cache.dirs--;
+    rp_dir_cache.entries -= dir->count;
+}
+
+static void rp_dir_push_front_locked(rp_dir_t *dir) {
+    dir->prev = NULL;
+    dir->next = rp_dir_cache.head;
+    if (rp_dir_cache.head) rp_dir_cache.head->prev = dir;
+    rp_dir_cache.head = dir;
+    if (!rp_dir_cache.tail) rp_dir_cache.tail = dir;
+    rp_dir_cache.dirs++;
+    rp_dir_cache.entries += dir->count;
+}
+
+// Look a directory up. Returns a referenced snapshot, with *stale set when its
+// TTL has run out and it must be revalidated before use, or NULL.
+static rp_dir_t *rp_dir_cache_get(const char *path, int *stale) {
+    *stale = 0;
+    if (rp_dir_cache.ttl_ms <= 0) return NULL;
+
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    rp_dir_t *dir = rp_dir_cache.head;
+    while (dir && strcmp(dir->path, path) != 0) dir = dir->next;
+    if (dir) {
+        dir->refs++;
+        *stale = dir->expires_ms <= rp_now_ms();
+        rp_dir_unlink_locked(dir);
+        rp_dir_push_front_locked(dir);
+        if (!*stale) rp_dir_cache.hits++;
+    } else {
+        rp_dir_cache.misses++;
+    }
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+    return dir;
+}
+
+// Cache a snapshot (or renew its TTL). Skipped when an invalidation happened
+// since gen was read, as the listing may predate that change. Returns 1 if cached.
+static int rp_dir_cache_put(rp_dir_t *dir, unsigned long gen) {
+    if (rp_dir_cache.ttl_ms <= 0) return 0;
+
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    if (rp_dir_cache.gen != gen) {
+        pthread_mutex_unlock(&rp_dir_cache.lock);
+        return 0;
+    }
+    for (rp_dir_t *old = rp_dir_cache.head; old; old = old->next) {
+        if (old != dir && strcmp(old->path, dir->path) == 0) {
+            rp_dir_unlink_locked(old);
+            rp_dir_unref_locked(old);
+            break;
+        }
+    }
+    dir->expires_ms = rp_now_ms() + rp_dir_cache.ttl_ms;
+    if (!dir->prev && !dir->next && rp_dir_cache.head != dir) {
+        dir->refs++;
+        rp_dir_push_front_locked(dir);
+    }
+    while ((rp_dir_cache.dirs > RP_DIR_CACHE_MAX_DIRS || rp_dir_cache.entries > RP_DIR_CACHE_MAX_ENTRIES) &&
+           rp_dir_cache.tail && rp_dir_cache.tail != dir) {
+        rp_dir_t *victim = rp_dir_cache.tail;
+        rp_dir_unlink_locked(victim);
+        rp_dir_unref_locked(victim);
+    }
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+    return 1;
+}
+
+// Forget the listing of a directory (len bytes of path) whose entries changed
+static void rp_dir_invalidate_n(const char *path, size_t len) {
+    if (rp_dir_cache.ttl_ms <= 0) return;
+
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    rp_dir_cache.gen++;
+    for (rp_dir_t *dir = rp_dir_cache.head; dir; dir = dir->next) {
+        if (strncmp(dir->path, path, len) == 0 && dir->path[len] == '\0') {
+            rp_dir_unlink_locked(dir);
+            rp_dir_unref_locked(dir);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+}
+
+// Forget the listing of the directory containing path
+static void rp_dir_invalidate_parent(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (slash) rp_dir_invalidate_n(path, slash == path ? 1 : (size_t)(slash - path));
+}
+
+// Forget the listings of a directory and everything below it
+static void rp_dir_invalidate_tree(const char *path) {
+    if (rp_dir_cache.ttl_ms <= 0) return;
+
+    size_t len = strlen(path);
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    rp_dir_cache.gen++;
+    rp_dir_t *dir = rp_dir_cache.head;
+    while (dir) {
+        rp_dir_t *next = dir->next;
+        if (strncmp(dir->path, path, len) == 0 && (dir->path[len] == '\0' || dir->path[len] == '/')) {
+            rp_dir_unlink_locked(dir);
+            rp_dir_unref_locked(dir);
+        }
+        dir = next;
+    }
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+}
+
+static void rp_dir_cache_clear(void) {
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    while (rp_dir_cache.head) {
+        rp_dir_t *dir = rp_dir_cache.head;
+        rp_dir_unlink_locked(dir);
+        rp_dir_unref_locked(dir);
+    }
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+}
+
+static int rp_dirent_cmp(const void *a, const void *b) {
+    return strcmp(((const rp_dirent_t *)a)->name, ((const rp_dirent_t *)b)->name);
+}
+
+// Whether a fresh cached listing of path's parent contains its last component:
+// 1 if listed, 0 if absent, -1 if no usable listing is cached.
+static int rp_dir_has_entry(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (rp_dir_cache.ttl_ms <= 0 || !slash || slash[1] == '\0') return -1;
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    rp_dirent_t key = { .name = (char *)(slash + 1) };
+
+    int found = -1;
+    long long now = rp_now_ms();
+    pthread_mutex_lock(&rp_dir_cache.lock);
+    for (rp_dir_t *dir = rp_dir_cache.head; dir; dir = dir->next) {
+        if (strncmp(dir->path, path, len) == 0 && dir->path[len] == '\0') {
+            if (dir->expires_ms > now) {
+                found = bsearch(&key, dir->entries, dir->count, sizeof(rp_dirent_t), rp_dirent_cmp) != NULL;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rp_dir_cache.lock);
+    return found;
+}
+
+// Send the buffered writes of a handle. The data is dropped on failure and
+// the error returned, so it is reported exactly once.
+static int rp_writeback_flush(rp_file_t *file, const char *path) {
+    rp_writeback_t *wb = &file->wb;
+    if (wb->len == 0) return 0;
+
+    LOG_DEBUG("write-back: flushing %zu bytes at offset %llu for %s",
+              wb->len, (unsigned long long)wb->start, path ? path : "N/A");
+
+    // Writing moves the handle offset and discards queued READs
+    file->pos = SFTP_POS_UNKNOWN;
+    ssize_t rc = sftp_pwrite_remote(file->handle, wb->data, wb->len, wb->start);
+    wb->len = 0;
+
+    // Readers may have cached the old contents while the data sat here
+    rp_cache_invalidate(file->remote_path);
+    if (path) {
+        rp_attr_invalidate(path);
+        rp_dir_invalidate_parent(path);
+    }
+
+    if (rc < 0) {
+        LOG_ERR("write-back: flush failed for %s (error code: %zd)", path ? path : "N/A", rc);
+        return (int)rc;
+    }
+    return 0;
+}
+
+// Flush and return any error a previous flush left for the caller
+static int rp_writeback_sync(rp_file_t *file, const char *path) {
+    int ret = rp_writeback_flush(file, path);
+    if (ret == 0) ret = file->wb.error;
+    file->wb.error = 0;
+    return ret;
+}
+
+// Flush ahead of an operation that cannot report the write error itself
+// (reads, getattr, truncate); the next write, flush or close reports it.
+static void rp_writeback_settle(rp_file_t *file, const char *path) {
+    int ret = rp_writeback_flush(file, path);
+    if (ret != 0 && file->wb.error == 0) file->wb.error = ret;
+}
+
+// STAT on the event loop when it runs, so the request shares the loop's
+// session with every other one in flight. Otherwise, once the loop has
+// stopped or when it did not answer in time, on this thread's pool session
+// (checked out here if needed).
+static int rp_stat_remote(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    remote_conn_info_t *mount = rp_mount_conn();
+    if (mount && mount->loop) {
+        int rc = sftp_loop_stat(mount->loop, remote_path, attrs);
+        if (rc != -ENOTCONN && rc != -ETIMEDOUT) return rc;
+    }
+
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int rc = 0;
+    if (sftp_stat_remote(remote_path, attrs) != 0) {
+        unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
+        int err = sftp_error_to_errno(sftp_err);
+        rc = err ? -err : -EIO;
+    }
+    rp_session_end(conn);
+    return rc;
+}
+
+// A fresh listing of the parent directory that lacks the name answers ENOENT
+// as well as a negative entry does
+int rp_stat_cached(const char *path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    int cached = rp_attr_get(path, attrs);
+    if (cached > 0) return 1;
+    if (cached < 0) return -ENOENT;
+
+    if (rp_attr_cache.neg_ttl_ms > 0 && rp_dir_has_entry(path) == 0) {
+        __atomic_fetch_add(&rp_attr_cache.neg_hits, 1, __ATOMIC_RELAXED);
+        return -ENOENT;
+    }
+    return 0;
+}
+
+void rp_stat_store(const char *path, const LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    if (attrs) rp_attr_put(path, attrs);
+    else rp_attr_put_negative(path);
+}
+
+// Stat a path through the attribute cache. Returns 0 or a negative errno.
+// ENOENT answers are cached too.
+static int rp_stat(const char *path, const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    int cached = rp_stat_cached(path, attrs);
+    if (cached) return cached > 0 ? 0 : cached;
+
+    int rc = rp_stat_remote(remote_path, attrs);
+    if (rc == 0) rp_stat_store(path, attrs);
+    else if (rc == -ENOENT) rp_stat_store(path, NULL);
+    return rc;
+}
+
+
+// List a remote directory into a new snapshot holding one reference.
+// Entry attributes also seed the attribute cache.
+static int rp_dir_load(const char *path, const char *remote_path, rp_dir_t **out) {
+    LIBSSH2_SFTP_ATTRIBUTES dir_attrs;
+    int have_mtime = rp_stat(path, remote_path, &dir_attrs) == 0 &&
+                     (dir_attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME);
+
+    LIBSSH2_SFTP_HANDLE *handle = sftp_opendir_remote(remote_path);
+    if (!handle) {
+        remote_conn_info_t *conn = get_conn_info();
+        unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
+        int err = sftp_error_to_errno(sftp_err);
+
+        LOG_ERR("readdir: sftp_opendir_remote failed for path '%s', sftp_err=%lu -> errno=%d",
+                path, sftp_err, err);
+
+        if (err == ENOSYS || err == EIO) {
+             LOG_ERR("readdir: Assuming path '%s' is not a directory.", path);
+             return -ENOTDIR;
+        }
+
+        return err ? -err : -EIO;
+    }
+
+    rp_dir_t *dir = calloc(1, sizeof(rp_dir_t));
+    if (!dir || !(dir->path = strdup(path))) {
+        free(dir);
+        sftp_closedir_remote(handle);
+        return -ENOMEM;
+    }
+    dir->refs = 1;
+    if (have_mtime) {
+        // A directory changed within the last second can change again without
+        // its (second-granularity) mtime moving, so it is never renewed by mtime
+        dir->mtime = dir_attrs.mtime;
+        dir->mtime_valid = (long long)time(NULL) - (long long)dir_attrs.mtime > 1;
+    }
+
+    char entry_buffer[512];
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    size_t cap = 0;
+    int rc;
+
+    while ((rc = sftp_readdir_remote(handle, entry_buffer, sizeof(entry_buffer), &attrs)) > 0) {
+        if (strcmp(entry_buffer, ".") == 0 || strcmp(entry_buffer, "..") == 0) {
+            continue;
+        }
+        if (dir->count == cap) {
+            size_t new_cap = cap ? cap * 2 : 64;
+            rp_dirent_t *grown = realloc(dir->entries, new_cap * sizeof(rp_dirent_t));
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            dir->entries = grown;
+            cap = new_cap;
+        }
+        rp_dirent_t *ent = &dir->entries[dir->count];
+        if (!(ent->name = strdup(entry_buffer))) {
+            rc = -1;
+            break;
+        }
+        ent->attrs = attrs;
+        // READDIR returns lstat-style attributes; symlinks are left to getattr,
+        // which reports the target
+        ent->has_attrs = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && !S_ISLNK(attrs.permissions);
+        dir->count++;
+
+        if (ent->has_attrs) {
+            char child[PATH_MAX];
+            int n = snprintf(child, sizeof(child), "%s/%s", strcmp(path, "/") == 0 ? "" : path, entry_buffer);
+            if (n > 0 && (size_t)n < sizeof(child)) rp_attr_put(child, &attrs);
+        }
+    }
+    sftp_closedir_remote(handle);
+
+    if (rc < 0) {
+        LOG_ERR("readdir: Error reading remote directory %s", path);
+        rp_dir_free(dir);
+        return -EIO;
+    }
+
+    qsort(dir->entries, dir->count, sizeof(rp_dirent_t), rp_dirent_cmp);
+    LOG_DEBUG("readdir: listed %zu entries of %s", dir->count, path);
+    *out = dir;
+    return 0;
+}
+
+// Get a referenced snapshot of a directory: from the cache, renewed by an
+// mtime check once expired, or freshly listed. Needs a checked-out session.
+static int rp_dir_acquire(const char *path, rp_dir_t **out) {
+    unsigned long gen = __atomic_load_n(&rp_dir_cache.gen, __ATOMIC_ACQUIRE);
+    int stale;
+    rp_dir_t *dir = rp_dir_cache_get(path, &stale);
+
+    char *remote_path = build_remote_path(path);
+    if (!remote_path) {
+        rp_dir_release(dir);
+        return -ENOMEM;
+    }
+
+    if (dir && stale) {
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+        int rc = sftp_stat_remote(remote_path, &attrs);
+        if (rc == 0) rp_attr_put(path, &attrs);
+        if (rc == 0 && dir->mtime_valid && (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) &&
+            attrs.mtime == dir->mtime && rp_dir_cache_put(dir, gen)) {
+            __atomic_fetch_add(&rp_dir_cache.renewed, 1, __ATOMIC_RELAXED);
+            LOG_DEBUG("readdir: %s unchanged, listing renewed", path);
+        } else {
+            rp_dir_release(dir);
+            dir = NULL;
+        }
+    }
+
+    int ret = 0;
+    if (!dir) {
+        ret = rp_dir_load(path, remote_path, &dir);
+        if (ret == 0) rp_dir_cache_put(dir, gen);
+    }
+    free(remote_path);
+    *out = ret == 0 ? dir : NULL;
+    return ret;
+}
+
+// Emit snapshot entries from offset on. Offsets are entry positions
+// (1 and 2 for "." and ".."), so the kernel can resume where it stopped.
+static void rp_dir_fill(rp_dir_t *dir, void *buf, fuse_fill_dir_t filler, off_t offset, int plus) {
+    if (offset < 1 && filler(buf, ".", NULL, 1, 0)) return;
+    if (offset < 2 && filler(buf, "..", NULL, 2, 0)) return;
+
+    for (size_t i = offset > 2 ? (size_t)offset - 2 : 0; i < dir->count; i++) {
+        rp_dirent_t *ent = &dir->entries[i];
+        off_t next = (off_t)(i + 3);
+        if (plus && ent->has_attrs) {
+            struct stat st;
+            rp_attrs_to_stat(ent->name, &ent->attrs, &st);
+            if (filler(buf, ent->name, &st, next, FUSE_FILL_DIR_PLUS)) return;
+        } else if (filler(buf, ent->name, NULL, next, 0)) {
+            return;
+        }
+    }
+}
+
+// remote_proc_path of the mount, for requests of the control socket thread,
+// which has no FUSE context to find the connection through
+static const char *rp_control_root;
+
+// A remote-cp/remote-mv request changed remote_path through the control
+// socket: drop it from every cache as if the change came through the mount.
+static void rp_control_invalidate(const char *remote_path) {
+    size_t root_len = strlen(rp_control_root);
+    while (root_len > 0 && rp_control_root[root_len - 1] == '/') root_len--;
+    if (strncmp(remote_path, rp_control_root, root_len) != 0 ||
+        (remote_path[root_len] != '\0' && remote_path[root_len] != '/')) {
+        rp_cache_invalidate(remote_path); // Outside the mount, only the content caches may know it
+        return;
+    }
+
+    const char *path = remote_path[root_len] ? remote_path + root_len : "/";
+    char *key = malloc(strlen(rp_control_root) + strlen(path) + 1);
+    if (key) {
+        // Same key as build_remote_path() for this FUSE path
+        sprintf(key, "%s%s", rp_control_root, path);
+        rp_cache_invalidate(key);
+        free(key);
+    }
+    rp_attr_invalidate_tree(path);
+    rp_attr_invalidate_parent(path);
+    rp_dir_invalidate_tree(path);
+    rp_dir_invalidate_parent(path);
+    // The kernel caches it as well when served through the low-level API
+    rp_ll_invalidate(path);
+}
+
 void* rp_init(struct fuse_conn_info *conn_info, struct fuse_config *cfg) {
     LOG_INFO("Initializing Remote Proc Filesystem...");
     remote_conn_info_t *conn = get_conn_info();
@@ -48,20 +988,82 @@ void* rp_init(struct fuse_conn_info *conn_info, struct fuse_config *cfg) {
     // To enable, add "-o async_read" to the mount command.
     // conn_info->async_read = 1; // Enable async reads
 
-    if (sftp_connect_and_auth(conn) != 0) {
+    // SFTP READDIR already returns attributes for every entry, so listings
+    // are always answered as readdirplus instead of letting the kernel guess.
+    if (conn_info->capable & FUSE_CAP_READDIRPLUS) {
+        conn_info->want |= FUSE_CAP_READDIRPLUS;
+        conn_info->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+    }
+
+    // Userspace attribute cache, independent of the kernel attr_timeout above
+    rp_attr_cache.ttl_ms = (long long)conn->attr_cache_ttl * 1000;
+    rp_attr_cache.neg_ttl_ms = (long long)conn->negative_cache_ttl * 1000;
+    rp_dir_cache.ttl_ms = (long long)conn->dir_cache_ttl * 1000;
+
+    // Shared block cache for file contents, bounded by -o cache_size=MiB
+    block_cache_init((size_t)conn->cache_size_mb * 1024 * 1024);
+    if (conn->disk_cache_dir &&
+        disk_cache_init(conn->disk_cache_dir, (size_t)conn->disk_cache_mb * 1024 * 1024,
+                        conn->remote_host, conn->remote_port) != 0) {
+        LOG_WARN("Continuing without the disk cache");
+    }
+
+    // Open the pool of SFTP sessions; FUSE worker threads check them out per request
+    conn->pool = sftp_pool_create(conn, conn->pool_size);
+    if (!conn->pool) {
         LOG_ERR("Failed to connect to remote host during init.");
         // Return conn here allows destroy to be called for cleanup
         return conn;
     }
 
-    LOG_INFO("Remote Proc Filesystem Initialized Successfully (Caching enabled: attr=%.1fs, entry=%.1fs).", cfg->attr_timeout, cfg->entry_timeout);
+    // Lookups go through the event loop when asked for; without it they use the pool
+    if (conn->event_loop && !(conn->loop = sftp_loop_start(conn))) {
+        LOG_WARN("Continuing without the event loop, stat requests use the pool");
+    }
+
+    // Serve remote-cp/remote-mv on these sessions instead of a login of their own
+    rp_control_root = conn->remote_proc_path;
+    if (conn->control_path && control_server_start(conn->control_path, conn->pool, rp_control_invalidate) != 0) {
+        LOG_WARN("Continuing without the control socket, remote-cp/remote-mv will connect on their own");
+    }
+
+    LOG_INFO("Remote Proc Filesystem Initialized Successfully (Caching enabled: attr=%.1fs, entry=%.1fs, connections=%d).", cfg->attr_timeout, cfg->entry_timeout, conn->pool->size);
     return conn;
 }
 
 void rp_destroy(void *private_data) {
     LOG_INFO("Destroying Remote Proc Filesystem...");
+    // Before the caches and the pool it works on go away
+    control_server_stop();
+    LOG_INFO("Read-ahead statistics: %lu hits, %lu misses", rp_ra_hits, rp_ra_misses);
+    LOG_INFO("Attribute cache statistics: %lu hits, %lu negative hits, %lu misses",
+             rp_attr_cache.hits, rp_attr_cache.neg_hits, rp_attr_cache.misses);
+    rp_attr_clear();
+    LOG_INFO("Directory cache statistics: %lu hits, %lu renewed by mtime, %lu misses",
+             rp_dir_cache.hits, rp_dir_cache.renewed, rp_dir_cache.misses);
+    rp_dir_cache_clear();
+    if (block_cache_enabled()) {
+        unsigned long bc_hits, bc_misses, bc_evictions;
+        size_t bc_used;
+        block_cache_stats(&bc_hits, &bc_misses, &bc_evictions, &bc_used);
+        LOG_INFO("Block cache statistics: %lu hits, %lu misses, %lu evictions, %zu KiB in use",
+                 bc_hits, bc_misses, bc_evictions, bc_used / 1024);
+    }
+    block_cache_destroy();
+    if (disk_cache_enabled()) {
+        unsigned long dc_hits, dc_misses, dc_evictions;
+        size_t dc_used;
+        disk_cache_stats(&dc_hits, &dc_misses, &dc_evictions, &dc_used);
+        LOG_INFO("Disk cache statistics: %lu hits, %lu misses, %lu evictions, %zu MiB on disk",
+                 dc_hits, dc_misses, dc_evictions, dc_used / (1024 * 1024));
+    }
+    disk_cache_destroy();
     remote_conn_info_t *conn = (remote_conn_info_t*)private_data;
     if (conn) {
+        sftp_loop_stop(conn->loop);
+        conn->loop = NULL;
+        sftp_pool_destroy(conn->pool);
+        conn->pool = NULL;
         sftp_disconnect(conn);
         free(conn->remote_host);
         free(conn->remote_user);
@@ -71,28 +1073,12 @@ void rp_destroy(void *private_data) {
     LOG_INFO("Remote Proc Filesystem Destroyed.");
 }
 
-int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
-    (void) fi;
-    LOG_DEBUG("getattr: %s", path);
+// Fill a struct stat from SFTP attributes, with defaults for missing fields
+void rp_attrs_to_stat(const char *path, const LIBSSH2_SFTP_ATTRIBUTES *attrs, struct stat *stbuf) {
     memset(stbuf, 0, sizeof(struct stat));
 
-    char *remote_path = build_remote_path(path);
-    if (!remote_path) return -ENOMEM;
-
-    LIBSSH2_SFTP_ATTRIBUTES attrs;
-    int rc = sftp_stat_remote(remote_path, &attrs);
-    free(remote_path);
-
-    if (rc != 0) {
-        remote_conn_info_t *conn = get_conn_info();
-        unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-        int err = sftp_error_to_errno(sftp_err);
-        LOG_DEBUG("getattr: sftp_stat_remote failed for %s, rc=%d, sftp_err=%lu -> errno=%d", path, rc, sftp_err, err);
-        return -err ? -err : -EIO;
-    }
-
-    if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
-        stbuf->st_mode = attrs.permissions;
+    if (attrs->flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+        stbuf->st_mode = attrs->permissions;
     } else {
         if (strcmp(path, "/") == 0) {
              stbuf->st_mode = S_IFDIR | 0555;
@@ -101,9 +1087,9 @@ int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
         }
     }
 
-    if (attrs.flags & LIBSSH2_SFTP_ATTR_UIDGID) {
-        stbuf->st_uid = attrs.uid;
-        stbuf->st_gid = attrs.gid;
+    if (attrs->flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+        stbuf->st_uid = attrs->uid;
+        stbuf->st_gid = attrs->gid;
     } else {
         stbuf->st_uid = getuid();
         stbuf->st_gid = getgid();
@@ -115,8 +1101,8 @@ int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
         stbuf->st_nlink = 1;
     }
 
-    if (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) {
-        stbuf->st_size = attrs.filesize;
+    if (attrs->flags & LIBSSH2_SFTP_ATTR_SIZE) {
+        stbuf->st_size = attrs->filesize;
     
         remote_conn_info_t *conn = get_conn_info();
         if (S_ISREG(stbuf->st_mode) && stbuf->st_size == 0 &&
@@ -133,10 +1119,10 @@ int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
     stbuf->st_blksize = 4096;
     stbuf->st_blocks = (stbuf->st_size + stbuf->st_blksize - 1) / stbuf->st_blksize;
 
-    if (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
-        stbuf->st_atime = attrs.atime;
-        stbuf->st_mtime = attrs.mtime;
-        stbuf->st_ctime = attrs.mtime;
+    if (attrs->flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+        stbuf->st_atime = attrs->atime;
+        stbuf->st_mtime = attrs->mtime;
+        stbuf->st_ctime = attrs->mtime;
     } else {
         time_t now = time(NULL);
         stbuf->st_atime = now;
@@ -145,71 +1131,101 @@ int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
     }
     stbuf->st_blksize = 4096;
     stbuf->st_blocks = (stbuf->st_size + stbuf->st_blksize -1) / stbuf->st_blksize;
-
-    LOG_DEBUG("getattr OK for %s (mode: %o, size: %ld)", path, stbuf->st_mode, stbuf->st_size);
-    return 0;
 }
 
-int rp_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
-               struct fuse_file_info *fi, enum fuse_readdir_flags flags)
-{
-    (void) offset;
-    (void) fi;
-    (void) flags;
-    LOG_DEBUG("readdir: %s", path);
+static int do_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    LOG_DEBUG("getattr: %s", path);
+    memset(stbuf, 0, sizeof(struct stat));
+
+    // fstat() on a file being written should see the size including buffered data
+    rp_file_t *file = rp_file(fi);
+    if (file && file->handle) rp_writeback_settle(file, path);
 
     char *remote_path = build_remote_path(path);
     if (!remote_path) return -ENOMEM;
 
-    LIBSSH2_SFTP_HANDLE *handle = sftp_opendir_remote(remote_path);
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int rc = rp_stat(path, remote_path, &attrs);
     free(remote_path);
 
-    if (!handle) {
-        remote_conn_info_t *conn = get_conn_info();
-        unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-        int err = sftp_error_to_errno(sftp_err);
+    if (rc != 0) {
+        LOG_DEBUG("getattr: stat failed for %s -> errno=%d", path, -rc);
+        return rc;
+    }
 
-        LOG_ERR("readdir: sftp_opendir_remote failed for path '%s', sftp_err=%lu -> errno=%d",
-                path, sftp_err, err);
+    rp_attrs_to_stat(path, &attrs, stbuf);
 
-        if (err == ENOSYS || err == EIO) {
-             LOG_ERR("readdir: Assuming path '%s' is not a directory.", path);
-             return -ENOTDIR;
-        }
+    LOG_DEBUG("getattr OK for %s (mode: %o, size: %ld)", path, stbuf->st_mode, stbuf->st_size);
+    return 0;
+}
 
-        return -err ? -err : -EIO;
-    }
+int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    // A path lookup is a single STAT, which the event loop serves without
+    // holding a pool session while the reply is outstanding
+    remote_conn_info_t *mount = rp_mount_conn();
+    if (!fi && mount && mount->loop) return do_getattr(path, stbuf, fi);
+
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    if (!conn) return -ENOTCONN;
+    int ret = do_getattr(path, stbuf, fi);
+    rp_session_end(conn);
+    return ret;
+}
 
-    filler(buf, ".", NULL, 0, 0);
-    filler(buf, "..", NULL, 0, 0);
+static int do_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                      struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    (void) fi;
+    int plus = (flags & FUSE_READDIR_PLUS) != 0;
+    LOG_DEBUG("readdir: %s (offset: %ld)%s", path, (long)offset, plus ? " (plus)" : "");
 
-    char entry_buffer[512];
-    LIBSSH2_SFTP_ATTRIBUTES attrs;
-    int rc;
+    rp_dir_t *dir = NULL;
+    int ret = rp_dir_acquire(path, &dir);
+    if (ret != 0) return ret;
 
-    while (1) {
-        rc = sftp_readdir_remote(handle, entry_buffer, sizeof(entry_buffer), &attrs);
-        if (rc == 0) {
-            break;
-        } else if (rc < 0) {
-            LOG_ERR("readdir: Error reading remote directory %s", path);
-            sftp_closedir_remote(handle);
-            return -EIO;
-        } else {
-            if (strcmp(entry_buffer, ".") == 0 || strcmp(entry_buffer, "..") == 0) {
-                continue;
-            }
-            LOG_DEBUG("readdir: adding entry '%s'", entry_buffer);
-            filler(buf, entry_buffer, NULL, 0, 0);
-        }
+    rp_dir_fill(dir, buf, filler, offset, plus);
+    rp_dir_release(dir);
+    LOG_DEBUG("readdir OK for %s", path);
+    return 0;
+}
+
+int rp_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+               struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    // Directories opened through rp_opendir are served from their snapshot
+    rp_dir_t *dir = fi ? (rp_dir_t *)(uintptr_t)fi->fh : NULL;
+    if (dir) {
+        LOG_DEBUG("readdir: %s (offset: %ld, %zu entries cached)", path, (long)offset, dir->count);
+        rp_dir_fill(dir, buf, filler, offset, (flags & FUSE_READDIR_PLUS) != 0);
+        return 0;
     }
 
-    sftp_closedir_remote(handle);
-    LOG_DEBUG("readdir OK for %s", path);
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_readdir(path, buf, filler, offset, fi, flags);
+    rp_session_end(conn);
+    return ret;
+}
+
+int rp_opendir(const char *path, struct fuse_file_info *fi) {
+    LOG_DEBUG("opendir: %s", path);
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    rp_dir_t *dir = NULL;
+    int ret = rp_dir_acquire(path, &dir);
+    rp_session_end(conn);
+    if (ret == 0) fi->fh = (uint64_t)(uintptr_t)dir;
+    return ret;
+}
+
+int rp_releasedir(const char *path, struct fuse_file_info *fi) {
+    LOG_DEBUG("releasedir: %s", path ? path : "N/A");
+    rp_dir_release((rp_dir_t *)(uintptr_t)fi->fh);
+    fi->fh = 0;
     return 0;
 }
 
-int rp_open(const char *path, struct fuse_file_info *fi) {
+static int do_open(const char *path, struct fuse_file_info *fi) {
     LOG_DEBUG("open: %s (POSIX flags: 0x%x)", path, fi->flags);
     
     char *remote_path = build_remote_path(path);
@@ -242,9 +1258,8 @@ int rp_open(const char *path, struct fuse_file_info *fi) {
 
     LIBSSH2_SFTP_HANDLE *handle = sftp_open_remote(remote_path, sftp_flags, open_mode);
 
-    free(remote_path);
-
     if (!handle) {
+        free(remote_path);
         remote_conn_info_t *conn = get_conn_info();
         unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
         int err = sftp_error_to_errno(sftp_err);
@@ -260,16 +1275,55 @@ int rp_open(const char *path, struct fuse_file_info *fi) {
             free(r_path_stat);
         }
         LOG_ERR("open: sftp_open_remote failed for %s with SFTP flags 0x%lx, sftp_err=%lu -> errno=%d", path, sftp_flags, sftp_err, err);
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
 
-    fi->fh = (uint64_t)handle;
-    LOG_DEBUG("open OK for %s, handle stored: %p", path, handle);
+    // Read-only files with a size and mtime can be served from the block
+    // caches. The handle is opened all the same, so the server still decides
+    // on permissions and existence, and its fstat gives the attributes the
+    // cached blocks are validated against (the attribute cache may be stale).
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int cacheable = 0;
+    if (access_mode == O_RDONLY && (block_cache_enabled() || disk_cache_enabled()) &&
+        libssh2_sftp_fstat(handle, &attrs) == 0) {
+        if ((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && S_ISDIR(attrs.permissions)) {
+            LOG_ERR("open: Attempted to open a directory with flags 0x%x: %s", fi->flags, path);
+            sftp_close_remote(handle);
+            free(remote_path);
+            return -EISDIR;
+        }
+        rp_attr_put(path, &attrs);
+        // Files reporting size 0 (e.g. /proc entries) or no mtime are never cached
+        cacheable = (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) && attrs.filesize > 0 &&
+                    (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME);
+    }
+
+    rp_file_t *file = rp_file_new(handle, remote_path);
+    if (!file) {
+        sftp_close_remote(handle);
+        return -ENOMEM;
+    }
+    if (cacheable) {
+        file->cacheable = 1;
+        file->size = attrs.filesize;
+        file->mtime = attrs.mtime;
+    }
+    fi->fh = (uint64_t)(uintptr_t)file;
+    LOG_DEBUG("open OK for %s, handle stored: %p (session %d%s)", path, handle, file->slot,
+              cacheable ? ", cached reads" : "");
     
     return 0;
 }
 
-int rp_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+int rp_open(const char *path, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_open(path, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     LOG_DEBUG("create: %s (mode: %o)", path, mode);
     
     // Ensure files are created with read-write permissions for the owner
@@ -279,44 +1333,70 @@ int rp_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     if (!remote_path) return -ENOMEM;
     
     LIBSSH2_SFTP_HANDLE *handle = sftp_create_remote(remote_path, mode);
-    free(remote_path);
     
     if (!handle) {
+        free(remote_path);
         remote_conn_info_t *conn = get_conn_info();
         unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
         int err = sftp_error_to_errno(sftp_err);
         LOG_ERR("create: sftp_create_remote failed for %s, sftp_err=%lu -> errno=%d", path, sftp_err, err);
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
     
-    fi->fh = (uint64_t)handle;
-    LOG_DEBUG("create OK for %s, handle stored: %p", path, handle);
+    rp_cache_invalidate(remote_path);
+    rp_attr_invalidate_parent(path);
+    rp_dir_invalidate_parent(path);
+    // The kernel looks the new file up right after create; answer from the handle
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (libssh2_sftp_fstat(handle, &attrs) == 0) {
+        rp_attr_put(path, &attrs);
+    } else {
+        rp_attr_invalidate(path);
+    }
+    rp_file_t *file = rp_file_new(handle, remote_path);
+    if (!file) {
+        sftp_close_remote(handle);
+        return -ENOMEM;
+    }
+    fi->fh = (uint64_t)(uintptr_t)file;
+    LOG_DEBUG("create OK for %s, handle stored: %p (session %d)", path, handle, file->slot);
     
     return 0;
 }
 
-int rp_read(const char *path, char *buf, size_t size, off_t offset,
-            struct fuse_file_info *fi)
+int rp_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_create(path, mode, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_read(const char *path, char *buf, size_t size, off_t offset,
+                   struct fuse_file_info *fi)
 {
     LOG_DEBUG("read: %s (size: %zu, offset: %ld)", path, size, offset);
 
-    LIBSSH2_SFTP_HANDLE *handle = (LIBSSH2_SFTP_HANDLE *)fi->fh;
-    if (!handle) {
+    rp_file_t *file = rp_file(fi);
+    if (!file || !file->handle) {
         LOG_ERR("read: Invalid SFTP handle for %s", path);
         return -EBADF;
     }
+    rp_writeback_settle(file, path);
 
-    if (offset > 0) {
-        LOG_DEBUG("read: Seeking to offset %ld", offset);
-        libssh2_sftp_seek64(handle, offset);
-    } else if (offset == 0) {
-         libssh2_sftp_seek64(handle, 0);
-    }
+    // Sequential reads continue the in-flight READ pipeline; anything else seeks
+    remote_conn_info_t *conn = get_conn_info();
+    size_t window = (size_t)conn->read_window_kb * 1024;
+    ssize_t bytes_read;
 
-    ssize_t bytes_read = sftp_read_remote(handle, buf, size);
+    if (conn->readahead_kb > 0) {
+        bytes_read = rp_readahead_read(file, buf, size, (libssh2_uint64_t)offset, conn);
+    } else {
+        bytes_read = rp_fetch(file, buf, size, (libssh2_uint64_t)offset, window);
+    }
 
     if (bytes_read < 0) {
-        LOG_ERR("read: sftp_read_remote failed for %s (error code: %zd)", path, bytes_read);
+        LOG_ERR("read: remote read failed for %s (error code: %zd)", path, bytes_read);
         return (int)bytes_read;
     }
 
@@ -324,24 +1404,70 @@ int rp_read(const char *path, char *buf, size_t size, off_t offset,
     return (int)bytes_read;
 }
 
-int rp_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+int rp_read(const char *path, char *buf, size_t size, off_t offset,
+            struct fuse_file_info *fi)
+{
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    if (!conn) return -ENOTCONN;
+    int ret = do_read(path, buf, size, offset, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
     LOG_DEBUG("write: %s (size: %zu, offset: %ld)", path, size, offset);
     
-    LIBSSH2_SFTP_HANDLE *handle = (LIBSSH2_SFTP_HANDLE *)fi->fh;
+    rp_file_t *file = rp_file(fi);
+    LIBSSH2_SFTP_HANDLE *handle = file ? file->handle : NULL;
     if (!handle) {
         LOG_ERR("write: Invalid SFTP handle for %s", path);
         return -EBADF;
     }
-    
-    if (offset > 0) {
-        LOG_DEBUG("write: Seeking to offset %ld", offset);
-        libssh2_sftp_seek64(handle, offset);
+
+    rp_writeback_t *wb = &file->wb;
+    if (wb->error) {
+        int err = wb->error;
+        wb->error = 0;
+        return err;
     }
-    
-    ssize_t bytes_written = sftp_write_remote(handle, buf, size);
+
+    rp_readahead_invalidate(file);
+    rp_cache_invalidate(file->remote_path);
+    rp_attr_invalidate(path);
+    rp_dir_invalidate_parent(path);
+
+    // Append when the write continues the buffered run and still fits
+    libssh2_uint64_t off = (libssh2_uint64_t)offset;
+    if (wb->len > 0 && off == wb->start + wb->len && wb->len + size <= wb->cap) {
+        memcpy(wb->data + wb->len, buf, size);
+        wb->len += size;
+        return (int)size;
+    }
+
+    int ret = rp_writeback_flush(file, path);
+    if (ret != 0) return ret;
+
+    remote_conn_info_t *conn = get_conn_info();
+    size_t cap = (size_t)conn->write_buffer_kb * 1024;
+    if (size < cap) {
+        if (!wb->data) {
+            wb->data = malloc(cap);
+            if (wb->data) wb->cap = cap;
+        }
+        if (wb->data) {
+            memcpy(wb->data, buf, size);
+            wb->start = off;
+            wb->len = size;
+            return (int)size;
+        }
+        LOG_WARN("write: no memory for write-back buffer of %s, writing through", path);
+    }
+
+    file->pos = SFTP_POS_UNKNOWN;
+    ssize_t bytes_written = sftp_pwrite_remote(handle, buf, size, off);
     
     if (bytes_written < 0) {
-        LOG_ERR("write: sftp_write_remote failed for %s (error code: %zd)", path, bytes_written);
+        LOG_ERR("write: sftp_pwrite_remote failed for %s (error code: %zd)", path, bytes_written);
         return (int)bytes_written;
     }
     
@@ -349,25 +1475,44 @@ int rp_write(const char *path, const char *buf, size_t size, off_t offset, struc
     return (int)bytes_written;
 }
 
-int rp_release(const char *path, struct fuse_file_info *fi) {
+int rp_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    if (!conn) return -ENOTCONN;
+    int ret = do_write(path, buf, size, offset, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_release(const char *path, struct fuse_file_info *fi) {
     LOG_DEBUG("release: %s", path ? path : "N/A");
-    LIBSSH2_SFTP_HANDLE *handle = (LIBSSH2_SFTP_HANDLE *)fi->fh;
+    rp_file_t *file = rp_file(fi);
+    LIBSSH2_SFTP_HANDLE *handle = file ? file->handle : NULL;
     int ret = 0;
 
     if (handle) {
-        LOG_DEBUG("release: Closing SFTP handle %p", handle);
+        ret = rp_writeback_sync(file, path);
+        LOG_DEBUG("release: Closing SFTP handle %p (read-ahead: %lu hits, %lu misses)",
+                  handle, file->ra.hits, file->ra.misses);
         int close_rc = sftp_close_remote(handle);
         if (close_rc != 0) {
             LOG_ERR("release: sftp_close_remote reported failure for %s with libssh2_rc=%d. Reporting EIO to FUSE.", path ? path : "N/A", close_rc);
             ret = -EIO;
         }
-        fi->fh = 0;
     } else {
          LOG_DEBUG("release: No SFTP handle to close for %s", path ? path : "N/A");
     }
     return ret;
 }
 
+int rp_release(const char *path, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    int ret = conn ? do_release(path, fi) : -ENOTCONN;
+    rp_session_end(conn);
+    rp_file_free(rp_file(fi));
+    fi->fh = 0;
+    return ret;
+}
+
 int rp_access(const char *path, int mask) {
      LOG_DEBUG("access: %s (mask: %d)", path, mask);
      
@@ -430,7 +1575,7 @@ int rp_access(const char *path, int mask) {
      return 0;
 }
 
-int rp_mkdir(const char *path, mode_t mode) {
+static int do_mkdir(const char *path, mode_t mode) {
     LOG_DEBUG("mkdir: %s (mode: %o)", path, mode);
     
     char *remote_path = build_remote_path(path);
@@ -438,20 +1583,31 @@ int rp_mkdir(const char *path, mode_t mode) {
     
     int rc = sftp_mkdir_remote(remote_path, mode);
     free(remote_path);
+    rp_attr_invalidate(path);
+    rp_attr_invalidate_parent(path);
+    rp_dir_invalidate_parent(path);
     
     if (rc != 0) {
         remote_conn_info_t *conn = get_conn_info();
         unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
         int err = sftp_error_to_errno(sftp_err);
         LOG_ERR("mkdir: sftp_mkdir_remote failed for %s, sftp_err=%lu -> errno=%d", path, sftp_err, err);
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
     
     LOG_DEBUG("mkdir OK for %s", path);
     return 0;
 }
 
-int rp_rmdir(const char *path) {
+int rp_mkdir(const char *path, mode_t mode) {
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_mkdir(path, mode);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_rmdir(const char *path) {
     LOG_DEBUG("rmdir: %s", path);
     
     char *remote_path = build_remote_path(path);
@@ -459,20 +1615,32 @@ int rp_rmdir(const char *path) {
     
     int rc = sftp_rmdir_remote(remote_path);
     free(remote_path);
+    rp_attr_invalidate_tree(path);
+    rp_attr_invalidate_parent(path);
+    rp_dir_invalidate_tree(path);
+    rp_dir_invalidate_parent(path);
     
     if (rc != 0) {
         remote_conn_info_t *conn = get_conn_info();
         unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
         int err = sftp_error_to_errno(sftp_err);
         LOG_ERR("rmdir: sftp_rmdir_remote failed for %s, sftp_err=%lu -> errno=%d", path, sftp_err, err);
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
     
     LOG_DEBUG("rmdir OK for %s", path);
     return 0;
 }
 
-int rp_rename(const char *from, const char *to, unsigned int flags) {
+int rp_rmdir(const char *path) {
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_rmdir(path);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_rename(const char *from, const char *to, unsigned int flags) {
     LOG_DEBUG("rename: %s -> %s (flags: %u)", from, to, flags);
 
     if (flags) {
@@ -507,6 +1675,17 @@ int rp_rename(const char *from, const char *to, unsigned int flags) {
     // Some SFTP servers might not support all these flags, so we use a more compatible approach
     long rename_flags = 0; // Use default flags for more compatibility
 
+    rp_cache_invalidate(remote_from);
+    rp_cache_invalidate(remote_to);
+    rp_attr_invalidate_tree(from);
+    rp_attr_invalidate_tree(to);
+    rp_attr_invalidate_parent(from);
+    rp_attr_invalidate_parent(to);
+    rp_dir_invalidate_tree(from);
+    rp_dir_invalidate_tree(to);
+    rp_dir_invalidate_parent(from);
+    rp_dir_invalidate_parent(to);
+
     int rc = libssh2_sftp_rename_ex(conn->sftp_session,
                                    remote_from, strlen(remote_from),
                                    remote_to, strlen(remote_to),
@@ -528,18 +1707,27 @@ int rp_rename(const char *from, const char *to, unsigned int flags) {
             // of this quick fix. For now, we'll return the error.
         }
         
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
 
     LOG_DEBUG("rename OK: %s -> %s", from, to);
     return 0;
 }
 
-int rp_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+int rp_rename(const char *from, const char *to, unsigned int flags) {
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_rename(from, to, flags);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
     (void) path;
     LOG_DEBUG("fsync: %s (isdatasync: %d)", path ? path : "N/A", isdatasync);
 
-    LIBSSH2_SFTP_HANDLE *handle = (LIBSSH2_SFTP_HANDLE *)fi->fh;
+    rp_file_t *file = rp_file(fi);
+    LIBSSH2_SFTP_HANDLE *handle = file ? file->handle : NULL;
     if (!handle) {
         LOG_ERR("fsync: Invalid SFTP handle");
         return -EIO;
@@ -548,6 +1736,9 @@ int rp_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
     remote_conn_info_t *conn = get_conn_info();
     if (!conn || !conn->sftp_session) return -ENOTCONN;
 
+    int ret = rp_writeback_sync(file, path);
+    if (ret != 0) return ret;
+
     int rc = libssh2_sftp_fsync(handle);
 
     if (rc == LIBSSH2_ERROR_EAGAIN) {
@@ -561,15 +1752,112 @@ int rp_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
              return -ENOSYS;
         }
         LOG_ERR("fsync: libssh2_sftp_fsync failed, rc=%d, sftp_err=%lu -> errno=%d", rc, sftp_err, err);
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
 
     LOG_DEBUG("fsync OK for %s", path);
     return 0;
 }
 
-int rp_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
+int rp_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    if (!conn) return -ENOTCONN;
+    int ret = do_fsync(path, isdatasync, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+// Called on every close() of a file descriptor: send buffered writes so the
+// error, if any, reaches the application instead of the ignored release.
+static int do_flush(const char *path, struct fuse_file_info *fi) {
+    LOG_DEBUG("flush: %s", path ? path : "N/A");
+    rp_file_t *file = rp_file(fi);
+    if (!file || !file->handle) return 0;
+    return rp_writeback_sync(file, path);
+}
+
+int rp_flush(const char *path, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    if (!conn) return -ENOTCONN;
+    int ret = do_flush(path, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+// copy_file_range(2) between two files of the mount, done on the server so
+// that cp inside the mountpoint does not pull the data down and push it back:
+// a whole-file copy into an empty file runs cp --reflink=auto, other ranges
+// run dd. -EOPNOTSUPP makes the kernel fall back to read/write for this call,
+// -ENOSYS (no exec access) for the rest of the mount.
+static ssize_t do_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+                                  const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+                                  size_t size, int flags) {
+    LOG_DEBUG("copy_file_range: %s (offset: %ld) -> %s (offset: %ld), size: %zu",
+              path_in, offset_in, path_out, offset_out, size);
+    if (flags) return -EINVAL;
+
+    rp_file_t *in = rp_file(fi_in);
+    rp_file_t *out = rp_file(fi_out);
+    if (!in || !out || !out->handle) return -EBADF;
+
+    // Buffered writes of both files must reach the server before it copies.
+    // Those of the source can only be sent over its own session.
+    if (in->wb.len > 0 && in->slot != out->slot) return -EOPNOTSUPP;
+    rp_writeback_settle(in, path_in);
+    int ret = rp_writeback_sync(out, path_out);
+    if (ret != 0) return ret;
+
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (sftp_stat_remote(in->remote_path, &attrs) != 0 || !(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE)) {
+        return -EOPNOTSUPP;
+    }
+    libssh2_uint64_t src_size = attrs.filesize;
+    if (size == 0 || (libssh2_uint64_t)offset_in >= src_size) return 0;
+    libssh2_uint64_t length = src_size - (libssh2_uint64_t)offset_in;
+    if (length > size) length = size;
+
+    int whole = offset_in == 0 && offset_out == 0 && length == src_size &&
+                sftp_stat_remote(out->remote_path, &attrs) == 0 &&
+                (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) && attrs.filesize == 0;
+
+    // The destination changes behind its handle's READ pipeline and the caches
+    rp_readahead_invalidate(out);
+    out->pos = SFTP_POS_UNKNOWN;
+    rp_cache_invalidate(out->remote_path);
+    rp_attr_invalidate(path_out);
+    rp_dir_invalidate_parent(path_out);
+
+    int rc = whole ? ssh_copy_remote(in->remote_path, out->remote_path, 0)
+                   : ssh_copy_remote_range(in->remote_path, (libssh2_uint64_t)offset_in,
+                                           out->remote_path, (libssh2_uint64_t)offset_out, length);
+    if (rc == -ENOSYS) {
+        LOG_INFO("copy_file_range: the server cannot run commands, copies go through read/write");
+        return -ENOSYS;
+    }
+    if (rc != 0) return -EOPNOTSUPP;
+
+    LOG_DEBUG("copy_file_range OK: %llu bytes copied on the server (%s)",
+              (unsigned long long)length, whole ? "cp" : "dd");
+    return (ssize_t)length;
+}
+
+ssize_t rp_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+                           const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+                           size_t size, int flags) {
+    remote_conn_info_t *conn = rp_session_begin(fi_out);
+    if (!conn) return -ENOTCONN;
+    ssize_t ret = do_copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size, flags);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
     LOG_DEBUG("truncate: %s (size: %ld)", path, size);
+    if (rp_file(fi)) {
+        rp_readahead_invalidate(rp_file(fi));
+        // Buffered writes must land before the size changes under them
+        if (rp_file(fi)->handle) rp_writeback_settle(rp_file(fi), path);
+    }
     remote_conn_info_t *conn = get_conn_info();
     if (!conn || !conn->sftp_session) return -ENOTCONN;
 
@@ -584,6 +1872,9 @@ int rp_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
 
     LOG_DEBUG("SFTP setstat (truncate): %s to size %llu", remote_path, new_attrs.filesize);
 
+    rp_cache_invalidate(remote_path);
+    rp_attr_invalidate(path);
+    rp_dir_invalidate_parent(path);
     int rc = libssh2_sftp_setstat(conn->sftp_session, remote_path, &new_attrs);
 
     free(remote_path);
@@ -604,7 +1895,15 @@ int rp_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
     return 0;
 }
 
-int rp_unlink(const char *path) {
+int rp_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    remote_conn_info_t *conn = rp_session_begin(fi);
+    if (!conn) return -ENOTCONN;
+    int ret = do_truncate(path, size, fi);
+    rp_session_end(conn);
+    return ret;
+}
+
+static int do_unlink(const char *path) {
     LOG_DEBUG("unlink: %s", path);
 
     char *remote_path = build_remote_path(path);
@@ -618,6 +1917,10 @@ int rp_unlink(const char *path) {
         return -ENOTCONN;
     }
 
+    rp_cache_invalidate(remote_path);
+    rp_attr_invalidate(path);
+    rp_attr_invalidate_parent(path);
+    rp_dir_invalidate_parent(path);
     int rc = sftp_unlink_remote(remote_path);
 
     free(remote_path);
@@ -630,9 +1933,17 @@ int rp_unlink(const char *path) {
 
         if (err == ENOSYS || err == EIO) {
         }
-        return -err ? -err : -EIO;
+        return err ? -err : -EIO;
     }
 
     LOG_DEBUG("unlink OK for %s", path);
     return 0;
 }
+
+int rp_unlink(const char *path) {
+    remote_conn_info_t *conn = rp_session_begin(NULL);
+    if (!conn) return -ENOTCONN;
+    int ret = do_unlink(path);
+    rp_session_end(conn);
+    return ret;
+}
@@ -7,11 +7,43 @@
 #include <stdlib.h>
 #include <errno.h>
 
+// Adaptive per-file read-ahead limits (-o readahead=KiB)
+#define RP_READAHEAD_DEFAULT_KB 4096
+#define RP_READAHEAD_MAX_KB     65536
+
+// Userspace attribute cache lifetime in seconds (-o attr_cache_ttl=), 0 disables
+#define RP_ATTR_CACHE_TTL_DEFAULT 5
+#define RP_ATTR_CACHE_TTL_MAX     3600
+
+// Lifetime of cached ENOENT lookups in seconds (-o negative_cache_ttl=), 0 disables
+#define RP_NEG_CACHE_TTL_DEFAULT  5
+#define RP_NEG_CACHE_TTL_MAX      3600
+
+// Directory listing cache lifetime in seconds (-o dir_cache_ttl=), 0 disables
+#define RP_DIR_CACHE_TTL_DEFAULT  5
+#define RP_DIR_CACHE_TTL_MAX      3600
+
+// Per-handle write-back buffer in KiB (-o write_buffer=), 0 writes through
+#define RP_WRITE_BUFFER_DEFAULT_KB 2048
+#define RP_WRITE_BUFFER_MAX_KB     65536
+
+// Shared with the low-level front end (rp_lowlevel.c), which resolves inodes
+// to FUSE paths and then runs the same handlers.
+char* build_remote_path(const char *fuse_path);
+// Attributes of path from the userspace caches: 1 with attrs filled, -ENOENT
+// if it is known not to exist, 0 if the server has to be asked
+int rp_stat_cached(const char *path, LIBSSH2_SFTP_ATTRIBUTES *attrs);
+// Cache the answer of a STAT sent elsewhere (attrs NULL for ENOENT)
+void rp_stat_store(const char *path, const LIBSSH2_SFTP_ATTRIBUTES *attrs);
+void rp_attrs_to_stat(const char *path, const LIBSSH2_SFTP_ATTRIBUTES *attrs, struct stat *stbuf);
+
 void* rp_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
 void rp_destroy(void *private_data);
 int rp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi);
 int rp_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
                struct fuse_file_info *fi, enum fuse_readdir_flags flags);
+int rp_opendir(const char *path, struct fuse_file_info *fi);
+int rp_releasedir(const char *path, struct fuse_file_info *fi);
 int rp_open(const char *path, struct fuse_file_info *fi);
 int rp_read(const char *path, char *buf, size_t size, off_t offset,
             struct fuse_file_info *fi);
@@ -25,5 +57,9 @@ int rp_rmdir(const char *path);
 int rp_truncate(const char *path, off_t size, struct fuse_file_info *fi);
 int rp_rename(const char *from, const char *to, unsigned int flags);
 int rp_fsync(const char *path, int isdatasync, struct fuse_file_info *fi);
+int rp_flush(const char *path, struct fuse_file_info *fi);
+ssize_t rp_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+                           const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+                           size_t size, int flags);
 
 #endif
\ No newline at end of file
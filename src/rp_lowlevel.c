@@ -0,0 +1,753 @@
+#include "rp_lowlevel.h"
+#include "remote_proc_fuse.h"
+#include "sftp_loop.h"
+#include <fuse_lowlevel.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RP_LL_BUCKETS       4096
+#define RP_LL_UNKNOWN_INO   0xffffffffu   // st_ino of listing entries without a node, as libfuse uses
+
+typedef struct rp_node {
+    fuse_ino_t ino;
+    uint64_t generation;
+    char *path;                 // FUSE path, "/" for the root
+    uint64_t nlookup;           // References held by the kernel
+    int linked;                 // Still reachable through path (not unlinked or replaced)
+    struct rp_node *ino_next;
+    struct rp_node *path_next;
+} rp_node_t;
+
+static struct {
+    struct fuse_session *se;    // Set while the session loop runs
+    remote_conn_info_t *conn;
+    double attr_timeout;
+    double entry_timeout;
+    double negative_timeout;
+
+    pthread_mutex_t lock;       // Protects the node table
+    rp_node_t *by_ino[RP_LL_BUCKETS];
+    rp_node_t *by_path[RP_LL_BUCKETS];
+    fuse_ino_t next_ino;
+    uint64_t generation;        // Start time of the mount, so ids of another run are told apart
+} rp_ll = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// --- Inode table (callers hold rp_ll.lock unless noted) ---
+
+static size_t rp_node_path_slot(const char *path) {
+    size_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h % RP_LL_BUCKETS;
+}
+
+static rp_node_t *rp_node_by_ino(fuse_ino_t ino) {
+    rp_node_t *node = rp_ll.by_ino[ino % RP_LL_BUCKETS];
+    while (node && node->ino != ino) node = node->ino_next;
+    return node;
+}
+
+static rp_node_t *rp_node_by_path(const char *path) {
+    rp_node_t *node = rp_ll.by_path[rp_node_path_slot(path)];
+    while (node && strcmp(node->path, path) != 0) node = node->path_next;
+    return node;
+}
+
+static void rp_node_link(rp_node_t *node) {
+    size_t slot = rp_node_path_slot(node->path);
+    node->path_next = rp_ll.by_path[slot];
+    rp_ll.by_path[slot] = node;
+    node->linked = 1;
+}
+
+// Take the node off its name; requests on its id keep working with the old path
+static void rp_node_unlink(rp_node_t *node) {
+    if (!node->linked) return;
+    rp_node_t **pp = &rp_ll.by_path[rp_node_path_slot(node->path)];
+    while (*pp != node) pp = &(*pp)->path_next;
+    *pp = node->path_next;
+    node->path_next = NULL;
+    node->linked = 0;
+}
+
+static rp_node_t *rp_node_new(const char *path, fuse_ino_t ino) {
+    rp_node_t *node = calloc(1, sizeof(rp_node_t));
+    if (!node || !(node->path = strdup(path))) {
+        LOG_ERR("Failed to allocate inode for %s", path);
+        free(node);
+        return NULL;
+    }
+    node->ino = ino;
+    node->generation = rp_ll.generation;
+    size_t slot = ino % RP_LL_BUCKETS;
+    node->ino_next = rp_ll.by_ino[slot];
+    rp_ll.by_ino[slot] = node;
+    rp_node_link(node);
+    return node;
+}
+
+static void rp_node_free(rp_node_t *node) {
+    rp_node_unlink(node);
+    rp_node_t **pp = &rp_ll.by_ino[node->ino % RP_LL_BUCKETS];
+    while (*pp != node) pp = &(*pp)->ino_next;
+    *pp = node->ino_next;
+    free(node->path);
+    free(node);
+}
+
+// Copy of the path of ino (takes the lock). 0, -ESTALE or -ENOMEM.
+static int rp_ll_path(fuse_ino_t ino, char **out) {
+    pthread_mutex_lock(&rp_ll.lock);
+    rp_node_t *node = rp_node_by_ino(ino);
+    *out = node ? strdup(node->path) : NULL;
+    pthread_mutex_unlock(&rp_ll.lock);
+    if (!node) return -ESTALE;
+    return *out ? 0 : -ENOMEM;
+}
+
+static char *rp_ll_join(const char *dir, const char *name) {
+    size_t dir_len = strcmp(dir, "/") == 0 ? 0 : strlen(dir);
+    char *path = malloc(dir_len + strlen(name) + 2);
+    if (path) sprintf(path, "%.*s/%s", (int)dir_len, dir, name);
+    return path;
+}
+
+// Path of name inside the directory parent (takes the lock)
+static int rp_ll_child(fuse_ino_t parent, const char *name, char **out) {
+    char *dir;
+    int rc = rp_ll_path(parent, &dir);
+    if (rc) return rc;
+    *out = rp_ll_join(dir, name);
+    free(dir);
+    return *out ? 0 : -ENOMEM;
+}
+
+// Add a kernel reference to the node of path, creating it on first sight,
+// and fill in the id fields of e (takes the lock)
+static int rp_node_ref(const char *path, struct fuse_entry_param *e) {
+    pthread_mutex_lock(&rp_ll.lock);
+    rp_node_t *node = rp_node_by_path(path);
+    if (!node) node = rp_node_new(path, rp_ll.next_ino++);
+    if (node) {
+        node->nlookup++;
+        e->ino = node->ino;
+        e->generation = node->generation;
+        e->attr.st_ino = node->ino;
+    }
+    pthread_mutex_unlock(&rp_ll.lock);
+    return node ? 0 : -ENOMEM;
+}
+
+static void rp_node_forget(fuse_ino_t ino, uint64_t nlookup) {
+    if (ino == FUSE_ROOT_ID) return;
+    pthread_mutex_lock(&rp_ll.lock);
+    rp_node_t *node = rp_node_by_ino(ino);
+    if (node) {
+        node->nlookup = node->nlookup > nlookup ? node->nlookup - nlookup : 0;
+        if (node->nlookup == 0) rp_node_free(node);
+    }
+    pthread_mutex_unlock(&rp_ll.lock);
+}
+
+// The name at path is gone (unlinked, or replaced by a rename)
+static void rp_node_detach(const char *path) {
+    pthread_mutex_lock(&rp_ll.lock);
+    rp_node_t *node = rp_node_by_path(path);
+    if (node) rp_node_unlink(node);
+    pthread_mutex_unlock(&rp_ll.lock);
+}
+
+// Rename: the node at from and every node below it move to to
+static void rp_node_move(const char *from, const char *to) {
+    size_t from_len = strlen(from);
+    size_t to_len = strlen(to);
+    pthread_mutex_lock(&rp_ll.lock);
+    for (size_t i = 0; i < RP_LL_BUCKETS; i++) {
+        for (rp_node_t *node = rp_ll.by_ino[i]; node; node = node->ino_next) {
+            if (!node->linked || strncmp(node->path, from, from_len) != 0 ||
+                (node->path[from_len] != '\0' && node->path[from_len] != '/')) {
+                continue;
+            }
+            char *moved = malloc(to_len + strlen(node->path + from_len) + 1);
+            rp_node_unlink(node);
+            if (!moved) continue;   // Left detached; its next lookup makes a new node
+            sprintf(moved, "%s%s", to, node->path + from_len);
+            free(node->path);
+            node->path = moved;
+            rp_node_link(node);
+        }
+    }
+    pthread_mutex_unlock(&rp_ll.lock);
+}
+
+static void rp_node_clear(void) {
+    pthread_mutex_lock(&rp_ll.lock);
+    for (size_t i = 0; i < RP_LL_BUCKETS; i++) {
+        while (rp_ll.by_ino[i]) rp_node_free(rp_ll.by_ino[i]);
+    }
+    pthread_mutex_unlock(&rp_ll.lock);
+}
+
+// --- Replies ---
+
+static void rp_ll_reply_entry(fuse_req_t req, const char *path, const struct stat *st) {
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.attr = *st;
+    e.attr_timeout = rp_ll.attr_timeout;
+    e.entry_timeout = rp_ll.entry_timeout;
+    if (rp_node_ref(path, &e) != 0) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    // An interrupted request never reaches the kernel, nor does the reference
+    if (fuse_reply_entry(req, &e) == -ENOENT) rp_node_forget(e.ino, 1);
+}
+
+static void rp_ll_reply_stat(fuse_req_t req, fuse_ino_t ino, int entry, const char *path,
+                             int rc, struct stat *st) {
+    if (rc != 0) {
+        if (entry && rc == -ENOENT && rp_ll.negative_timeout > 0) {
+            // Id 0 lets the kernel cache the miss for entry_timeout
+            struct fuse_entry_param e;
+            memset(&e, 0, sizeof(e));
+            e.entry_timeout = rp_ll.negative_timeout;
+            fuse_reply_entry(req, &e);
+        } else {
+            fuse_reply_err(req, -rc);
+        }
+    } else if (entry) {
+        rp_ll_reply_entry(req, path, st);
+    } else {
+        st->st_ino = ino;
+        fuse_reply_attr(req, st, rp_ll.attr_timeout);
+    }
+}
+
+// STAT queued on the event loop; replied to from its I/O thread
+typedef struct {
+    sftp_future_t future;       // First member: the completion casts back to the request
+    fuse_req_t req;
+    fuse_ino_t ino;
+    int entry;                  // lookup (reply an entry) or getattr (reply attributes)
+    char *path;
+    char *remote_path;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+} rp_ll_stat_t;
+
+static void rp_ll_stat_done(sftp_future_t *future) {
+    rp_ll_stat_t *op = (rp_ll_stat_t *)future;
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    int rc = future->status;
+
+    if (rc == -ENOTCONN) {
+        // The loop lost its session (or is shutting down) before answering.
+        // This runs on its I/O thread, which must not do blocking pool I/O,
+        // so the request fails; later ones fall back to the pool on submit.
+        rc = -EIO;
+    } else if (rc == 0) {
+        rp_stat_store(op->path, &op->attrs);
+        rp_attrs_to_stat(op->path, &op->attrs, &st);
+    } else if (rc == -ENOENT) {
+        rp_stat_store(op->path, NULL);
+    }
+    rp_ll_reply_stat(op->req, op->ino, op->entry, op->path, rc, &st);
+
+    free(op->path);
+    free(op->remote_path);
+    free(op);
+}
+
+// Reply to lookup/getattr of path (taking ownership of it): from the caches,
+// asynchronously through the event loop, or on a pool session as a last resort
+static void rp_ll_stat(fuse_req_t req, fuse_ino_t ino, char *path, int entry) {
+    sftp_loop_t *loop = rp_ll.conn->loop;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int cached = loop ? rp_stat_cached(path, &attrs) : 0;
+
+    if (loop && cached == 0) {
+        rp_ll_stat_t *op = calloc(1, sizeof(rp_ll_stat_t));
+        char *remote_path = op ? build_remote_path(path) : NULL;
+        if (remote_path) {
+            op->future.op = SFTP_LOOP_STAT;
+            op->future.path = remote_path;
+            op->future.attrs = &op->attrs;
+            op->future.complete = rp_ll_stat_done;
+            op->req = req;
+            op->ino = ino;
+            op->entry = entry;
+            op->path = path;
+            op->remote_path = remote_path;
+            if (sftp_loop_submit(loop, &op->future) == 0) return;
+            free(remote_path);
+        }
+        free(op);
+    }
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    int rc;
+    if (cached > 0) {
+        rp_attrs_to_stat(path, &attrs, &st);
+        rc = 0;
+    } else if (cached < 0) {
+        rc = cached;
+    } else {
+        rc = rp_getattr(path, &st, NULL);
+    }
+    rp_ll_reply_stat(req, ino, entry, path, rc, &st);
+    free(path);
+}
+
+// --- Operations ---
+
+static void rp_ll_init(void *userdata, struct fuse_conn_info *conn_info) {
+    (void) userdata;
+    // rp_init() picks the cache timeouts the high-level API would apply
+    struct fuse_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    rp_init(conn_info, &cfg);
+    rp_ll.attr_timeout = cfg.attr_timeout;
+    rp_ll.entry_timeout = cfg.entry_timeout;
+    rp_ll.negative_timeout = cfg.negative_timeout;
+}
+
+static void rp_ll_destroy(void *userdata) {
+    rp_destroy(userdata);
+}
+
+static void rp_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char *path;
+    int rc = rp_ll_child(parent, name, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    rp_ll_stat(req, 0, path, 1);
+}
+
+static void rp_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    rp_node_forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void rp_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+    for (size_t i = 0; i < count; i++) {
+        rp_node_forget(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+static void rp_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    if (!fi) {
+        rp_ll_stat(req, ino, path, 0);
+        return;
+    }
+    // fstat() must see data still buffered in the handle, the path handler settles it
+    struct stat st;
+    rc = rp_getattr(path, &st, fi);
+    rp_ll_reply_stat(req, ino, 0, path, rc, &st);
+    free(path);
+}
+
+// Only the size can be changed, as through the path API (which has no
+// chmod/chown/utimens). The time update that comes with a truncate is left
+// to the server.
+static void rp_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+                          struct fuse_file_info *fi) {
+    int times = FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_ATIME_NOW |
+                FUSE_SET_ATTR_MTIME_NOW | FUSE_SET_ATTR_CTIME;
+    if ((to_set & ~(FUSE_SET_ATTR_SIZE | times)) || !(to_set & FUSE_SET_ATTR_SIZE)) {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    struct stat st;
+    rc = rp_truncate(path, attr->st_size, fi);
+    if (rc == 0) rc = rp_getattr(path, &st, fi);
+    rp_ll_reply_stat(req, ino, 0, path, rc, &st);
+    free(path);
+}
+
+static void rp_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    char *path;
+    int rc = rp_ll_child(parent, name, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    struct stat st;
+    rc = rp_mkdir(path, mode);
+    if (rc == 0) rc = rp_getattr(path, &st, NULL);
+    rp_ll_reply_stat(req, 0, 1, path, rc, &st);
+    free(path);
+}
+
+static void rp_ll_remove(fuse_req_t req, fuse_ino_t parent, const char *name, int (*op)(const char *)) {
+    char *path;
+    int rc = rp_ll_child(parent, name, &path);
+    if (rc == 0) {
+        rc = op(path);
+        if (rc == 0) rp_node_detach(path);
+        free(path);
+    }
+    fuse_reply_err(req, -rc);
+}
+
+static void rp_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    rp_ll_remove(req, parent, name, rp_unlink);
+}
+
+static void rp_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    rp_ll_remove(req, parent, name, rp_rmdir);
+}
+
+static void rp_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                         fuse_ino_t newparent, const char *newname, unsigned int flags) {
+    char *from = NULL, *to = NULL;
+    int rc = rp_ll_child(parent, name, &from);
+    if (rc == 0) rc = rp_ll_child(newparent, newname, &to);
+    if (rc == 0) rc = rp_rename(from, to, flags);
+    if (rc == 0) {
+        rp_node_detach(to);
+        rp_node_move(from, to);
+    }
+    free(from);
+    free(to);
+    fuse_reply_err(req, -rc);
+}
+
+static void rp_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc == 0) rc = rp_open(path, fi);
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+    } else if (fuse_reply_open(req, fi) == -ENOENT) {
+        rp_release(path, fi);   // Interrupted: the kernel never got the handle
+    }
+    free(path);
+}
+
+static void rp_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                         struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_child(parent, name, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+
+    struct stat st;
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    rc = rp_create(path, mode, fi);
+    if (rc == 0) {
+        rc = rp_getattr(path, &st, fi);
+        if (rc == 0) {
+            e.attr = st;
+            e.attr_timeout = rp_ll.attr_timeout;
+            e.entry_timeout = rp_ll.entry_timeout;
+            rc = rp_node_ref(path, &e);
+        }
+        if (rc != 0) rp_release(path, fi);
+    }
+
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+    } else if (fuse_reply_create(req, &e, fi) == -ENOENT) {
+        rp_release(path, fi);
+        rp_node_forget(e.ino, 1);
+    }
+    free(path);
+}
+
+static void rp_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    char *buf = malloc(size ? size : 1);
+    rc = buf ? rp_read(path, buf, size, off, fi) : -ENOMEM;
+    if (rc < 0) fuse_reply_err(req, -rc);
+    else fuse_reply_buf(req, buf, (size_t)rc);
+    free(buf);
+    free(path);
+}
+
+static void rp_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+                        struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc == 0) {
+        rc = rp_write(path, buf, size, off, fi);
+        free(path);
+    }
+    if (rc < 0) fuse_reply_err(req, -rc);
+    else fuse_reply_write(req, (size_t)rc);
+}
+
+static void rp_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc == 0) {
+        rc = rp_flush(path, fi);
+        free(path);
+    }
+    fuse_reply_err(req, -rc);
+}
+
+static void rp_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path;
+    // The handle must go even if the node is unknown, so a lost path is not an error here
+    int rc = rp_ll_path(ino, &path);
+    rc = rp_release(rc == 0 ? path : "?", fi);
+    free(path);
+    fuse_reply_err(req, -rc);
+}
+
+static void rp_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc == 0) {
+        rc = rp_fsync(path, datasync, fi);
+        free(path);
+    }
+    fuse_reply_err(req, -rc);
+}
+
+static void rp_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc == 0) rc = rp_opendir(path, fi);
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+    } else if (fuse_reply_open(req, fi) == -ENOENT) {
+        rp_releasedir(path, fi);
+    }
+    free(path);
+}
+
+typedef struct {
+    fuse_req_t req;
+    const char *dir;            // FUSE path of the directory
+    char *buf;
+    size_t size;
+    size_t used;
+    int plus;
+} rp_ll_dirbuf_t;
+
+// fuse_fill_dir_t for rp_readdir(): pack entries into the reply buffer, 1 when it is full
+static int rp_ll_fill(void *buf, const char *name, const struct stat *stbuf, off_t off,
+                      enum fuse_fill_dir_flags flags) {
+    rp_ll_dirbuf_t *d = (rp_ll_dirbuf_t *)buf;
+    size_t room = d->size - d->used;
+    size_t len;
+
+    if (d->plus) {
+        struct fuse_entry_param e;
+        memset(&e, 0, sizeof(e));
+        int dot = strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+        if (stbuf && !dot && (flags & FUSE_FILL_DIR_PLUS)) {
+            // Entries with attributes count as lookups, as if the kernel had asked for each
+            char *path = rp_ll_join(d->dir, name);
+            e.attr = *stbuf;
+            e.attr_timeout = rp_ll.attr_timeout;
+            e.entry_timeout = rp_ll.entry_timeout;
+            if (!path || rp_node_ref(path, &e) != 0) {
+                memset(&e, 0, sizeof(e));
+                e.attr.st_mode = stbuf->st_mode;
+                e.attr.st_ino = RP_LL_UNKNOWN_INO;
+            }
+            free(path);
+        } else {
+            e.attr.st_mode = stbuf ? stbuf->st_mode : 0;
+            e.attr.st_ino = RP_LL_UNKNOWN_INO;
+        }
+        len = fuse_add_direntry_plus(d->req, d->buf + d->used, room, name, &e, off);
+        if (len > room) {
+            if (e.ino) rp_node_forget(e.ino, 1);
+            return 1;
+        }
+    } else {
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_mode = stbuf ? stbuf->st_mode : 0;
+        st.st_ino = RP_LL_UNKNOWN_INO;
+        len = fuse_add_direntry(d->req, d->buf + d->used, room, name, &st, off);
+        if (len > room) return 1;
+    }
+    d->used += len;
+    return 0;
+}
+
+static void rp_ll_readdir_common(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                                 struct fuse_file_info *fi, int plus) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    rp_ll_dirbuf_t d = { .req = req, .dir = path, .buf = malloc(size), .size = size, .plus = plus };
+    rc = d.buf ? rp_readdir(path, &d, rp_ll_fill, off, fi, plus ? FUSE_READDIR_PLUS : 0) : -ENOMEM;
+    if (rc != 0) fuse_reply_err(req, -rc);
+    else fuse_reply_buf(req, d.buf, d.used);
+    free(d.buf);
+    free(path);
+}
+
+static void rp_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    rp_ll_readdir_common(req, ino, size, off, fi, 0);
+}
+
+static void rp_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    rp_ll_readdir_common(req, ino, size, off, fi, 1);
+}
+
+static void rp_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    (void) ino;
+    fuse_reply_err(req, -rp_releasedir(NULL, fi));
+}
+
+static void rp_ll_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+    char *path;
+    int rc = rp_ll_path(ino, &path);
+    if (rc == 0) {
+        rc = rp_access(path, mask);
+        free(path);
+    }
+    fuse_reply_err(req, -rc);
+}
+
+static void rp_ll_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in, struct fuse_file_info *fi_in,
+                                  fuse_ino_t ino_out, off_t off_out, struct fuse_file_info *fi_out,
+                                  size_t len, int flags) {
+    char *path_in = NULL, *path_out = NULL;
+    int rc = rp_ll_path(ino_in, &path_in);
+    if (rc == 0) rc = rp_ll_path(ino_out, &path_out);
+    ssize_t copied = rc;
+    if (rc == 0) copied = rp_copy_file_range(path_in, fi_in, off_in, path_out, fi_out, off_out, len, flags);
+    if (copied < 0) fuse_reply_err(req, (int)-copied);
+    else fuse_reply_write(req, (size_t)copied);
+    free(path_in);
+    free(path_out);
+}
+
+static const struct fuse_lowlevel_ops rp_ll_oper = {
+    .init            = rp_ll_init,
+    .destroy         = rp_ll_destroy,
+    .lookup          = rp_ll_lookup,
+    .forget          = rp_ll_forget,
+    .forget_multi    = rp_ll_forget_multi,
+    .getattr         = rp_ll_getattr,
+    .setattr         = rp_ll_setattr,
+    .mkdir           = rp_ll_mkdir,
+    .unlink          = rp_ll_unlink,
+    .rmdir           = rp_ll_rmdir,
+    .rename          = rp_ll_rename,
+    .open            = rp_ll_open,
+    .create          = rp_ll_create,
+    .read            = rp_ll_read,
+    .write           = rp_ll_write,
+    .flush           = rp_ll_flush,
+    .release         = rp_ll_release,
+    .fsync           = rp_ll_fsync,
+    .opendir         = rp_ll_opendir,
+    .readdir         = rp_ll_readdir,
+    .readdirplus     = rp_ll_readdirplus,
+    .releasedir      = rp_ll_releasedir,
+    .access          = rp_ll_access,
+    .copy_file_range = rp_ll_copy_file_range,
+};
+
+// --- Public API ---
+
+void rp_ll_invalidate(const char *path) {
+    struct fuse_session *se = __atomic_load_n(&rp_ll.se, __ATOMIC_ACQUIRE);
+    const char *slash = strrchr(path, '/');
+    if (!se || !slash) return;
+
+    char *parent_path = slash == path ? strdup("/") : strndup(path, (size_t)(slash - path));
+    fuse_ino_t ino = 0, parent = 0;
+    pthread_mutex_lock(&rp_ll.lock);
+    rp_node_t *node = rp_node_by_path(path);
+    if (node) ino = node->ino;
+    node = parent_path ? rp_node_by_path(parent_path) : NULL;
+    if (node) parent = node->ino;
+    pthread_mutex_unlock(&rp_ll.lock);
+    free(parent_path);
+
+    if (ino) fuse_lowlevel_notify_inval_inode(se, ino, 0, 0);
+    if (parent && slash[1]) fuse_lowlevel_notify_inval_entry(se, parent, slash + 1, strlen(slash + 1));
+}
+
+int rp_ll_main(struct fuse_args *args, remote_conn_info_t *conn) {
+    struct fuse_cmdline_opts opts;
+    if (fuse_parse_cmdline(args, &opts) != 0) return 1;
+    if (opts.show_help) {
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        free(opts.mountpoint);
+        return 0;
+    }
+    if (opts.show_version) {
+        fuse_lowlevel_version();
+        free(opts.mountpoint);
+        return 0;
+    }
+    if (!opts.mountpoint) {
+        LOG_ERR("No mount point given");
+        return 1;
+    }
+
+    int ret = 1;
+    fuse_ll_conn = conn;
+    rp_ll.conn = conn;
+    rp_ll.generation = (uint64_t)time(NULL);
+    rp_ll.next_ino = FUSE_ROOT_ID + 1;
+    pthread_mutex_lock(&rp_ll.lock);
+    rp_node_t *root = rp_node_new("/", FUSE_ROOT_ID);
+    if (root) root->nlookup = 1;    // Never forgotten
+    pthread_mutex_unlock(&rp_ll.lock);
+
+    struct fuse_session *se = root ? fuse_session_new(args, &rp_ll_oper, sizeof(rp_ll_oper), conn) : NULL;
+    if (se) {
+        if (fuse_set_signal_handlers(se) == 0) {
+            if (fuse_session_mount(se, opts.mountpoint) == 0) {
+                fuse_daemonize(opts.foreground);
+                __atomic_store_n(&rp_ll.se, se, __ATOMIC_RELEASE);
+                LOG_INFO("Serving %s through the low-level FUSE API", opts.mountpoint);
+                ret = opts.singlethread ? fuse_session_loop(se) : fuse_session_loop_mt(se, opts.clone_fd);
+                __atomic_store_n(&rp_ll.se, NULL, __ATOMIC_RELEASE);
+                fuse_session_unmount(se);
+            }
+            fuse_remove_signal_handlers(se);
+        }
+        fuse_session_destroy(se);
+    }
+
+    rp_node_clear();
+    free(opts.mountpoint);
+    return ret != 0 ? 1 : 0;
+}
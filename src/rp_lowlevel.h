@@ -0,0 +1,29 @@
+#ifndef RP_LOWLEVEL_H
+#define RP_LOWLEVEL_H
+
+#include "common.h"
+
+// Front end on the low-level, inode-based FUSE API (-o lowlevel), an
+// alternative to fuse_main() with the path handlers of remote_proc_fuse.c.
+//
+// The kernel talks in node ids. An inode table maps each id to its FUSE path,
+// a generation and the number of kernel references: lookup, create, mkdir and
+// readdirplus entries add one, forget drops them, and the node is freed at
+// zero. Renames rewrite the paths of the node and everything below it;
+// unlink and rmdir detach the node from its name so a new file there gets a
+// new id. Requests resolve their id to a path and run the path handler.
+//
+// lookup and getattr, the bulk of the traffic, reply asynchronously when the
+// event loop runs (-o event_loop): the STAT is queued on the loop and the
+// reply is sent from its I/O thread, so the FUSE worker is free at once.
+// Changes made through the control socket invalidate the kernel's entry and
+// attribute caches for exactly the affected node.
+
+// Parse the FUSE command line, mount and serve until unmounted. Returns the exit status.
+int rp_ll_main(struct fuse_args *args, remote_conn_info_t *conn);
+
+// Tell the kernel to forget what it cached about path (FUSE path), if a
+// low-level session is running and knows it. Not for use inside a request.
+void rp_ll_invalidate(const char *path);
+
+#endif // RP_LOWLEVEL_H
@@ -0,0 +1,533 @@
+#include "sftp_loop.h"
+#include "ssh_sftp_client.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SFTP_LOOP_BUCKETS       64            // Pending requests, hashed by id
+#define SFTP_LOOP_BUFFER        (64 * 1024)   // Initial size of the in/out buffers
+
+// SFTP reply types
+#define SSH_FXP_STATUS          101
+#define SSH_FXP_ATTRS           105
+
+// Value of the incoming list once the I/O thread has exited
+#define SFTP_LOOP_CLOSED        ((sftp_future_t *)1)
+
+// sftp_future_t.state of a future waited for with sftp_future_wait()
+#define SFTP_FUTURE_WAITING     0
+#define SFTP_FUTURE_DONE        1
+#define SFTP_FUTURE_ABANDONED   2   // The waiter timed out; the loop frees it
+
+struct sftp_loop {
+    remote_conn_info_t conn;            // The loop's own session (config strings borrowed from the template)
+    LIBSSH2_CHANNEL *channel;           // SFTP channel of conn, driven directly
+    int epfd;
+    int wakefd;                         // eventfd signalled when incoming goes from empty to non-empty
+    pthread_t thread;
+    int stopping;
+
+    // Pushed by any thread, taken whole by the I/O thread (newest first)
+    sftp_future_t *incoming;
+
+    // Everything below belongs to the I/O thread
+    sftp_future_t *pending[SFTP_LOOP_BUCKETS];
+    uint32_t next_id;
+    char *out;                          // Encoded requests not yet accepted by the channel
+    size_t out_len, out_off, out_cap;
+    char *in;                           // Received bytes not yet parsed into replies
+    size_t in_len, in_cap;
+    uint32_t sock_events;               // Events the socket is registered for
+    int want_out;                       // libssh2 blocked on sending
+};
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} sftp_loop_reader_t;
+
+// --- Encoding ---
+
+static int sftp_loop_reserve(sftp_loop_t *loop, size_t len) {
+    if (loop->out_cap - loop->out_len >= len) return 0;
+    size_t cap = loop->out_cap ? loop->out_cap : SFTP_LOOP_BUFFER;
+    while (cap - loop->out_len < len) cap *= 2;
+    char *out = realloc(loop->out, cap);
+    if (!out) return -ENOMEM;
+    loop->out = out;
+    loop->out_cap = cap;
+    return 0;
+}
+
+// Callers reserve the whole packet first
+static void sftp_loop_put_u32(sftp_loop_t *loop, uint32_t value) {
+    unsigned char *p = (unsigned char *)loop->out + loop->out_len;
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+    loop->out_len += 4;
+}
+
+static void sftp_loop_put_string(sftp_loop_t *loop, const char *s, size_t len) {
+    sftp_loop_put_u32(loop, (uint32_t)len);
+    memcpy(loop->out + loop->out_len, s, len);
+    loop->out_len += len;
+}
+
+// Append the request packet to the output buffer
+static int sftp_loop_encode(sftp_loop_t *loop, sftp_future_t *future) {
+    size_t path_len = strlen(future->path);
+    size_t len = 4 + 1 + 4 + 4 + path_len;
+    if (len > SFTP_LOOP_PACKET_MAX) return -ENAMETOOLONG;
+    int rc = sftp_loop_reserve(loop, len);
+    if (rc) return rc;
+
+    size_t start = loop->out_len;
+    loop->out_len += 4;                         // Length, filled in below
+    loop->out[loop->out_len++] = (char)future->op;
+    sftp_loop_put_u32(loop, future->id);
+    sftp_loop_put_string(loop, future->path, path_len);
+
+    size_t end = loop->out_len;
+    loop->out_len = start;
+    sftp_loop_put_u32(loop, (uint32_t)(end - start - 4));
+    loop->out_len = end;
+    return 0;
+}
+
+// --- Decoding ---
+
+static int sftp_loop_get_u32(sftp_loop_reader_t *r, uint32_t *value) {
+    if (r->end - r->p < 4) return -EPROTO;
+    *value = (uint32_t)r->p[0] << 24 | (uint32_t)r->p[1] << 16 | (uint32_t)r->p[2] << 8 | r->p[3];
+    r->p += 4;
+    return 0;
+}
+
+static int sftp_loop_get_u64(sftp_loop_reader_t *r, uint64_t *value) {
+    uint32_t hi, lo;
+    if (sftp_loop_get_u32(r, &hi) || sftp_loop_get_u32(r, &lo)) return -EPROTO;
+    *value = (uint64_t)hi << 32 | lo;
+    return 0;
+}
+
+static int sftp_loop_skip_string(sftp_loop_reader_t *r) {
+    uint32_t len;
+    if (sftp_loop_get_u32(r, &len) || (size_t)(r->end - r->p) < len) return -EPROTO;
+    r->p += len;
+    return 0;
+}
+
+static int sftp_loop_get_attrs(sftp_loop_reader_t *r, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    uint32_t flags, a, b;
+    memset(attrs, 0, sizeof(*attrs));
+    if (sftp_loop_get_u32(r, &flags)) return -EPROTO;
+    attrs->flags = flags;
+    if (flags & LIBSSH2_SFTP_ATTR_SIZE) {
+        uint64_t size;
+        if (sftp_loop_get_u64(r, &size)) return -EPROTO;
+        attrs->filesize = size;
+    }
+    if (flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+        if (sftp_loop_get_u32(r, &a) || sftp_loop_get_u32(r, &b)) return -EPROTO;
+        attrs->uid = a;
+        attrs->gid = b;
+    }
+    if (flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+        if (sftp_loop_get_u32(r, &a)) return -EPROTO;
+        attrs->permissions = a;
+    }
+    if (flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+        if (sftp_loop_get_u32(r, &a) || sftp_loop_get_u32(r, &b)) return -EPROTO;
+        attrs->atime = a;
+        attrs->mtime = b;
+    }
+    if (flags & LIBSSH2_SFTP_ATTR_EXTENDED) {
+        uint32_t count;
+        if (sftp_loop_get_u32(r, &count)) return -EPROTO;
+        while (count-- > 0) {
+            if (sftp_loop_skip_string(r) || sftp_loop_skip_string(r)) return -EPROTO;
+        }
+    }
+    return 0;
+}
+
+// --- Requests ---
+
+static void sftp_loop_complete(sftp_future_t *future, int status) {
+    future->status = status;
+    if (future->complete) {
+        future->complete(future);
+        return;
+    }
+    if (__atomic_exchange_n(&future->state, SFTP_FUTURE_DONE, __ATOMIC_ACQ_REL) == SFTP_FUTURE_ABANDONED) {
+        sem_destroy(&future->done);
+        free(future);
+        return;
+    }
+    sem_post(&future->done);
+}
+
+static sftp_future_t *sftp_loop_take(sftp_loop_t *loop, uint32_t id) {
+    sftp_future_t **pp = &loop->pending[id % SFTP_LOOP_BUCKETS];
+    while (*pp && (*pp)->id != id) pp = &(*pp)->next;
+    sftp_future_t *future = *pp;
+    if (future) *pp = future->next;
+    return future;
+}
+
+// Move newly queued requests to the pending table and encode them, in submission order
+static void sftp_loop_accept(sftp_loop_t *loop) {
+    sftp_future_t *list = __atomic_exchange_n(&loop->incoming, NULL, __ATOMIC_ACQUIRE);
+    sftp_future_t *fifo = NULL;
+    while (list) {
+        sftp_future_t *next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    while (fifo) {
+        sftp_future_t *future = fifo;
+        fifo = fifo->next;
+        future->id = loop->next_id++;
+        int rc = sftp_loop_encode(loop, future);
+        if (rc != 0) {
+            sftp_loop_complete(future, rc);
+            continue;
+        }
+        sftp_future_t **bucket = &loop->pending[future->id % SFTP_LOOP_BUCKETS];
+        future->next = *bucket;
+        *bucket = future;
+    }
+}
+
+// Complete the request a reply packet (type, id, payload) answers
+static int sftp_loop_dispatch(sftp_loop_t *loop, const unsigned char *packet, size_t len) {
+    sftp_loop_reader_t r = { packet + 1, packet + len };
+    uint32_t id;
+    if (sftp_loop_get_u32(&r, &id)) return -EPROTO;
+
+    sftp_future_t *future = sftp_loop_take(loop, id);
+    if (!future) {
+        LOG_WARN("SFTP loop: reply type %u for unknown request %u", packet[0], id);
+        return 0;
+    }
+
+    int status = -EPROTO;
+    uint32_t code;
+    if (packet[0] == SSH_FXP_STATUS && sftp_loop_get_u32(&r, &code) == 0) {
+        // STAT answers OK with ATTRS, never with a status
+        if (code != LIBSSH2_FX_OK) {
+            int err = sftp_error_to_errno(code);
+            status = err ? -err : -EIO;
+        }
+    } else if (packet[0] == SSH_FXP_ATTRS) {
+        status = sftp_loop_get_attrs(&r, future->attrs);
+    }
+    if (status == -EPROTO) {
+        LOG_WARN("SFTP loop: malformed reply type %u to request %u (op %d)", packet[0], id, future->op);
+    }
+    sftp_loop_complete(future, status);
+    return 0;
+}
+
+// Fail everything queued or in flight and refuse further submissions
+static void sftp_loop_close(sftp_loop_t *loop, int err) {
+    sftp_future_t *list = __atomic_exchange_n(&loop->incoming, SFTP_LOOP_CLOSED, __ATOMIC_ACQUIRE);
+    while (list) {
+        sftp_future_t *next = list->next;
+        sftp_loop_complete(list, err);
+        list = next;
+    }
+    for (int i = 0; i < SFTP_LOOP_BUCKETS; i++) {
+        while (loop->pending[i]) {
+            sftp_future_t *future = loop->pending[i];
+            loop->pending[i] = future->next;
+            sftp_loop_complete(future, err);
+        }
+    }
+}
+
+// --- I/O ---
+
+// Hand buffered requests to the channel until it would block
+static int sftp_loop_flush(sftp_loop_t *loop) {
+    loop->want_out = 0;
+    while (loop->out_off < loop->out_len) {
+        ssize_t rc = libssh2_channel_write(loop->channel, loop->out + loop->out_off,
+                                           loop->out_len - loop->out_off);
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            loop->want_out = (libssh2_session_block_directions(loop->conn.ssh_session) &
+                              LIBSSH2_SESSION_BLOCK_OUTBOUND) != 0;
+            return 0;
+        }
+        if (rc < 0) {
+            LOG_ERR("SFTP loop: channel write failed (libssh2 error %zd)", rc);
+            return -EIO;
+        }
+        loop->out_off += (size_t)rc;
+    }
+    loop->out_off = loop->out_len = 0;
+    return 0;
+}
+
+// Read everything available and dispatch the complete replies
+static int sftp_loop_receive(sftp_loop_t *loop) {
+    for (;;) {
+        if (loop->in_len == loop->in_cap) {
+            // Only reached for a reply larger than the buffer; parsing bounded its size
+            char *in = realloc(loop->in, loop->in_cap * 2);
+            if (!in) return -ENOMEM;
+            loop->in = in;
+            loop->in_cap *= 2;
+        }
+        ssize_t rc = libssh2_channel_read(loop->channel, loop->in + loop->in_len,
+                                          loop->in_cap - loop->in_len);
+        if (rc == LIBSSH2_ERROR_EAGAIN) break;
+        if (rc < 0) {
+            LOG_ERR("SFTP loop: channel read failed (libssh2 error %zd)", rc);
+            return -EIO;
+        }
+        if (rc == 0) {
+            if (libssh2_channel_eof(loop->channel)) {
+                LOG_ERR("SFTP loop: server closed the channel");
+                return -ENOTCONN;
+            }
+            break;
+        }
+        loop->in_len += (size_t)rc;
+
+        size_t off = 0;
+        while (loop->in_len - off >= 4) {
+            const unsigned char *p = (const unsigned char *)loop->in + off;
+            uint32_t len = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+            if (len < 5 || len > SFTP_LOOP_PACKET_MAX) {
+                LOG_ERR("SFTP loop: bad reply length %u", len);
+                return -EPROTO;
+            }
+            if (loop->in_len - off - 4 < len) break;
+            int err = sftp_loop_dispatch(loop, p + 4, len);
+            if (err) return err;
+            off += 4 + (size_t)len;
+        }
+        memmove(loop->in, loop->in + off, loop->in_len - off);
+        loop->in_len -= off;
+    }
+
+    if (libssh2_session_block_directions(loop->conn.ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
+        loop->want_out = 1;
+    }
+    return 0;
+}
+
+// Sleep until the socket is ready in the direction libssh2 waits for, or a
+// request was queued
+static int sftp_loop_wait(sftp_loop_t *loop) {
+    uint32_t events = EPOLLIN | (loop->want_out ? EPOLLOUT : 0);
+    if (events != loop->sock_events) {
+        struct epoll_event ev = { .events = events, .data.fd = loop->conn.sock };
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, loop->conn.sock, &ev) != 0) return -errno;
+        loop->sock_events = events;
+    }
+
+    struct epoll_event ready[2];
+    if (epoll_wait(loop->epfd, ready, 2, -1) < 0 && errno != EINTR) return -errno;
+    return 0;
+}
+
+static void *sftp_loop_thread(void *arg) {
+    sftp_loop_t *loop = (sftp_loop_t *)arg;
+    int err = 0;
+    while (err == 0) {
+        uint64_t count;
+        if (read(loop->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            err = -errno;
+            break;
+        }
+        if (__atomic_load_n(&loop->stopping, __ATOMIC_ACQUIRE)) {
+            err = -ENOTCONN;
+            break;
+        }
+        sftp_loop_accept(loop);
+        err = sftp_loop_flush(loop);
+        if (err == 0) err = sftp_loop_receive(loop);
+        if (err == 0) err = sftp_loop_wait(loop);
+    }
+
+    if (!__atomic_load_n(&loop->stopping, __ATOMIC_ACQUIRE)) {
+        LOG_ERR("SFTP loop stopped: %s; metadata requests go back to the pool", strerror(-err));
+    }
+    sftp_loop_close(loop, -ENOTCONN);
+    return NULL;
+}
+
+// --- Public API ---
+
+sftp_loop_t *sftp_loop_start(const remote_conn_info_t *tmpl) {
+    if (!tmpl) return NULL;
+
+    sftp_loop_t *loop = calloc(1, sizeof(sftp_loop_t));
+    if (!loop) {
+        LOG_ERR("Failed to allocate the SFTP event loop");
+        return NULL;
+    }
+    loop->conn = *tmpl;
+    loop->conn.sock = -1;
+    loop->conn.ssh_session = NULL;
+    loop->conn.sftp_session = NULL;
+    loop->conn.pool_size = 1;
+    loop->conn.pool = NULL;
+    loop->conn.loop = NULL;
+    loop->epfd = -1;
+    loop->wakefd = -1;
+    loop->next_id = 1;
+
+    if (sftp_connect_and_auth(&loop->conn) != 0) {
+        LOG_ERR("SFTP loop: could not connect its session");
+        free(loop);
+        return NULL;
+    }
+
+    // libssh2 already exchanged SSH_FXP_INIT/VERSION on this channel and is
+    // not used on it again; requests and replies are handled here.
+    loop->channel = libssh2_sftp_get_channel(loop->conn.sftp_session);
+    loop->out = malloc(SFTP_LOOP_BUFFER);
+    loop->in = malloc(SFTP_LOOP_BUFFER);
+    loop->out_cap = loop->out ? SFTP_LOOP_BUFFER : 0;
+    loop->in_cap = SFTP_LOOP_BUFFER;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->sock_events = EPOLLIN;
+    struct epoll_event sock_ev = { .events = EPOLLIN, .data.fd = loop->conn.sock };
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.fd = loop->wakefd };
+
+    if (!loop->channel || !loop->out || !loop->in || loop->epfd < 0 || loop->wakefd < 0 ||
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->conn.sock, &sock_ev) != 0 ||
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &wake_ev) != 0) {
+        LOG_ERR("SFTP loop: setup failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    libssh2_session_set_blocking(loop->conn.ssh_session, 0);
+    if (pthread_create(&loop->thread, NULL, sftp_loop_thread, loop) != 0) {
+        LOG_ERR("SFTP loop: could not start its I/O thread");
+        libssh2_session_set_blocking(loop->conn.ssh_session, 1);
+        goto fail;
+    }
+
+    LOG_INFO("SFTP event loop ready for metadata requests");
+    return loop;
+
+fail:
+    if (loop->epfd >= 0) close(loop->epfd);
+    if (loop->wakefd >= 0) close(loop->wakefd);
+    free(loop->out);
+    free(loop->in);
+    sftp_disconnect(&loop->conn);
+    free(loop);
+    return NULL;
+}
+
+void sftp_loop_stop(sftp_loop_t *loop) {
+    if (!loop) return;
+
+    __atomic_store_n(&loop->stopping, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(loop->wakefd, &one, sizeof(one)) < 0) {
+        LOG_WARN("SFTP loop: wakeup failed: %s", strerror(errno));
+    }
+    pthread_join(loop->thread, NULL);
+
+    libssh2_session_set_blocking(loop->conn.ssh_session, 1);
+    sftp_disconnect(&loop->conn);
+    close(loop->epfd);
+    close(loop->wakefd);
+    free(loop->out);
+    free(loop->in);
+    free(loop);
+}
+
+int sftp_loop_submit(sftp_loop_t *loop, sftp_future_t *future) {
+    if (!loop || !future || !future->path) return -EINVAL;
+
+    future->status = 0;
+    future->state = SFTP_FUTURE_WAITING;
+    if (!future->complete) sem_init(&future->done, 0, 0);
+
+    sftp_future_t *head = __atomic_load_n(&loop->incoming, __ATOMIC_RELAXED);
+    do {
+        if (head == SFTP_LOOP_CLOSED) {
+            if (!future->complete) sem_destroy(&future->done);
+            return -ENOTCONN;
+        }
+        future->next = head;
+    } while (!__atomic_compare_exchange_n(&loop->incoming, &head, future, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // A non-empty list means the I/O thread has been woken already and has not taken it yet
+    if (!head) {
+        uint64_t one = 1;
+        if (write(loop->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG_WARN("SFTP loop: wakeup failed: %s", strerror(errno));
+        }
+    }
+    return 0;
+}
+
+int sftp_future_wait(sftp_future_t *future) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SFTP_LOOP_TIMEOUT_SEC;
+
+    int rc;
+    while ((rc = sem_timedwait(&future->done, &deadline)) != 0 && errno == EINTR);
+    if (rc != 0) {
+        int waiting = SFTP_FUTURE_WAITING;
+        if (__atomic_compare_exchange_n(&future->state, &waiting, SFTP_FUTURE_ABANDONED, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return -ETIMEDOUT;
+        }
+        // Completed right at the deadline; its wakeup is being posted
+        while (sem_wait(&future->done) != 0 && errno == EINTR);
+    }
+    sem_destroy(&future->done);
+    return future->status;
+}
+
+// A waited request in one allocation, so that after a timeout the loop can
+// free it without touching the caller's path or attributes
+typedef struct {
+    sftp_future_t future;               // First: the loop frees the call through it
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    char path[];
+} sftp_loop_call_t;
+
+int sftp_loop_stat(sftp_loop_t *loop, const char *path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
+    if (!path) return -EINVAL;
+    size_t len = strlen(path) + 1;
+    sftp_loop_call_t *call = malloc(sizeof(sftp_loop_call_t) + len);
+    if (!call) return -ENOMEM;
+    memset(call, 0, sizeof(sftp_loop_call_t));
+    memcpy(call->path, path, len);
+    call->future.op = SFTP_LOOP_STAT;
+    call->future.path = call->path;
+    call->future.attrs = &call->attrs;
+
+    int rc = sftp_loop_submit(loop, &call->future);
+    if (rc == 0) rc = sftp_future_wait(&call->future);
+    if (rc == -ETIMEDOUT) {
+        LOG_WARN("SFTP loop: no reply to STAT %s after %d s", path, SFTP_LOOP_TIMEOUT_SEC);
+        return rc;
+    }
+    if (rc == 0) *attrs = call->attrs;
+    free(call);
+    return rc;
+}
@@ -0,0 +1,70 @@
+#ifndef SFTP_LOOP_H
+#define SFTP_LOOP_H
+
+#include "common.h"
+#include <semaphore.h>
+#include <stdint.h>
+
+// Event loop multiplexing SFTP metadata requests over one session.
+//
+// The pool (sftp_pool.c) gives each FUSE worker a whole blocking session for
+// the duration of a request, so a slow STAT keeps that session, and the
+// worker waiting for it, idle. The loop instead owns one extra session and a
+// dedicated I/O thread that drives it non-blocking: workers queue requests
+// (a lock-free list, the thread is woken through an eventfd), the thread
+// writes them to the SFTP channel as soon as they arrive, matches replies by
+// request id as they come back and completes the caller's future. Any number
+// of requests can be in flight on the one channel at a time.
+//
+// libssh2's SFTP layer keeps a single state slot per operation type and
+// cannot have two STATs outstanding on one session, so the loop speaks SFTP
+// (version 3) on the session's channel itself; libssh2 only provides the
+// encrypted, non-blocking transport. Only STAT is carried (getattr and
+// lookup); file handles and changes to the tree stay on the pool sessions.
+
+#define SFTP_LOOP_PACKET_MAX    (256 * 1024)  // Largest reply accepted
+#define SFTP_LOOP_TIMEOUT_SEC   30            // sftp_future_wait() gives up after this
+
+// SFTP request types the loop accepts (values from the protocol)
+typedef enum {
+    SFTP_LOOP_STAT    = 17      // path -> attrs
+} sftp_loop_op_t;
+
+// One request and its completion. The caller owns the memory and, unless it
+// set a completion callback, must wait for it once sftp_loop_submit()
+// accepted it.
+typedef struct sftp_future {
+    sftp_loop_op_t op;
+    const char *path;
+    LIBSSH2_SFTP_ATTRIBUTES *attrs;    // Filled by STAT
+    // When set, called on the I/O thread at completion instead of waking a
+    // waiter. It owns the future from then on and must not wait on the loop.
+    void (*complete)(struct sftp_future *future);
+
+    // Owned by the loop until completion
+    int status;                        // 0 or negative errno
+    uint32_t id;
+    int state;                         // Handshake between the waiter and the loop
+    sem_t done;
+    struct sftp_future *next;
+} sftp_future_t;
+
+typedef struct sftp_loop sftp_loop_t;
+
+// Connect a session with the template's settings and start its I/O thread
+sftp_loop_t *sftp_loop_start(const remote_conn_info_t *tmpl);
+void sftp_loop_stop(sftp_loop_t *loop);
+
+// Queue a request; 0, or -ENOTCONN once the session is gone (nothing to wait for)
+int sftp_loop_submit(sftp_loop_t *loop, sftp_future_t *future);
+// Block until the request completed and return its status (not for callbacks).
+// -ETIMEDOUT after SFTP_LOOP_TIMEOUT_SEC: the future, which must then be a
+// single malloc() block holding everything the loop reads (path, attrs), is
+// left to the loop, which frees it when the reply or the shutdown arrives.
+int sftp_future_wait(sftp_future_t *future);
+
+// Submit and wait. -ENOTCONN means the loop cannot serve requests any more,
+// -ETIMEDOUT that this one got no reply in time.
+int sftp_loop_stat(sftp_loop_t *loop, const char *path, LIBSSH2_SFTP_ATTRIBUTES *attrs);
+
+#endif // SFTP_LOOP_H
@@ -0,0 +1,153 @@
+#include "sftp_pool.h"
+#include "ssh_sftp_client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Nesting depth of the checkout held by this thread (handlers such as
+// rp_access call rp_getattr, which must reuse the session already held).
+static __thread int tls_depth = 0;
+
+sftp_pool_t *sftp_pool_create(const remote_conn_info_t *tmpl, int size) {
+    if (!tmpl) return NULL;
+    if (size < 1) size = 1;
+    if (size > SFTP_POOL_MAX_SIZE) size = SFTP_POOL_MAX_SIZE;
+
+    sftp_pool_t *pool = calloc(1, sizeof(sftp_pool_t));
+    if (!pool) {
+        LOG_ERR("Failed to allocate SFTP session pool");
+        return NULL;
+    }
+    pool->slots = calloc(size, sizeof(remote_conn_info_t));
+    pool->in_use = calloc(size, sizeof(int));
+    if (!pool->slots || !pool->in_use) {
+        LOG_ERR("Failed to allocate SFTP session pool slots");
+        free(pool->slots);
+        free(pool->in_use);
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < size; i++) {
+        remote_conn_info_t *slot = &pool->slots[pool->size];
+        *slot = *tmpl;
+        slot->sock = -1;
+        slot->ssh_session = NULL;
+        slot->sftp_session = NULL;
+        slot->pool_size = 1;
+        slot->pool = NULL;
+        slot->loop = NULL;
+
+        if (sftp_connect_and_auth(slot) != 0) {
+            LOG_WARN("SFTP pool: connection %d of %d failed, continuing with %d session(s)",
+                     i + 1, size, pool->size);
+            break;
+        }
+        pool->size++;
+    }
+
+    if (pool->size == 0) {
+        LOG_ERR("SFTP pool: no session could be established");
+        free(pool->slots);
+        free(pool->in_use);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+    LOG_INFO("SFTP pool ready with %d session(s)", pool->size);
+    return pool;
+}
+
+void sftp_pool_destroy(sftp_pool_t *pool) {
+    if (!pool) return;
+
+    for (int i = 0; i < pool->size; i++) {
+        sftp_disconnect(&pool->slots[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->available);
+    free(pool->slots);
+    free(pool->in_use);
+    free(pool);
+}
+
+int sftp_pool_slot_of(const sftp_pool_t *pool, const remote_conn_info_t *conn) {
+    if (!pool || !conn || conn < pool->slots || conn >= pool->slots + pool->size) {
+        return -1;
+    }
+    return (int)(conn - pool->slots);
+}
+
+remote_conn_info_t *sftp_pool_checkout(sftp_pool_t *pool) {
+    if (!pool) return NULL;
+
+    if (sftp_tls_conn && sftp_pool_slot_of(pool, sftp_tls_conn) >= 0) {
+        tls_depth++;
+        return sftp_tls_conn;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    int slot = -1;
+    while (slot < 0) {
+        for (int i = 0; i < pool->size; i++) {
+            int candidate = (pool->next + i) % pool->size;
+            if (!pool->in_use[candidate]) {
+                slot = candidate;
+                break;
+            }
+        }
+        if (slot < 0) {
+            pthread_cond_wait(&pool->available, &pool->lock);
+        }
+    }
+    pool->in_use[slot] = 1;
+    pool->next = (slot + 1) % pool->size;
+    pthread_mutex_unlock(&pool->lock);
+
+    sftp_tls_conn = &pool->slots[slot];
+    tls_depth = 1;
+    return sftp_tls_conn;
+}
+
+remote_conn_info_t *sftp_pool_checkout_slot(sftp_pool_t *pool, int slot) {
+    if (!pool || slot < 0 || slot >= pool->size) return NULL;
+
+    if (sftp_tls_conn) {
+        if (sftp_tls_conn == &pool->slots[slot]) {
+            tls_depth++;
+            return sftp_tls_conn;
+        }
+        // Waiting for a second session while holding one could deadlock the pool
+        LOG_ERR("SFTP pool: thread already holds session %d, cannot check out session %d",
+                sftp_pool_slot_of(pool, sftp_tls_conn), slot);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->in_use[slot]) {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+    pool->in_use[slot] = 1;
+    pthread_mutex_unlock(&pool->lock);
+
+    sftp_tls_conn = &pool->slots[slot];
+    tls_depth = 1;
+    return sftp_tls_conn;
+}
+
+void sftp_pool_checkin(sftp_pool_t *pool, remote_conn_info_t *conn) {
+    int slot = sftp_pool_slot_of(pool, conn);
+    if (slot < 0) return;
+
+    if (--tls_depth > 0) return;
+
+    sftp_tls_conn = NULL;
+    tls_depth = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->in_use[slot] = 0;
+    pthread_cond_broadcast(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
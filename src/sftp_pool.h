@@ -0,0 +1,32 @@
+#ifndef SFTP_POOL_H
+#define SFTP_POOL_H
+
+#include "common.h"
+#include <pthread.h>
+
+#define SFTP_POOL_MAX_SIZE 32
+
+// A fixed set of authenticated SFTP sessions shared by the FUSE worker threads.
+// libssh2 sessions are not thread-safe, so a session is used by exactly one
+// thread at a time: workers check one out, run their SFTP calls on it and
+// check it back in. While checked out, get_conn_info() returns that session.
+typedef struct sftp_pool {
+    remote_conn_info_t *slots;   // Connected sessions (config strings borrowed from the template)
+    int *in_use;                 // Per-slot checkout flag
+    int size;                    // Number of connected sessions
+    int next;                    // Round-robin cursor so load spreads across connections
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+} sftp_pool_t;
+
+sftp_pool_t *sftp_pool_create(const remote_conn_info_t *tmpl, int size);
+void sftp_pool_destroy(sftp_pool_t *pool);
+
+// Check out any free session (blocks until one is available).
+remote_conn_info_t *sftp_pool_checkout(sftp_pool_t *pool);
+// Check out a specific session, e.g. the one that owns an open SFTP handle.
+remote_conn_info_t *sftp_pool_checkout_slot(sftp_pool_t *pool, int slot);
+void sftp_pool_checkin(sftp_pool_t *pool, remote_conn_info_t *conn);
+int sftp_pool_slot_of(const sftp_pool_t *pool, const remote_conn_info_t *conn);
+
+#endif // SFTP_POOL_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // fallocate, O_DIRECT
 #include "ssh_sftp_client.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -8,9 +9,45 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
 
 #include "common.h" // Đảm bảo include common.h
+#include "control.h"
 remote_conn_info_t *ssh_cli_conn = NULL;
+remote_conn_info_t *fuse_ll_conn = NULL;
+__thread remote_conn_info_t *sftp_tls_conn = NULL;
+
+// Error of the last call forwarded to a live mount (control.c), as -errno
+static __thread int sftp_control_errno = 0;
+static int sftp_lazy_connect_failed = 0;
+
+// remote-cp/remote-mv talking to a live mount: calls of the main thread go
+// over the control socket; -j workers have a pool session checked out. A
+// forwarded call failing with -ENOTCONN lost the mount (unmounted meanwhile)
+// and is redone once on the tool's own session.
+static int sftp_use_control(void) {
+    return !sftp_tls_conn && control_active();
+}
+
+static int sftp_control_result(int rc) {
+    sftp_control_errno = rc;
+    return rc == 0 ? 0 : -1;
+}
+
+// Session for this thread. A tool served by a live mount opens its own SSH
+// session only for the first call that cannot be forwarded (directory
+// listings, exec channels, handles) or once the mount went away.
+static remote_conn_info_t *sftp_session_conn(void) {
+    sftp_control_errno = 0;
+    remote_conn_info_t *conn = get_conn_info();
+    if (conn && conn == ssh_cli_conn && !conn->sftp_session && conn->remote_host &&
+        control_served() && !sftp_lazy_connect_failed) {
+        LOG_DEBUG("Connecting a session of our own to %s", conn->remote_host);
+        if (sftp_connect_and_auth(conn) != 0) sftp_lazy_connect_failed = 1;
+    }
+    return conn;
+}
 
 // Helper function to log libssh2 errors
 static void log_libssh2_error(LIBSSH2_SESSION *session, const char *prefix) {
@@ -147,7 +184,11 @@ void sftp_disconnect(remote_conn_info_t *conn) {
 }
 
 int sftp_stat_remote(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
-    remote_conn_info_t *conn = get_conn_info();
+    if (sftp_use_control()) {
+        int rc = control_stat(remote_path, attrs);
+        if (rc != -ENOTCONN) return sftp_control_result(rc);
+    }
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return -1;
 
     int rc = libssh2_sftp_stat(conn->sftp_session, remote_path, attrs);
@@ -158,7 +199,7 @@ int sftp_stat_remote(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
 }
 
 LIBSSH2_SFTP_HANDLE* sftp_opendir_remote(const char *remote_path) {
-    remote_conn_info_t *conn = get_conn_info();
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return NULL;
 
     LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_opendir(conn->sftp_session, remote_path);
@@ -179,7 +220,7 @@ int sftp_closedir_remote(LIBSSH2_SFTP_HANDLE *handle) {
 }
 
 LIBSSH2_SFTP_HANDLE* sftp_open_remote(const char *remote_path, unsigned long flags, long mode) {
-    remote_conn_info_t *conn = get_conn_info();
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return NULL;
 
     LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open(conn->sftp_session, remote_path, flags, mode);
@@ -198,7 +239,7 @@ ssize_t sftp_read_remote(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t count
     if (!handle) return -EBADF; // Use errno code
     ssize_t rc = libssh2_sftp_read(handle, buffer, count);
     if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) { // Check for actual errors, ignore EAGAIN for now
-        remote_conn_info_t *conn = get_conn_info();
+        remote_conn_info_t *conn = sftp_session_conn();
         if (conn && conn->sftp_session) {
             unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
             LOG_ERR("sftp_read_remote failed: libssh2 rc=%zd, sftp_err=%lu -> errno=%d", rc, sftp_err, sftp_error_to_errno(sftp_err));
@@ -211,11 +252,47 @@ ssize_t sftp_read_remote(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t count
     return rc;
 }
 
+// Positioned read that keeps libssh2's READ pipeline alive across calls.
+// libssh2 keeps up to four times the size of each libssh2_sftp_read() call
+// outstanding as SFTP READ requests and hands the replies back in order, but
+// libssh2_sftp_seek64() throws that queue away. So we only seek when the
+// caller does not continue from *pos, slice each call to window/4 so no more
+// than `window` bytes are in flight, and loop until count bytes or EOF.
+ssize_t sftp_pread_remote(LIBSSH2_SFTP_HANDLE *handle, libssh2_uint64_t *pos,
+                          char *buffer, size_t count, libssh2_uint64_t offset, size_t window) {
+    if (!handle || !pos) return -EBADF;
+
+    if (*pos != offset) {
+        libssh2_sftp_seek64(handle, offset);
+        *pos = offset;
+    }
+
+    size_t slice = window / 4;
+    if (slice < SFTP_READ_SLICE_MIN) slice = SFTP_READ_SLICE_MIN;
+
+    size_t total = 0;
+    while (total < count) {
+        size_t want = count - total;
+        if (want > slice) want = slice;
+
+        ssize_t rc = sftp_read_remote(handle, buffer + total, want);
+        if (rc < 0) {
+            // The pipeline state is unknown after an error, force a seek next time
+            *pos = SFTP_POS_UNKNOWN;
+            return rc;
+        }
+        if (rc == 0) break; // EOF
+        total += rc;
+        *pos += rc;
+    }
+    return (ssize_t)total;
+}
+
 ssize_t sftp_write_remote(LIBSSH2_SFTP_HANDLE *handle, const char *buffer, size_t count) {
     if (!handle) return -EBADF; // Use errno code
     ssize_t rc = libssh2_sftp_write(handle, buffer, count);
      if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) { // Check for actual errors
-        remote_conn_info_t *conn = get_conn_info();
+        remote_conn_info_t *conn = sftp_session_conn();
         if (conn && conn->sftp_session) {
             unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
             LOG_ERR("sftp_write_remote failed: libssh2 rc=%zd, sftp_err=%lu -> errno=%d", rc, sftp_err, sftp_error_to_errno(sftp_err));
@@ -228,27 +305,65 @@ ssize_t sftp_write_remote(LIBSSH2_SFTP_HANDLE *handle, const char *buffer, size_
     return rc;
 }
 
+// Send count bytes at the current position of the handle. libssh2_sftp_write()
+// splits a large buffer into SFTP WRITE packets, sends as many as the channel
+// window allows and returns once the first ones are acknowledged; calling it
+// again with the rest of the buffer collects the remaining ACKs without
+// re-sending anything. Seeking is local to libssh2 and resets that state, so
+// callers seek at most once (sftp_pwrite_remote) and consecutive calls keep
+// the WRITE pipeline going.
+static ssize_t sftp_write_all(LIBSSH2_SFTP_HANDLE *handle, const char *buffer, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+        ssize_t rc = sftp_write_remote(handle, buffer + total, count - total);
+        if (rc < 0) return rc;
+        if (rc == 0) return -EIO; // Failure without an SFTP status code
+        total += rc;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t sftp_pwrite_remote(LIBSSH2_SFTP_HANDLE *handle, const char *buffer,
+                           size_t count, libssh2_uint64_t offset) {
+    if (!handle) return -EBADF;
+
+    libssh2_sftp_seek64(handle, offset);
+    return sftp_write_all(handle, buffer, count);
+}
+
 int sftp_close_remote(LIBSSH2_SFTP_HANDLE *handle) {
     if (!handle) return -1;
     return libssh2_sftp_close(handle);
 }
 
 int sftp_unlink_remote(const char *remote_path) {
-    remote_conn_info_t *conn = get_conn_info();
+    if (sftp_use_control()) {
+        int rc = control_unlink(remote_path);
+        if (rc != -ENOTCONN) return sftp_control_result(rc);
+    }
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return -1;
 
     return libssh2_sftp_unlink(conn->sftp_session, remote_path);
 }
 
 int sftp_mkdir_remote(const char *remote_path, long mode) {
-    remote_conn_info_t *conn = get_conn_info();
+    if (sftp_use_control()) {
+        int rc = control_mkdir(remote_path, mode);
+        if (rc != -ENOTCONN) return sftp_control_result(rc);
+    }
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return -1;
 
     return libssh2_sftp_mkdir(conn->sftp_session, remote_path, mode);
 }
 
 int sftp_rmdir_remote(const char *remote_path) {
-    remote_conn_info_t *conn = get_conn_info();
+    if (sftp_use_control()) {
+        int rc = control_rmdir(remote_path);
+        if (rc != -ENOTCONN) return sftp_control_result(rc);
+    }
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return -1;
 
     return libssh2_sftp_rmdir(conn->sftp_session, remote_path);
@@ -282,11 +397,48 @@ int sftp_error_to_errno(unsigned long sftp_err) {
     }
 }
 
-int sftp_copy_local_to_remote(const char *local_path, const char *remote_path) {
-    FILE *local_file = fopen(local_path, "rb");
-    if (!local_file) {
-        LOG_ERR("Failed to open local file '%s': %s", local_path, strerror(errno));
-        return -errno;
+// Error of the last failed SFTP call on this thread's session as -errno
+int sftp_last_errno(void) {
+    if (sftp_control_errno != 0) return sftp_control_errno;
+    remote_conn_info_t *conn = get_conn_info();
+    if (conn && conn->sftp_session) {
+        int err = sftp_error_to_errno(libssh2_sftp_last_error(conn->sftp_session));
+        return err ? -err : -EIO;
+    }
+    return -EIO;
+}
+
+// Aligned copy buffer: page aligned for the kernel, and usable with O_DIRECT
+static char *sftp_copy_buffer_alloc(void) {
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, SFTP_DIRECT_IO_ALIGN, SFTP_COPY_BUFFER_SIZE) != 0) return NULL;
+    return buffer;
+}
+
+// pwrite the whole buffer, retrying short writes and EINTR
+static int local_pwrite_all(int fd, const char *buffer, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t n = pwrite(fd, buffer + done, count - done, offset + (off_t)done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Whole-file upload. With map set, regular files are mapped and handed to
+// libssh2 straight from the page cache, SFTP_COPY_BUFFER_SIZE bytes per call;
+// otherwise, and for anything that cannot be mapped (empty files, pipes,
+// /proc), the file is read into an aligned buffer. The descriptor is left open.
+static int sftp_copy_fd(int fd, const char *remote_path, int map_source) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        LOG_ERR("Failed to stat the local source of '%s': %s", remote_path, strerror(err));
+        return -err;
     }
 
     unsigned long flags = LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC;
@@ -294,96 +446,324 @@ int sftp_copy_local_to_remote(const char *local_path, const char *remote_path) {
     if (!remote_handle) {
         // sftp_open_remote already logs the specific SFTP error
         LOG_ERR("Failed to open/create remote file '%s'", remote_path);
-        fclose(local_file);
-        // Get last sftp error and convert to errno
-        remote_conn_info_t *conn = get_conn_info();
-        if (conn && conn->sftp_session) {
-             unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-             return -sftp_error_to_errno(sftp_err);
-        }
-        return -EIO; // Generic error if no session
+        return sftp_last_errno();
     }
 
-    char buffer[32768];
-    size_t bytes_read;
-    ssize_t bytes_written;
     int result = 0;
+    char *map = MAP_FAILED;
+    size_t map_len = 0;
+    if (map_source && S_ISREG(st.st_mode) && st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+        map_len = (size_t)st.st_size;
+        map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            LOG_DEBUG("mmap of the source of '%s' failed (%s), reading instead", remote_path, strerror(errno));
+        } else {
+            madvise(map, map_len, MADV_SEQUENTIAL);
+        }
+    }
 
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), local_file)) > 0) {
-        char *buf_ptr = buffer;
-        size_t remaining = bytes_read;
-        while (remaining > 0) {
-            bytes_written = sftp_write_remote(remote_handle, buf_ptr, remaining);
-            if (bytes_written < 0) {
-                 // sftp_write_remote logs the error
-                 LOG_ERR("Failed to write to remote file '%s'", remote_path);
-                 result = (int)bytes_written; // Already negative errno
-                 goto cleanup_copy_local_to_remote;
+    if (map != MAP_FAILED) {
+        // The size is the one seen at open: a file truncated by someone else
+        // while it is copied faults here (SIGBUS), acceptable for a short-lived
+        // tool only.
+        for (size_t off = 0; off < map_len; off += SFTP_COPY_BUFFER_SIZE) {
+            size_t want = map_len - off < SFTP_COPY_BUFFER_SIZE ? map_len - off : SFTP_COPY_BUFFER_SIZE;
+            ssize_t written = sftp_write_all(remote_handle, map + off, want);
+            if (written < 0) {
+                LOG_ERR("Failed to write to remote file '%s'", remote_path);
+                result = (int)written;
+                break;
             }
-            remaining -= bytes_written;
-            buf_ptr += bytes_written;
+        }
+        munmap(map, map_len);
+    } else {
+        char *buffer = sftp_copy_buffer_alloc();
+        if (!buffer) {
+            result = -ENOMEM;
+        } else {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            while (1) {
+                ssize_t got = read(fd, buffer, SFTP_COPY_BUFFER_SIZE);
+                if (got < 0) {
+                    if (errno == EINTR) continue;
+                    result = -errno;
+                    LOG_ERR("Error reading the local source of '%s': %s", remote_path, strerror(errno));
+                    break;
+                }
+                if (got == 0) break; // EOF
+                ssize_t written = sftp_write_all(remote_handle, buffer, (size_t)got);
+                if (written < 0) {
+                    LOG_ERR("Failed to write to remote file '%s'", remote_path);
+                    result = (int)written;
+                    break;
+                }
+            }
+            free(buffer);
         }
     }
 
-    if (ferror(local_file)) {
-        LOG_ERR("Error reading from local file '%s': %s", local_path, strerror(errno));
-        result = -errno;
+    if (sftp_close_remote(remote_handle) != 0 && result == 0) {
+        result = -EIO; // Deferred write errors are reported on close
     }
+    return result;
+}
 
-cleanup_copy_local_to_remote:
-    fclose(local_file);
-    sftp_close_remote(remote_handle); // sftp_close_remote logs errors
+// Files passed by a tool over the control socket: never mapped, a file
+// truncated while it is copied must not take the whole mount down with SIGBUS
+int sftp_copy_fd_to_remote(int fd, const char *remote_path) {
+    return sftp_copy_fd(fd, remote_path, 0);
+}
 
+int sftp_copy_local_to_remote(const char *local_path, const char *remote_path) {
+    int fd = open(local_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        int err = errno;
+        LOG_ERR("Failed to open local file '%s': %s", local_path, strerror(err));
+        return -err;
+    }
+
+    int result = sftp_use_control() ? control_put(fd, remote_path) : -EBUSY;
+    // Not forwarded, every copy slot of the mount is taken or the mount went
+    // away: use our own session
+    if (result == -EBUSY || result == -ENOTCONN) result = sftp_copy_fd(fd, remote_path, 1);
+    close(fd);
     return result;
 }
 
-int sftp_copy_remote_to_local(const char *remote_path, const char *local_path) {
+// Download an open remote file of the given size into fd, from offset 0. The
+// local blocks are reserved up front when the size is known. With direct set
+// (fd opened O_DIRECT) every chunk but the last is a full
+// SFTP_COPY_BUFFER_SIZE at an aligned offset, so only the tail has to leave
+// O_DIRECT.
+static int sftp_copy_handle_to_fd(LIBSSH2_SFTP_HANDLE *remote_handle, const char *remote_path,
+                                  libssh2_uint64_t size, int fd, int direct) {
+    // Best effort: keeps the file contiguous and reports ENOSPC early on
+    // filesystems that support it, without changing the visible size
+    if (size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) != 0 && errno == ENOSPC) {
+        LOG_ERR("Not enough space for '%s' (%llu bytes)", remote_path, (unsigned long long)size);
+        return -ENOSPC;
+    }
+
+    char *buffer = sftp_copy_buffer_alloc();
+    if (!buffer) return -ENOMEM;
+
+    remote_conn_info_t *conn = sftp_session_conn();
+    int result = 0;
+    libssh2_uint64_t offset = 0;
+    libssh2_uint64_t pos = 0; // Freshly opened handle, no seek needed
+    size_t window = (size_t)SFTP_READ_WINDOW_DEFAULT_KB * 1024;
+    if (conn && conn->read_window_kb > 0) window = (size_t)conn->read_window_kb * 1024;
+    while (1) {
+        ssize_t got = sftp_pread_remote(remote_handle, &pos, buffer, SFTP_COPY_BUFFER_SIZE, offset, window);
+        if (got < 0) {
+            // sftp_read_remote logs the error
+            LOG_ERR("Error reading from remote file '%s'", remote_path);
+            result = (int)got;
+            break;
+        }
+        if (got == 0) break; // EOF
+
+        if (direct && (got % SFTP_DIRECT_IO_ALIGN) != 0) {
+            // Unaligned tail: finish with a buffered write
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = 0;
+        }
+        result = local_pwrite_all(fd, buffer, (size_t)got, (off_t)offset);
+        if (result == -EINVAL && direct) {
+            // The filesystem accepted O_DIRECT at open but not these writes
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = 0;
+            result = local_pwrite_all(fd, buffer, (size_t)got, (off_t)offset);
+        }
+        if (result != 0) {
+            LOG_ERR("Failed to write the local copy of '%s': %s", remote_path, strerror(-result));
+            break;
+        }
+        offset += got;
+    }
+
+    free(buffer);
+    return result;
+}
+
+static LIBSSH2_SFTP_HANDLE *sftp_open_for_copy(const char *remote_path, libssh2_uint64_t *size) {
     LIBSSH2_SFTP_HANDLE *remote_handle = sftp_open_remote(remote_path, LIBSSH2_FXF_READ, 0);
     if (!remote_handle) {
         // sftp_open_remote logs the specific SFTP error
         LOG_ERR("Failed to open remote file '%s' for reading", remote_path);
-        remote_conn_info_t *conn = get_conn_info();
-        if (conn && conn->sftp_session) {
-             unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-             return -sftp_error_to_errno(sftp_err);
+        return NULL;
+    }
+
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    *size = 0;
+    if (libssh2_sftp_fstat_ex(remote_handle, &attrs, 0) == 0 &&
+        (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE)) {
+        *size = attrs.filesize;
+    }
+    return remote_handle;
+}
+
+// Whole-file download into an open descriptor, which is left open. The mount
+// runs this on files a tool passed over the control socket.
+int sftp_copy_remote_to_fd(const char *remote_path, int fd) {
+    libssh2_uint64_t size;
+    LIBSSH2_SFTP_HANDLE *remote_handle = sftp_open_for_copy(remote_path, &size);
+    if (!remote_handle) return sftp_last_errno();
+
+    int result = sftp_copy_handle_to_fd(remote_handle, remote_path, size, fd, 0);
+    sftp_close_remote(remote_handle); // sftp_close_remote logs errors
+    return result;
+}
+
+// Whole-file download. Large files skip the page cache when the connection
+// asks for direct I/O (remote-cp --direct); that needs the tool's own session,
+// every other download of a tool served by a live mount is done by the mount.
+int sftp_copy_remote_to_local(const char *remote_path, const char *local_path) {
+    int open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    remote_conn_info_t *conn = get_conn_info();
+    if (sftp_use_control() && !(conn && conn->direct_io)) {
+        int fd = open(local_path, open_flags, 0666);
+        if (fd < 0) {
+            int err = errno;
+            LOG_ERR("Failed to open local file '%s' for writing: %s", local_path, strerror(err));
+            return -err;
         }
-        return -EIO;
+        int result = control_get(remote_path, fd);
+        if (close(fd) != 0 && result == 0) {
+            result = -errno;
+            LOG_ERR("Failed to close local file '%s': %s", local_path, strerror(errno));
+        }
+        // -EBUSY: every copy slot of the mount is taken, -ENOTCONN: the mount
+        // went away; download it ourselves
+        if (result != -EBUSY && result != -ENOTCONN) return result;
     }
 
-    FILE *local_file = fopen(local_path, "wb");
-    if (!local_file) {
-        LOG_ERR("Failed to open local file '%s' for writing: %s", local_path, strerror(errno));
+    libssh2_uint64_t size;
+    LIBSSH2_SFTP_HANDLE *remote_handle = sftp_open_for_copy(remote_path, &size);
+    if (!remote_handle) return sftp_last_errno();
+
+    conn = sftp_session_conn();
+    int direct = conn && conn->direct_io && size >= SFTP_DIRECT_IO_MIN;
+    int fd = direct ? open(local_path, open_flags | O_DIRECT, 0666) : -1;
+    if (fd < 0) {
+        if (direct) LOG_DEBUG("O_DIRECT not available for '%s', using buffered writes", local_path);
+        direct = 0;
+        fd = open(local_path, open_flags, 0666);
+    }
+    if (fd < 0) {
+        int err = errno;
+        LOG_ERR("Failed to open local file '%s' for writing: %s", local_path, strerror(err));
         sftp_close_remote(remote_handle);
-        return -errno;
+        return -err;
     }
 
-    char buffer[32768];
-    ssize_t bytes_read;
-    size_t bytes_written;
-    int result = 0;
+    int result = sftp_copy_handle_to_fd(remote_handle, remote_path, size, fd, direct);
+    if (close(fd) != 0 && result == 0) {
+        result = -errno;
+        LOG_ERR("Failed to close local file '%s': %s", local_path, strerror(errno));
+    }
+    sftp_close_remote(remote_handle); // sftp_close_remote logs errors
 
-    while (1) {
-        bytes_read = sftp_read_remote(remote_handle, buffer, sizeof(buffer));
-        if (bytes_read > 0) {
-            bytes_written = fwrite(buffer, 1, bytes_read, local_file);
-            if (bytes_written < (size_t)bytes_read) {
-                LOG_ERR("Failed to write to local file '%s': %s", local_path, strerror(errno));
-                result = -errno;
-                break;
-            }
-        } else if (bytes_read == 0) { // EOF
+    return result;
+}
+
+// Copy one byte range of an open local file into an existing remote file.
+// Used by striped transfers, where several sessions each send their own range.
+// progress (optional) sees every chunk once the server acknowledged it.
+int sftp_copy_range_local_to_remote(int fd, const char *remote_path,
+                                    libssh2_uint64_t offset, libssh2_uint64_t length,
+                                    sftp_copy_progress_t progress, void *arg) {
+    LIBSSH2_SFTP_HANDLE *remote_handle = sftp_open_remote(remote_path, LIBSSH2_FXF_WRITE, 0);
+    if (!remote_handle) {
+        LOG_ERR("Failed to open remote file '%s' for writing", remote_path);
+        return sftp_last_errno();
+    }
+
+    char *buffer = sftp_copy_buffer_alloc();
+    if (!buffer) {
+        sftp_close_remote(remote_handle);
+        return -ENOMEM;
+    }
+
+    int result = 0;
+    while (length > 0) {
+        size_t want = length < SFTP_COPY_BUFFER_SIZE ? (size_t)length : SFTP_COPY_BUFFER_SIZE;
+        ssize_t got = pread(fd, buffer, want, (off_t)offset);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            result = -errno;
+            LOG_ERR("Error reading local file at offset %llu: %s", (unsigned long long)offset, strerror(errno));
             break;
-        } else { // Error
-            // sftp_read_remote logs the error
-            LOG_ERR("Error reading from remote file '%s'", remote_path);
-            result = (int)bytes_read; // Already negative errno
+        }
+        if (got == 0) {
+            LOG_ERR("Local file shrank while copying to '%s'", remote_path);
+            result = -EIO;
+            break;
+        }
+        ssize_t written = sftp_pwrite_remote(remote_handle, buffer, (size_t)got, offset);
+        if (written < 0) {
+            LOG_ERR("Failed to write to remote file '%s'", remote_path);
+            result = (int)written;
             break;
         }
+        if (progress) progress(arg, offset, buffer, (size_t)got);
+        offset += got;
+        length -= got;
     }
 
-    fclose(local_file);
-    sftp_close_remote(remote_handle); // sftp_close_remote logs errors
+    free(buffer);
+    if (sftp_close_remote(remote_handle) != 0 && result == 0) {
+        result = -EIO; // Deferred write errors are reported on close
+    }
+    return result;
+}
 
+// Copy one byte range of a remote file into an open local file with pwrite.
+// progress (optional) sees every chunk once it is written locally.
+int sftp_copy_range_remote_to_local(const char *remote_path, int fd,
+                                    libssh2_uint64_t offset, libssh2_uint64_t length,
+                                    sftp_copy_progress_t progress, void *arg) {
+    LIBSSH2_SFTP_HANDLE *remote_handle = sftp_open_remote(remote_path, LIBSSH2_FXF_READ, 0);
+    if (!remote_handle) {
+        LOG_ERR("Failed to open remote file '%s' for reading", remote_path);
+        return sftp_last_errno();
+    }
+
+    char *buffer = sftp_copy_buffer_alloc();
+    if (!buffer) {
+        sftp_close_remote(remote_handle);
+        return -ENOMEM;
+    }
+
+    int result = 0;
+    libssh2_uint64_t pos = SFTP_POS_UNKNOWN;
+    size_t window = (size_t)SFTP_READ_WINDOW_DEFAULT_KB * 1024;
+    while (length > 0) {
+        size_t want = length < SFTP_COPY_BUFFER_SIZE ? (size_t)length : SFTP_COPY_BUFFER_SIZE;
+        ssize_t got = sftp_pread_remote(remote_handle, &pos, buffer, want, offset, window);
+        if (got < 0) {
+            LOG_ERR("Error reading from remote file '%s'", remote_path);
+            result = (int)got;
+            break;
+        }
+        if (got == 0) {
+            LOG_ERR("Remote file '%s' shrank while copying", remote_path);
+            result = -EIO;
+            break;
+        }
+        result = local_pwrite_all(fd, buffer, (size_t)got, (off_t)offset);
+        if (result != 0) {
+            LOG_ERR("Error writing local file at offset %llu: %s",
+                    (unsigned long long)offset, strerror(-result));
+            break;
+        }
+        if (progress) progress(arg, offset, buffer, (size_t)got);
+        offset += got;
+        length -= got;
+    }
+
+    free(buffer);
+    sftp_close_remote(remote_handle);
     return result;
 }
 
@@ -409,13 +789,7 @@ int sftp_move_remote_to_local(const char *remote_path, const char *local_path) {
         int unlink_rc = sftp_unlink_remote(remote_path);
         if (unlink_rc != 0) {
             // sftp_unlink_remote logs the error
-            remote_conn_info_t *conn = get_conn_info();
-            if (conn && conn->sftp_session) {
-                 unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-                 result = -sftp_error_to_errno(sftp_err);
-            } else {
-                 result = -EIO;
-            }
+            result = sftp_last_errno();
             LOG_ERR("Failed to remove remote file '%s' after copy (errno %d)", remote_path, -result);
             // Attempt to clean up local file
             if (unlink(local_path) != 0) {
@@ -426,33 +800,95 @@ int sftp_move_remote_to_local(const char *remote_path, const char *local_path) {
     return result;
 }
 
-// Add sftp_rename_remote function
-int sftp_rename_remote(const char *old_path, const char *new_path) {
-    remote_conn_info_t *conn = get_conn_info();
-    if (!conn || !conn->sftp_session) return -ENOTCONN;
+static int ssh_exec_script(const char *script, const char *arg1, const char *arg2);
 
+static int sftp_rename_plain(remote_conn_info_t *conn, const char *old_path, const char *new_path,
+                             unsigned long *sftp_err) {
     long rename_flags = LIBSSH2_SFTP_RENAME_OVERWRITE |
                         LIBSSH2_SFTP_RENAME_ATOMIC |
                         LIBSSH2_SFTP_RENAME_NATIVE;
-
     int rc = libssh2_sftp_rename_ex(conn->sftp_session,
                                    old_path, strlen(old_path),
                                    new_path, strlen(new_path),
                                    rename_flags);
+    if (rc != 0) *sftp_err = libssh2_sftp_last_error(conn->sftp_session);
+    return rc;
+}
 
-    if (rc != 0) {
-        unsigned long sftp_err = libssh2_sftp_last_error(conn->sftp_session);
-        int err = sftp_error_to_errno(sftp_err);
-        LOG_ERR("sftp_rename_remote failed for '%s' -> '%s', sftp_err=%lu -> errno=%d",
-                old_path, new_path, sftp_err, err);
-        return -err ? -err : -EIO;
+// Without exec access: move the target aside, rename, then drop the old
+// target, or put it back when the rename fails. Not atomic, but the target
+// is never lost.
+static int sftp_rename_aside(remote_conn_info_t *conn, const char *old_path, const char *new_path,
+                             unsigned long *sftp_err) {
+    char *aside = malloc(strlen(new_path) + 48);
+    if (!aside) return -1;
+    sprintf(aside, "%s.remote-mv-old.%ld", new_path, (long)getpid());
+
+    int rc = sftp_rename_plain(conn, new_path, aside, sftp_err);
+    if (rc == 0) {
+        rc = sftp_rename_plain(conn, old_path, new_path, sftp_err);
+        if (rc == 0) {
+            LOG_WARN("Replaced '%s' in two renames, the replacement was not atomic", new_path);
+            if (libssh2_sftp_unlink(conn->sftp_session, aside) != 0) {
+                LOG_WARN("Could not remove the old '%s' kept as '%s'", new_path, aside);
+            }
+        } else {
+            unsigned long restore_err;
+            if (sftp_rename_plain(conn, aside, new_path, &restore_err) != 0) {
+                LOG_ERR("Could not restore '%s', the old file is kept as '%s'", new_path, aside);
+            }
+        }
     }
-    return 0;
+    free(aside);
+    return rc;
+}
+
+// Rename that replaces an existing file like rename(2). SFTP v3 servers
+// (OpenSSH) ignore the overwrite flag and refuse an existing target with a
+// generic failure. Only then, with the source still there and the target a
+// file, the rename is redone atomically by mv on the server, or without exec
+// access by moving the target aside first.
+int sftp_rename_remote(const char *old_path, const char *new_path) {
+    if (sftp_use_control()) {
+        int rc = control_rename(old_path, new_path);
+        if (rc != -ENOTCONN) return rc;
+    }
+    remote_conn_info_t *conn = sftp_session_conn();
+    if (!conn || !conn->sftp_session) return -ENOTCONN;
+
+    unsigned long sftp_err = 0;
+    if (sftp_rename_plain(conn, old_path, new_path, &sftp_err) == 0) return 0;
+    int err = sftp_error_to_errno(sftp_err);
+
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if ((sftp_err == LIBSSH2_FX_FAILURE || sftp_err == LIBSSH2_FX_FILE_ALREADY_EXISTS) &&
+        sftp_stat_remote(old_path, &attrs) == 0 && sftp_stat_remote(new_path, &attrs) == 0 &&
+        !((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISDIR(attrs.permissions))) {
+        int status = ssh_exec_script("exec mv -f -- \"$1\" \"$2\"", old_path, new_path);
+        if (status == 0) return 0;
+        if (status == 126 || status == 127) status = -ENOSYS; // mv missing or not executable
+        if (status == -ENOSYS) {
+            unsigned long aside_err = 0;
+            if (sftp_rename_aside(conn, old_path, new_path, &aside_err) == 0) return 0;
+            if (aside_err) {
+                sftp_err = aside_err;
+                err = sftp_error_to_errno(sftp_err);
+            }
+        }
+    }
+
+    LOG_ERR("sftp_rename_remote failed for '%s' -> '%s', sftp_err=%lu -> errno=%d",
+            old_path, new_path, sftp_err, err);
+    return err ? -err : -EIO;
 }
 
 // Add sftp_setstat_remote function
 int sftp_setstat_remote(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs) {
-    remote_conn_info_t *conn = get_conn_info();
+    if (sftp_use_control()) {
+        int rc = control_setstat(remote_path, attrs);
+        if (rc != -ENOTCONN) return rc;
+    }
+    remote_conn_info_t *conn = sftp_session_conn();
     if (!conn || !conn->sftp_session) return -ENOTCONN;
 
     int rc = libssh2_sftp_setstat(conn->sftp_session, remote_path, attrs);
@@ -466,3 +902,195 @@ int sftp_setstat_remote(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs)
     }
     return 0;
 }
+
+// Quote an argument for the remote POSIX shell ('...' with embedded quotes
+// written as '\''). Caller frees.
+char *ssh_shell_quote(const char *arg) {
+    size_t len = 3;
+    for (const char *p = arg; *p; p++) len += (*p == '\'') ? 4 : 1;
+
+    char *quoted = malloc(len);
+    if (!quoted) return NULL;
+    char *out = quoted;
+    *out++ = '\'';
+    for (const char *p = arg; *p; p++) {
+        if (*p == '\'') {
+            memcpy(out, "'\\''", 4);
+            out += 4;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out++ = '\'';
+    *out = '\0';
+    return quoted;
+}
+
+// Start a shell command on the server over an exec channel of this thread's
+// SSH session; its stderr is discarded. Returns -ENOSYS when the server does
+// not allow exec channels (e.g. an SFTP-only account).
+int ssh_exec_start(const char *command, LIBSSH2_CHANNEL **channel) {
+    remote_conn_info_t *conn = sftp_session_conn();
+    if (!conn || !conn->ssh_session) return -ENOTCONN;
+
+    *channel = libssh2_channel_open_session(conn->ssh_session);
+    if (!*channel) {
+        LOG_DEBUG("Server refused a session channel for exec");
+        return -ENOSYS;
+    }
+    libssh2_channel_handle_extended_data2(*channel, LIBSSH2_CHANNEL_EXTENDED_DATA_IGNORE);
+    if (libssh2_channel_exec(*channel, command) != 0) {
+        LOG_DEBUG("Server refused to run: %s", command);
+        libssh2_channel_free(*channel);
+        *channel = NULL;
+        return -ENOSYS;
+    }
+    return 0;
+}
+
+// Read the command's stdout; 0 at end of output
+ssize_t ssh_exec_read(LIBSSH2_CHANNEL *channel, char *buffer, size_t count) {
+    ssize_t n = libssh2_channel_read(channel, buffer, count);
+    if (n < 0) {
+        LOG_ERR("Error reading exec channel: libssh2 error %zd", n);
+        return -EIO;
+    }
+    return n;
+}
+
+// Write all of buffer to the command's stdin
+int ssh_exec_write(LIBSSH2_CHANNEL *channel, const char *buffer, size_t count) {
+    while (count > 0) {
+        ssize_t n = libssh2_channel_write(channel, buffer, count);
+        if (n < 0) {
+            LOG_ERR("Error writing exec channel: libssh2 error %zd", n);
+            return -EIO;
+        }
+        buffer += n;
+        count -= (size_t)n;
+    }
+    return 0;
+}
+
+// Close stdin, let the command finish (unread output is dropped) and free the
+// channel. Returns the command's exit status.
+int ssh_exec_finish(LIBSSH2_CHANNEL *channel) {
+    char discard[4096];
+    libssh2_channel_send_eof(channel);
+    while (libssh2_channel_read(channel, discard, sizeof(discard)) > 0) {
+    }
+    libssh2_channel_close(channel);
+    libssh2_channel_wait_closed(channel);
+    int exit_status = libssh2_channel_get_exit_status(channel);
+    libssh2_channel_free(channel);
+    return exit_status;
+}
+
+// Run a command to completion and collect its stdout. Returns the exit
+// status (with *output set, caller frees), -ENOSYS or another -errno.
+int ssh_exec_remote(const char *command, char **output, size_t *output_len) {
+    *output = NULL;
+    *output_len = 0;
+
+    LIBSSH2_CHANNEL *channel;
+    int result = ssh_exec_start(command, &channel);
+    if (result != 0) return result;
+
+    size_t cap = 65536;
+    char *buffer = malloc(cap);
+    size_t len = 0;
+    if (!buffer) result = -ENOMEM;
+    while (result == 0) {
+        if (cap - len < 32768) {
+            char *grown = realloc(buffer, cap * 2);
+            if (!grown) {
+                result = -ENOMEM;
+                break;
+            }
+            buffer = grown;
+            cap *= 2;
+        }
+        ssize_t n = ssh_exec_read(channel, buffer + len, cap - len - 1);
+        if (n < 0) result = (int)n;
+        else if (n == 0) break;
+        else len += (size_t)n;
+    }
+
+    int exit_status = ssh_exec_finish(channel);
+    if (result != 0) {
+        free(buffer);
+        return result;
+    }
+    buffer[len] = '\0';
+    *output = buffer;
+    *output_len = len;
+    return exit_status;
+}
+
+// Run a script with "sh -c" on the server, passing two paths as $1 and $2.
+// Output is dropped; returns the exit status, -ENOSYS or another -errno.
+static int ssh_exec_script(const char *script, const char *arg1, const char *arg2) {
+    char *quoted_script = ssh_shell_quote(script);
+    char *quoted1 = ssh_shell_quote(arg1);
+    char *quoted2 = ssh_shell_quote(arg2);
+    char *command = NULL;
+    if (quoted_script && quoted1 && quoted2) {
+        size_t len = strlen(quoted_script) + strlen(quoted1) + strlen(quoted2) + 16;
+        command = malloc(len);
+        if (command) snprintf(command, len, "sh -c %s sh %s %s", quoted_script, quoted1, quoted2);
+    }
+    free(quoted_script);
+    free(quoted1);
+    free(quoted2);
+    if (!command) return -ENOMEM;
+
+    char *output = NULL;
+    size_t output_len;
+    int status = ssh_exec_remote(command, &output, &output_len);
+    free(output);
+    free(command);
+    return status;
+}
+
+// Copy src to dst on the server itself, so the data never crosses the network.
+// cp --reflink=auto clones the extents on filesystems that can (btrfs, XFS)
+// and copies locally elsewhere; a cp without --reflink gets a plain cp.
+// Returns -ENOSYS when the server cannot run commands or has no cp.
+int ssh_copy_remote(const char *src, const char *dst, int opts) {
+    char script[256];
+    const char *args = (opts & SSH_COPY_RECURSIVE) ? ((opts & SSH_COPY_UPDATE) ? " -R -p -u" : " -R")
+                                                   : ((opts & SSH_COPY_UPDATE) ? " -p -u" : "");
+    snprintf(script, sizeof(script),
+             "cp --reflink=auto%s -- \"$1\" \"$2\" 2>/dev/null || exec cp%s -- \"$1\" \"$2\"",
+             args, args);
+
+    int status = ssh_exec_script(script, src, dst);
+    if (status < 0) return status;
+    if (status == 126 || status == 127) return -ENOSYS; // cp missing or not executable
+    if (status != 0) {
+        LOG_ERR("Server-side copy of '%s' to '%s' failed (exit status %d)", src, dst, status);
+        return -EIO;
+    }
+    return 0;
+}
+
+// Copy length bytes of src at src_offset over dst at dst_offset on the server
+// (GNU dd with byte-granular offsets; dst is neither truncated nor created).
+// Returns -EOPNOTSUPP when dd fails, which includes a dd without these flags.
+int ssh_copy_remote_range(const char *src, libssh2_uint64_t src_offset,
+                          const char *dst, libssh2_uint64_t dst_offset, libssh2_uint64_t length) {
+    char script[512];
+    snprintf(script, sizeof(script),
+             "exec dd if=\"$1\" of=\"$2\" bs=1M skip=%llu seek=%llu count=%llu "
+             "iflag=skip_bytes,count_bytes oflag=seek_bytes conv=notrunc 2>/dev/null",
+             (unsigned long long)src_offset, (unsigned long long)dst_offset,
+             (unsigned long long)length);
+
+    int status = ssh_exec_script(script, src, dst);
+    if (status < 0) return status;
+    if (status != 0) {
+        LOG_DEBUG("Server-side range copy of '%s' to '%s' failed (exit status %d)", src, dst, status);
+        return -EOPNOTSUPP;
+    }
+    return 0;
+}
@@ -11,6 +11,19 @@
 // Cần include libssh2_sftp.h để định nghĩa kiểu LIBSSH2_SFTP_ATTRIBUTES
 #include <libssh2_sftp.h>
 
+// Tham số cho luồng đọc pipeline (sftp_pread_remote)
+#define SFTP_READ_WINDOW_DEFAULT_KB 2048                              // 2 MiB READ requests in flight per handle
+#define SFTP_READ_WINDOW_MAX_KB     (4 * LIBSSH2_CHANNEL_WINDOW_DEFAULT / 1024) // libssh2 caps its read-ahead here
+#define SFTP_READ_SLICE_MIN         32768
+#define SFTP_POS_UNKNOWN            ((libssh2_uint64_t)-1)
+
+// Bộ đệm cho mỗi lượt đọc/ghi khi copy theo từng đoạn (striped transfer)
+#define SFTP_COPY_BUFFER_SIZE       (2 * 1024 * 1024)
+
+// Ghi trực tiếp (O_DIRECT) khi tải file lớn về, xem remote-cp --direct
+#define SFTP_DIRECT_IO_ALIGN        4096
+#define SFTP_DIRECT_IO_MIN          (64ULL * 1024 * 1024)
+
 // --- Khai báo các hàm ---
 int sftp_connect_and_auth(remote_conn_info_t *conn);
 void sftp_disconnect(remote_conn_info_t *conn);
@@ -20,7 +33,11 @@ int sftp_readdir_remote(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t buffer
 int sftp_closedir_remote(LIBSSH2_SFTP_HANDLE *handle);
 LIBSSH2_SFTP_HANDLE* sftp_open_remote(const char *remote_path, unsigned long flags, long mode);
 ssize_t sftp_read_remote(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t count);
+ssize_t sftp_pread_remote(LIBSSH2_SFTP_HANDLE *handle, libssh2_uint64_t *pos,
+                          char *buffer, size_t count, libssh2_uint64_t offset, size_t window);
 ssize_t sftp_write_remote(LIBSSH2_SFTP_HANDLE *handle, const char *buffer, size_t count);
+ssize_t sftp_pwrite_remote(LIBSSH2_SFTP_HANDLE *handle, const char *buffer,
+                           size_t count, libssh2_uint64_t offset);
 int sftp_close_remote(LIBSSH2_SFTP_HANDLE *handle);
 LIBSSH2_SFTP_HANDLE* sftp_create_remote(const char *remote_path, long mode);
 int sftp_unlink_remote(const char *remote_path);
@@ -28,8 +45,23 @@ int sftp_mkdir_remote(const char *remote_path, long mode);
 int sftp_rmdir_remote(const char *remote_path);
 // int sftp_close_remote(LIBSSH2_SFTP_HANDLE *handle); // Khai báo bị lặp lại, bỏ đi
 int sftp_error_to_errno(unsigned long sftp_err);
+// Lỗi của lệnh SFTP vừa thất bại trên luồng này, dạng -errno
+int sftp_last_errno(void);
 int sftp_copy_local_to_remote(const char *local_path, const char *remote_path);
 int sftp_copy_remote_to_local(const char *remote_path, const char *local_path);
+// Như trên với file local đã mở sẵn (fd không bị đóng), dùng cho control socket.
+// File nguồn được đọc bằng read(), không mmap: file bị cắt ngắn trong lúc copy
+// không được làm mount chết vì SIGBUS.
+int sftp_copy_fd_to_remote(int fd, const char *remote_path);
+int sftp_copy_remote_to_fd(const char *remote_path, int fd);
+// Gọi sau mỗi đoạn (tối đa SFTP_COPY_BUFFER_SIZE byte) đã ghi xong ở đích
+typedef void (*sftp_copy_progress_t)(void *arg, libssh2_uint64_t offset, const char *data, size_t len);
+int sftp_copy_range_local_to_remote(int fd, const char *remote_path,
+                                    libssh2_uint64_t offset, libssh2_uint64_t length,
+                                    sftp_copy_progress_t progress, void *arg);
+int sftp_copy_range_remote_to_local(const char *remote_path, int fd,
+                                    libssh2_uint64_t offset, libssh2_uint64_t length,
+                                    sftp_copy_progress_t progress, void *arg);
 int sftp_move_local_to_remote(const char *local_path, const char *remote_path);
 int sftp_move_remote_to_local(const char *remote_path, const char *local_path);
 
@@ -39,4 +71,19 @@ int sftp_rename_remote(const char *old_path, const char *new_path);
 // ---> THÊM KHAI BÁO CHO HÀM SETSTAT <--- (Có thể cần sau này)
 int sftp_setstat_remote(const char *remote_path, LIBSSH2_SFTP_ATTRIBUTES *attrs);
 
+// Chạy lệnh shell trên server qua kênh exec của cùng phiên SSH
+char *ssh_shell_quote(const char *arg);
+int ssh_exec_start(const char *command, LIBSSH2_CHANNEL **channel);
+ssize_t ssh_exec_read(LIBSSH2_CHANNEL *channel, char *buffer, size_t count);
+int ssh_exec_write(LIBSSH2_CHANNEL *channel, const char *buffer, size_t count);
+int ssh_exec_finish(LIBSSH2_CHANNEL *channel);
+int ssh_exec_remote(const char *command, char **output, size_t *output_len);
+
+// Copy phía server (cp --reflink=auto / dd qua kênh exec), dữ liệu không đi qua client
+#define SSH_COPY_RECURSIVE  0x1     // cp -R
+#define SSH_COPY_UPDATE     0x2     // cp -p -u: skip destinations that are not older
+int ssh_copy_remote(const char *src, const char *dst, int opts);
+int ssh_copy_remote_range(const char *src, libssh2_uint64_t src_offset,
+                          const char *dst, libssh2_uint64_t dst_offset, libssh2_uint64_t length);
+
 #endif // SSH_SFTP_CLIENT_H
@@ -0,0 +1,567 @@
+#define _XOPEN_SOURCE 700 // nftw, futimens
+#include "tar_stream.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TAR_OCTAL_SIZE_MAX  077777777777ULL     // Largest size the 12-byte field holds
+#define TAR_RECORD_SIZE     (20 * TAR_BLOCK_SIZE) // tar's default blocking factor
+
+// Whether the server has tar: 0 not checked yet, 1 yes, -1 no
+static int tar_remote_status = 0;
+
+int tar_stream_available(void) {
+    if (tar_remote_status == 0) {
+        char *output;
+        size_t output_len;
+        int status = ssh_exec_remote("sh -c 'command -v tar >/dev/null'", &output, &output_len);
+        if (status >= 0) free(output);
+        tar_remote_status = status == 0 ? 1 : -1;
+        LOG_DEBUG("Remote tar %s (status %d)", status == 0 ? "available" : "unavailable", status);
+    }
+    return tar_remote_status > 0 ? 0 : -ENOSYS;
+}
+
+// Runs cmd ("... $1 ...") under sh on the server with dir as $1
+static char *tar_command(const char *cmd, const char *dir) {
+    char *quoted_cmd = ssh_shell_quote(cmd);
+    char *quoted_dir = ssh_shell_quote(dir);
+    char *command = NULL;
+    if (quoted_cmd && quoted_dir) {
+        command = malloc(strlen(quoted_cmd) + strlen(quoted_dir) + 16);
+        if (command) sprintf(command, "sh -c %s sh %s", quoted_cmd, quoted_dir);
+    }
+    free(quoted_cmd);
+    free(quoted_dir);
+    return command;
+}
+
+// --- Writing (upload) ---
+
+typedef struct {
+    LIBSSH2_CHANNEL *channel;
+    char *buffer;               // TAR_STREAM_BUFFER bytes waiting for the channel
+    size_t len;
+    int error;                  // First failure (negative errno)
+    size_t base_len;            // Length of the local root, stripped from entry names
+    unsigned long files;
+    unsigned long long total;   // Archive bytes produced
+    int verbose;
+} tar_writer_t;
+
+// nftw() has no user argument
+static tar_writer_t *g_tar_writer = NULL;
+
+static void tar_flush(tar_writer_t *w) {
+    if (w->len > 0 && w->error == 0) {
+        w->error = ssh_exec_write(w->channel, w->buffer, w->len);
+    }
+    w->len = 0;
+}
+
+// Append data, or zeros when data is NULL
+static void tar_put(tar_writer_t *w, const char *data, size_t len) {
+    while (len > 0 && w->error == 0) {
+        size_t n = TAR_STREAM_BUFFER - w->len;
+        if (n > len) n = len;
+        if (data) {
+            memcpy(w->buffer + w->len, data, n);
+            data += n;
+        } else {
+            memset(w->buffer + w->len, 0, n);
+        }
+        w->len += n;
+        w->total += n;
+        len -= n;
+        if (w->len == TAR_STREAM_BUFFER) tar_flush(w);
+    }
+}
+
+static void tar_put_padding(tar_writer_t *w, unsigned long long size) {
+    size_t tail = (size_t)(size % TAR_BLOCK_SIZE);
+    if (tail) tar_put(w, NULL, TAR_BLOCK_SIZE - tail);
+}
+
+static void tar_octal(char *field, size_t width, unsigned long long value) {
+    snprintf(field, width, "%0*llo", (int)(width - 1), value);
+}
+
+static void tar_put_header(tar_writer_t *w, const char *prefix, size_t prefix_len,
+                           const char *name, size_t name_len, char type, unsigned int mode,
+                           unsigned long long size, unsigned long long mtime) {
+    char header[TAR_BLOCK_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, name, name_len < 100 ? name_len : 100);
+    tar_octal(header + 100, 8, mode & 07777);
+    tar_octal(header + 108, 8, 0);          // uid/gid: the server extracts as its own user
+    tar_octal(header + 116, 8, 0);
+    tar_octal(header + 124, 12, size <= TAR_OCTAL_SIZE_MAX ? size : 0);
+    tar_octal(header + 136, 12, mtime <= TAR_OCTAL_SIZE_MAX ? mtime : 0);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 345, prefix, prefix_len);
+
+    unsigned int sum = 0;
+    memset(header + 148, ' ', 8);
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) sum += (unsigned char)header[i];
+    snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+    tar_put(w, header, sizeof(header));
+}
+
+static size_t pax_record(char *out, const char *key, const char *value) {
+    // The length prefix counts its own digits
+    size_t body = strlen(key) + strlen(value) + 3; // ' ', '=', '\n'
+    size_t len = body;
+    for (;;) {
+        char digits[24];
+        size_t total = body + (size_t)snprintf(digits, sizeof(digits), "%zu", len);
+        if (total == len) break;
+        len = total;
+    }
+    return (size_t)sprintf(out, "%zu %s=%s\n", len, key, value);
+}
+
+// Header for one entry; names that fit neither the name field nor
+// prefix + name, and sizes over 8 GiB, go in a pax extended header first
+static void tar_put_entry(tar_writer_t *w, const char *name, char type, unsigned int mode,
+                          unsigned long long size, unsigned long long mtime) {
+    size_t len = strlen(name);
+    size_t split = 0;
+    int pax_path = 0;
+    if (len > 100) {
+        pax_path = 1;
+        for (size_t i = 1; i < len && i <= 155; i++) {
+            if (name[i] == '/' && len - i - 1 <= 100 && len - i - 1 > 0) {
+                split = i;
+                pax_path = 0;
+                break;
+            }
+        }
+    }
+    int pax_size = size > TAR_OCTAL_SIZE_MAX;
+
+    if (pax_path || pax_size) {
+        char *records = malloc(len + 96);
+        if (!records) {
+            w->error = -ENOMEM;
+            return;
+        }
+        size_t n = 0;
+        if (pax_path) n += pax_record(records + n, "path", name);
+        if (pax_size) {
+            char value[24];
+            snprintf(value, sizeof(value), "%llu", size);
+            n += pax_record(records + n, "size", value);
+        }
+        tar_put_header(w, "", 0, "PaxHeader", 9, 'x', 0644, n, mtime);
+        tar_put(w, records, n);
+        tar_put_padding(w, n);
+        free(records);
+    }
+
+    if (split) {
+        tar_put_header(w, name, split, name + split + 1, len - split - 1, type, mode, size, mtime);
+    } else {
+        tar_put_header(w, "", 0, name, len, type, mode, size, mtime);
+    }
+}
+
+static int tar_put_file(tar_writer_t *w, const char *path, const char *name, const struct stat *sb) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening local file %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+    unsigned long long size = (unsigned long long)sb->st_size;
+    tar_put_entry(w, name, '0', sb->st_mode, size, sb->st_mtime > 0 ? (unsigned long long)sb->st_mtime : 0);
+
+    // Read straight into the stream buffer
+    unsigned long long left = size;
+    while (left > 0 && w->error == 0) {
+        size_t room = TAR_STREAM_BUFFER - w->len;
+        if (room > left) room = (size_t)left;
+        ssize_t n = read(fd, w->buffer + w->len, room);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->error = -errno;
+            fprintf(stderr, "Error reading local file %s: %s\n", path, strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            // The header already promised size bytes
+            LOG_WARN("%s shrank while being sent, padding with zeros", path);
+            tar_put(w, NULL, (size_t)left);
+            break;
+        }
+        w->len += (size_t)n;
+        w->total += (unsigned long long)n;
+        left -= (unsigned long long)n;
+        if (w->len == TAR_STREAM_BUFFER) tar_flush(w);
+    }
+    close(fd);
+    tar_put_padding(w, size);
+    w->files++;
+    return w->error;
+}
+
+static int tar_walk(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    tar_writer_t *w = g_tar_writer;
+    if (ftwbuf->level == 0) return 0; // The root exists on the server already
+
+    const char *name = path + w->base_len;
+    while (*name == '/') name++;
+
+    if (typeflag == FTW_D) {
+        char dir_name[PATH_MAX + 1];
+        snprintf(dir_name, sizeof(dir_name), "%s/", name);
+        if (w->verbose) printf("Sending directory %s\n", name);
+        tar_put_entry(w, dir_name, '5', sb->st_mode, 0,
+                      sb->st_mtime > 0 ? (unsigned long long)sb->st_mtime : 0);
+    } else if (typeflag == FTW_F && S_ISREG(sb->st_mode)) {
+        if (w->verbose) printf("Sending %s\n", name);
+        if (w->error == 0) tar_put_file(w, path, name, sb);
+    } else if (typeflag == FTW_DNR || typeflag == FTW_NS) {
+        fprintf(stderr, "Error reading local path %s\n", path);
+        w->error = -EACCES;
+    } else if (w->verbose) {
+        printf("Skipping non-regular file: %s\n", path);
+    }
+    return w->error != 0;
+}
+
+int tar_upload_tree(const char *local_dir, const char *remote_dir, int verbose) {
+    char *command = tar_command("mkdir -p -- \"$1\" && cd -- \"$1\" && exec tar -xof -", remote_dir);
+    if (!command) return -ENOMEM;
+    LIBSSH2_CHANNEL *channel;
+    int result = ssh_exec_start(command, &channel);
+    free(command);
+    if (result != 0) return result;
+
+    tar_writer_t w = {
+        .channel = channel,
+        .buffer = malloc(TAR_STREAM_BUFFER),
+        .base_len = strlen(local_dir),
+        .verbose = verbose
+    };
+    if (!w.buffer) {
+        ssh_exec_finish(channel);
+        return -ENOMEM;
+    }
+
+    g_tar_writer = &w;
+    int walk = nftw(local_dir, tar_walk, 20, FTW_PHYS);
+    g_tar_writer = NULL;
+    if (walk != 0 && w.error == 0) w.error = -EIO;
+
+    if (w.error == 0) {
+        // End of archive: two zero blocks, padded to a full record
+        tar_put(&w, NULL, 2 * TAR_BLOCK_SIZE);
+        if (w.total % TAR_RECORD_SIZE) tar_put(&w, NULL, TAR_RECORD_SIZE - (size_t)(w.total % TAR_RECORD_SIZE));
+        tar_flush(&w);
+    }
+    free(w.buffer);
+
+    int status = ssh_exec_finish(channel);
+    if (w.error != 0) return w.error;
+    if (status != 0) {
+        fprintf(stderr, "Error: tar on the server failed with status %d while extracting into %s\n",
+                status, remote_dir);
+        return -EIO;
+    }
+    if (verbose) {
+        printf("Sent %lu file(s) as one tar stream (%llu bytes)\n", w.files, w.total);
+    }
+    return 0;
+}
+
+// --- Reading (download) ---
+
+typedef struct {
+    LIBSSH2_CHANNEL *channel;
+    char *buffer;
+    size_t len;
+    size_t pos;
+} tar_reader_t;
+
+static int tar_refill(tar_reader_t *r) {
+    ssize_t n = ssh_exec_read(r->channel, r->buffer, TAR_STREAM_BUFFER);
+    if (n < 0) return (int)n;
+    if (n == 0) {
+        fprintf(stderr, "Error: tar stream from the server ended early\n");
+        return -EIO;
+    }
+    r->len = (size_t)n;
+    r->pos = 0;
+    return 0;
+}
+
+// Read len bytes into data, or skip them when data is NULL
+static int tar_get(tar_reader_t *r, char *data, unsigned long long len) {
+    while (len > 0) {
+        if (r->pos == r->len) {
+            int result = tar_refill(r);
+            if (result != 0) return result;
+        }
+        size_t n = r->len - r->pos;
+        if (n > len) n = (size_t)len;
+        if (data) {
+            memcpy(data, r->buffer + r->pos, n);
+            data += n;
+        }
+        r->pos += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Copy len bytes of the stream into fd
+static int tar_get_to_fd(tar_reader_t *r, int fd, unsigned long long len) {
+    while (len > 0) {
+        if (r->pos == r->len) {
+            int result = tar_refill(r);
+            if (result != 0) return result;
+        }
+        size_t n = r->len - r->pos;
+        if (n > len) n = (size_t)len;
+        ssize_t written = write(fd, r->buffer + r->pos, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        r->pos += (size_t)written;
+        len -= (unsigned long long)written;
+    }
+    return 0;
+}
+
+static unsigned long long tar_padding(unsigned long long size) {
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+// Octal field, or GNU base-256 when the top bit of the first byte is set
+static unsigned long long tar_number(const char *field, size_t width) {
+    unsigned long long value = 0;
+    if ((unsigned char)field[0] & 0x80) {
+        value = (unsigned char)field[0] & 0x7f;
+        for (size_t i = 1; i < width; i++) value = value << 8 | (unsigned char)field[i];
+        return value;
+    }
+    size_t i = 0;
+    while (i < width && field[i] == ' ') i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++) value = value * 8 + (unsigned)(field[i] - '0');
+    return value;
+}
+
+static int tar_header_valid(const char *header) {
+    unsigned long long stored = tar_number(header + 148, 8);
+    unsigned int sum = 0;
+    int signed_sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        char c = (i >= 148 && i < 156) ? ' ' : header[i];
+        sum += (unsigned char)c;
+        signed_sum += (signed char)c;
+    }
+    return stored == sum || (long long)stored == signed_sum;
+}
+
+// Strip "./" and leading slashes; NULL for names that would leave the target
+static const char *tar_clean_name(const char *name) {
+    for (;;) {
+        if (name[0] == '/') name++;
+        else if (name[0] == '.' && name[1] == '/') name += 2;
+        else break;
+    }
+    if (strcmp(name, ".") == 0) return "";
+    for (const char *p = name; *p; ) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') return NULL;
+        if (!end) break;
+        p = end + 1;
+    }
+    return name;
+}
+
+// Create the missing directories above path (below the local root)
+static void tar_make_parents(char *path, size_t root_len) {
+    for (char *p = path + root_len + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+}
+
+static int tar_get_file(tar_reader_t *r, char *path, size_t root_len, unsigned int mode,
+                        unsigned long long size, unsigned long long mtime) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode & 0777);
+    if (fd < 0 && errno == ENOENT) {
+        tar_make_parents(path, root_len);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode & 0777);
+    }
+    if (fd < 0) {
+        int err = errno;
+        fprintf(stderr, "Error creating local file %s: %s\n", path, strerror(err));
+        return -err;
+    }
+    int result = tar_get_to_fd(r, fd, size);
+    if (result == 0) {
+        struct timespec times[2] = { { .tv_nsec = UTIME_NOW }, { .tv_sec = (time_t)mtime } };
+        futimens(fd, times);
+    } else if (result != -EIO) {
+        fprintf(stderr, "Error writing local file %s: %s\n", path, strerror(-result));
+    }
+    if (close(fd) != 0 && result == 0) result = -errno;
+    return result;
+}
+
+int tar_download_tree(const char *remote_dir, const char *local_dir, int verbose) {
+    char *command = tar_command("cd -- \"$1\" && exec tar -cf - .", remote_dir);
+    if (!command) return -ENOMEM;
+    LIBSSH2_CHANNEL *channel;
+    int result = ssh_exec_start(command, &channel);
+    free(command);
+    if (result != 0) return result;
+
+    tar_reader_t r = { .channel = channel, .buffer = malloc(TAR_STREAM_BUFFER) };
+    if (!r.buffer) {
+        ssh_exec_finish(channel);
+        return -ENOMEM;
+    }
+
+    size_t root_len = strlen(local_dir);
+    char *long_name = NULL;     // From a GNU 'L' entry or a pax "path" record
+    unsigned long long pax_size = 0;
+    int have_pax_size = 0;
+    unsigned long files = 0;
+    unsigned long long bytes = 0;
+    char header[TAR_BLOCK_SIZE];
+
+    while (result == 0 && (result = tar_get(&r, header, TAR_BLOCK_SIZE)) == 0) {
+        int zero = 1;
+        for (size_t i = 0; i < TAR_BLOCK_SIZE && zero; i++) zero = header[i] == 0;
+        if (zero) break; // End of archive
+
+        if (!tar_header_valid(header)) {
+            fprintf(stderr, "Error: corrupt tar stream from the server\n");
+            result = -EIO;
+            break;
+        }
+        char type = header[156];
+        unsigned long long size = have_pax_size ? pax_size : tar_number(header + 124, 12);
+        unsigned long long padded = size + tar_padding(size);
+
+        if (type == 'L' || type == 'x') {
+            // Metadata for the next entry
+            if (size > TAR_PAX_MAX) {
+                result = -EIO;
+                break;
+            }
+            char *data = malloc((size_t)size + 1);
+            if (!data) {
+                result = -ENOMEM;
+                break;
+            }
+            result = tar_get(&r, data, size);
+            if (result == 0) result = tar_get(&r, NULL, tar_padding(size));
+            data[size] = '\0';
+            if (result == 0 && type == 'L') {
+                free(long_name);
+                long_name = data;
+                continue;
+            }
+            // pax records: "<len> <key>=<value>\n"
+            for (char *p = data; result == 0 && p < data + size; ) {
+                char *end;
+                unsigned long len = strtoul(p, &end, 10);
+                if (len == 0 || p + len > data + size || *end != ' ') break;
+                char *key = end + 1;
+                char *eq = memchr(key, '=', (size_t)(p + len - key));
+                if (eq) {
+                    p[len - 1] = '\0';
+                    *eq = '\0';
+                    if (strcmp(key, "path") == 0) {
+                        free(long_name);
+                        long_name = strdup(eq + 1);
+                    } else if (strcmp(key, "size") == 0) {
+                        pax_size = strtoull(eq + 1, NULL, 10);
+                        have_pax_size = 1;
+                    }
+                }
+                p += len;
+            }
+            free(data);
+            continue;
+        }
+        if (type == 'g' || type == 'K') {
+            result = tar_get(&r, NULL, padded);
+            continue;
+        }
+
+        char name[PATH_MAX];
+        if (long_name) {
+            snprintf(name, sizeof(name), "%s", long_name);
+        } else if (memcmp(header + 257, "ustar", 6) == 0 && header[345]) {
+            snprintf(name, sizeof(name), "%.155s/%.100s", header + 345, header);
+        } else {
+            snprintf(name, sizeof(name), "%.100s", header);
+        }
+        free(long_name);
+        long_name = NULL;
+        have_pax_size = 0;
+
+        unsigned int mode = (unsigned int)tar_number(header + 100, 8);
+        unsigned long long mtime = tar_number(header + 136, 12);
+        const char *clean = tar_clean_name(name);
+        char path[PATH_MAX];
+        if (clean) snprintf(path, sizeof(path), "%s/%s", local_dir, clean);
+
+        if (!clean) {
+            fprintf(stderr, "Warning: skipping unsafe path in tar stream: %s\n", name);
+            result = tar_get(&r, NULL, padded);
+        } else if (type == '5') {
+            size_t len = strlen(path);
+            while (len > root_len && path[len - 1] == '/') path[--len] = '\0';
+            struct stat st;
+            if (mkdir(path, mode & 0777) != 0 && (errno != EEXIST || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))) {
+                fprintf(stderr, "Error creating local directory %s: %s\n", path,
+                        errno == EEXIST ? strerror(ENOTDIR) : strerror(errno));
+                result = errno == EEXIST ? -ENOTDIR : -errno;
+            } else if (verbose && len > root_len) {
+                printf("Created local directory: %s\n", path);
+            }
+            if (result == 0) result = tar_get(&r, NULL, padded);
+        } else if (type == '0' || type == '\0' || type == '7') {
+            if (verbose) printf("Receiving %s\n", clean);
+            result = tar_get_file(&r, path, root_len, mode, size, mtime);
+            if (result == 0) result = tar_get(&r, NULL, tar_padding(size));
+            files++;
+            bytes += size;
+        } else {
+            if (verbose) printf("Skipping non-regular file: %s\n", clean);
+            result = tar_get(&r, NULL, padded);
+        }
+    }
+    free(long_name);
+    free(r.buffer);
+
+    int status = ssh_exec_finish(channel);
+    if (result != 0) return result;
+    if (status == 1) {
+        // GNU tar: some file changed while it was read
+        fprintf(stderr, "Warning: tar on the server reported files changed during the copy\n");
+    } else if (status != 0) {
+        fprintf(stderr, "Error: tar on the server failed with status %d while reading %s\n",
+                status, remote_dir);
+        return -EIO;
+    }
+    if (verbose) {
+        printf("Received %lu file(s) as one tar stream (%llu bytes)\n", files, bytes);
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef TAR_STREAM_H
+#define TAR_STREAM_H
+
+#include "common.h"
+#include "ssh_sftp_client.h"
+
+// Bulk copy of a directory tree for remote-cp -r --tar. The tree travels as
+// one tar stream over an exec channel of the SSH session ("tar -x" or
+// "tar -c" on the server), so small files no longer cost an SFTP
+// OPEN/WRITE/CLOSE round trip each. The archive is written and read here
+// (ustar, with pax records for long names and large files), so no local tar
+// is needed. Like the per-file path, only directories and regular files are
+// copied.
+
+#define TAR_BLOCK_SIZE      512
+#define TAR_STREAM_BUFFER   (256 * 1024)
+#define TAR_PAX_MAX         (1024 * 1024)   // Largest pax header accepted from the server
+
+// 0 when the server can run tar, -ENOSYS otherwise (callers fall back to per-file copy)
+int tar_stream_available(void);
+int tar_upload_tree(const char *local_dir, const char *remote_dir, int verbose);
+int tar_download_tree(const char *remote_dir, const char *local_dir, int verbose);
+
+#endif // TAR_STREAM_H
@@ -0,0 +1,661 @@
+#include "transfer.h"
+#include "ssh_sftp_client.h"
+#include "mount_config.h"
+#include "delta.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert(TRANSFER_STRIPE_CHUNK % TRANSFER_JOURNAL_BLOCK == 0,
+               "stripe ranges must start on journal block boundaries");
+
+// Set once a move fell back to comparing sizes, so the warning is printed once
+static int transfer_size_only_warned = 0;
+
+// Give a copied file the source mtime (TRANSFER_UPDATE). A failure only
+// costs a re-copy on the next run, so it is not fatal.
+static void transfer_set_mtime(transfer_direction_t direction, const char *dst, unsigned long mtime) {
+    if (direction == TRANSFER_UPLOAD) {
+        LIBSSH2_SFTP_ATTRIBUTES attrs = {
+            .flags = LIBSSH2_SFTP_ATTR_ACMODTIME,
+            .atime = (unsigned long)time(NULL),
+            .mtime = mtime
+        };
+        if (sftp_setstat_remote(dst, &attrs) != 0) {
+            LOG_WARN("Could not set modification time of %s", dst);
+        }
+        return;
+    }
+    struct timespec times[2] = { { .tv_nsec = UTIME_NOW }, { .tv_sec = (time_t)mtime } };
+    if (utimensat(AT_FDCWD, dst, times, 0) != 0) {
+        LOG_WARN("Could not set modification time of %s: %s", dst, strerror(errno));
+    }
+}
+
+// TRANSFER_MOVE: check that dst is a copy of src, then delete src. The size
+// alone proves nothing for striped downloads (the destination gets its final
+// size up front), so the content is compared by MD5 whenever the server can
+// run md5sum; otherwise only the size is checked.
+static int transfer_remove_source(transfer_direction_t direction, const char *src, const char *dst) {
+    libssh2_uint64_t src_size, dst_size;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    struct stat st;
+    int have_src, have_dst;
+    if (direction == TRANSFER_UPLOAD) {
+        have_src = stat(src, &st) == 0;
+        src_size = have_src ? (libssh2_uint64_t)st.st_size : 0;
+        have_dst = sftp_stat_remote(dst, &attrs) == 0 && (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE);
+        dst_size = have_dst ? attrs.filesize : 0;
+    } else {
+        have_src = sftp_stat_remote(src, &attrs) == 0 && (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE);
+        src_size = have_src ? attrs.filesize : 0;
+        have_dst = stat(dst, &st) == 0;
+        dst_size = have_dst ? (libssh2_uint64_t)st.st_size : 0;
+    }
+    int same = have_src && have_dst && src_size == dst_size;
+    if (same) {
+        int content = direction == TRANSFER_UPLOAD ? delta_same_content(src, dst) : delta_same_content(dst, src);
+        if (content >= 0) {
+            same = content;
+        } else if (!__atomic_exchange_n(&transfer_size_only_warned, 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "Warning: the server cannot checksum files, moved files are checked by size only\n");
+        }
+    }
+    if (!same) {
+        fprintf(stderr, "Error: %s does not match %s after the copy, keeping the source\n", dst, src);
+        return -EIO;
+    }
+
+    int result = 0;
+    if (direction == TRANSFER_UPLOAD) {
+        if (unlink(src) != 0) result = -errno;
+    } else {
+        result = sftp_unlink_remote(src) == 0 ? 0 : -EIO;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error removing %s after the copy: %s\n", src, strerror(-result));
+    }
+    return result;
+}
+
+// TRANSFER_UPDATE: is dst already a copy of src? Same size and mtime is
+// enough; with TRANSFER_CHECKSUM a same-sized file with another mtime is
+// compared by content and, when equal, only gets its mtime fixed.
+static int transfer_up_to_date(const transfer_engine_t *engine, transfer_direction_t direction,
+                               const char *src, const char *dst,
+                               libssh2_uint64_t size, unsigned long mtime) {
+    if (!(engine->flags & TRANSFER_UPDATE) || size == TRANSFER_SIZE_UNKNOWN) return 0;
+
+    libssh2_uint64_t dst_size;
+    unsigned long dst_mtime = TRANSFER_MTIME_UNKNOWN;
+    if (direction == TRANSFER_UPLOAD) {
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+        if (sftp_stat_remote(dst, &attrs) != 0 || !(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ||
+            !(attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) || !LIBSSH2_SFTP_S_ISREG(attrs.permissions)) {
+            return 0;
+        }
+        dst_size = attrs.filesize;
+        if (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) dst_mtime = attrs.mtime;
+    } else {
+        struct stat st;
+        if (stat(dst, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+        dst_size = (libssh2_uint64_t)st.st_size;
+        dst_mtime = (unsigned long)st.st_mtime;
+    }
+
+    if (dst_size != size) return 0;
+    if (mtime != TRANSFER_MTIME_UNKNOWN && dst_mtime == mtime) return 1;
+    if (!(engine->flags & TRANSFER_CHECKSUM)) return 0;
+
+    int same = direction == TRANSFER_UPLOAD ? delta_same_content(src, dst) : delta_same_content(dst, src);
+    if (same < 0 && engine->verbose) {
+        printf("Cannot checksum %s on the server, copying it\n", direction == TRANSFER_UPLOAD ? dst : src);
+    }
+    if (same == 1 && mtime != TRANSFER_MTIME_UNKNOWN) transfer_set_mtime(direction, dst, mtime);
+    return same == 1;
+}
+
+// Copy one whole file; TRANSFER_SKIPPED when TRANSFER_UPDATE finds it current
+static int transfer_run(const transfer_engine_t *engine, transfer_direction_t direction,
+                        const char *src, const char *dst, libssh2_uint64_t size, unsigned long mtime) {
+    int verbose = engine->verbose;
+    if (transfer_up_to_date(engine, direction, src, dst, size, mtime)) {
+        if (verbose) printf("Skipping %s (up to date)\n", src);
+        return TRANSFER_SKIPPED;
+    }
+    int delta = engine->flags & TRANSFER_DELTA;
+    int result;
+    if (direction == TRANSFER_UPLOAD) {
+        if (verbose) printf("Copying local file %s to remote %s\n", src, dst);
+        result = delta ? delta_copy_local_to_remote(src, dst, verbose) : sftp_copy_local_to_remote(src, dst);
+    } else {
+        if (verbose) printf("Copying remote file %s to local %s\n", src, dst);
+        result = delta ? delta_copy_remote_to_local(src, dst, verbose) : sftp_copy_remote_to_local(src, dst);
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error copying %s to %s: %s\n", src, dst, strerror(-result));
+        return result;
+    }
+    if ((engine->flags & (TRANSFER_UPDATE | TRANSFER_MOVE)) && mtime != TRANSFER_MTIME_UNKNOWN) {
+        transfer_set_mtime(direction, dst, mtime);
+    }
+    if (engine->flags & TRANSFER_MOVE) {
+        result = transfer_remove_source(direction, src, dst);
+    }
+    return result;
+}
+
+static void job_free(transfer_job_t *job) {
+    free(job->src);
+    free(job->dst);
+    free(job);
+}
+
+// Record the first failure and wake a submit blocked on a full queue
+static void transfer_fail(transfer_engine_t *engine, int result) {
+    pthread_mutex_lock(&engine->lock);
+    if (engine->error == 0) engine->error = result;
+    pthread_cond_broadcast(&engine->not_full);
+    pthread_mutex_unlock(&engine->lock);
+}
+
+static int copy_range(const transfer_stripe_t *stripe, libssh2_uint64_t offset, libssh2_uint64_t length,
+                      sftp_copy_progress_t progress, void *arg) {
+    if (stripe->direction == TRANSFER_UPLOAD) {
+        return sftp_copy_range_local_to_remote(stripe->fd, stripe->dst, offset, length, progress, arg);
+    }
+    return sftp_copy_range_remote_to_local(stripe->src, stripe->fd, offset, length, progress, arg);
+}
+
+// Every chunk reported by copy_range is exactly one journal block
+static void journal_progress(void *arg, libssh2_uint64_t offset, const char *data, size_t len) {
+    transfer_journal_mark(arg, (size_t)(offset / TRANSFER_JOURNAL_BLOCK), transfer_block_hash(data, len));
+}
+
+// Copy one range, skipping the blocks a resumed journal already has
+static int transfer_run_range(const transfer_job_t *job) {
+    transfer_stripe_t *stripe = job->stripe;
+    transfer_journal_t *journal = stripe->journal;
+    if (!journal) return copy_range(stripe, job->offset, job->length, NULL, NULL);
+
+    libssh2_uint64_t pos = job->offset;
+    libssh2_uint64_t end = job->offset + job->length;
+    while (pos < end) {
+        if (transfer_journal_has(journal, (size_t)(pos / TRANSFER_JOURNAL_BLOCK))) {
+            pos = (pos / TRANSFER_JOURNAL_BLOCK + 1) * TRANSFER_JOURNAL_BLOCK;
+            continue;
+        }
+        libssh2_uint64_t run_end = pos;
+        while (run_end < end && !transfer_journal_has(journal, (size_t)(run_end / TRANSFER_JOURNAL_BLOCK))) {
+            run_end = (run_end / TRANSFER_JOURNAL_BLOCK + 1) * TRANSFER_JOURNAL_BLOCK;
+        }
+        if (run_end > end) run_end = end;
+
+        int result = copy_range(stripe, pos, run_end - pos, journal_progress, journal);
+        if (result != 0) return result;
+        pos = run_end;
+    }
+    return 0;
+}
+
+static void stripe_free(transfer_stripe_t *stripe) {
+    free(stripe->src);
+    free(stripe->dst);
+    free(stripe);
+}
+
+// Account for one finished range. Called with the engine lock held; returns
+// 1 for the last one, whose caller then runs stripe_finish() unlocked.
+static int stripe_range_done(transfer_stripe_t *stripe, int result) {
+    if (result != 0 && stripe->error == 0) stripe->error = result;
+    return --stripe->pending == 0;
+}
+
+// Close the local file and settle a stripe whose ranges are all done. Runs
+// without the engine lock: the remote setstat/stat/unlink and journal I/O of
+// one file must not stall the other workers.
+static void stripe_finish(transfer_engine_t *engine, transfer_stripe_t *stripe) {
+    if (stripe->error == 0 && (engine->flags & (TRANSFER_UPDATE | TRANSFER_MOVE)) &&
+        stripe->mtime != TRANSFER_MTIME_UNKNOWN) {
+        transfer_set_mtime(stripe->direction, stripe->dst, stripe->mtime);
+    }
+    if (close(stripe->fd) != 0 && stripe->error == 0) stripe->error = -errno;
+    if (stripe->error) {
+        fprintf(stderr, "Error copying %s to %s: %s\n", stripe->src, stripe->dst, strerror(-stripe->error));
+    } else if (engine->flags & TRANSFER_MOVE) {
+        stripe->error = transfer_remove_source(stripe->direction, stripe->src, stripe->dst);
+    }
+    if (stripe->journal) {
+        if (stripe->error && engine->verbose) {
+            printf("Progress of %s saved, run again with --resume to continue\n", stripe->src);
+        }
+        transfer_journal_close(stripe->journal, stripe->error == 0);
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    if (stripe->error) {
+        if (engine->error == 0) engine->error = stripe->error;
+        pthread_cond_broadcast(&engine->not_full);
+    } else {
+        engine->done++;
+    }
+    pthread_mutex_unlock(&engine->lock);
+    stripe_free(stripe);
+}
+
+static void *transfer_worker(void *arg) {
+    transfer_engine_t *engine = arg;
+
+    // The session stays with this thread; sftp_copy_* find it via get_conn_info()
+    remote_conn_info_t *conn = sftp_pool_checkout(engine->pool);
+
+    pthread_mutex_lock(&engine->lock);
+    for (;;) {
+        while (!engine->head && !engine->closing) {
+            pthread_cond_wait(&engine->not_empty, &engine->lock);
+        }
+        transfer_job_t *job = engine->head;
+        if (!job) break; // Closing and drained
+
+        engine->head = job->next;
+        if (!engine->head) engine->tail = NULL;
+        engine->queued--;
+        int skip = engine->error != 0;
+        pthread_cond_signal(&engine->not_full);
+        pthread_mutex_unlock(&engine->lock);
+
+        int result = 0;
+        if (!skip) {
+            result = job->stripe ? transfer_run_range(job)
+                                 : transfer_run(engine, job->direction, job->src, job->dst,
+                                                job->size, job->mtime);
+        }
+
+        pthread_mutex_lock(&engine->lock);
+        transfer_stripe_t *finished = NULL;
+        if (job->stripe) {
+            // A skipped range still counts, so the file is closed and the error reported
+            if (stripe_range_done(job->stripe, skip ? -ECANCELED : result)) finished = job->stripe;
+        } else if (result < 0) {
+            if (engine->error == 0) engine->error = result;
+        } else if (result == TRANSFER_SKIPPED) {
+            engine->skipped++;
+        } else if (!skip) {
+            engine->done++;
+        }
+        if (engine->error) {
+            pthread_cond_broadcast(&engine->not_full); // Wake a blocked submit so it sees the error
+        }
+        job_free(job);
+        if (finished) {
+            pthread_mutex_unlock(&engine->lock);
+            stripe_finish(engine, finished);
+            pthread_mutex_lock(&engine->lock);
+        }
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    sftp_pool_checkin(engine->pool, conn);
+    return NULL;
+}
+
+transfer_engine_t *transfer_engine_create(const remote_conn_info_t *tmpl, int jobs, int flags, int verbose) {
+    transfer_engine_t *engine = calloc(1, sizeof(transfer_engine_t));
+    if (!engine) {
+        LOG_ERR("Failed to allocate transfer engine");
+        return NULL;
+    }
+    engine->flags = flags;
+    engine->verbose = verbose;
+    if (tmpl && tmpl->remote_host) {
+        engine->host = strdup(tmpl->remote_host);
+        engine->port = tmpl->remote_port;
+    }
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->not_empty, NULL);
+    pthread_cond_init(&engine->not_full, NULL);
+
+    if (jobs <= 1 || !tmpl) return engine;
+    if (jobs > TRANSFER_JOBS_MAX) jobs = TRANSFER_JOBS_MAX;
+
+    engine->pool = sftp_pool_create(tmpl, jobs);
+    if (!engine->pool) {
+        LOG_WARN("Could not open parallel SFTP sessions, copying one file at a time");
+        return engine;
+    }
+
+    engine->workers = calloc(engine->pool->size, sizeof(pthread_t));
+    if (!engine->workers) {
+        LOG_WARN("Failed to allocate transfer workers, copying one file at a time");
+        sftp_pool_destroy(engine->pool);
+        engine->pool = NULL;
+        return engine;
+    }
+    for (int i = 0; i < engine->pool->size; i++) {
+        if (pthread_create(&engine->workers[i], NULL, transfer_worker, engine) != 0) {
+            LOG_WARN("Started only %d of %d transfer workers", i, engine->pool->size);
+            break;
+        }
+        engine->nworkers++;
+    }
+    if (engine->nworkers == 0) {
+        free(engine->workers);
+        engine->workers = NULL;
+        sftp_pool_destroy(engine->pool);
+        engine->pool = NULL;
+    }
+    if (verbose) {
+        printf("Transferring with %d parallel session(s)\n", engine->nworkers ? engine->nworkers : 1);
+    }
+    return engine;
+}
+
+// Append a job, waiting while the queue is full. Takes ownership of job.
+static int transfer_enqueue(transfer_engine_t *engine, transfer_job_t *job) {
+    pthread_mutex_lock(&engine->lock);
+    while (engine->queued >= TRANSFER_QUEUE_LIMIT && !engine->error) {
+        pthread_cond_wait(&engine->not_full, &engine->lock);
+    }
+    int error = engine->error;
+    if (error) {
+        pthread_mutex_unlock(&engine->lock);
+        job_free(job);
+        return error;
+    }
+    if (engine->tail) engine->tail->next = job; else engine->head = job;
+    engine->tail = job;
+    engine->queued++;
+    pthread_cond_signal(&engine->not_empty);
+    pthread_mutex_unlock(&engine->lock);
+    return 0;
+}
+
+// Downloads keep the journal beside the destination; uploads keep it in the
+// config directory, named after the remote end so any source dir works.
+static char *journal_path(const transfer_engine_t *engine, transfer_direction_t direction, const char *dst) {
+    char path[PATH_MAX];
+    if (direction == TRANSFER_DOWNLOAD) {
+        int n = snprintf(path, sizeof(path), "%s%s", dst, TRANSFER_JOURNAL_SUFFIX);
+        return n > 0 && (size_t)n < sizeof(path) ? strdup(path) : NULL;
+    }
+
+    char *config_dir = get_config_dir();
+    if (!config_dir) return NULL;
+    snprintf(path, sizeof(path), "%s/journals", config_dir);
+    free(config_dir);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        LOG_WARN("Cannot create journal directory %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "\n%d\n", engine->port);
+    const char *parts[3] = { engine->host ? engine->host : "", port_str, dst };
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (int i = 0; i < 3; i++) {
+        for (const unsigned char *p = (const unsigned char *)parts[i]; *p; p++) {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        }
+    }
+    size_t len = strlen(path);
+    snprintf(path + len, sizeof(path) - len, "/%016llx.journal", (unsigned long long)h);
+    return strdup(path);
+}
+
+// Check the blocks an earlier run recorded against what the destination
+// holds now: local blocks are re-hashed, remote ones must lie within the
+// remote file (re-reading them would cost as much as sending them again).
+static void journal_verify(transfer_journal_t *journal, transfer_direction_t direction, const char *dst) {
+    if (direction == TRANSFER_DOWNLOAD) {
+        int fd = open(dst, O_RDONLY);
+        char *buffer = fd >= 0 ? malloc(TRANSFER_JOURNAL_BLOCK) : NULL;
+        for (size_t i = 0; i < journal->nblocks; i++) {
+            if (!transfer_journal_has(journal, i)) continue;
+            libssh2_uint64_t offset = (libssh2_uint64_t)i * TRANSFER_JOURNAL_BLOCK;
+            size_t len = journal->size - offset < TRANSFER_JOURNAL_BLOCK
+                       ? (size_t)(journal->size - offset) : TRANSFER_JOURNAL_BLOCK;
+            if (!buffer || pread(fd, buffer, len, (off_t)offset) != (ssize_t)len ||
+                transfer_block_hash(buffer, len) != transfer_journal_hash_of(journal, i)) {
+                transfer_journal_forget(journal, i);
+            }
+        }
+        free(buffer);
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    int have_size = sftp_stat_remote(dst, &attrs) == 0 && (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE);
+    for (size_t i = 0; i < journal->nblocks; i++) {
+        if (!transfer_journal_has(journal, i)) continue;
+        libssh2_uint64_t end = (libssh2_uint64_t)(i + 1) * TRANSFER_JOURNAL_BLOCK;
+        if (end > journal->size) end = journal->size;
+        if (!have_size || attrs.filesize < end) transfer_journal_forget(journal, i);
+    }
+}
+
+// Open the journal of a resumable copy and keep only blocks still valid
+static transfer_journal_t *stripe_journal(transfer_engine_t *engine, transfer_direction_t direction,
+                                          const char *src, const char *dst,
+                                          libssh2_uint64_t size, unsigned long mtime) {
+    char *file = journal_path(engine, direction, dst);
+    if (!file) {
+        LOG_WARN("No journal for %s, it will not be resumable", dst);
+        return NULL;
+    }
+    transfer_journal_t *journal = transfer_journal_open(file, src, dst, size, mtime);
+    free(file);
+    if (!journal) return NULL;
+
+    if (journal->resumed) {
+        size_t recorded = journal->done;
+        journal_verify(journal, direction, dst);
+        if (engine->verbose || journal->done != recorded) {
+            printf("Resuming %s: %zu of %zu blocks already copied", src, journal->done, journal->nblocks);
+            if (journal->done != recorded) printf(" (%zu failed verification)", recorded - journal->done);
+            printf("\n");
+        }
+    }
+    return journal;
+}
+
+// Create (or, when resuming, reopen) the destination and open the local side
+// of a copy done in ranges. Runs on the caller's connection.
+static int stripe_open(transfer_stripe_t *stripe, libssh2_uint64_t size) {
+    int keep = stripe->journal && stripe->journal->done > 0;
+
+    if (stripe->direction == TRANSFER_UPLOAD) {
+        stripe->fd = open(stripe->src, O_RDONLY);
+        if (stripe->fd < 0) {
+            LOG_ERR("Failed to open local file '%s': %s", stripe->src, strerror(errno));
+            return -errno;
+        }
+        unsigned long flags = LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | (keep ? 0 : LIBSSH2_FXF_TRUNC);
+        LIBSSH2_SFTP_HANDLE *handle = sftp_open_remote(stripe->dst, flags, 0644);
+        if (!handle) {
+            LOG_ERR("Failed to open/create remote file '%s'", stripe->dst);
+            return sftp_last_errno();
+        }
+        sftp_close_remote(handle);
+        return 0;
+    }
+
+    // Sparse file of the final size; every range fills its own part
+    stripe->fd = open(stripe->dst, O_WRONLY | O_CREAT | (keep ? 0 : O_TRUNC), 0666);
+    if (stripe->fd < 0 || ftruncate(stripe->fd, (off_t)size) != 0) {
+        LOG_ERR("Failed to create local file '%s': %s", stripe->dst, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+// Copy a file as ranges of `chunk` bytes: queued for the workers, or run
+// right here when copying inline.
+static int transfer_submit_ranges(transfer_engine_t *engine, transfer_direction_t direction,
+                                  const char *src, const char *dst,
+                                  libssh2_uint64_t size, unsigned long mtime, libssh2_uint64_t chunk) {
+    transfer_stripe_t *stripe = calloc(1, sizeof(transfer_stripe_t));
+    if (!stripe) return -ENOMEM;
+    stripe->direction = direction;
+    stripe->src = strdup(src);
+    stripe->dst = strdup(dst);
+    stripe->fd = -1;
+    stripe->mtime = mtime;
+    if (!stripe->src || !stripe->dst) {
+        stripe_free(stripe);
+        return -ENOMEM;
+    }
+
+    if ((engine->flags & TRANSFER_RESUME) && size >= TRANSFER_RESUME_MIN) {
+        stripe->journal = stripe_journal(engine, direction, src, dst, size, mtime);
+    }
+
+    int result = stripe_open(stripe, size);
+    if (result != 0) {
+        fprintf(stderr, "Error copying %s to %s: %s\n", src, dst, strerror(-result));
+        if (stripe->fd >= 0) close(stripe->fd);
+        transfer_journal_close(stripe->journal, 0);
+        stripe_free(stripe);
+        transfer_fail(engine, result);
+        return result;
+    }
+
+    libssh2_uint64_t nranges = (size + chunk - 1) / chunk;
+    if (engine->verbose) {
+        printf("Copying %s to %s in %llu range(s) of up to %llu MiB\n", src, dst,
+               (unsigned long long)nranges, (unsigned long long)(chunk / (1024 * 1024)));
+    }
+
+    // Count every range up front so an early finisher cannot free the stripe
+    pthread_mutex_lock(&engine->lock);
+    stripe->pending = (int)nranges;
+    pthread_mutex_unlock(&engine->lock);
+
+    for (libssh2_uint64_t i = 0; i < nranges; i++) {
+        transfer_job_t *job = calloc(1, sizeof(transfer_job_t));
+        if (!job) {
+            result = -ENOMEM;
+        } else {
+            job->direction = direction;
+            job->stripe = stripe;
+            job->offset = i * chunk;
+            job->length = size - job->offset < chunk ? size - job->offset : chunk;
+
+            if (engine->nworkers == 0) {
+                result = transfer_run_range(job);
+                job_free(job);
+                pthread_mutex_lock(&engine->lock);
+                int last = stripe_range_done(stripe, result);
+                pthread_mutex_unlock(&engine->lock);
+                if (last) stripe_finish(engine, stripe);
+                if (result == 0) continue;
+                // The failed range was settled above, the rest below
+                i++;
+            } else {
+                result = transfer_enqueue(engine, job);
+                if (result == 0) continue;
+            }
+        }
+        // Ranges that were never run are settled here
+        pthread_mutex_lock(&engine->lock);
+        if (engine->error == 0) engine->error = result;
+        int last = 0;
+        for (; i < nranges; i++) last = stripe_range_done(stripe, -ECANCELED);
+        pthread_cond_broadcast(&engine->not_full);
+        pthread_mutex_unlock(&engine->lock);
+        if (last) stripe_finish(engine, stripe);
+        return result;
+    }
+    return 0;
+}
+
+int transfer_engine_submit(transfer_engine_t *engine, transfer_direction_t direction,
+                           const char *src, const char *dst,
+                           libssh2_uint64_t size, unsigned long mtime) {
+    pthread_mutex_lock(&engine->lock);
+    int error = engine->error;
+    pthread_mutex_unlock(&engine->lock);
+    if (error) return error;
+
+    if (size != TRANSFER_SIZE_UNKNOWN && !(engine->flags & TRANSFER_DELTA)) {
+        int stripe = engine->nworkers > 1 && size >= TRANSFER_STRIPE_MIN;
+        int resume = (engine->flags & TRANSFER_RESUME) && size >= TRANSFER_RESUME_MIN;
+        if (stripe || resume) {
+            // Ranges skip the per-job check in the workers, so do it here
+            if (transfer_up_to_date(engine, direction, src, dst, size, mtime)) {
+                if (engine->verbose) printf("Skipping %s (up to date)\n", src);
+                pthread_mutex_lock(&engine->lock);
+                engine->skipped++;
+                pthread_mutex_unlock(&engine->lock);
+                return 0;
+            }
+            return transfer_submit_ranges(engine, direction, src, dst, size, mtime,
+                                          stripe ? TRANSFER_STRIPE_CHUNK : size);
+        }
+    }
+
+    if (engine->nworkers == 0) {
+        int result = transfer_run(engine, direction, src, dst, size, mtime);
+        if (result < 0) {
+            transfer_fail(engine, result);
+            return result;
+        }
+        if (result == TRANSFER_SKIPPED) engine->skipped++;
+        else engine->done++;
+        return 0;
+    }
+
+    transfer_job_t *job = calloc(1, sizeof(transfer_job_t));
+    if (!job) return -ENOMEM;
+    job->direction = direction;
+    job->src = strdup(src);
+    job->dst = strdup(dst);
+    job->size = size;
+    job->mtime = mtime;
+    if (!job->src || !job->dst) {
+        job_free(job);
+        return -ENOMEM;
+    }
+    return transfer_enqueue(engine, job);
+}
+
+int transfer_engine_error(transfer_engine_t *engine) {
+    pthread_mutex_lock(&engine->lock);
+    int error = engine->error;
+    pthread_mutex_unlock(&engine->lock);
+    return error;
+}
+
+int transfer_engine_finish(transfer_engine_t *engine) {
+    if (!engine) return -EINVAL;
+
+    pthread_mutex_lock(&engine->lock);
+    engine->closing = 1;
+    pthread_cond_broadcast(&engine->not_empty);
+    pthread_mutex_unlock(&engine->lock);
+
+    for (int i = 0; i < engine->nworkers; i++) {
+        pthread_join(engine->workers[i], NULL);
+    }
+    if (engine->verbose) {
+        printf("%s %lu file(s)", (engine->flags & TRANSFER_MOVE) ? "Moved" : "Copied", engine->done);
+        if (engine->flags & TRANSFER_UPDATE) printf(", %lu already up to date", engine->skipped);
+        printf("\n");
+    }
+
+    int error = engine->error;
+    free(engine->workers);
+    sftp_pool_destroy(engine->pool);
+    free(engine->host);
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->not_empty);
+    pthread_cond_destroy(&engine->not_full);
+    free(engine);
+    return error;
+}
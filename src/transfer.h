@@ -0,0 +1,123 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "common.h"
+#include "sftp_pool.h"
+#include "transfer_journal.h"
+#include <pthread.h>
+
+// Work queue of file copies for the helper utilities. With more than one job
+// the engine opens its own SFTP sessions (a pool cloned from the connection
+// set up by the tool) and runs one worker thread per session; each worker
+// keeps its session checked out for its whole life. With a single job, files
+// are copied inline on the caller's connection as before.
+//
+// Files of at least TRANSFER_STRIPE_MIN bytes are split into ranges of
+// TRANSFER_STRIPE_CHUNK bytes that go through the same queue, so one large
+// file is spread over every session. Each range is copied with positioned
+// reads/writes on its own remote handle into a destination created up front.
+//
+// With TRANSFER_RESUME, files of at least TRANSFER_RESUME_MIN bytes take the
+// same range path with a checkpoint journal (see transfer_journal.h): blocks
+// recorded by an interrupted run are verified and skipped. Downloads keep the
+// journal next to the destination file, uploads under the config directory.
+//
+// With TRANSFER_DELTA every file is copied whole by one worker through the
+// delta path, which takes precedence over striping and resuming.
+//
+// With TRANSFER_UPDATE a file is skipped when the destination already has
+// the source's size and mtime (rsync's quick check), or with
+// TRANSFER_CHECKSUM the same size and content. Copied files get the source
+// mtime so the next run can skip them. The check runs in the workers, so
+// remote stats of an upload overlap like the copies do.
+//
+// With TRANSFER_MOVE (remote-mv) every copied file keeps its source mtime,
+// and once the destination is complete it is compared with the source (size,
+// then MD5 checksums when the server can run md5sum, see delta.h); the source
+// is deleted right away by the same worker. A file failing the check is kept
+// and fails the run.
+
+#define TRANSFER_JOBS_MAX       SFTP_POOL_MAX_SIZE
+#define TRANSFER_QUEUE_LIMIT    1024    // Pending jobs before submit blocks
+#define TRANSFER_STRIPE_MIN     (64ULL * 1024 * 1024)
+#define TRANSFER_STRIPE_CHUNK   (32ULL * 1024 * 1024)
+#define TRANSFER_SIZE_UNKNOWN   ((libssh2_uint64_t)-1)
+#define TRANSFER_RESUME_MIN     (4ULL * TRANSFER_JOURNAL_BLOCK)
+#define TRANSFER_JOURNAL_SUFFIX ".remote-cp-journal"
+
+// transfer_engine_create() flags
+#define TRANSFER_RESUME         0x1     // Journal large files and continue interrupted copies
+#define TRANSFER_DELTA          0x2     // Send only changed blocks of existing files (delta.h)
+#define TRANSFER_UPDATE         0x4     // Skip files whose destination is current, keep mtimes
+#define TRANSFER_CHECKSUM       0x8     // With TRANSFER_UPDATE, compare content when mtimes differ
+#define TRANSFER_TAR            0x10    // remote-cp -r: whole trees as a tar stream (tar_stream.h), not used here
+#define TRANSFER_MOVE           0x20    // remote-mv: verify each copy, then delete its source
+
+#define TRANSFER_MTIME_UNKNOWN  0UL
+#define TRANSFER_SKIPPED        1       // transfer_run(): destination already up to date
+
+typedef enum {
+    TRANSFER_UPLOAD,            // Local file -> remote path
+    TRANSFER_DOWNLOAD           // Remote path -> local file
+} transfer_direction_t;
+
+// A file being copied as several ranges; freed by the worker finishing the last one
+typedef struct transfer_stripe {
+    transfer_direction_t direction;
+    char *src;
+    char *dst;
+    int fd;                     // Local side, shared by all ranges (pread/pwrite)
+    unsigned long mtime;        // Source mtime, set on the destination with TRANSFER_UPDATE
+    transfer_journal_t *journal; // Checkpoints of a resumable copy, NULL otherwise
+    int pending;                // Ranges not finished yet
+    int error;                  // First failed range (negative errno)
+} transfer_stripe_t;
+
+typedef struct transfer_job {
+    transfer_direction_t direction;
+    char *src;
+    char *dst;
+    transfer_stripe_t *stripe;  // Set for one range of a striped file
+    libssh2_uint64_t size;      // Source attributes of a whole-file job
+    unsigned long mtime;
+    libssh2_uint64_t offset;
+    libssh2_uint64_t length;
+    struct transfer_job *next;
+} transfer_job_t;
+
+typedef struct transfer_engine {
+    sftp_pool_t *pool;          // NULL when copying inline
+    pthread_t *workers;
+    int nworkers;
+    int flags;
+    int verbose;
+    char *host;                 // Names upload journals
+    int port;
+    transfer_job_t *head, *tail;
+    int queued;
+    int closing;                // No more jobs will be submitted
+    int error;                  // First failure (negative errno), stops the queue
+    unsigned long done;
+    unsigned long skipped;      // Files found up to date (TRANSFER_UPDATE)
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} transfer_engine_t;
+
+transfer_engine_t *transfer_engine_create(const remote_conn_info_t *tmpl, int jobs, int flags, int verbose);
+// Queue a copy (or run it right away without workers). size and mtime are the
+// source attributes when the caller already knows them (enables striping,
+// resuming and update checks), otherwise TRANSFER_SIZE_UNKNOWN and
+// TRANSFER_MTIME_UNKNOWN. Returns the first error seen so
+// far so callers can stop walking a tree early.
+int transfer_engine_submit(transfer_engine_t *engine, transfer_direction_t direction,
+                           const char *src, const char *dst,
+                           libssh2_uint64_t size, unsigned long mtime);
+// First error so far (0 if none), for a caller running several operations
+// through one engine that wants to stop before starting the next one
+int transfer_engine_error(transfer_engine_t *engine);
+// Wait for all queued jobs, stop the workers and free the engine.
+// Returns 0 or the first error.
+int transfer_engine_finish(transfer_engine_t *engine);
+
+#endif // TRANSFER_H
@@ -0,0 +1,206 @@
+#include "transfer_journal.h"
+#include "ssh_sftp_client.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FNV-1a over 64-bit words; only has to tell a finished block from a torn one
+uint64_t transfer_block_hash(const char *data, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h ^= w;
+        h *= 1099511628211ULL;
+    }
+    for (; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h ^ len;
+}
+
+static void journal_free(transfer_journal_t *j) {
+    free(j->file);
+    free(j->src);
+    free(j->dst);
+    free(j->bitmap);
+    free(j->hashes);
+    pthread_mutex_destroy(&j->lock);
+    free(j);
+}
+
+static int journal_has(const transfer_journal_t *j, size_t index) {
+    return index < j->nblocks && (j->bitmap[index / 8] & (1u << (index % 8)));
+}
+
+// Read the blocks of a sidecar written for the same copy; 0 when it matches
+static int journal_load(transfer_journal_t *j) {
+    FILE *fp = fopen(j->file, "r");
+    if (!fp) return -1;
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int ok = (n = getline(&line, &cap, fp)) > 0 &&
+             strncmp(line, TRANSFER_JOURNAL_MAGIC, strlen(TRANSFER_JOURNAL_MAGIC)) == 0;
+    int matched = 0;
+    char *bitmap_hex = NULL, *hashes_hex = NULL;
+
+    while (ok && (n = getline(&line, &cap, fp)) > 0) {
+        if (line[n - 1] == '\n') line[--n] = '\0';
+        char *value = strchr(line, ' ');
+        if (!value) continue;
+        *value++ = '\0';
+        if (strcmp(line, "src") == 0) matched += strcmp(value, j->src) == 0;
+        else if (strcmp(line, "dst") == 0) matched += strcmp(value, j->dst) == 0;
+        else if (strcmp(line, "size") == 0) matched += strtoull(value, NULL, 10) == j->size;
+        else if (strcmp(line, "mtime") == 0) matched += strtoul(value, NULL, 10) == j->mtime;
+        else if (strcmp(line, "bitmap") == 0 && !bitmap_hex) bitmap_hex = strdup(value);
+        else if (strcmp(line, "hashes") == 0 && !hashes_hex) hashes_hex = strdup(value);
+    }
+    fclose(fp);
+    free(line);
+
+    size_t nbytes = (j->nblocks + 7) / 8;
+    ok = ok && matched == 4 && bitmap_hex && hashes_hex &&
+         strlen(bitmap_hex) == nbytes * 2 && strlen(hashes_hex) == j->nblocks * 16;
+    for (size_t i = 0; ok && i < nbytes; i++) {
+        unsigned int byte;
+        ok = sscanf(bitmap_hex + i * 2, "%2x", &byte) == 1;
+        j->bitmap[i] = (unsigned char)byte;
+    }
+    for (size_t i = 0; ok && i < j->nblocks; i++) {
+        unsigned long long h;
+        ok = sscanf(hashes_hex + i * 16, "%16llx", &h) == 1;
+        j->hashes[i] = h;
+        if (journal_has(j, i)) j->done++;
+    }
+    free(bitmap_hex);
+    free(hashes_hex);
+
+    if (!ok) {
+        memset(j->bitmap, 0, nbytes);
+        memset(j->hashes, 0, j->nblocks * sizeof(uint64_t));
+        j->done = 0;
+        return -1;
+    }
+    return 0;
+}
+
+transfer_journal_t *transfer_journal_open(const char *file, const char *src, const char *dst,
+                                          libssh2_uint64_t size, unsigned long mtime) {
+    transfer_journal_t *j = calloc(1, sizeof(transfer_journal_t));
+    if (!j) return NULL;
+    pthread_mutex_init(&j->lock, NULL);
+    j->file = strdup(file);
+    j->src = strdup(src);
+    j->dst = strdup(dst);
+    j->size = size;
+    j->mtime = mtime;
+    j->nblocks = (size_t)((size + TRANSFER_JOURNAL_BLOCK - 1) / TRANSFER_JOURNAL_BLOCK);
+    j->bitmap = calloc((j->nblocks + 7) / 8 + 1, 1);
+    j->hashes = calloc(j->nblocks + 1, sizeof(uint64_t));
+    if (!j->file || !j->src || !j->dst || !j->bitmap || !j->hashes) {
+        LOG_ERR("Failed to allocate transfer journal for %s", src);
+        journal_free(j);
+        return NULL;
+    }
+
+    j->resumed = journal_load(j) == 0;
+    j->saved = time(NULL);
+    return j;
+}
+
+int transfer_journal_has(transfer_journal_t *j, size_t index) {
+    pthread_mutex_lock(&j->lock);
+    int has = journal_has(j, index);
+    pthread_mutex_unlock(&j->lock);
+    return has;
+}
+
+uint64_t transfer_journal_hash_of(transfer_journal_t *j, size_t index) {
+    pthread_mutex_lock(&j->lock);
+    uint64_t h = index < j->nblocks ? j->hashes[index] : 0;
+    pthread_mutex_unlock(&j->lock);
+    return h;
+}
+
+// Write the sidecar atomically (tmp file + rename) so it never lists a block
+// that was not recorded. Called with the lock held.
+static int journal_save_locked(transfer_journal_t *j) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", j->file);
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        LOG_WARN("Cannot write transfer journal %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+    fchmod(fileno(fp), 0600);
+    fprintf(fp, "%s\nsrc %s\ndst %s\nsize %llu\nmtime %lu\nbitmap ",
+            TRANSFER_JOURNAL_MAGIC, j->src, j->dst, (unsigned long long)j->size, j->mtime);
+    for (size_t i = 0; i < (j->nblocks + 7) / 8; i++) {
+        fprintf(fp, "%02x", j->bitmap[i]);
+    }
+    fprintf(fp, "\nhashes ");
+    for (size_t i = 0; i < j->nblocks; i++) {
+        fprintf(fp, "%016llx", (unsigned long long)j->hashes[i]);
+    }
+    fprintf(fp, "\n");
+    if (fclose(fp) != 0 || rename(tmp, j->file) != 0) {
+        LOG_WARN("Failed to save transfer journal %s", j->file);
+        unlink(tmp);
+        return -1;
+    }
+    j->dirty = 0;
+    j->saved = time(NULL);
+    return 0;
+}
+
+void transfer_journal_mark(transfer_journal_t *j, size_t index, uint64_t hash) {
+    pthread_mutex_lock(&j->lock);
+    if (index < j->nblocks) {
+        if (!journal_has(j, index)) j->done++;
+        j->bitmap[index / 8] |= (unsigned char)(1u << (index % 8));
+        j->hashes[index] = hash;
+        j->dirty++;
+        if (time(NULL) - j->saved >= TRANSFER_JOURNAL_SAVE_SEC) journal_save_locked(j);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+void transfer_journal_forget(transfer_journal_t *j, size_t index) {
+    pthread_mutex_lock(&j->lock);
+    if (journal_has(j, index)) {
+        j->bitmap[index / 8] &= (unsigned char)~(1u << (index % 8));
+        j->hashes[index] = 0;
+        j->done--;
+        j->dirty++;
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+int transfer_journal_save(transfer_journal_t *j) {
+    pthread_mutex_lock(&j->lock);
+    int rc = journal_save_locked(j);
+    pthread_mutex_unlock(&j->lock);
+    return rc;
+}
+
+void transfer_journal_close(transfer_journal_t *j, int complete) {
+    if (!j) return;
+    if (complete) {
+        if (unlink(j->file) != 0 && errno != ENOENT) {
+            LOG_WARN("Cannot remove transfer journal %s: %s", j->file, strerror(errno));
+        }
+    } else if (j->dirty || !j->resumed) {
+        transfer_journal_save(j);
+    }
+    journal_free(j);
+}
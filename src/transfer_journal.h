@@ -0,0 +1,50 @@
+#ifndef TRANSFER_JOURNAL_H
+#define TRANSFER_JOURNAL_H
+
+#include "common.h"
+#include "ssh_sftp_client.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// Checkpoint journal of a resumable copy (remote-cp --resume). A small text
+// sidecar records the source the copy belongs to (paths, size, mtime) and
+// which fixed-size blocks already reached the destination, with a hash of
+// each block's data. A later run with the same source continues with the
+// missing blocks only; a changed source starts over.
+
+#define TRANSFER_JOURNAL_MAGIC    "remote-cp-journal 1"
+#define TRANSFER_JOURNAL_BLOCK    SFTP_COPY_BUFFER_SIZE
+#define TRANSFER_JOURNAL_SAVE_SEC 1         // Rewrite the sidecar at most this often while copying
+
+typedef struct transfer_journal {
+    char *file;                 // Sidecar path
+    char *src;
+    char *dst;
+    libssh2_uint64_t size;      // Source attributes the blocks belong to
+    unsigned long mtime;
+    size_t nblocks;
+    unsigned char *bitmap;      // One bit per block present at the destination
+    uint64_t *hashes;           // Hash of each present block
+    size_t done;                // Blocks present
+    int resumed;                // Loaded from an earlier run
+    int dirty;                  // Blocks recorded since the last save
+    time_t saved;
+    pthread_mutex_t lock;
+} transfer_journal_t;
+
+// Load the journal in file if it matches src/dst/size/mtime, otherwise start
+// an empty one (the old file is overwritten on the first save).
+transfer_journal_t *transfer_journal_open(const char *file, const char *src, const char *dst,
+                                          libssh2_uint64_t size, unsigned long mtime);
+int transfer_journal_has(transfer_journal_t *journal, size_t index);
+uint64_t transfer_journal_hash_of(transfer_journal_t *journal, size_t index);
+void transfer_journal_mark(transfer_journal_t *journal, size_t index, uint64_t hash);
+void transfer_journal_forget(transfer_journal_t *journal, size_t index);
+int transfer_journal_save(transfer_journal_t *journal);
+// Delete the sidecar after a complete copy, or save it for the next run; frees the journal
+void transfer_journal_close(transfer_journal_t *journal, int complete);
+
+uint64_t transfer_block_hash(const char *data, size_t len);
+
+#endif // TRANSFER_JOURNAL_H
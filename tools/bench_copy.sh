@@ -0,0 +1,131 @@
+#!/bin/sh
+# Time whole-file copies of remote-cp built from two revisions against the
+# same SSH server, to compare the copy paths (sftp_copy_fd_to_remote and
+# sftp_copy_remote_to_local) before and after a change.
+#
+# Usage: tools/bench_copy.sh [OLD_REV [NEW_REV]]
+#   OLD_REV  default: the parent of the commit that moved whole-file copies
+#            to mmap and aligned pwrite ("[user-017]" in the log)
+#   NEW_REV  default: HEAD
+#
+# Settings (environment):
+#   BENCH_HOST     SSH server (default: localhost, e.g. a local sshd)
+#   BENCH_PORT     SSH port (default: 22)
+#   BENCH_USER     login (default: $USER)
+#   BENCH_KEY      private key (default: ~/.ssh/id_ed25519, else ~/.ssh/id_rsa)
+#   BENCH_REMOTE   scratch directory on the server, created and emptied (default: /tmp/remote-cp-bench)
+#   BENCH_SIZE_MB  size of the test file (default: 1024)
+#   BENCH_RUNS     runs per direction and revision; the best one is reported (default: 3)
+#
+# Each revision is built in its own git worktree and mounts the scratch
+# directory with its own remotefs (HOME then points to a private directory,
+# so the saved mounts of the caller are left alone). Copies run with -j 1,
+# which keeps them on the single-session whole-file path rather than the
+# striped transfer engine. The control socket of the mount is removed once it
+# is up, so remote-cp of a revision that has one does not hand the copy to
+# remotefs: every revision measures the copy on the tool's own SSH session
+# (sftp_copy_local_to_remote, sftp_copy_remote_to_local). Needs fuse3
+# (fusermount3), ssh and the build dependencies.
+# Dropping the page cache between runs needs root; without it the local side
+# of each run is served from memory, which is the case the copy paths are
+# meant to be fast in anyway.
+
+set -eu
+
+repo=$(git -C "$(dirname "$0")" rev-parse --show-toplevel)
+if [ $# -ge 1 ]; then
+    old_rev=$1
+else
+    old_rev=$(git -C "$repo" log --format=%H --grep='^\[user-017\]' | tail -n 1)
+    [ -n "$old_rev" ] || { echo "bench_copy: no [user-017] commit, give OLD_REV" >&2; exit 1; }
+    old_rev="$old_rev^"
+fi
+new_rev=${2:-HEAD}
+
+host=${BENCH_HOST:-localhost}
+port=${BENCH_PORT:-22}
+user=${BENCH_USER:-$USER}
+key=${BENCH_KEY:-}
+if [ -z "$key" ]; then
+    key=$HOME/.ssh/id_ed25519
+    [ -f "$key" ] || key=$HOME/.ssh/id_rsa
+fi
+remote=${BENCH_REMOTE:-/tmp/remote-cp-bench}
+size_mb=${BENCH_SIZE_MB:-1024}
+runs=${BENCH_RUNS:-3}
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/remote-cp-bench.XXXXXX")
+mnt=$work/mnt
+cleanup() {
+    fusermount3 -u "$mnt" 2>/dev/null || true
+    for dir in "$work"/rev-*; do
+        if [ -d "$dir" ]; then
+            git -C "$repo" worktree remove --force "$dir"
+        fi
+    done
+    rm -rf "$work"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+mkdir -p "$mnt" "$work/home/.config/remotefs"
+ssh -p "$port" -i "$key" "$user@$host" "mkdir -p '$remote' && rm -f '$remote/bench.dat'"
+HOME=$work/home
+export HOME
+
+echo "Creating a ${size_mb} MiB test file"
+dd if=/dev/urandom of="$work/data" bs=1M count="$size_mb" status=none
+
+drop_caches() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+}
+
+# Best wall-clock time of $runs runs of the command, in seconds
+best_of() {
+    best=
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        drop_caches
+        start=$(date +%s.%N)
+        "$@" > /dev/null
+        end=$(date +%s.%N)
+        best=$(echo "$start $end ${best:-}" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) print t; else print $3 }')
+        i=$((i + 1))
+    done
+    echo "$best"
+}
+
+bench_rev() {
+    name=$1
+    rev=$2
+    tree=$work/rev-$name
+    git -C "$repo" worktree add --detach --quiet "$tree" "$rev"
+    make -C "$tree" --quiet all > /dev/null
+
+    "$tree/bin/remotefs" "$mnt" -o host="$host" -o port="$port" \
+        -o user="$user" -o key="$key" -o remotepath="$remote"
+    i=0
+    until mountpoint -q "$mnt"; do
+        i=$((i + 1))
+        [ "$i" -le 50 ] || { echo "bench_copy: $name: mount did not come up" >&2; exit 1; }
+        sleep 0.1
+    done
+    rm -f "$HOME"/.config/remotefs/control-*.sock
+
+    up=$(best_of "$tree/bin/remote-cp" -j 1 "$work/data" "$mnt/bench.dat")
+    down=$(best_of "$tree/bin/remote-cp" -j 1 "$mnt/bench.dat" "$work/down.dat")
+    cmp -s "$work/data" "$work/down.dat" || { echo "bench_copy: $name: downloaded data differs" >&2; exit 1; }
+    rm -f "$work/down.dat" "$mnt/bench.dat"
+    fusermount3 -u "$mnt"
+
+    printf '%-4s %-12s upload %7.2fs %8.1f MiB/s   download %7.2fs %8.1f MiB/s\n' "$name" \
+        "$(git -C "$repo" rev-parse --short "$rev")" \
+        "$up" "$(echo "$size_mb $up" | awk '{ print $1 / $2 }')" \
+        "$down" "$(echo "$size_mb $down" | awk '{ print $1 / $2 }')"
+}
+
+bench_rev old "$old_rev"
+bench_rev new "$new_rev"